@@ -0,0 +1,141 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Shared bits for the benchmarks. BenchData reads the test video once
+ * and chops it into segments so the benchmarks aren't timing file IO,
+ * and Latency collects per-operation times so we can report p50/p99
+ * alongside the throughput numbers google benchmark gives us.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <fr/media2.h>
+#include <memory>
+#include <vector>
+#include "TestHelpers.h"
+
+namespace fr::media2::bench {
+
+  // Same one the tests use
+  using test::SegmentCollector;
+
+  class BenchData {
+  public:
+    // The reader stays open so the video stream's codec context
+    // can be used to benchmark the decoder.
+    std::shared_ptr<PacketReader> reader;
+    Stream::pointer videoStream;
+    SegmentCollector video;
+    SegmentCollector audio;
+
+    static BenchData& instance() {
+      static BenchData data;
+      return data;
+    }
+
+    static size_t packets(const std::vector<Segment::pointer>& segments) {
+      size_t ret = 0;
+      for (const auto& segment : segments) {
+        ret += segment->packets.size();
+      }
+      return ret;
+    }
+
+    static size_t bytes(const Segment& segment) {
+      size_t ret = 0;
+      for (const auto& packet : segment.packets) {
+        ret += packet->size;
+      }
+      return ret;
+    }
+
+    static size_t bytes(const std::vector<Segment::pointer>& segments) {
+      size_t ret = 0;
+      for (const auto& segment : segments) {
+        ret += bytes(*segment);
+      }
+      return ret;
+    }
+
+  private:
+    BenchData() {
+      reader = std::make_shared<PacketReader>(TEST_FILE);
+      std::vector<std::shared_ptr<Segmenter>> segmenters;
+      auto collect = [&](Stream::pointer stream, SegmentCollector& collector) {
+        auto segmenter = std::make_shared<Segmenter>();
+        segmenter->subscribe(stream);
+        collector.subscribe(segmenter.get());
+        segmenters.push_back(segmenter);
+      };
+      if (!reader->videoStreams.empty()) {
+        videoStream = reader->videoStreams[0];
+        collect(videoStream, video);
+      }
+      if (!reader->audioStreams.empty()) {
+        collect(reader->audioStreams[0], audio);
+      }
+      reader->sendEvent(PacketReaderStateMachine::play{});
+      reader->join();
+      for (auto& segmenter : segmenters) {
+        segmenter->flush();
+        segmenter->unsubscribe();
+      }
+      video.unsubscribe();
+      audio.unsubscribe();
+    }
+  };
+
+  // Per-operation timings. Call start and stop around the thing you
+  // want timed (inside the benchmark loop) and report at the end.
+  class Latency {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    void start() { began = clock::now(); }
+    void stop() { record(clock::now() - began); }
+    void record(clock::duration elapsed) { samples.push_back(elapsed); }
+
+    // Adds p50_us and p99_us counters to state
+    void report(benchmark::State& state) {
+      if (samples.empty()) {
+        return;
+      }
+      std::sort(samples.begin(), samples.end());
+      state.counters["p50_us"] = micros(0.50);
+      state.counters["p99_us"] = micros(0.99);
+    }
+
+  private:
+    clock::time_point began;
+    std::vector<clock::duration> samples;
+
+    double micros(double percentile) {
+      size_t index = std::min(samples.size() - 1,
+                              static_cast<size_t>(percentile * samples.size()));
+      return std::chrono::duration<double, std::micro>(samples[index]).count();
+    }
+  };
+
+  // Sets the packets/s and bytes/s numbers google benchmark prints
+  inline void throughput(benchmark::State& state, size_t packets, size_t bytes) {
+    state.SetItemsProcessed(packets);
+    state.SetBytesProcessed(bytes);
+  }
+
+}
@@ -0,0 +1,251 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Decoder and Scaler benchmarks. These run the objects' process methods
+ * directly so we're not timing signal dispatch on top of the codec work.
+ */
+
+#include "BenchData.h"
+#include <cstring>
+#include <mutex>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
+using namespace fr::media2;
+using namespace fr::media2::bench;
+
+class BenchDecoder : public Decoder {
+public:
+  using Decoder::process;
+};
+
+class BenchScaler : public Scaler {
+public:
+  using Scaler::Scaler;
+  using Scaler::process;
+};
+
+class BenchFrame2Mat : public Frame2Mat {
+public:
+  using Frame2Mat::Frame2Mat;
+  using Frame2Mat::process;
+};
+
+// Decodes one GOP per iteration and drains the decoder at the end of it
+static void DecoderProcess(benchmark::State& state) {
+  auto& data = BenchData::instance();
+  auto& segments = data.video.collected;
+  if (segments.empty() || !data.videoStream->data->context) {
+    state.SkipWithError("No video in test file");
+    return;
+  }
+  StreamData::pointer stream = data.videoStream->data;
+  BenchDecoder decoder;
+  size_t frames = 0;
+  auto connection = decoder.frames.connect([&frames](Frame::const_pointer, const StreamData::pointer&) {
+    frames++;
+  });
+  Packet::pointer drain = Packet::nullPacket();
+  Latency latency;
+  size_t seg = 0;
+  size_t packets = 0;
+  size_t bytes = 0;
+  for (auto _ : state) {
+    const Segment::pointer& segment = segments[seg];
+    latency.start();
+    for (const Packet::pointer& packet : segment->packets) {
+      decoder.process(packet, stream);
+    }
+    decoder.process(drain, stream);
+    latency.stop();
+    avcodec_flush_buffers(stream->context.get());
+    packets += segment->packets.size();
+    bytes += BenchData::bytes(*segment);
+    seg = (seg + 1) % segments.size();
+  }
+  connection.disconnect();
+  throughput(state, packets, bytes);
+  state.counters["frames/s"] = benchmark::Counter(frames, benchmark::Counter::kIsRate);
+  latency.report(state);
+}
+BENCHMARK(DecoderProcess)->UseRealTime();
+
+// Decoded frames from the first GOP, for the scaler
+static std::vector<Frame::pointer>& decodedFrames() {
+  static std::vector<Frame::pointer> frames;
+  static std::once_flag decoded;
+  std::call_once(decoded, [] {
+    auto& data = BenchData::instance();
+    if (data.video.collected.empty()) {
+      return;
+    }
+    StreamData::pointer stream = data.videoStream->data;
+    BenchDecoder decoder;
+    auto connection = decoder.frames.connect([](Frame::const_pointer frame, const StreamData::pointer&) {
+      frames.push_back(Frame::clone(frame));
+    });
+    for (const Packet::pointer& packet : data.video.collected[0]->packets) {
+      decoder.process(packet, stream);
+    }
+    decoder.process(Packet::nullPacket(), stream);
+    avcodec_flush_buffers(stream->context.get());
+    connection.disconnect();
+  });
+  return frames;
+}
+
+// Args are output width, height and pixel format
+static void ScalerProcess(benchmark::State& state) {
+  auto& frames = decodedFrames();
+  if (frames.empty()) {
+    state.SkipWithError("No video in test file");
+    return;
+  }
+  BenchScaler scaler(state.range(0), state.range(1), (AVPixelFormat) state.range(2));
+  Latency latency;
+  size_t i = 0;
+  size_t bytes = 0;
+  for (auto _ : state) {
+    const Frame::pointer& frame = frames[i];
+    latency.start();
+    scaler.process(frame, nullptr);
+    latency.stop();
+    bytes += av_image_get_buffer_size((AVPixelFormat) frame->format, frame->width,
+                                      frame->height, 1);
+    i = (i + 1) % frames.size();
+  }
+  throughput(state, state.iterations(), bytes);
+  latency.report(state);
+}
+BENCHMARK(ScalerProcess)
+  ->ArgNames({"width", "height", "format"})
+  ->Args({640, 360, AV_PIX_FMT_YUV420P})
+  ->Args({1920, 1080, AV_PIX_FMT_YUV420P})
+  ->Args({-1, -1, AV_PIX_FMT_BGR24});
+
+// A 4K frame scaled to 720p on args threads, in bands of args
+// bandHeight rows (0 splits the frame evenly.) One thread is the plain
+// sws_scale path.
+static void ScalerBands(benchmark::State& state) {
+  static Frame::pointer frame = [] {
+    auto ret = Frame::create(3840, 2160, AV_PIX_FMT_YUV420P);
+    for (int p = 0; p < 3; ++p) {
+      int rows = p ? 1080 : 2160;
+      for (int y = 0; y < rows; ++y) {
+        memset(ret->data[p] + y * ret->linesize[p], (y * 5 + p * 40) & 0xff, ret->linesize[p]);
+      }
+    }
+    return ret;
+  }();
+  BenchScaler scaler(1280, 720, AV_PIX_FMT_YUV420P, state.range(0), state.range(1));
+  Latency latency;
+  for (auto _ : state) {
+    latency.start();
+    scaler.process(frame, nullptr);
+    latency.stop();
+  }
+  throughput(state, state.iterations(),
+             state.iterations() * av_image_get_buffer_size(AV_PIX_FMT_YUV420P, 3840, 2160, 1));
+  latency.report(state);
+}
+BENCHMARK(ScalerBands)
+  ->ArgNames({"threads", "bandHeight"})
+  ->Args({1, 0})
+  ->Args({2, 0})
+  ->Args({4, 0})
+  ->Args({8, 0})
+  ->Args({4, 64})
+  ->UseRealTime();
+
+// The PixelKernels fast paths against swscale on a 1080p frame. Args
+// are the conversion (below) and the instruction set, with -1 for
+// swscale. Instruction sets the CPU doesn't have are skipped.
+struct Conversion {
+  AVPixelFormat from;
+  AVPixelFormat to;
+  int divisor;
+};
+
+static const Conversion conversions[] = {
+  {AV_PIX_FMT_YUVJ420P, AV_PIX_FMT_BGR24, 1},
+  {AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12, 1},
+  {AV_PIX_FMT_NV12, AV_PIX_FMT_YUV420P, 1},
+  {AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUV420P, 2},
+};
+
+static void PixelConvert(benchmark::State& state) {
+  const Conversion& conversion = conversions[state.range(0)];
+  int width = 1920 / conversion.divisor;
+  int height = 1080 / conversion.divisor;
+  auto src = Frame::create(1920, 1080, conversion.from);
+  auto dst = Frame::create(width, height, conversion.to);
+  // Mid grey. The kernels don't care what's in it.
+  memset(src->buf[0]->data, 0x80, src->buf[0]->size);
+  PixelKernels::Convert convert;
+  std::unique_ptr<SwsContext, decltype(&sws_freeContext)> sws{nullptr, &sws_freeContext};
+  if (state.range(1) < 0) {
+    sws.reset(sws_getContext(1920, 1080, conversion.from, width, height, conversion.to,
+                             SWS_BICUBIC, nullptr, nullptr, nullptr));
+    state.SetLabel("swscale");
+  } else {
+    auto isa = (PixelKernels::Isa) state.range(1);
+    convert = PixelKernels::find(1920, 1080, conversion.from, width, height, conversion.to, isa,
+                                 PixelKernels::Accuracy::approximate);
+    if (!convert) {
+      state.SkipWithError("Not supported on this CPU");
+      return;
+    }
+    state.SetLabel(PixelKernels::name(isa));
+  }
+  for (auto _ : state) {
+    if (convert) {
+      convert(src.get(), dst.get());
+    } else {
+      sws_scale(sws.get(), src->data, src->linesize, 0, 1080, dst->data, dst->linesize);
+    }
+  }
+  state.counters["frames/s"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
+BENCHMARK(PixelConvert)
+  ->ArgNames({"conversion", "isa"})
+  ->Apply([](benchmark::internal::Benchmark* b) {
+    for (int conversion = 0; conversion < 4; ++conversion) {
+      b->Args({conversion, -1});
+      for (auto isa : {PixelKernels::Isa::generic, PixelKernels::Isa::sse4,
+                       PixelKernels::Isa::avx2, PixelKernels::Isa::neon}) {
+        b->Args({conversion, (int) isa});
+      }
+    }
+  });
+
+// 1080p yuvj420p frames to mats, with args zeroCopy on or off. The
+// difference is the memcpy of every BGR frame.
+static void Frame2MatMats(benchmark::State& state) {
+  auto frame = Frame::create(1920, 1080, AV_PIX_FMT_YUVJ420P);
+  memset(frame->buf[0]->data, 0x80, frame->buf[0]->size);
+  BenchFrame2Mat converter(0 != state.range(0));
+  size_t rows = 0;
+  auto connection = converter.mats.connect([&rows](cv::Mat mat) { rows += mat.rows; });
+  for (auto _ : state) {
+    converter.process(frame, nullptr);
+  }
+  connection.disconnect();
+  benchmark::DoNotOptimize(rows);
+  state.counters["frames/s"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
+BENCHMARK(Frame2MatMats)->ArgName("zeroCopy")->Arg(0)->Arg(1);
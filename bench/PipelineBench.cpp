@@ -0,0 +1,431 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Benchmarks for the packet -> segment -> serialized segment -> segment
+ * part of the pipeline, plus the stream cache the unpacker hits for
+ * every segment.
+ */
+
+#include "BenchData.h"
+#include <atomic>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/signals2.hpp>
+#include <cstddef>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <uuid.h>
+
+using namespace fr::media2;
+using namespace fr::media2::bench;
+
+// Copying packets out of the reader is the first thing the segmenter does
+static void PacketCopy(benchmark::State& state) {
+  auto& segments = BenchData::instance().video.collected;
+  if (segments.empty()) {
+    state.SkipWithError("No video in test file");
+    return;
+  }
+  size_t seg = 0;
+  size_t pkt = 0;
+  size_t bytes = 0;
+  for (auto _ : state) {
+    const Packet::pointer& packet = segments[seg]->packets[pkt];
+    Packet::pointer copy = Packet::copy(packet);
+    benchmark::DoNotOptimize(copy.get());
+    bytes += packet->size;
+    if (++pkt >= segments[seg]->packets.size()) {
+      pkt = 0;
+      seg = (seg + 1) % segments.size();
+    }
+  }
+  throughput(state, state.iterations(), bytes);
+}
+BENCHMARK(PacketCopy);
+
+// Fires one packet at a number of subscribers through Stream::packets,
+// the way PacketReader hands packets out
+static void StreamForward(benchmark::State& state) {
+  auto& data = BenchData::instance();
+  if (data.video.collected.empty()) {
+    state.SkipWithError("No video in test file");
+    return;
+  }
+  // Shared by all the threads, like a stream with a few subscribers
+  // being fed by a read-ahead dispatcher per thread
+  static Stream stream;
+  static std::atomic<size_t> delivered = 0;
+  static std::vector<Connection> connections;
+  if (0 == state.thread_index()) {
+    stream.data = data.video.stream;
+    for (int64_t i = 0; i < state.range(0); ++i) {
+      connections.push_back(stream.packets.connect([](const Packet::pointer& packet, const StreamData::pointer&) {
+        delivered.fetch_add(1, std::memory_order_relaxed);
+      }));
+    }
+  }
+  const Packet::pointer& packet = data.video.collected[0]->packets[0];
+  for (auto _ : state) {
+    stream.forward(packet);
+  }
+  if (0 == state.thread_index()) {
+    for (auto& connection : connections) {
+      connection.disconnect();
+    }
+    connections.clear();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(StreamForward)->ArgName("subscribers")->Arg(1)->Arg(4)->Arg(16)->ThreadRange(1, 8)->UseRealTime();
+
+// The same thing through a boost::signals2 signal with a shared
+// StreamData, which is what Stream::packets used to be
+static void Signals2Forward(benchmark::State& state) {
+  auto& data = BenchData::instance();
+  if (data.video.collected.empty()) {
+    state.SkipWithError("No video in test file");
+    return;
+  }
+  static boost::signals2::signal<void(const Packet::pointer&, StreamData::pointer)> packets;
+  static std::atomic<size_t> delivered = 0;
+  static std::vector<boost::signals2::connection> connections;
+  if (0 == state.thread_index()) {
+    for (int64_t i = 0; i < state.range(0); ++i) {
+      connections.push_back(packets.connect([](const Packet::pointer& packet, StreamData::pointer) {
+        delivered.fetch_add(1, std::memory_order_relaxed);
+      }));
+    }
+  }
+  StreamData::pointer streamData = data.video.stream;
+  const Packet::pointer& packet = data.video.collected[0]->packets[0];
+  for (auto _ : state) {
+    packets(packet, streamData);
+  }
+  if (0 == state.thread_index()) {
+    for (auto& connection : connections) {
+      connection.disconnect();
+    }
+    connections.clear();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(Signals2Forward)->ArgName("subscribers")->Arg(1)->Arg(4)->Arg(16)->ThreadRange(1, 8)->UseRealTime();
+
+// Builds a whole segment (one GOP) a packet at a time
+static void SegmentAppend(benchmark::State& state) {
+  auto& segments = BenchData::instance().video.collected;
+  if (segments.empty()) {
+    state.SkipWithError("No video in test file");
+    return;
+  }
+  Latency latency;
+  size_t seg = 0;
+  size_t packets = 0;
+  size_t bytes = 0;
+  for (auto _ : state) {
+    const Segment::pointer& source = segments[seg];
+    latency.start();
+    Segment::pointer segment = source->next();
+    for (const Packet::pointer& packet : source->packets) {
+      segment->append(packet);
+    }
+    latency.stop();
+    benchmark::DoNotOptimize(segment.get());
+    packets += source->packets.size();
+    bytes += BenchData::bytes(*source);
+    seg = (seg + 1) % segments.size();
+  }
+  throughput(state, packets, bytes);
+  latency.report(state);
+}
+BENCHMARK(SegmentAppend);
+
+// Arg 0 is boost serialization, arg 1 is SegmentWire
+static void SegmentSerialize(benchmark::State& state) {
+  auto& segments = BenchData::instance().video.collected;
+  if (segments.empty()) {
+    state.SkipWithError("No video in test file");
+    return;
+  }
+  bool wire = state.range(0) != 0;
+  Latency latency;
+  size_t seg = 0;
+  size_t packets = 0;
+  size_t bytes = 0;
+  for (auto _ : state) {
+    const Segment::pointer& segment = segments[seg];
+    std::stringstream stream;
+    latency.start();
+    if (wire) {
+      SegmentWire::write(*segment, stream);
+    } else {
+      boost::archive::binary_oarchive archive(stream);
+      archive << *segment;
+    }
+    latency.stop();
+    benchmark::DoNotOptimize(stream.tellp());
+    packets += segment->packets.size();
+    bytes += BenchData::bytes(*segment);
+    seg = (seg + 1) % segments.size();
+  }
+  throughput(state, packets, bytes);
+  latency.report(state);
+}
+BENCHMARK(SegmentSerialize)->ArgName("wire")->Arg(0)->Arg(1);
+
+// This is what the unpacker does with every segment it receives
+static void SegmentUnpackerSegFrom(benchmark::State& state) {
+  auto& segments = BenchData::instance().video.collected;
+  if (segments.empty()) {
+    state.SkipWithError("No video in test file");
+    return;
+  }
+  bool wire = state.range(0) != 0;
+  // Serialize everything up front. Reading a stringstream doesn't
+  // consume it, so each one can just be rewound and read again.
+  std::vector<std::unique_ptr<std::stringstream>> serialized;
+  for (const auto& segment : segments) {
+    auto stream = std::make_unique<std::stringstream>();
+    if (wire) {
+      SegmentWire::write(*segment, *stream);
+    } else {
+      boost::archive::binary_oarchive archive(*stream);
+      archive << *segment;
+    }
+    serialized.push_back(std::move(stream));
+  }
+  Latency latency;
+  size_t seg = 0;
+  size_t packets = 0;
+  size_t bytes = 0;
+  for (auto _ : state) {
+    std::stringstream& stream = *serialized[seg];
+    stream.clear();
+    stream.seekg(0);
+    latency.start();
+    auto segment = SegmentUnpacker::segFrom(stream);
+    latency.stop();
+    packets += segment->packets.size();
+    bytes += BenchData::bytes(*segment);
+    seg = (seg + 1) % serialized.size();
+  }
+  throughput(state, packets, bytes);
+  latency.report(state);
+}
+BENCHMARK(SegmentUnpackerSegFrom)->ArgName("wire")->Arg(0)->Arg(1);
+
+// Storing a stream's segments. Arg 0 is what the storage demo used to
+// do (a file per segment), arg 1 is a SegmentStore. Both get fsynced,
+// the file per segment way once per file and the store once per group
+// commit.
+static void SegmentStorage(benchmark::State& state) {
+  auto& segments = BenchData::instance().video.collected;
+  if (segments.empty()) {
+    state.SkipWithError("No video in test file");
+    return;
+  }
+  bool store = state.range(0) != 0;
+  std::vector<std::string> serialized;
+  for (const auto& segment : segments) {
+    std::stringstream stream;
+    SegmentWire::write(*segment, stream);
+    serialized.push_back(stream.str());
+  }
+  std::filesystem::path root = std::filesystem::temp_directory_path() / "media2_bench_storage";
+  std::filesystem::remove_all(root);
+  std::filesystem::create_directories(root);
+  uuid_t id;
+  uuid_generate(id);
+  auto segmentStore = store ? std::make_unique<SegmentStore>(root) : nullptr;
+  Latency latency;
+  size_t seg = 0;
+  int64_t dts = 0;
+  size_t bytes = 0;
+  for (auto _ : state) {
+    // Every segment needs a later dts than the last one
+    std::string& data = serialized[seg];
+    memcpy(data.data() + offsetof(SegmentWire::Header, dts), &dts, sizeof(dts));
+    latency.start();
+    if (store) {
+      segmentStore->append(id, (const uint8_t*) data.data(), data.size());
+    } else {
+      std::filesystem::path file = root / std::to_string(dts);
+      int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      benchmark::DoNotOptimize(write(fd, data.data(), data.size()));
+      fsync(fd);
+      close(fd);
+    }
+    latency.stop();
+    bytes += data.size();
+    dts += 3000;
+    seg = (seg + 1) % serialized.size();
+  }
+  if (store) {
+    segmentStore->commit();
+    state.counters["commits"] = segmentStore->commits();
+  }
+  throughput(state, state.iterations(), bytes);
+  latency.report(state);
+  segmentStore.reset();
+  std::filesystem::remove_all(root);
+}
+BENCHMARK(SegmentStorage)->ArgName("store")->Arg(0)->Arg(1)->UseRealTime();
+
+// Replaying a stored stream, with a subscriber that just counts the
+// packets. The log is in the page cache after the first go around, so
+// this is mostly the cost of decoding the segments and sending the
+// packets.
+static void SegmentStoreReplay(benchmark::State& state) {
+  auto& segments = BenchData::instance().video.collected;
+  if (segments.empty()) {
+    state.SkipWithError("No video in test file");
+    return;
+  }
+  std::filesystem::path root = std::filesystem::temp_directory_path() / "media2_bench_replay";
+  std::filesystem::remove_all(root);
+  std::filesystem::path dir;
+  {
+    SegmentStore store(root);
+    for (const auto& segment : segments) {
+      store.append(*segment);
+    }
+    store.close();
+    dir = store.streamDir(segments[0]->jobId);
+  }
+  SegmentStoreReader reader(dir);
+  size_t packets = 0;
+  size_t bytes = 0;
+  auto connection = reader.stream()->packets.connect([&](const Packet::pointer& packet, const StreamData::pointer&) {
+    packets++;
+    bytes += packet->size;
+  });
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(reader.replay());
+  }
+  connection.disconnect();
+  throughput(state, packets, bytes);
+  std::filesystem::remove_all(root);
+}
+BENCHMARK(SegmentStoreReplay)->UseRealTime();
+
+// Opening and reading the whole test file, straight from the file (0),
+// through an MmapSource (1) and from a MemorySource (2). The file's in
+// the page cache, so this is the cost of the read copies and the
+// demuxing.
+static void ReaderSource(benchmark::State& state) {
+  std::shared_ptr<std::vector<uint8_t>> data;
+  if (2 == state.range(0)) {
+    std::ifstream in(TEST_FILE, std::ios::binary);
+    data = std::make_shared<std::vector<uint8_t>>(std::istreambuf_iterator<char>(in),
+                                                  std::istreambuf_iterator<char>());
+  }
+  size_t packets = 0;
+  size_t bytes = 0;
+  Latency open;
+  for (auto _ : state) {
+    open.start();
+    std::unique_ptr<PacketReader> reader;
+    if (0 == state.range(0)) {
+      reader = std::make_unique<PacketReader>(TEST_FILE);
+    } else if (1 == state.range(0)) {
+      reader = std::make_unique<PacketReader>(std::make_shared<MmapSource>(TEST_FILE));
+    } else {
+      reader = std::make_unique<PacketReader>(std::make_shared<MemorySource>(*data, data));
+    }
+    open.stop();
+    for (auto& stream : reader->streams) {
+      stream->packets.connect([&](const Packet::pointer& packet, const StreamData::pointer&) {
+        packets++;
+        bytes += packet->size;
+      });
+    }
+    reader->sendEvent(PacketReaderStateMachine::play{});
+    reader->join();
+  }
+  throughput(state, packets, bytes);
+  open.report(state);
+}
+BENCHMARK(ReaderSource)->ArgName("source")->Arg(0)->Arg(1)->Arg(2)->UseRealTime();
+
+// Cache hits for a bunch of streams, from a bunch of threads. The cache
+// is shared by all the threads, so it's set up once for each number of
+// shards.
+static constexpr size_t cachedStreams = 1024;
+
+static StreamCache& benchCache(size_t shards, std::vector<UuidKey>& ids) {
+  static std::mutex mutex;
+  static std::map<size_t, std::unique_ptr<StreamCache>> caches;
+  static std::vector<UuidKey> cachedIds;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto& segments = BenchData::instance().video.collected;
+  if (cachedIds.empty() && !segments.empty()) {
+    for (size_t i = 0; i < cachedStreams; ++i) {
+      uuid_t id;
+      uuid_generate(id);
+      cachedIds.emplace_back(id);
+    }
+  }
+  auto& cache = caches[shards];
+  if (!cache) {
+    cache = std::make_unique<StreamCache>(600, 10, shards);
+    for (const UuidKey& key : cachedIds) {
+      uuid_t id;
+      key.copyTo(id);
+      auto segment = Segment::create(id, segments[0]->parameters);
+      cache->get(segment.get());
+    }
+  }
+  ids = cachedIds;
+  return *cache;
+}
+
+static void streamCacheGet(benchmark::State& state, size_t shards) {
+  std::vector<UuidKey> ids;
+  StreamCache& cache = benchCache(shards, ids);
+  if (ids.empty()) {
+    state.SkipWithError("No video in test file");
+    return;
+  }
+  // Each thread walks the ids from a different starting point
+  size_t i = state.thread_index() * (ids.size() / state.threads());
+  uuid_t id;
+  for (auto _ : state) {
+    ids[i].copyTo(id);
+    Stream::pointer stream = cache.get(id);
+    benchmark::DoNotOptimize(stream.get());
+    i = (i + 1) % ids.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void StreamCacheGet(benchmark::State& state) {
+  streamCacheGet(state, 16);
+}
+BENCHMARK(StreamCacheGet)->ThreadRange(1, 16)->UseRealTime();
+
+// Sixteen unpacker threads hammering the cache, with everything behind
+// one lock versus split up into shards
+static void StreamCacheContention(benchmark::State& state) {
+  streamCacheGet(state, state.range(0));
+}
+BENCHMARK(StreamCacheContention)->ArgName("shards")->Arg(1)->Arg(4)->Arg(16)->Arg(64)->Threads(16)->UseRealTime();
@@ -0,0 +1,139 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * End to end benchmark. Publishes every segment in the test file over
+ * a loopback zmq connection to a SegmentUnpacker and waits for all the
+ * packets to come out the other end. Latency is from handing a segment
+ * to the publisher to its first packet coming out of the unpacked
+ * stream.
+ */
+
+#include "BenchData.h"
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+using namespace fr::media2;
+using namespace fr::media2::bench;
+
+// Arg is the number of unpacker threads
+static void EndToEndZmq(benchmark::State& state) {
+  auto& data = BenchData::instance();
+  std::vector<std::pair<SegmentCollector*, std::shared_ptr<ZmqSegmentPublisher>>> sources;
+  std::string addr("tcp://127.0.0.1:2720");
+  size_t filePackets = 0;
+  size_t fileBytes = 0;
+
+  std::mutex mutex;
+  std::condition_variable arrived;
+  size_t received = 0;
+  // When each segment was sent, by (media type, dts)
+  std::map<std::pair<int, int64_t>, Latency::clock::time_point> sent;
+  Latency latency;
+  std::vector<Connection> connections;
+
+  auto countPacket = [&](const Packet::pointer& packet, const StreamData::pointer& stream) {
+    auto now = Latency::clock::now();
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = sent.find({stream->parameters->codec_type, packet->dts});
+    if (found != sent.end()) {
+      latency.record(now - found->second);
+      sent.erase(found);
+    }
+    received++;
+    arrived.notify_all();
+  };
+
+  ZmqSegmentSubscriber subscriber(addr);
+  SegmentUnpacker unpacker(state.range(0), [&](Stream::pointer stream) {
+    std::lock_guard<std::mutex> lock(mutex);
+    connections.push_back(stream->packets.connect(countPacket));
+  });
+  unpacker.subscribe(&subscriber);
+  subscriber.process();
+
+  for (SegmentCollector* collector : {&data.video, &data.audio}) {
+    if (!collector->collected.empty()) {
+      sources.emplace_back(collector, std::make_shared<ZmqSegmentPublisher>(addr));
+      filePackets += BenchData::packets(collector->collected);
+      fileBytes += BenchData::bytes(collector->collected);
+    }
+  }
+  if (sources.empty()) {
+    state.SkipWithError("Nothing in test file");
+    return;
+  }
+
+  // Pub/sub drops everything until the connection is up, so keep
+  // poking it until something makes it through
+  auto& [firstCollector, firstPublisher] = sources[0];
+  bool connected = false;
+  for (int tries = 0; tries < 500 && !connected; ++tries) {
+    firstPublisher->process(firstCollector->collected[0], firstCollector->stream);
+    std::unique_lock<std::mutex> lock(mutex);
+    connected = arrived.wait_for(lock, std::chrono::milliseconds(10), [&]{ return received > 0; });
+  }
+  if (!connected) {
+    state.SkipWithError("Could not connect to loopback subscriber");
+    return;
+  }
+  // Let the rest of the warmup segments drain out before timing anything
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  for (auto _ : state) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      received = 0;
+      sent.clear();
+    }
+    // Send the streams interleaved, more or less like a live source would
+    std::vector<size_t> next(sources.size(), 0);
+    bool sending = true;
+    while (sending) {
+      sending = false;
+      for (size_t i = 0; i < sources.size(); ++i) {
+        auto& [collector, publisher] = sources[i];
+        if (next[i] < collector->collected.size()) {
+          const Segment::pointer& segment = collector->collected[next[i]++];
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            sent[{segment->parameters.codec_type, segment->dts}] = Latency::clock::now();
+          }
+          publisher->process(segment, collector->stream);
+          sending = true;
+        }
+      }
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!arrived.wait_for(lock, std::chrono::seconds(10), [&]{ return received >= filePackets; })) {
+      state.SkipWithError("Lost packets in transport");
+      break;
+    }
+  }
+
+  unpacker.close();
+  subscriber.close();
+  subscriber.join();
+  for (auto& connection : connections) {
+    connection.disconnect();
+  }
+  throughput(state, filePackets * state.iterations(), fileBytes * state.iterations());
+  latency.report(state);
+}
+BENCHMARK(EndToEndZmq)->ArgName("threads")->Arg(1)->Arg(4)->UseRealTime()->Unit(benchmark::kMillisecond);
@@ -0,0 +1,7 @@
+/**
+ * main function for google benchmark
+ */
+
+#include <benchmark/benchmark.h>
+
+BENCHMARK_MAIN();
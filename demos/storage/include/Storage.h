@@ -15,11 +15,11 @@
  *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
  *
  * Receives incoming segments and stores them to disk. There are two
- * components to this; a receiver receives the segment buffer and
- * job ID and stores it for later processing. A threadpool takes each
- * segment, decompresses it to retrieve some data from the segment
- * and then stores the segment buffer to the directories made by the
- * router.
+ * components to this; a receiver receives each segment and its
+ * job ID and hands it to a worker. Each stream always goes to the
+ * same worker, so its segments get stored in the order they arrived.
+ * The workers look up the job to find the directory the router made
+ * for it and append the segment to a SegmentStore there.
  */
 
 #pragma once
@@ -31,9 +31,6 @@
 #include <Job.h> // From router demo
 #include <atomic>
 #include <fr/media2.h>
-#include <condition_variable>
-#include <deque>
-#include <fstream>
 #include <thread>
 #include <uuid.h>
 #include <memory>
@@ -54,12 +51,12 @@ namespace fr::media2::demos {
     void join();
     
     // Add another segment to process
-    void add(std::stringstream& buffer, uuid_t streamId);
+    void add(const Segment::pointer& segment, uuid_t streamId);
     
   private:
 
     struct Tasks {
-      std::shared_ptr<std::stringstream> buffer;
+      Segment::pointer segment;
       uuid_t id;
       std::shared_ptr<Job> metadata;
     };
@@ -70,24 +67,18 @@ namespace fr::media2::demos {
     
     std::thread receiverThread;
     std::vector<std::thread> storagePool;
+    // One queue per worker
+    std::vector<std::unique_ptr<WorkQueue<std::unique_ptr<Tasks>>>> tasks;
     
     // Store jobs in cache so I don't have to look them up
     // for every segment.
     std::unordered_map<std::string, std::shared_ptr<Job>> jobCache;
-    std::deque<std::unique_ptr<Tasks>> tasks;
-    std::mutex taskMutex;
+    // One store per job root
+    std::unordered_map<std::string, std::unique_ptr<SegmentStore>> stores;
     std::mutex cacheMutex;
 
     std::shared_ptr<::fr::media2::ZmqSegmentSubscriber> subscriber;
 
-    // Gets set false by workers if tasks are empty
-    // Gets set true by receiverThread when more work
-    // arrives.
-    bool moreWork;
-
-    // Worker threads can wait on this
-    std::condition_variable workNotification;
-
     // Queries zmq service for ID
     std::shared_ptr<Job> jobServiceLookup(std::string id);
     
@@ -95,10 +86,12 @@ namespace fr::media2::demos {
     std::string idStr(uuid_t id);
     // Query job by stream ID
     std::shared_ptr<Job> queryJob(uuid_t id);
+    // Store for a job, opened the first time it's needed
+    SegmentStore* store(const std::shared_ptr<Job>& job);
     // Run receiver thread
     void receive(std::string storageServiceAddress); 
     // Run by worker threads
-    void process();
+    void process(WorkQueue<std::unique_ptr<Tasks>>* queue);
     
   };
 
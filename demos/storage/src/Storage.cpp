@@ -17,9 +17,6 @@
 
 #include <Storage.h>
 #include <iostream>
-#include <boost/archive/binary_iarchive.hpp>
-#include <boost/serialization/shared_ptr.hpp>
-#include <boost/serialization/vector.hpp>
 
 namespace fr::media2::demos {
 
@@ -27,16 +24,20 @@ namespace fr::media2::demos {
     queryServiceAddress(queryServiceAddress) {
 
     std::cout << "Starting storage service on " << storageServiceAddress << std::endl;
-    receiverThread = std::thread([this, storageServiceAddress]{ receive(storageServiceAddress); });
+    if (nthreads < 1) {
+      nthreads = 1;
+    }
     for (int i = 0; i < nthreads; ++i) {
-      storagePool.push_back(std::thread([this]{process();}));
+      tasks.push_back(std::make_unique<WorkQueue<std::unique_ptr<Tasks>>>());
     }
+    for (auto& queue : tasks) {
+      storagePool.push_back(std::thread([this, q = queue.get()]{process(q);}));
+    }
+    receiverThread = std::thread([this, storageServiceAddress]{ receive(storageServiceAddress); });
   }
 
   Storage::~Storage() {
     shutdown();
-    // Wake workers if they're restin'
-    workNotification.notify_all();
     join();
   }
 
@@ -46,6 +47,10 @@ namespace fr::media2::demos {
       subscriber->close();
       subscriber->join();
     }
+    // Workers finish whatever is queued before they exit
+    for (auto& queue : tasks) {
+      queue->close();
+    }
   }
 
   void Storage::join() {
@@ -58,18 +63,20 @@ namespace fr::media2::demos {
       }
     }
     storagePool.clear();
+    // Commits anything that's still outstanding
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    stores.clear();
   }
 
-  void Storage::add(std::stringstream &buffer, uuid_t streamId) {
+  void Storage::add(const Segment::pointer& segment, uuid_t streamId) {
     auto task = std::make_unique<Tasks>();
-    task->buffer = std::make_shared<std::stringstream>();
-    task->buffer->swap(buffer);
+    // The packets just reference the message they came in, so this
+    // doesn't copy any packet data
+    task->segment = Segment::copy(segment);
     uuid_copy(task->id, streamId);
-    
-    std::lock_guard<std::mutex> lock(taskMutex);
-    tasks.push_back(std::move(task));
-    moreWork = true;
-    workNotification.notify_all();
+    // Keep each stream on one worker so its segments stay in order
+    size_t worker = UuidKey(streamId).hash() % tasks.size();
+    tasks[worker]->push(std::move(task));
   }
 
   std::string Storage::idStr(uuid_t id) {
@@ -110,57 +117,47 @@ namespace fr::media2::demos {
     return ret;
   }
 
+  SegmentStore* Storage::store(const std::shared_ptr<Job>& job) {
+    std::filesystem::path root = job->jobRoot();
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto& ret = stores[root.string()];
+    if (!ret) {
+      ret = std::make_unique<SegmentStore>(root);
+    }
+    return ret.get();
+  }
+
   void Storage::receive(std::string storageServiceAddress) {
     subscriber = std::make_shared<ZmqSegmentSubscriber>(storageServiceAddress);
-    subscriber->receivedSegment.connect([this](std::stringstream& buffer, uuid_t uuid) {
-      this->add(buffer, uuid);
+    subscriber->segments.connect([this](const Segment::pointer& segment, uuid_t uuid, AVMediaType, int, int) {
+      this->add(segment, uuid);
     });
     subscriber->process();
   }
 
-  void Storage::process() {
-    std::mutex cvWaiter; // Waits on workNotification
-
-    // If we shut down, we want to process remaining tasks before
-    // exiting.
-    while(!shutdownRequest || !tasks.empty()) {
-      std::unique_ptr<Tasks> task;
-      {
-	std::lock_guard<std::mutex> lock(taskMutex);
-	if (!tasks.empty()) {
-	  task = std::move(tasks.front());
-	  tasks.pop_front();
-	}
+  void Storage::process(WorkQueue<std::unique_ptr<Tasks>>* queue) {
+    // Once we shut down, the queue hands out what's left and then
+    // pop returns false.
+    std::unique_ptr<Tasks> task;
+    while(queue->pop(task)) {
+      // Get job for directory to store in
+      while(nullptr == task->metadata.get()) {
+	task->metadata = queryJob(task->id);
       }
-      if (nullptr != task.get()) {
-	// Get job for directory to store in
-	while(nullptr == task->metadata.get()) {
-	  task->metadata = queryJob(task->id);
+      if (!task->metadata->jobId.empty()) {
+	// The store gets the dts out of the segment header, so nothing
+	// has to be unpacked, and it's appended to the stream's log
+	// rather than getting a file of its own.
+	try {
+	  if (!store(task->metadata)->append(*task->segment)) {
+	    std::cout << "Dropping out of order segment " << task->segment->dts
+		      << " for " << idStr(task->id) << std::endl;
+	  }
+	} catch (std::exception& e) {
+	  std::cout << "Could not store segment for " << idStr(task->id) << ": " << e.what() << std::endl;
 	}
-	if (!task->metadata->jobId.empty()) {
-	  // I have to unpack the segment to get its
-	  // timestamp (This seems like something I should
-	  // send on the wire so I don't have to mess with that)
-	  auto ptr = std::make_shared<Segment>();
-	  boost::archive::binary_iarchive ar(*task->buffer);
-	  ar >> (*ptr);
-	  
-	  std::filesystem::path writeDir = task->metadata->jobRoot() / idStr(task->id);
-	  std::string filename{"/"};
-	  filename.append(std::to_string(ptr->dts));
-	  std::cout << "Writing " << writeDir.string() + filename << std::endl;
-	  std::ofstream seg(writeDir.string() + filename);
-	  seg << task->buffer->str();
-	}
-      } else {
-	// No work ATM
-	std::unique_lock<std::mutex> lock(cvWaiter);
-	moreWork = false;
-	workNotification.wait(lock, [this]{return moreWork;});
       }
-    } 
-     
+    }
   }
 
 }
-
@@ -17,25 +17,48 @@
  */
 
 #pragma once
+#include <fr/media2/AsyncFrameSubscriber.h>
+#include <fr/media2/AsyncPacketSubscriber.h>
+#include <fr/media2/BackpressureQueue.h>
 #include <fr/media2/Decoder.h>
+#include <fr/media2/DecoderConfig.h>
 #include <fr/media2/Encoder.h>
 #include <fr/media2/Frame.h>
 #include <fr/media2/Frame2Mat.h>
+#include <fr/media2/FramePool.h>
 #include <fr/media2/FrameSource.h>
 #include <fr/media2/FrameSubscriber.h>
+#include <fr/media2/IOSink.h>
+#include <fr/media2/IOSource.h>
 #include <fr/media2/Muxer.h>
 #include <fr/media2/Packet.h>
+#include <fr/media2/PacketInterleaver.h>
+#include <fr/media2/PacketPool.h>
 #include <fr/media2/PacketReader.h>
+#include <fr/media2/PacketRing.h>
 #include <fr/media2/PacketSubscriber.h>
+#include <fr/media2/PixelKernels.h>
+#include <fr/media2/ProbeCache.h>
+#include <fr/media2/RenditionLadder.h>
 #include <fr/media2/Resampler.h>
 #include <fr/media2/Scaler.h>
 #include <fr/media2/Segment.h>
 #include <fr/media2/Segmenter.h>
+#include <fr/media2/SegmentPackager.h>
+#include <fr/media2/SegmentSource.h>
+#include <fr/media2/SegmentStore.h>
+#include <fr/media2/SegmentStoreReader.h>
 #include <fr/media2/SegmentUnpacker.h>
 #include <fr/media2/SegmentSubscriber.h>
+#include <fr/media2/SegmentTranscoder.h>
+#include <fr/media2/SegmentWire.h>
 #include <fr/media2/Serialization.h>
+#include <fr/media2/Signal.h>
+#include <fr/media2/SliceScaler.h>
 #include <fr/media2/Stream.h>
 #include <fr/media2/StreamCache.h>
 #include <fr/media2/StreamData.h>
+#include <fr/media2/UuidKey.h>
+#include <fr/media2/WorkQueue.h>
 #include <fr/media2/ZmqSegmentPublisher.h>
 #include <fr/media2/ZmqSegmentSubscriber.h>
@@ -0,0 +1,81 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * The frame version of AsyncPacketSubscriber. Subscribe it to a frame
+ * source (a Decoder, usually) and subscribe your slow frame consumer
+ * (an Encoder, say) to it. Frames are referenced into a queue in the
+ * decoder's thread and sent on from this object's thread, so a slow
+ * encoder doesn't stop the decoder from getting on with the next
+ * packet.
+ *
+ *   AsyncFrameSubscriber async(decoder, encoder, 16);
+ *
+ * It's a FrameSource, so it passes along the codec parameters and time
+ * base of whatever it's subscribed to. Only subscribe it to one source.
+ *
+ * Queueing a frame just takes a reference to its buffers, so keep the
+ * queue short. Each decoded 4K frame is around 12MB.
+ */
+
+#pragma once
+
+#include <fr/media2/BackpressureQueue.h>
+#include <fr/media2/Frame.h>
+#include <fr/media2/FrameSource.h>
+#include <fr/media2/FrameSubscriber.h>
+#include <fr/media2/StreamData.h>
+#include <thread>
+
+namespace fr::media2 {
+
+  class AsyncFrameSubscriber : public FrameSubscriber, public FrameSource {
+  public:
+
+    explicit AsyncFrameSubscriber(size_t capacity = 16, Backpressure policy = Backpressure::block);
+    // Subscribes to source and subscribes subscriber to this
+    AsyncFrameSubscriber(FrameSource& source, FrameSubscriber& subscriber,
+                         size_t capacity = 16, Backpressure policy = Backpressure::block);
+    ~AsyncFrameSubscriber() override;
+    AsyncFrameSubscriber(const AsyncFrameSubscriber& copy) = delete;
+    AsyncFrameSubscriber operator=(const AsyncFrameSubscriber& copy) = delete;
+
+    void subscribeCallback(FrameSource* source) override;
+
+    // Waits until everything queued so far has been sent on
+    void flush();
+    // Stops taking frames, sends on what's queued and stops the thread
+    void close();
+    // Same, but throws away what's queued
+    void abort();
+
+    BackpressureStats stats();
+
+  protected:
+    void process(Frame::const_pointer frame, const StreamData::pointer& stream) override;
+
+  private:
+    struct Item {
+      Frame::pointer frame = Frame::pointer{nullptr, &Frame::destroy};
+      StreamData::pointer stream;
+    };
+
+    BackpressureQueue<Item> queue;
+    std::thread worker;
+
+    void run();
+  };
+
+}
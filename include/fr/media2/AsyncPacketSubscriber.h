@@ -0,0 +1,104 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Puts a queue and a thread between a stream and whatever is subscribed
+ * to it. Subscribe this to a stream (or several) and subscribe your slow
+ * thing (a Muxer, a Decoder feeding an Encoder) to the output stream it
+ * makes for that source. Packets are copied into the queue in the
+ * thread of whoever is reading them and sent on from this object's
+ * thread, so a slow subscriber no longer holds up a PacketReader.
+ *
+ *   AsyncPacketSubscriber async(256, Backpressure::dropUntilKeyframe);
+ *   async.subscribe(reader.videoStreams[0]);
+ *   async.attach(reader.videoStreams[0], muxer);
+ *
+ * All the outputs are sent from the same thread, in the order packets
+ * (and stream events) arrived, so something subscribed to several of them (like a Muxer)
+ * still only gets called from one thread at a time.
+ *
+ * What happens when the queue fills up is up to the Backpressure
+ * policy (see BackpressureQueue.h.) stats tells you how deep the queue
+ * has been and how much was dropped.
+ */
+
+#pragma once
+
+#include <fr/media2/BackpressureQueue.h>
+#include <fr/media2/Packet.h>
+#include <fr/media2/PacketSubscriber.h>
+#include <fr/media2/Stream.h>
+#include <fr/media2/StreamData.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fr::media2 {
+
+  class AsyncPacketSubscriber : public PacketSubscriber {
+  public:
+
+    explicit AsyncPacketSubscriber(size_t capacity = 256, Backpressure policy = Backpressure::block);
+    // Subscribes to source and attaches subscriber to its output
+    AsyncPacketSubscriber(Stream::pointer source, PacketSubscriber& subscriber,
+                          size_t capacity = 256, Backpressure policy = Backpressure::block);
+    ~AsyncPacketSubscriber() override;
+    AsyncPacketSubscriber(const AsyncPacketSubscriber& copy) = delete;
+    AsyncPacketSubscriber operator=(const AsyncPacketSubscriber& copy) = delete;
+
+    // Sets up an output stream for source, which has the same stream
+    // data as source does
+    void subscribe(Stream::pointer to) override;
+    void unsubscribe() override;
+
+    // The stream packets from source come back out of. Null if this
+    // isn't subscribed to source.
+    Stream::pointer output(const Stream::pointer& source);
+    // Subscribes subscriber to the output for source
+    void attach(const Stream::pointer& source, PacketSubscriber& subscriber);
+
+    // Waits until everything queued so far has been sent on
+    void flush();
+    // Stops taking packets, sends on what's queued and stops the thread
+    void close();
+    // Same, but throws away what's queued
+    void abort();
+
+    BackpressureStats stats();
+
+  protected:
+    // Doesn't do anything, each subscription queues its own packets
+    void process(const Packet::pointer& packet, const StreamData::pointer& stream) override;
+
+  private:
+    struct Item {
+      Packet::pointer packet = Packet::nullPacket();
+      Stream* output = nullptr;
+      // Stream events go through the queue too, so they stay in order
+      // with the packets
+      bool isEvent = false;
+      StreamEvent event = StreamEvent::endOfStream;
+    };
+
+    BackpressureQueue<Item> queue;
+    std::mutex outputsMutex;
+    // Source and output, in the order they were subscribed
+    std::vector<std::pair<Stream::pointer, Stream::pointer>> outputs;
+    std::thread worker;
+
+    void run();
+  };
+
+}
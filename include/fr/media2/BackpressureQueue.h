@@ -0,0 +1,225 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * A bounded queue for the async subscribers, which decides what to do
+ * when the consumer can't keep up. Each item is tagged with whether
+ * it's a keyframe and which source it came from, so the policies can
+ * avoid throwing away the packets a decoder needs most.
+ *
+ * * block makes the producer wait for room, like WorkQueue does. Nothing
+ *   is lost, but a slow consumer slows down whatever is feeding it.
+ * * dropOldest throws out whatever has been waiting longest.
+ * * dropNonKey throws out the oldest non-keyframe in the queue. If
+ *   everything queued is a keyframe, an incoming non-keyframe is dropped
+ *   and an incoming keyframe waits for room.
+ * * dropUntilKeyframe drops the incoming item and then everything else
+ *   from the same source until its next keyframe, so a decoder never
+ *   sees a frame whose references were thrown away.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <set>
+
+namespace fr::media2 {
+
+  enum class Backpressure {
+    block,
+    dropOldest,
+    dropNonKey,
+    dropUntilKeyframe
+  };
+
+  struct BackpressureStats {
+    // Items waiting right now
+    size_t depth = 0;
+    // The most that's ever been waiting
+    size_t peakDepth = 0;
+    // Items offered to the queue
+    uint64_t pushed = 0;
+    // Items handed to the consumer
+    uint64_t delivered = 0;
+    // Items thrown away by the policy
+    uint64_t dropped = 0;
+    // Time the producer spent waiting for room
+    std::chrono::nanoseconds producerStall{0};
+  };
+
+  template<typename T>
+  class BackpressureQueue {
+  public:
+
+    BackpressureQueue(size_t capacity, Backpressure policy) :
+      capacity(capacity > 0 ? capacity : 1), policy(policy) {}
+    BackpressureQueue(const BackpressureQueue& copy) = delete;
+    BackpressureQueue operator=(const BackpressureQueue& copy) = delete;
+
+    // Offers an item. Returns false if the item (not something else)
+    // was dropped, or if the queue is closed.
+    bool push(T item, bool key, int source) {
+      std::unique_lock<std::mutex> lock(mutex);
+      current.pushed++;
+      if (closed) {
+        return false;
+      }
+      if (Backpressure::dropUntilKeyframe == policy && skipping.contains(source)) {
+        if (!key || items.size() >= capacity) {
+          current.dropped++;
+          return false;
+        }
+        skipping.erase(source);
+      }
+      while (items.size() >= capacity) {
+        if (Backpressure::dropOldest == policy) {
+          items.pop_front();
+          current.dropped++;
+        } else if (Backpressure::dropNonKey == policy && dropOldestNonKey()) {
+          // Made some room
+        } else if (Backpressure::dropNonKey == policy && !key) {
+          current.dropped++;
+          return false;
+        } else if (Backpressure::dropUntilKeyframe == policy) {
+          skipping.insert(source);
+          current.dropped++;
+          return false;
+        } else {
+          auto start = std::chrono::steady_clock::now();
+          notFull.wait(lock, [this]{ return closed || items.size() < capacity; });
+          current.producerStall += std::chrono::steady_clock::now() - start;
+          if (closed) {
+            return false;
+          }
+        }
+      }
+      items.push_back(Entry{std::move(item), key, source});
+      current.peakDepth = std::max(current.peakDepth, items.size());
+      lock.unlock();
+      notEmpty.notify_one();
+      return true;
+    }
+
+    // Waits for an item. Returns false once the queue is closed and
+    // empty. Call done when you've finished with the item, so
+    // waitUntilIdle knows when everything has been handled.
+    bool pop(T& item) {
+      std::unique_lock<std::mutex> lock(mutex);
+      notEmpty.wait(lock, [this]{ return closed || !items.empty(); });
+      if (items.empty()) {
+        return false;
+      }
+      item = std::move(items.front().item);
+      items.pop_front();
+      current.delivered++;
+      busy = true;
+      lock.unlock();
+      notFull.notify_one();
+      return true;
+    }
+
+    void done() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        busy = false;
+      }
+      idle.notify_all();
+    }
+
+    // Waits until the queue is empty and the consumer has finished
+    // with the last item
+    void waitUntilIdle() {
+      std::unique_lock<std::mutex> lock(mutex);
+      idle.wait(lock, [this]{ return closed || (items.empty() && !busy); });
+    }
+
+    // No more items. The consumer still gets whatever is queued.
+    void close() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+      }
+      notEmpty.notify_all();
+      notFull.notify_all();
+      idle.notify_all();
+    }
+
+    // Throws away whatever is queued and closes
+    void abort() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        current.dropped += items.size();
+        items.clear();
+        closed = true;
+      }
+      notEmpty.notify_all();
+      notFull.notify_all();
+      idle.notify_all();
+    }
+
+    BackpressureStats stats() {
+      std::lock_guard<std::mutex> lock(mutex);
+      BackpressureStats ret = current;
+      ret.depth = items.size();
+      return ret;
+    }
+
+  private:
+    struct Entry {
+      T item;
+      bool key;
+      int source;
+    };
+
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::condition_variable idle;
+    std::deque<Entry> items;
+    size_t capacity;
+    Backpressure policy;
+    bool closed = false;
+    bool busy = false;
+    // Sources that are dropping until their next keyframe
+    std::set<int> skipping;
+    BackpressureStats current;
+
+    bool dropOldestNonKey() {
+      for (auto it = items.begin(); it != items.end(); ++it) {
+        if (!it->key) {
+          items.erase(it);
+          current.dropped++;
+          return true;
+        }
+      }
+      return false;
+    }
+  };
+
+}
+
+inline std::ostream& operator<<(std::ostream& o, const fr::media2::BackpressureStats& stats) {
+  o << "depth " << stats.depth << " (peak " << stats.peakDepth << "), "
+    << stats.pushed << " pushed, " << stats.delivered << " delivered, "
+    << stats.dropped << " dropped, producer stalled "
+    << std::chrono::duration_cast<std::chrono::milliseconds>(stats.producerStall).count() << " ms";
+  return o;
+}
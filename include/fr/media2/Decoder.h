@@ -18,9 +18,13 @@
  *
  * Decoding does not use a thread; it runs in the thread of its
  * notifier. If you don't want to block while reading the source
- * and want to buffer packets to feed to the decoder, you can
- * write another PacketSubscriber that buffers them and feeds
- * them to this decoder in its own thread.
+ * and want to buffer packets to feed to the decoder, subscribe
+ * it through an AsyncPacketSubscriber, which feeds them to the
+ * decoder in its own thread. AsyncFrameSubscriber does the same
+ * thing for whatever is taking frames from the decoder.
+ *
+ * At the end of the stream the decoder is drained, so a frame threaded
+ * decoder hands over the frames it was still working on.
  *
  * As with packets, don't expect the frames you get to be valid
  * once your callback returns to the Decoder. If you need to keep
@@ -29,7 +33,8 @@
 
 #pragma once
 
-#include <boost/signals2.hpp>
+#include <fr/media2/Signal.h>
+#include <fr/media2/DecoderConfig.h>
 #include <fr/media2/PacketSubscriber.h>
 #include <fr/media2/Frame.h>
 #include <fr/media2/FrameSource.h>
@@ -43,12 +48,21 @@ namespace fr {
     protected:
 
       Frame::pointer workingFrame = Frame::create();
+      DecoderConfig config;
       
       void process(const Packet::pointer& packet,
-		   StreamData::pointer stream) override;
+		   const StreamData::pointer& stream) override;
+      void streamEvent(StreamEvent event, const StreamData::pointer& stream) override;
+      // Sends everything the decoder has ready
+      void receiveFrames(const StreamData::pointer& stream);
 
     public:
       Decoder() = default;
+      // config is used to open the codec context of streams that
+      // don't have an open one yet (streams made from segments.)
+      // Streams from a PacketReader were already opened with the
+      // reader's config.
+      explicit Decoder(const DecoderConfig& config) : config(config) {}
       virtual ~Decoder() = default;
 
       void subscribeCallback(Stream::pointer to) override;
@@ -0,0 +1,80 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Settings for opening decoders. LibAV only looks at these when the
+ * codec is opened, so they go to the PacketReader (or Decoder, for
+ * streams built from segments) rather than being something you can
+ * change on the fly.
+ *
+ * Frame threading decodes several frames at once, which is where most
+ * of the speedup on big H.264/HEVC comes from, but it holds on to
+ * threads - 1 frames before you see the first one. Slice threading
+ * splits each frame up instead and adds no delay, but only helps if
+ * the video was encoded with slices. StreamData::decoderDelay will
+ * tell you how many frames of delay you actually got.
+ *
+ * The default is one thread, which is what decoders always got before
+ * there was a DecoderConfig. Frame threading is something you have to
+ * ask for (frameThreaded() does), because the frames it's holding only
+ * come out when the stream sends StreamEvent::endOfStream. PacketReader
+ * does that at the end of the file, but streams fed from segments
+ * (SegmentUnpacker, SegmentStoreReader) don't ever end, so the last
+ * few frames would just sit in the decoder.
+ */
+
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+namespace fr::media2 {
+
+  struct DecoderConfig {
+    // 0 lets LibAV pick (one per core), 1 turns threading off
+    int threads = 1;
+    // Kinds of threading the decoder is allowed to use. If neither
+    // is set the decoder runs single threaded.
+    bool frameThreads = false;
+    bool sliceThreads = true;
+    // Frames to skip decoding entirely (AVDISCARD_NONREF skips frames
+    // nothing else references, which is most B frames)
+    AVDiscard skipFrame = AVDISCARD_DEFAULT;
+    // Frames to skip the loop filter on. Looks blockier but decodes
+    // quite a bit faster.
+    AVDiscard skipLoopFilter = AVDISCARD_DEFAULT;
+    // Decode into buffers from FramePool instead of the context's own
+    // pool, so they get reused across decoders (and across segments,
+    // where every segment gets a new context.)
+    bool pooledFrames = true;
+
+    // Sets these on a context. Do this before avcodec_open2.
+    void apply(AVCodecContext* context) const;
+
+    // Decode as fast as possible at the expense of quality. Good for
+    // thumbnails and previews.
+    static DecoderConfig preview();
+    // Slice threading only, so the decoder doesn't add any delay
+    static DecoderConfig lowLatency();
+    // Frame and slice threading with a thread per core. Fastest, but
+    // only use it on streams that end (see above.)
+    static DecoderConfig frameThreaded();
+    // No threading at all, for when you're running lots of decoders
+    // side by side
+    static DecoderConfig singleThreaded();
+  };
+
+}
@@ -75,7 +75,7 @@ namespace fr::media2 {
   protected:
 
     void process(Frame::const_pointer frame,
-		 StreamData::pointer stream) override;
+		 const StreamData::pointer& stream) override;
 
     AVCodecContext *context = nullptr;
     bool firstPacket = true;
@@ -46,7 +46,8 @@ namespace fr {
 
       // Create a video frame of a specified size and pixel format
       // You can also specify the alignment if you want to, but
-      // ffmpeg is generally pretty good about figuring it out
+      // ffmpeg is generally pretty good about figuring it out.
+      // The buffers come from FramePool.
       static pointer create(int width,
 			    int height,
 			    AVPixelFormat fmt,
@@ -57,6 +58,11 @@ namespace fr {
       static pointer create(int64_t layout, AVSampleFormat format,
 			    int rate, int align = 0);
 
+      // Same thing with room for nbSamples. These buffers come from
+      // FramePool too.
+      static pointer create(int64_t layout, AVSampleFormat format,
+			    int rate, int nbSamples, int align);
+
       // Clone frame. If you unref the old one, it's basically a copy.
       static pointer clone(const_pointer copy);
     };
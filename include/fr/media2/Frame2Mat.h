@@ -19,40 +19,58 @@
  * or formats. If you're converting frames from multiple streams,
  * create a Frame2Mat object for each different resolution and pixel
  * format.
+ *
+ * By default the mats don't copy anything. Frames that aren't BGR get
+ * scaled into a BGR frame from FramePool and the mat just points at
+ * that frame's buffer, holding a reference to it. The buffer goes back
+ * to the pool when the last mat using it goes away, so hang on to the
+ * mats as long as you like. Frames that were already BGR when they got
+ * here belong to someone else, so those still get copied. If you want
+ * every mat to have its own copy, pass false to the constructor.
  */
 
 #pragma once
 
-#include <boost/signals2.hpp>
+#include <fr/media2/Signal.h>
 #include <fr/media2/Frame.h>
+#include <fr/media2/FrameSource.h>
 #include <fr/media2/FrameSubscriber.h>
 #include <fr/media2/Scaler.h>
+#include <memory>
+#include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
 
 namespace fr {
   namespace media2 {
 
-    class Frame2Mat : public FrameSubscriber {
+    // The frames signal comes from FrameSource. If we don't receive
+    // frames in BGR format we'll create a scaler to convert them and
+    // subscribe IT to this frames signal, then re-emit frames we
+    // receive that are not in bgr format to this signal
+    class Frame2Mat : public FrameSubscriber, public FrameSource {
     public:
-      // Frames signal. If we don't receive frames in BGR format
-      // we'll create a scaler to convert them and subscribe IT
-      // to this frames signal, then re-emit frames we receive
-      // that are not in bgr format to this signal
-      boost::signals2::signal<void(Frame::const_pointer,
-	     StreamData::pointer)> frames;
-      
-      boost::signals2::signal<void(cv::Mat)> mats;
+      explicit Frame2Mat(bool zeroCopy = true);
       virtual ~Frame2Mat() override;
 
+      Signal<void(cv::Mat)> mats;
+
+      // Wraps a BGR24 frame in a mat that holds a reference to the
+      // frame's buffer instead of copying it. Nobody else should be
+      // writing to the frame.
+      static cv::Mat wrap(const AVFrame* frame);
+
     protected:
-      void process(Frame::const_pointer frame, StreamData::pointer stream) override;
-      // Process BGRA frames for the conversion to OpenCV Mats.
-      void processBgr(Frame::const_pointer frame, StreamData::pointer stream);
+      void process(Frame::const_pointer frame, const StreamData::pointer& stream) override;
+      // Process BGR frames for the conversion to OpenCV Mats. owned is
+      // true if the frame came from our own scaler, so nobody else has
+      // it.
+      void processBgr(Frame::const_pointer frame, const StreamData::pointer& stream, bool owned);
     private:
-      // OpenCV wants frames in BGRA pixel format,
+      // OpenCV wants frames in BGR pixel format,
       // so we'll just set up a scaler and handle that
       // if the frames we receive are not in that format.
       std::unique_ptr<Scaler> bgrScaler;
+      bool zeroCopy;
 
     };
 
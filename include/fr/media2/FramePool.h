@@ -0,0 +1,139 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Recycles frame buffers, so decoding, scaling and resampling don't
+ * have to hit the allocator for every frame. It's the frame version of
+ * PacketPool. Buffers come from an AVBufferPool for each shape of frame,
+ * keyed on (width, height, pixel format, alignment) for video and
+ * (channel layout, sample format, number of samples, alignment) for
+ * audio. All the planes of a frame live in one buffer.
+ *
+ * Only maxPools shapes get pools at once. When a new shape turns up
+ * after that, the pool that went longest without handing out a buffer
+ * is dropped. Buffers it already handed out stay good and get freed
+ * when they come back instead of being reused.
+ *
+ * Frames that get their buffers here are ordinary refcounted AVFrames.
+ * Frame::clone just takes another reference, so handing one off to
+ * another thread doesn't copy anything. When the last reference goes
+ * away, the buffer goes back to its pool.
+ *
+ * Frame::create uses the pool. Decoders can use it by setting the
+ * codec context's get_buffer2 to FramePool::getBuffer2, which
+ * DecoderConfig does unless you tell it not to. Scaler and Resampler
+ * output frames come from it too.
+ */
+
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+#include <libavutil/samplefmt.h>
+}
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <tuple>
+
+namespace fr::media2 {
+
+  class FramePool {
+  public:
+
+    struct Stats {
+      // Buffers we handed out that came back from an earlier frame
+      uint64_t hits = 0;
+      // Buffers we had to allocate
+      uint64_t misses = 0;
+      // Frames we couldn't pool (hardware formats, huge channel counts)
+      // and left to LibAV
+      uint64_t fallbacks = 0;
+      // Number of different frame shapes we have pools for
+      size_t pools = 0;
+    };
+
+    // The one pool everyone uses
+    static FramePool& instance();
+
+    FramePool(const FramePool& copy) = delete;
+    FramePool operator=(const FramePool& copy) = delete;
+
+    // Gives frame buffers for a width x height image in format. This
+    // sets up data, linesize and buf but doesn't touch width, height
+    // or format, so a decoder can ask for a bigger buffer than the
+    // picture. An align of 0 picks one that's good for SIMD. Returns a
+    // negative AVERROR if it fails.
+    int getVideo(AVFrame* frame, int width, int height, AVPixelFormat format, int align = 0);
+    // Same thing for nbSamples of audio. The frame's channel layout
+    // (or channels) is used to work out how many planes there are.
+    int getAudio(AVFrame* frame, int64_t layout, int channels, AVSampleFormat format,
+                 int nbSamples, int align = 0);
+    // Fills in buffers for a frame that already has its width, height
+    // and format, or its layout, format and nb_samples set, like
+    // av_frame_get_buffer does.
+    int get(AVFrame* frame, int align = 0);
+
+    // Use as AVCodecContext::get_buffer2. Falls back to LibAV's own
+    // for anything it can't handle.
+    static int getBuffer2(AVCodecContext* context, AVFrame* frame, int flags);
+
+    // Maximum number of frame shapes to keep pools for
+    void setMaxPools(size_t maxPools);
+    size_t getMaxPools();
+
+    Stats stats();
+    void resetStats();
+
+  private:
+    FramePool() = default;
+    ~FramePool();
+
+    // Video: width, height, format, align. Audio: layout/channels,
+    // samples, format, align, with the type to tell them apart.
+    using Key = std::tuple<int, int64_t, int, int, int>;
+
+    struct Entry {
+      AVBufferPool* pool;
+      // When it last handed out a buffer, in uses
+      uint64_t lastUse;
+    };
+
+    std::mutex mutex;
+    std::map<Key, Entry> pools;
+    size_t maxPools = 64;
+    uint64_t uses = 0;
+
+    std::atomic<uint64_t> requests = 0;
+    std::atomic<uint64_t> misses = 0;
+    std::atomic<uint64_t> fallbacks = 0;
+
+    AVBufferRef* buffer(const Key& key, size_t size);
+    // Drops least recently used pools until there are at most keep.
+    // Call with the mutex held.
+    void evict(size_t keep);
+    template<typename Size>
+    static AVBufferRef* poolAlloc(void* opaque, Size size);
+  };
+
+}
+
+std::ostream& operator<<(std::ostream& o, const fr::media2::FramePool::Stats& stats);
@@ -24,7 +24,7 @@ extern "C" {
 #include <libavcodec/codec_par.h>
 }
 
-#include <boost/signals2.hpp>
+#include <fr/media2/Signal.h>
 #include <fr/media2/Frame.h>
 #include <fr/media2/StreamData.h>
 
@@ -34,8 +34,8 @@ namespace fr::media2 {
   public:
     // Stream in this signal is informational only and can be
     // null in anything that creates this kind of signal.
-    boost::signals2::signal<void(Frame::const_pointer,
-				 StreamData::pointer)> frames;
+    Signal<void(Frame::const_pointer,
+				 const StreamData::pointer&)> frames;
 
     AVCodecParameters *parameters = nullptr;
     AVRational time_base = {0,0};
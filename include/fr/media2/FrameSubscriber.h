@@ -22,7 +22,7 @@
 
 #pragma once
 
-#include <boost/signals2.hpp>
+#include <fr/media2/Signal.h>
 #include <fr/media2/FrameSource.h>
 #include <fr/media2/Frame.h>
 #include <fr/media2/StreamData.h>
@@ -35,9 +35,9 @@ namespace fr {
 
     class FrameSubscriber {
     protected:
-      std::vector<boost::signals2::connection> subscriptions;
+      std::vector<Connection> subscriptions;
       // Override process to implement your callback
-      virtual void process(Frame::const_pointer frame, StreamData::pointer stream) = 0;
+      virtual void process(Frame::const_pointer frame, const StreamData::pointer& stream) = 0;
 
     public:
       // This ptr will be copied from source on subscription. I could be convinced
@@ -0,0 +1,153 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Somewhere for a Muxer to write that isn't a file. The Muxer wraps the
+ * sink in an AVIOContext, so fragmented output can go out over zmq or
+ * to the HTTP layer without a trip through a temp file.
+ *
+ * Along with the data, LibAV says what kind of data it is (the
+ * AVIO_DATA_MARKER types.) A new fragment starts with a SYNC_POINT (or
+ * BOUNDARY_POINT if it doesn't start on a keyframe), the container
+ * header is HEADER and the trailer is TRAILER. Everything else is
+ * UNKNOWN, which just means more of whatever came before it. LibAV
+ * flushes its buffer at every marker, so a write never has the end of
+ * one fragment and the start of the next in it.
+ *
+ * * MemorySink collects everything in memory. It can seek, so it works
+ *   for formats that go back and patch things up, like regular MP4.
+ * * ChunkSink collects writes until a fragment is done and hands the
+ *   whole fragment to a callback. It can't seek.
+ *
+ * Both keep their buffers around when you're done with the data, so
+ * once they've grown big enough, writing doesn't allocate anything.
+ */
+
+#pragma once
+
+extern "C" {
+#include <libavformat/avio.h>
+}
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace fr::media2 {
+
+  class IOSink {
+  public:
+    using pointer = std::shared_ptr<IOSink>;
+
+    virtual ~IOSink() = default;
+
+    // Takes size bytes. type is the AVIO_DATA_MARKER type of the data
+    // and time is its timestamp in AV_TIME_BASE (or AV_NOPTS_VALUE),
+    // if LibAV knows. Returns size or an AVERROR.
+    virtual int write(const uint8_t* data, int size, AVIODataMarkerType type, int64_t time) = 0;
+    // Works like lseek, except whence can also be AVSEEK_SIZE. Returns
+    // the new position, or an AVERROR. The default can't seek.
+    virtual int64_t seek(int64_t offset, int whence);
+    virtual bool seekable() const;
+    // Everything written so far is complete (the muxer finished a
+    // fragment, or was closed), so anything the sink is holding on to
+    // should go out now
+    virtual void flush();
+    // For error messages. The muxer also uses it to guess the format if
+    // you don't give it one.
+    virtual std::string name() const;
+
+    // Size of the AVIOContext's buffer
+    int bufferSize = 64 * 1024;
+
+    // Makes an AVIOContext that writes to sink. Like IOSource's, it
+    // only has a plain pointer to sink, and needs freeContext to free
+    // it.
+    static AVIOContext* createContext(IOSink* sink);
+    static void freeContext(AVIOContext** context);
+  };
+
+  class MemorySink : public IOSink {
+  public:
+    explicit MemorySink(const std::string& name = "memory");
+
+    int write(const uint8_t* data, int size, AVIODataMarkerType type, int64_t time) override;
+    int64_t seek(int64_t offset, int whence) override;
+    bool seekable() const override;
+    std::string name() const override;
+
+    // Everything written so far. Only good until the next write.
+    std::span<const uint8_t> data() const;
+    size_t size() const;
+    // Empties the sink, but keeps the memory for next time
+    void clear();
+
+  private:
+    std::vector<uint8_t> storage;
+    size_t length = 0;
+    size_t position = 0;
+    std::string sinkName;
+  };
+
+  class ChunkSink : public IOSink {
+  public:
+    struct Chunk {
+      // Only good while the callback is running. Copy it if you want
+      // to keep it.
+      std::span<const uint8_t> data;
+      // Type of the data the chunk starts with. HEADER for the
+      // container header (the init segment for fragmented MP4),
+      // SYNC_POINT or BOUNDARY_POINT for a fragment, TRAILER for the
+      // trailer.
+      AVIODataMarkerType type = AVIO_DATA_MARKER_UNKNOWN;
+      // Start of the fragment in AV_TIME_BASE, or AV_NOPTS_VALUE
+      int64_t time = 0;
+      // Where the chunk starts in the output
+      uint64_t offset = 0;
+    };
+
+    using ChunkFunction = std::function<void(const Chunk& chunk)>;
+
+    // maxChunk is the most a chunk can get to before it's sent anyway,
+    // for formats that don't mark where their fragments start (0 for
+    // no limit.) It only cuts between writes, so chunks can go over it
+    // by up to bufferSize.
+    explicit ChunkSink(ChunkFunction callback, size_t maxChunk = 0, const std::string& name = "chunks");
+
+    int write(const uint8_t* data, int size, AVIODataMarkerType type, int64_t time) override;
+    void flush() override;
+    std::string name() const override;
+
+    uint64_t chunks() const;
+    uint64_t bytes() const;
+
+  private:
+    ChunkFunction callback;
+    size_t maxChunk;
+    std::string sinkName;
+    std::vector<uint8_t> pending;
+    AVIODataMarkerType pendingType = AVIO_DATA_MARKER_UNKNOWN;
+    int64_t pendingTime = 0;
+    uint64_t offset = 0;
+    uint64_t sent = 0;
+
+    // Sends whatever's pending
+    void emit();
+  };
+
+}
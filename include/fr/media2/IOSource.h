@@ -0,0 +1,171 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Lets a PacketReader demux something that isn't a file or a URL LibAV
+ * knows how to open. An IOSource hands out bytes through read (and
+ * seek, if it can), and the reader wraps it in an AVIOContext, so
+ * segments you already have in memory or that came in over zmq don't
+ * have to go through a temp file first.
+ *
+ * * MemorySource reads from memory you already have. Nothing's copied
+ *   except into LibAV's IO buffer.
+ * * MmapSource maps a file and reads it like a MemorySource, so there's
+ *   no read system call copying it into LibAV's buffer.
+ * * FileDescriptorSource reads a pipe, socket or anything else you have
+ *   a file descriptor for. Pipes can't seek, so formats that need to
+ *   (like MP4 with the moov atom at the end) won't work through one.
+ * * CallbackSource takes a couple of functions, if you don't want to
+ *   write a class.
+ *
+ * A ProbeCache only gets used for a source that says what's in it
+ * with cacheKey. Names like "memory" and "pipe" are the same for every
+ * source of that kind, so they can't be cache keys. MmapSource uses its
+ * path, since it's reading a file anyway.
+ *
+ * A source is read by one reader at a time. It keeps its position,
+ * so if you want to read the same memory twice at once, make two
+ * MemorySources.
+ */
+
+#pragma once
+
+extern "C" {
+#include <libavformat/avio.h>
+}
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+
+namespace fr::media2 {
+
+  class IOSource {
+  public:
+    using pointer = std::shared_ptr<IOSource>;
+
+    virtual ~IOSource() = default;
+
+    // Copies up to size bytes into buffer. Returns the number of bytes
+    // copied, AVERROR_EOF at the end or some other AVERROR if it
+    // couldn't read.
+    virtual int read(uint8_t* buffer, int size) = 0;
+    // Works like lseek, except whence can also be AVSEEK_SIZE, which
+    // asks for the total size. Returns the new position (or the size),
+    // or an AVERROR. The default can't seek.
+    virtual int64_t seek(int64_t offset, int whence);
+    virtual bool seekable() const;
+    // For error messages
+    virtual std::string name() const;
+    // What a ProbeCache should key this source's contents on, as a
+    // path or URL (see ProbeCache::key.) Two sources with the same key
+    // have to have the same streams. The default is empty, which means
+    // don't cache it.
+    virtual std::string cacheKey() const;
+
+    // Size of the AVIOContext's buffer
+    int bufferSize = 64 * 1024;
+
+    // Makes an AVIOContext that reads from source. It just has a plain
+    // pointer to source, so keep the source around until you've freed
+    // the context with freeContext. Returns null if LibAV couldn't
+    // allocate one.
+    static AVIOContext* createContext(IOSource* source);
+    static void freeContext(AVIOContext** context);
+  };
+
+  class MemorySource : public IOSource {
+  public:
+    // data isn't copied, so it has to stay put while the source is
+    // around. If something needs to stay alive for that to be true,
+    // pass it as owner and the source will hang on to it.
+    MemorySource(std::span<const uint8_t> data, std::shared_ptr<const void> owner = nullptr,
+                 const std::string& name = "memory");
+    MemorySource(const uint8_t* data, size_t size, std::shared_ptr<const void> owner = nullptr,
+                 const std::string& name = "memory");
+
+    int read(uint8_t* buffer, int size) override;
+    int64_t seek(int64_t offset, int whence) override;
+    bool seekable() const override;
+    std::string name() const override;
+
+    std::span<const uint8_t> data() const;
+
+  protected:
+    // For subclasses that work out what data is in their constructor
+    explicit MemorySource(const std::string& name);
+
+    std::span<const uint8_t> bytes;
+    size_t position = 0;
+    std::shared_ptr<const void> owner;
+    std::string sourceName;
+  };
+
+  class MmapSource : public MemorySource {
+  public:
+    // Throws a runtime_error if path can't be opened or mapped
+    explicit MmapSource(const std::string& path);
+    ~MmapSource() override;
+    MmapSource(const MmapSource& copy) = delete;
+    MmapSource operator=(const MmapSource& copy) = delete;
+
+    // The path
+    std::string cacheKey() const override;
+  };
+
+  class FileDescriptorSource : public IOSource {
+  public:
+    // If owned is set the descriptor gets closed with the source
+    explicit FileDescriptorSource(int fd, bool owned = false, const std::string& name = "pipe");
+    ~FileDescriptorSource() override;
+    FileDescriptorSource(const FileDescriptorSource& copy) = delete;
+    FileDescriptorSource operator=(const FileDescriptorSource& copy) = delete;
+
+    int read(uint8_t* buffer, int size) override;
+    // Only works if fd is a regular file
+    int64_t seek(int64_t offset, int whence) override;
+    bool seekable() const override;
+    std::string name() const override;
+
+  private:
+    int fd;
+    bool owned;
+    bool canSeek;
+    std::string sourceName;
+  };
+
+  class CallbackSource : public IOSource {
+  public:
+    using ReadFunction = std::function<int(uint8_t* buffer, int size)>;
+    using SeekFunction = std::function<int64_t(int64_t offset, int whence)>;
+
+    // Leave seek empty if you can't seek
+    explicit CallbackSource(ReadFunction read, SeekFunction seek = nullptr,
+                            const std::string& name = "callback");
+
+    int read(uint8_t* buffer, int size) override;
+    int64_t seek(int64_t offset, int whence) override;
+    bool seekable() const override;
+    std::string name() const override;
+
+  private:
+    ReadFunction readFunction;
+    SeekFunction seekFunction;
+    std::string sourceName;
+  };
+
+}
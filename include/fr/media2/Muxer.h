@@ -17,8 +17,8 @@
  * Muxes data from multiple encoders.
  *
  * This is a bit different from the others because this is the (or at least, a)
- * end of the line for packets. There's not a signal to subscribe to in this
- * object (at least for the time being.)
+ * end of the line for packets. The only signal is fragments, for
+ * fragmented output.
  *
  * This object can also handle subscribing to multiple packet sources.
  * Each new subscription will create an entry in StreamInfo with the
@@ -28,6 +28,24 @@
  * This is a no-frills muxer, but there's a great deal of room to add
  * frills in other objects. We may also decide to build a more-frills
  * muxer at some point in the future.
+ *
+ * It can write to an IOSink instead of a file, if you want the output
+ * in memory or handed to you in chunks as it's written.
+ *
+ * Regular MP4 isn't playable until the trailer's written at close. Call
+ * setFragmented (for mp4 or mov) to get fragmented MP4 (CMAF style,
+ * with an empty moov up front and a moof per fragment) instead. Each
+ * fragment starts on a keyframe of the first video stream, which is
+ * where a Segmenter cuts its segments, so fragments line up with
+ * segments. Packets aren't held in the buffer in this mode, and each
+ * fragment is written out as soon as the keyframe that ends it shows
+ * up, so whoever's reading the output is at most a GOP behind.
+ *
+ * If packets come in from more than one thread, call setInterleaving.
+ * The muxer then sorts them back into dts order itself instead of
+ * counting on them showing up in about the right order. Subscribing
+ * and processing are safe to do from any thread, but nothing can
+ * subscribe after the header's written.
  */
 
 #pragma once
@@ -36,10 +54,14 @@ extern "C" {
 #include <libavformat/avformat.h>
 }
 
-#include <boost/signals2.hpp>
+#include <fr/media2/Signal.h>
 #include <deque>
+#include <fr/media2/IOSink.h>
+#include <fr/media2/PacketInterleaver.h>
 #include <fr/media2/PacketSubscriber.h>
 #include <fr/media2/StreamData.h>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <stdexcept>
 #include <string>
@@ -53,7 +75,7 @@ namespace fr::media2 {
     class StreamInfo {
     public:
       using pointer = std::shared_ptr<StreamInfo>;
-      boost::signals2::connection subscription;
+      Connection subscription;
       Muxer* owner = nullptr;
       // Output stream assigned by muxer
       AVStream *stream;
@@ -67,13 +89,13 @@ namespace fr::media2 {
 
       void subscribe(Stream::pointer to) {
         subscription = to->packets.connect([this](const Packet::pointer& packet,
-                                                  StreamData::pointer stream) {
+                                                  const StreamData::pointer& stream) {
           this->process(packet, stream);
         });
       }
       // Actually handles the processing for incoming packets on this
       // stream. Forwards on to the process method above
-      void process(const Packet::pointer &packet, StreamData::pointer stream) {
+      void process(const Packet::pointer &packet, const StreamData::pointer& stream) {
         if (nullptr == owner) {
           throw std::runtime_error("Nullptr in muxer (This should not be possible.)");
         }
@@ -93,6 +115,9 @@ namespace fr::media2 {
     // Constructor will attempt to determine the format from the filename.
     // Specify it directly if you really want to be sure
     Muxer(std::string filename, std::string format = "", long bufferMax = 300);
+    // Writes to sink. If you don't give it a format it guesses from
+    // the sink's name.
+    Muxer(IOSink::pointer sink, std::string format = "", long bufferMax = 300);
     Muxer(const Muxer& copy) = delete;
     virtual ~Muxer() override;
     Muxer operator=(const Muxer& copy) = delete;
@@ -122,9 +147,58 @@ namespace fr::media2 {
 
     States state = States::READY;
 
+    // Muxer private options (like movflags for mp4.) They're used when
+    // the header is written, so set them before any packets show up.
+    std::map<std::string, std::string> options;
+
+    // A piece of fragmented output
+    struct Fragment {
+      // 0 is the init segment (ftyp and moov.) Fragments count up
+      // from 1.
+      uint64_t sequence = 0;
+      // Where it is in the output, in bytes
+      uint64_t offset = 0;
+      uint64_t size = 0;
+      // Presentation time of the start of the fragment, and how long
+      // it is, in AV_TIME_BASE units (microseconds.) AV_NOPTS_VALUE
+      // and 0 for the init segment.
+      int64_t startTime = AV_NOPTS_VALUE;
+      int64_t duration = 0;
+    };
+
+    // Fires when the init segment or a fragment has been completely
+    // written, from whatever thread wrote the packet that finished
+    // it. If you're writing to an IOSink, it's been flushed, so a
+    // ChunkSink has already sent the fragment.
+    Signal<void(const Fragment&)> fragments;
+
+    // Switches to fragmented MP4. minDuration is the shortest a
+    // fragment can be, in microseconds. With 0 every keyframe starts a
+    // fragment, otherwise it's the first keyframe after minDuration.
+    // Has to be called before the header's written.
+    void setFragmented(int64_t minDuration = 0);
+    bool isFragmented() const;
+
+    // Puts packets from all the streams in dts order before they're
+    // written (see PacketInterleaver), so it's safe to feed the muxer
+    // from more than one thread, like a SegmentUnpacker with several
+    // workers or encoders running in parallel. maxDelta is how far (in
+    // microseconds) the other streams can get ahead of one that's gone
+    // quiet before the muxer stops waiting for it. Has to be called
+    // before the header's written.
+    //
+    // Streams can subscribe from other threads too, but only until the
+    // header's written, which normally happens at the first packet. If
+    // you know how many streams are coming, pass it as streams and the
+    // header (and everything else) waits until they've all subscribed.
+    // If some of them never do, close or flush gives up on them.
+    void setInterleaving(int64_t maxDelta = 10000000, size_t streams = 0);
+    // All zeros if interleaving isn't on
+    PacketInterleaver::Stats interleavingStats();
+
   protected:
     // This one doesn't actually do anything in this case
-    void process(const Packet::pointer& packet, StreamData::pointer stream) override;
+    void process(const Packet::pointer& packet, const StreamData::pointer& stream) override;
     void process(const Packet::pointer& packet, StreamData::pointer stream, StreamInfo* info);
 
   private:
@@ -135,13 +209,49 @@ namespace fr::media2 {
     std::string filename;
     // Output format context
     AVFormatContext *context = nullptr;
+    // If we're not writing to a file
+    IOSink::pointer sink;
+    AVIOContext *ioContext = nullptr;
     // Keeps track of stream start so we can write the header in process
     bool streamStart = true;
     // Number of elements to retain in buffer.
     long bufferMax;
     std::mutex bufferMutex;
+    // Orders packets from several threads, if setInterleaving was
+    // called. It writes with bufferMutex held.
+    std::unique_ptr<PacketInterleaver> interleaver;
+    // How many streams setInterleaving was told to wait for, and what
+    // came out of the interleaver before they all showed up
+    size_t expectedStreams = 0;
+    std::deque<Packet::pointer> held;
+
+    // Fragmented output. Only touched while holding bufferMutex.
+    bool fragmented = false;
+    int64_t fragmentMinDuration = 0;
+    // Stream whose keyframes start fragments. -1 if there's no video,
+    // in which case any keyframe does.
+    int fragmentStream = -1;
+    uint64_t fragmentSequence = 0;
+    uint64_t fragmentOffset = 0;
+    size_t fragmentPackets = 0;
+    // Whether the current fragment has a keyframe from fragmentStream
+    bool fragmentKeyed = false;
+    int64_t fragmentStart = AV_NOPTS_VALUE;
+    int64_t fragmentEnd = AV_NOPTS_VALUE;
+
+    // Sets up context for filename and format
+    void allocateContext();
     // Write a packet to output
     void write(Packet::pointer &);
+    // Writes the header and whatever was held waiting for it
+    void writeHeader();
+    // Sends the init segment out after the header's written
+    void writeInit();
+    // Finishes the current fragment before packet if it's time to,
+    // and adds packet to the fragment timing
+    void trackFragment(const AVPacket* packet);
+    // Has mov write out the current fragment and tells everyone about it
+    void finishFragment();
     // Copy stream timing data from input stream to output stream.
     // We won't necessarily have this info when we subscribe;
     // ffmpeg frequently has to start reading packets before
@@ -39,7 +39,8 @@ namespace fr {
 
       // Destroy a packet. You can use this for a destructor
       // if you create your own shared/unique ptrs with
-      // for AVPacket.
+      // for AVPacket. The packet is unreffed and returned to
+      // the PacketPool rather than freed.
       static void destroy(AVPacket* pkt);
       
       // Define unique ptr and const ptr for same.
@@ -51,7 +52,8 @@ namespace fr {
 
       // Create an empty packet. For reading (Which is mostly
       // all we're doing for the near term) it will be filled
-      // in by the library reading the packets.
+      // in by the library reading the packets. Packets come
+      // out of the PacketPool if it has any.
       static pointer create();
 
       // Create a packet pointer to nullptr
@@ -60,7 +62,8 @@ namespace fr {
       // Copy a packet. Note that this may or may not actually copy
       // memory, depending on what LibAV feels like. What I'm
       // instructing it to do is to create a copy Ptr and then
-      // av_packet_ref the copy with the original.
+      // av_packet_ref the copy with the original. If the original
+      // isn't refcounted, its data gets copied into a pooled buffer.
       static pointer copy(const pointer& toCopy);
 
       // Returns true if this packet contains an iframe
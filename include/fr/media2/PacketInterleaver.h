@@ -0,0 +1,142 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Puts packets from several streams back in dts order, when they're
+ * coming from more than one thread. Each stream has a min-heap of
+ * packets keyed on dts (in microseconds, so streams with different
+ * time bases compare properly.) A packet is written once every stream
+ * that's still going has been seen at or past its dts, which is the
+ * watermark. So a stream that's running ahead waits for the others to
+ * catch up.
+ *
+ * A stream that goes quiet (a sparse subtitle stream, or one whose
+ * producer died) would hold everything up forever, so packets that are
+ * more than maxDelta older than the newest one are written whether
+ * everyone has caught up or not. If the quiet stream shows up again,
+ * its packets are written as soon as they're ready, which keeps them in
+ * order within their stream even if they can't go in order with
+ * everything else.
+ *
+ * Any thread can push. Whoever pushes while nobody else is writing
+ * becomes the writer and writes everything that's ready, including
+ * what other threads push while it's at it. Everyone else just queues
+ * their packet and goes back to work, so producers don't line up
+ * behind the muxer. The write function is only ever called from one
+ * thread at a time.
+ *
+ * A packet that shows up after a later packet from its own stream has
+ * already been written can't go in without breaking the stream's dts
+ * order, so it's dropped and counted as late.
+ */
+
+#pragma once
+
+extern "C" {
+#include <libavutil/rational.h>
+}
+
+#include <condition_variable>
+#include <cstdint>
+#include <fr/media2/Packet.h>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace fr::media2 {
+
+  class PacketInterleaver {
+  public:
+    using WriteFunction = std::function<void(Packet::pointer& packet)>;
+
+    struct Stats {
+      // Packets waiting right now
+      size_t queued = 0;
+      // The most that have ever been waiting
+      size_t peakQueued = 0;
+      uint64_t pushed = 0;
+      uint64_t written = 0;
+      // Dropped for showing up after their stream had moved on
+      uint64_t late = 0;
+    };
+
+    // maxDelta is in microseconds. 0 waits for quiet streams forever.
+    explicit PacketInterleaver(WriteFunction write, int64_t maxDelta = 10000000);
+    PacketInterleaver(const PacketInterleaver& copy) = delete;
+    PacketInterleaver operator=(const PacketInterleaver& copy) = delete;
+
+    // Starts waiting for stream. Streams are numbered however you like
+    // (the muxer uses the output stream index.) Pushing to a stream
+    // adds it too, but then nothing waits for it until its first packet.
+    void addStream(int stream);
+    // No more packets are coming for stream, so stop waiting for it
+    void finishStream(int stream);
+
+    // Queues packet, which has timeBase, and writes whatever is ready.
+    // If write throws, the exception comes out of whichever push or
+    // flush was doing the writing.
+    void push(int stream, Packet::pointer packet, AVRational timeBase);
+    // Writes everything that's queued, in dts order, whether it's ready
+    // or not. Waits for the current writer first.
+    void flush();
+
+    Stats stats();
+
+  private:
+    struct Entry {
+      int64_t key;
+      uint64_t sequence;
+      Packet::pointer packet;
+    };
+
+    struct StreamQueue {
+      // Min-heap on (key, sequence)
+      std::vector<Entry> heap;
+      bool active = false;
+      bool finished = false;
+      // Newest dts pushed and last one written
+      int64_t newest = INT64_MIN;
+      int64_t written = INT64_MIN;
+    };
+
+    WriteFunction write;
+    int64_t maxDelta;
+    std::mutex mutex;
+    std::condition_variable writerDone;
+    std::vector<StreamQueue> streams;
+    uint64_t sequence = 0;
+    // Oldest and newest dts pushed to any stream
+    int64_t first = INT64_MAX;
+    int64_t newest = INT64_MIN;
+    bool writing = false;
+    Stats current;
+
+    // For the heaps, which put the biggest thing on top
+    static bool later(const Entry& a, const Entry& b);
+    StreamQueue& queue(int stream);
+    // How far every stream has got. Everything at or before it is ready.
+    int64_t watermark() const;
+    // Moves ready packets (or all of them, if all is set) into batch,
+    // in dts order. Called with mutex held.
+    void take(std::vector<Packet::pointer>& batch, bool all);
+    // Writes until there's nothing left to take. Called with lock held
+    // and writing set, returns the same way.
+    void drain(std::unique_lock<std::mutex>& lock, bool all);
+  };
+
+}
+
+std::ostream& operator<<(std::ostream& o, const fr::media2::PacketInterleaver::Stats& stats);
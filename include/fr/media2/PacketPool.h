@@ -0,0 +1,126 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Recycles AVPackets and packet payload buffers so we don't have to
+ * hit the allocator for every packet that goes through a Segment.
+ *
+ * There are two parts to this. Packet shells (The AVPacket structs
+ * themselves) get returned to the pool by Packet::destroy and handed
+ * back out by Packet::create, so you don't need to do anything special
+ * to use them. Payload buffers come from a set of AVBufferPools, one
+ * per power-of-two size class. These are refcounted by LibAV and go
+ * back to their pool when the last packet referencing them is
+ * unreffed. Serialization uses these when loading packets.
+ *
+ * There's one pool per process. Packet::pointer uses a plain function
+ * pointer for its deleter, so there's nowhere to stash a per-stream
+ * pool anyway.
+ */
+
+#pragma once
+
+extern "C" {
+#include <libavcodec/packet.h>
+#include <libavutil/buffer.h>
+}
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace fr::media2 {
+
+  class PacketPool {
+  public:
+
+    // Counters for the pool. Hits are requests we satisfied from
+    // something we already had laying around, misses had to go to
+    // the allocator.
+    struct Stats {
+      uint64_t packetHits = 0;
+      uint64_t packetMisses = 0;
+      // Packets that were too many to keep and were freed instead
+      uint64_t packetDrops = 0;
+      uint64_t bufferHits = 0;
+      uint64_t bufferMisses = 0;
+      // Number of packets currently sitting in the pool
+      size_t idlePackets = 0;
+    };
+
+    // The one pool everyone uses
+    static PacketPool& instance();
+
+    PacketPool(const PacketPool& copy) = delete;
+    PacketPool operator=(const PacketPool& copy) = delete;
+
+    // Get an empty packet. You probably want Packet::create instead.
+    AVPacket* acquire();
+    // Unref a packet and keep it for later. If the pool already
+    // has maxIdle packets in it, the packet gets freed instead.
+    // You probably want Packet::destroy instead.
+    void release(AVPacket* packet);
+
+    // Get a buffer with room for at least size bytes, plus the
+    // AV_INPUT_BUFFER_PADDING_SIZE padding LibAV wants at the end of
+    // packet data (The padding is zeroed.) You own the reference;
+    // hand it to a packet's buf and it'll be cleaned up with the packet.
+    AVBufferRef* buffer(size_t size);
+
+    // Maximum number of idle packets to keep around.
+    void setMaxIdle(size_t maxIdle);
+    size_t getMaxIdle();
+
+    Stats stats();
+    void resetStats();
+
+  private:
+    PacketPool();
+    ~PacketPool();
+
+    // Smallest size class is 1 << minShift bytes, largest is
+    // 1 << maxShift bytes. Anything bigger than that gets allocated
+    // directly and counts as a miss.
+    static constexpr size_t minShift = 10;
+    static constexpr size_t maxShift = 24;
+
+    std::mutex packetMutex;
+    std::vector<AVPacket*> idle;
+    size_t maxIdle = 4096;
+
+    std::mutex bufferMutex;
+    std::array<AVBufferPool*, maxShift - minShift + 1> bufferPools{};
+
+    std::atomic<uint64_t> packetHits = 0;
+    std::atomic<uint64_t> packetMisses = 0;
+    std::atomic<uint64_t> packetDrops = 0;
+    std::atomic<uint64_t> bufferRequests = 0;
+    std::atomic<uint64_t> bufferMisses = 0;
+
+    // Returns the buffer pool for a size class, creating it if we
+    // haven't needed it yet.
+    AVBufferPool* poolFor(size_t sizeClass);
+    // Allocator for the buffer pools. LibAV only calls this when a
+    // pool is empty, so it's where we count buffer misses.
+    template<typename Size>
+    static AVBufferRef* poolAlloc(void* opaque, Size size);
+  };
+
+}
+
+std::ostream& operator<<(std::ostream& o, const fr::media2::PacketPool::Stats& stats);
@@ -28,6 +28,27 @@
  * decoded before you can do much with them, although you can tell
  * whether the packet has a key frame and a few other things based
  * on flags in the AVPacket.
+ *
+ * By default the reading thread also runs all the subscribers, so one
+ * slow subscriber holds up reading for every stream. If you turn on
+ * read-ahead, the reading thread just fills a PacketRing and separate
+ * dispatch threads hand the packets out to subscribers.
+ *
+ * Send a seek event to jump somewhere else in the source without
+ * reopening it. While playing, the reading thread does the seek before
+ * it reads its next packet, so subscribers never see packets from
+ * before and after the seek mixed up. The decoder contexts get flushed,
+ * and between the last old packet and the first new one
+ * signals.discontinuity fires and every stream forwards a
+ * StreamEvent::discontinuity. A Segmenter sends off the segment it was
+ * holding when it gets one, so no segment spans the seek.
+ *
+ * InputOptions lets you force the container format, pass demuxer
+ * options and cap how much probing gets done. Give it a ProbeCache and
+ * inputs it's seen before skip avformat_find_stream_info altogether.
+ *
+ * To demux something that's already in memory, or comes in through a
+ * pipe, give it an IOSource instead of a filename.
  */
 
 #pragma once
@@ -38,13 +59,19 @@ extern "C" {
 #include <libavutil/avutil.h>
 }
 
+#include <atomic>
 #include <boost/signals2.hpp>
 #include <boost/sml.hpp>
 #include <condition_variable>
+#include <fr/media2/DecoderConfig.h>
+#include <fr/media2/IOSource.h>
 #include <fr/media2/Packet.h>
 #include <fr/media2/PacketReaderBase.h>
+#include <fr/media2/PacketRing.h>
+#include <fr/media2/ProbeCache.h>
 #include <fr/media2/Stream.h>
 #include <fr/media2/StreamData.h>
+#include <map>
 #include <mutex>
 #include <string>
 #include <thread>
@@ -53,10 +80,39 @@ extern "C" {
 namespace fr {
   namespace media2 {
 
+    // How to open the input. The defaults are what avformat_open_input
+    // and avformat_find_stream_info do on their own.
+    struct InputOptions {
+      // Container format to use instead of guessing one (from
+      // av_find_input_format.)
+      const AVInputFormat* format = nullptr;
+      // Demuxer and protocol options, like rtsp_transport
+      std::map<std::string, std::string> options;
+      // More options, if you've already got them in a dictionary. This
+      // gets copied, so you still own it. options wins if something's
+      // in both.
+      const AVDictionary* dictionary = nullptr;
+      // Bytes and microseconds avformat_find_stream_info can read
+      // trying to figure the streams out. 0 leaves LibAV's defaults.
+      int64_t probeSize = 0;
+      int64_t analyzeDuration = 0;
+      // If set, stream info comes from here when it can, and
+      // avformat_find_stream_info only runs on a miss.
+      ProbeCache::pointer probeCache;
+    };
+
     class PacketReader : public PacketReaderBase {
     public:
 
-      PacketReader(const std::string& filename);
+      // config is used to open the decoders for each stream
+      PacketReader(const std::string& filename,
+                   const DecoderConfig& config = DecoderConfig{});
+      PacketReader(const std::string& filename, const InputOptions& input,
+                   const DecoderConfig& config = DecoderConfig{});
+      // Reads from source instead of opening a file. The reader hangs
+      // on to source until it's closed.
+      PacketReader(IOSource::pointer source, const InputOptions& input = InputOptions{},
+                   const DecoderConfig& config = DecoderConfig{});
       PacketReader(const PacketReader& copy) = delete;
       virtual ~PacketReader() override;
 
@@ -70,6 +126,10 @@ namespace fr {
         boost::signals2::signal<void()> shutdown;
         // Fired when reset is called
         boost::signals2::signal<void()> reset;
+        // Fired after a seek, before any packets from the new position
+        // go out. Gets the timestamp and stream index from the seek
+        // event.
+        boost::signals2::signal<void(int64_t timestamp, int streamIndex)> discontinuity;
       } signals;
 
       // Defined in base
@@ -80,6 +140,9 @@ namespace fr {
       state;
       // Name of the resource to open
       std::string filename;
+      // What the probe cache knows this input as. The filename, or the
+      // IOSource's cacheKey, which is empty if it can't be cached.
+      std::string probeKey;
       // Streams held here
       std::vector<Stream::pointer> streams;
       // If you want to interact with just audio or video streams,
@@ -106,22 +169,79 @@ namespace fr {
       // *Does not block*.
       void process() override;
 
+      // Turns on read-ahead. The reader will get up to packets packets
+      // (and bytes bytes, if that's not 0) ahead of the subscribers.
+      // By default one dispatch thread runs all the subscribers, so
+      // they still see packets in file order. If threadPerStream is
+      // set, each stream gets its own ring and dispatch thread, and
+      // the limits are per stream. Subscribers to more than one
+      // stream will be called from more than one thread then, so
+      // they'd better be able to handle that. packets = 0 turns
+      // read-ahead back off. Set this before you call process.
+      void setReadAhead(size_t packets, size_t bytes = 0, bool threadPerStream = false);
+      // Read-ahead stats, added up across all the rings
+      PacketRing::Stats readAheadStats();
+
     protected:
       std::thread processingThread;
       AVFormatContext *formatContext = nullptr;
+      InputOptions inputOptions;
+      DecoderConfig decoderConfig;
+      // Custom IO, if this isn't reading a file
+      IOSource::pointer ioSource;
+      AVIOContext* ioContext = nullptr;
       std::mutex pauseMutex;
       std::mutex streamMutex;
       std::condition_variable paused;
 
-      // First thing to do in opening the media source. This
-      // object owns the format.
-      // TODO: Provide methods to supply input format
-      // and an avdictionary for this function to use.
+      size_t readAheadPackets = 0;
+      size_t readAheadBytes = 0;
+      bool dispatchPerStream = false;
+      // Guards rings. The dispatch threads have their own copy of
+      // the streams, so they never need streamMutex.
+      std::mutex dispatchMutex;
+      std::vector<std::unique_ptr<PacketRing>> rings;
+      std::vector<std::thread> dispatchers;
+      std::vector<Stream::pointer> dispatchStreams;
+
+      struct SeekRequest {
+        int64_t timestamp = 0;
+        int flags = 0;
+        int streamIndex = -1;
+      };
+      // A seek waiting for the reading thread to pick it up. Guarded
+      // by seekMutex, as is reading.
+      std::mutex seekMutex;
+      SeekRequest pendingSeek;
+      std::atomic<bool> seekPending = false;
+      bool reading = false;
+
+      // First thing to do in opening the media source, with
+      // inputOptions. This object owns the format.
       bool openFormat();
+      // Sets formatContext up to read from ioSource
+      bool openSource();
+      // Fills in the stream info from the probe cache, or probes for
+      // it. Returns the avformat_find_stream_info result.
+      int findStreamInfo();
       // Opens codecs and sets up the stream vectors
       bool setupStreams();
       // Processes the file in processingThread.
       void processPrivately();
+      // Sets up rings and starts the dispatch threads if read-ahead
+      // is on
+      void startDispatch();
+      // Hands a packet to the right ring. Returns false if it
+      // couldn't, because read-ahead is shutting down.
+      bool queuePacket(Packet::pointer& packet);
+      // Runs in a dispatch thread until its ring is closed and empty
+      void dispatch(PacketRing& ring);
+      // Stops the dispatch threads. If drain is set they finish what's
+      // in the rings first, otherwise it gets dropped.
+      void stopDispatch(bool drain);
+      // Wakes up everything blocked on a ring so the reader can shut
+      // down
+      void abortDispatch();
 
       // Open kicks off opening. This is handled automatically
       // so that the streams can be set up before you try
@@ -140,6 +260,18 @@ namespace fr {
       void error(const std::string &msg) override;
       // Send eof to subscribers
       void eof() override;
+      // Seeks now if nothing is reading, otherwise leaves it for the
+      // reading thread
+      void seek(int64_t timestamp, int flags, int streamIndex) override;
+      // Does a pending seek, if there is one. Only call this from
+      // whatever is reading packets.
+      void applySeek();
+      // Seeks the format and flushes the decoders. Returns false (and
+      // sends an error) if the seek failed.
+      bool seekTo(const SeekRequest& request);
+      // Tells everyone subscribed to every stream. Only call this from
+      // whatever is reading packets, with dispatch stopped.
+      void forwardEvent(StreamEvent event);
 
       void initState();
 
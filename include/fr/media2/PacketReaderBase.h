@@ -24,6 +24,7 @@
 #pragma once
 
 #include <boost/sml.hpp>
+#include <cstdint>
 #include <iostream>
 
 namespace fr {
@@ -41,6 +42,7 @@ namespace fr {
       virtual void shutdown() = 0;
       virtual void error(const std::string &msg) = 0;
       virtual void eof() = 0;
+      virtual void seek(int64_t timestamp, int flags, int streamIndex) = 0;
       
     public:
 
@@ -69,7 +71,16 @@ namespace fr {
       struct pause{}; // Pauses packet reading
       struct eof{}; // Signals end of media file
       struct reset{}; // Closes and re-opens the source	
-      // TODO: Add seek event with timestamp
+      // Moves to timestamp without reopening anything. If streamIndex
+      // is -1, timestamp is in AV_TIME_BASE units (microseconds),
+      // otherwise it's in that stream's time base. By default it lands
+      // on the last keyframe at or before timestamp. flags are
+      // AVSEEK_FLAG_* (AVSEEK_FLAG_ANY to land on any frame.)
+      struct seek {
+	int64_t timestamp = 0;
+	int flags = 0;
+	int streamIndex = -1;
+      };
 
       // Actions
       static constexpr auto send_open_error = [](const auto &event, Sender &s) { s.owner->error(event.msg); };
@@ -78,6 +89,9 @@ namespace fr {
       static constexpr auto unpause = [](Sender &s) { s.owner->unpause(); };
       static constexpr auto send_reset = [](Sender &s) { s.owner->reset(); };
       static constexpr auto send_eof = [](Sender &s) { s.owner->eof(); };
+      static constexpr auto send_seek = [](const auto &event, Sender &s) {
+	s.owner->seek(event.timestamp, event.flags, event.streamIndex);
+      };
 	
       // machine
       struct PlayerState {
@@ -90,12 +104,15 @@ namespace fr {
 	    "opening"_s + event<open_error> / send_open_error            = X, // Failed
 	    "opened"_s + event<play> / start_processing                  = "playing"_s,
 	    "opened"_s + event<reset> / send_reset                       = "done"_s,
+	    "opened"_s + event<seek> / send_seek                         = "opened"_s,
 	    "playing"_s + event<pause>                                   = "paused"_s,
 	    "playing"_s + event<reset> / send_reset                      = "done"_s,
 	    "playing"_s + event<eof> / send_eof                          = "done"_s,
+	    "playing"_s + event<seek> / send_seek                        = "playing"_s,
 	    "paused"_s + event<play> / unpause                           = "playing"_s,
 	    "paused"_s + event<pause> / unpause                          = "playing"_s,
 	    "paused"_s + event<reset> / send_reset                       = "done"_s,
+	    "paused"_s + event<seek> / send_seek                         = "paused"_s,
 	    "done"_s + event<reset> / send_reset                         = "done"_s,
 	    "done"_s + event<open> / send_open                           = "opening"_s
 	  );
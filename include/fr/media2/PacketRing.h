@@ -0,0 +1,96 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * A fixed size ring of packets that sits between something reading
+ * packets and something handing them out to subscribers. It's bounded
+ * by a number of packets and optionally by the number of payload bytes
+ * in it, so a slow consumer can only get so far behind before the
+ * producer has to wait.
+ *
+ * It also keeps track of how full it gets and how long each side spent
+ * waiting on the other, which is handy for figuring out whether your
+ * read-ahead is too small or your subscribers are too slow.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fr/media2/Packet.h>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace fr::media2 {
+
+  class PacketRing {
+  public:
+
+    struct Stats {
+      // What's in the ring right now
+      size_t packets = 0;
+      size_t bytes = 0;
+      // The most that's ever been in it
+      size_t peakPackets = 0;
+      size_t peakBytes = 0;
+      // Number of packets that have gone through the ring
+      uint64_t pushed = 0;
+      // Time the producer spent waiting for room
+      std::chrono::nanoseconds producerStall{0};
+      // Time consumers spent waiting for packets
+      std::chrono::nanoseconds consumerStall{0};
+
+      Stats& operator+=(const Stats& other);
+    };
+
+    // maxBytes of 0 means only limit by number of packets. A packet
+    // bigger than maxBytes is still let in when the ring is empty, so
+    // it can't get stuck.
+    explicit PacketRing(size_t maxPackets, size_t maxBytes = 0);
+    PacketRing(const PacketRing& copy) = delete;
+    PacketRing operator=(const PacketRing& copy) = delete;
+
+    // Takes ownership of packet, waiting for room if the ring is full.
+    // Returns false (and leaves packet alone) if the ring has been
+    // closed or aborted.
+    bool push(Packet::pointer& packet);
+    // Waits for a packet. Returns false when the ring is closed and
+    // empty, or aborted.
+    bool pop(Packet::pointer& packet);
+    // No more packets are coming. Consumers get whatever is left.
+    void close();
+    // Drops whatever is in the ring and wakes everyone up
+    void abort();
+
+    Stats stats();
+
+  private:
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::vector<Packet::pointer> slots;
+    size_t head = 0;
+    size_t maxBytes;
+    bool closed = false;
+    Stats current;
+
+    bool hasRoom(size_t size) const;
+  };
+
+}
+
+std::ostream& operator<<(std::ostream& o, const fr::media2::PacketRing::Stats& stats);
@@ -29,11 +29,14 @@ namespace fr {
   namespace media2 {
     class PacketSubscriber {
     protected:
-      virtual void process(const Packet::pointer& packet, StreamData::pointer stream) = 0;
+      virtual void process(const Packet::pointer& packet, const StreamData::pointer& stream) = 0;
+      // Called for StreamEvents, in order with the packets. The default
+      // ignores them.
+      virtual void streamEvent(StreamEvent event, const StreamData::pointer& stream);
       // Subscription stores your subscription so you can disconnect
       // when you want to. Right now I'm assuming that most of these objects
       // will only subscribe to one thing. We'll see how long that lasts...
-      std::vector<boost::signals2::connection> subscriptions;
+      std::vector<Connection> subscriptions;
     public:
       
       using pointer = std::unique_ptr<PacketSubscriber>;
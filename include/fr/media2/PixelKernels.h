@@ -0,0 +1,91 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Hand vectorized versions of the conversions we do most, for when
+ * there's no scaling to do (or it's exactly half size) and swscale's
+ * general purpose machinery is overkill. Scaler checks here first and
+ * only sets up swscale if nothing matches.
+ *
+ * Only the yuv420p/nv12 shuffles give exactly what swscale does, so
+ * those are all find hands back unless you ask for approximate ones
+ * too. Scaler only does that if you call setApproximate on it.
+ *
+ * * yuv420p to nv12 and back, same size. These just shuffle bytes
+ *   around, so they're bit exact with swscale.
+ * * yuv420p and yuvj420p to bgr24, same size. BT.601, limited range
+ *   for yuv420p and full range for yuvj420p, with chroma shared by
+ *   each 2x2 block of pixels like swscale's unscaled converters do.
+ *   These are 16 bit fixed point, so they can be a level or two off
+ *   from swscale.
+ * * yuv420p and yuvj420p to half the width and height in the same
+ *   format, averaging each 2x2 block. That's a box filter, not the
+ *   bicubic swscale would use, which at exactly half size is about
+ *   the same picture for a fraction of the work.
+ *
+ * Every instruction set gives exactly the same output as the plain C
+ * version. Which one gets used is decided at run time from what the
+ * CPU supports (AVX2, then SSE4.1 on x86, NEON on ARM.)
+ */
+
+#pragma once
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+
+#include <functional>
+
+namespace fr::media2 {
+
+  class PixelKernels {
+  public:
+
+    enum class Isa {
+      generic,
+      sse4,
+      avx2,
+      neon
+    };
+
+    enum class Accuracy {
+      // Bit exact with swscale
+      exact,
+      // Also the bgr24 and half size kernels, which aren't
+      approximate
+    };
+
+    using Convert = std::function<void(const AVFrame* src, AVFrame* dst)>;
+
+    // Returns a conversion from src to dst, which needs to already
+    // have buffers, using the best instruction set the CPU has. Empty
+    // if there isn't one for these sizes and formats.
+    static Convert find(int srcWidth, int srcHeight, AVPixelFormat srcFormat,
+                        int dstWidth, int dstHeight, AVPixelFormat dstFormat,
+                        Accuracy accuracy = Accuracy::exact);
+    // Same thing with a particular instruction set, for tests and
+    // benchmarks. Empty if the CPU doesn't support it.
+    static Convert find(int srcWidth, int srcHeight, AVPixelFormat srcFormat,
+                        int dstWidth, int dstHeight, AVPixelFormat dstFormat, Isa isa,
+                        Accuracy accuracy = Accuracy::exact);
+
+    // The best instruction set this CPU has
+    static Isa best();
+    static bool supported(Isa isa);
+    static const char* name(Isa isa);
+  };
+
+}
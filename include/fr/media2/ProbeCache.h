@@ -0,0 +1,136 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Remembers what avformat_find_stream_info found out about an input,
+ * so the next time it's opened the PacketReader can skip probing. For
+ * MPEG-TS and network inputs, probing means reading and decoding a few
+ * seconds of data before the first packet goes anywhere, which is most
+ * of the time it takes to start a job.
+ *
+ * Entries are keyed by the input's path, size and modification time,
+ * or by a hash of its first few bytes and its size if you'd rather
+ * not trust mtimes. Inputs that aren't local files (URLs) aren't
+ * cached unless you turn on cacheUrls, in which case they're keyed by
+ * the URL alone. That's only safe if whatever is at the URL always
+ * has the same streams.
+ *
+ * Each entry has the codec parameters (stored with Serialization.h),
+ * time bases and frame rates of every stream. If you give the cache a
+ * directory, entries are saved there too (one file each), so they
+ * survive a restart and can be shared between processes.
+ *
+ * A cached entry is only used if the input opens up with the same
+ * number of streams, of the same types, as the entry. Otherwise the
+ * input is probed as usual and the entry replaced.
+ */
+
+#pragma once
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fr::media2 {
+
+  class ProbeCache {
+  public:
+    using pointer = std::shared_ptr<ProbeCache>;
+
+    enum class Key {
+      // Path, size and modification time
+      fileStat,
+      // Hash of the first hashBytes of the file, and its size
+      contentHash
+    };
+
+    struct Settings {
+      Key key = Key::fileStat;
+      size_t hashBytes = 1024 * 1024;
+      // Cache inputs that aren't local files by their URL
+      bool cacheUrls = false;
+    };
+
+    struct Stats {
+      uint64_t hits = 0;
+      uint64_t misses = 0;
+      uint64_t stores = 0;
+    };
+
+    // Just in memory
+    ProbeCache();
+    // Also saved in directory
+    explicit ProbeCache(const std::filesystem::path& directory);
+    ProbeCache(const std::filesystem::path& directory, const Settings& settings);
+    ProbeCache(const ProbeCache& copy) = delete;
+    ProbeCache operator=(const ProbeCache& copy) = delete;
+
+    // Fills in the streams of a context avformat_open_input just
+    // opened from the cache. Returns false if there's nothing usable
+    // cached for url, in which case you have to probe it yourself.
+    bool apply(const std::string& url, AVFormatContext* context);
+    // Saves what avformat_find_stream_info found out about url
+    void store(const std::string& url, const AVFormatContext* context);
+    // Forgets about url
+    void remove(const std::string& url);
+
+    // What url is cached under. Empty if it can't be cached.
+    std::string key(const std::string& url) const;
+
+    Stats stats();
+
+  private:
+    struct StreamEntry {
+      std::unique_ptr<AVCodecParameters, void(*)(AVCodecParameters*)> parameters{nullptr, &freeParameters};
+      AVRational time_base = {0, 1};
+      AVRational avg_frame_rate = {0, 1};
+      AVRational r_frame_rate = {0, 1};
+      int64_t start_time = AV_NOPTS_VALUE;
+      int64_t duration = AV_NOPTS_VALUE;
+    };
+
+    struct Entry {
+      std::string key;
+      int64_t start_time = AV_NOPTS_VALUE;
+      int64_t duration = AV_NOPTS_VALUE;
+      int64_t bit_rate = 0;
+      std::vector<StreamEntry> streams;
+    };
+
+    static constexpr uint32_t version = 1;
+
+    std::filesystem::path directory;
+    Settings settings;
+    std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<const Entry>> entries;
+    Stats current;
+
+    static void freeParameters(AVCodecParameters* parameters);
+    // Where an entry lives in directory
+    std::filesystem::path entryPath(const std::string& key) const;
+    std::shared_ptr<const Entry> find(const std::string& key);
+    std::shared_ptr<const Entry> load(const std::string& key) const;
+    void save(const Entry& entry) const;
+  };
+
+}
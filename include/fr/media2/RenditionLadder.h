@@ -0,0 +1,188 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Encodes several renditions of one video stream from a single decode.
+ * Subscribe it to a Decoder and give it a list of renditions, biggest
+ * first (say 1080p and 720p for a 4K source.) Each rendition is scaled
+ * from the one before it rather than from the source, so the 720p
+ * scale works from a 1080p frame instead of a 4K one.
+ *
+ * Every rendition has its own thread, which scales its frame, hands it
+ * to the next rendition down and then encodes it, so the encoders all
+ * run at the same time. Each thread has a small queue of frames in
+ * front of it. If an encoder falls behind, its queue fills up and
+ * everything above it (eventually the decoder) waits for it.
+ *
+ * Each rendition comes out as a Stream whose StreamData is named after
+ * the rendition ("720p" unless you name it something else) and has the
+ * encoded parameters in it. Subscribe a Segmenter to it if you want
+ * segments you can publish, or a Muxer if you want a file.
+ *
+ * A Muxer copies the parameters and time_base when you subscribe it,
+ * so they have to be there by then. When the ladder is subscribed to
+ * something that already knows the source size and time base (a
+ * Decoder does), the sizes are worked out and the encoders opened
+ * right then. Otherwise that waits for the first frame, so don't hand
+ * the streams to a Muxer until isConfigured() says it's happened.
+ *
+ * Frames that were keyframes in the source are forced to keyframes in
+ * every rendition, so segments from different renditions line up.
+ *
+ * Renditions that are not smaller than the source are skipped, so a
+ * 1080p source with a 1080p/720p ladder only gets a 720p rendition.
+ * A skipped rendition's stream just never sends any packets.
+ */
+
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/pixfmt.h>
+#include <libswscale/swscale.h>
+}
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fr/media2/Frame.h>
+#include <fr/media2/FrameSource.h>
+#include <fr/media2/FrameSubscriber.h>
+#include <fr/media2/Packet.h>
+#include <fr/media2/Stream.h>
+#include <fr/media2/WorkQueue.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fr::media2 {
+
+  class RenditionLadder : public FrameSubscriber {
+  public:
+
+    struct Rendition {
+      // -1 for one of these keeps the source aspect ratio
+      int width = -1;
+      int height = -1;
+      // Name of the stream data. Defaults to the output height with a p
+      // on it, which for a rendition with only a width is filled in
+      // once the source size is known.
+      std::string name;
+      std::string codec = "libx264";
+      AVPixelFormat format = AV_PIX_FMT_YUV420P;
+      // 0 leaves it up to the encoder
+      int64_t bitRate = 0;
+      // Encoder private options, like preset or crf for x264
+      std::map<std::string, std::string> options;
+      // 0 lets the encoder decide
+      int encoderThreads = 0;
+    };
+
+    // 1080p and 720p, which is what the transcoder demo wants
+    static std::vector<Rendition> hd();
+
+    // queueDepth is the number of frames that can be waiting for each
+    // rendition's thread.
+    explicit RenditionLadder(const std::vector<Rendition>& renditions, size_t queueDepth = 8);
+    ~RenditionLadder() override;
+    RenditionLadder(const RenditionLadder& copy) = delete;
+    RenditionLadder operator=(const RenditionLadder& copy) = delete;
+
+    void subscribeCallback(FrameSource* source) override;
+
+    size_t size() const;
+    const Rendition& rendition(size_t index) const;
+    // Packets for a rendition come out of this stream, from that
+    // rendition's thread.
+    Stream::pointer stream(size_t index) const;
+    // Whether the source size is known and the renditions are sized,
+    // named and have their encoders open, so the streams have their
+    // parameters and time_base
+    bool isConfigured() const;
+    // Whether a rendition is being encoded. Everything is until the
+    // first frame shows up and the source size is known.
+    bool active(size_t index) const;
+
+    // Drains all the encoders and waits for the last packets to come
+    // out. This is the end of the stream; frames after it are dropped.
+    void flush();
+    // Stops the rendition threads without draining the encoders
+    void close();
+
+    // Number of frames that couldn't be scaled or encoded
+    uint64_t failures() const;
+
+  protected:
+
+    void process(Frame::const_pointer frame, const StreamData::pointer& stream) override;
+
+  private:
+
+    struct Job {
+      // A null frame means flush
+      Frame::pointer frame = Frame::pointer{nullptr, &Frame::destroy};
+    };
+
+    struct Rung {
+      Rendition settings;
+      Stream::pointer stream = std::make_shared<Stream>();
+      const AVCodec* codec = nullptr;
+      WorkQueue<Job> queue;
+      std::thread thread;
+      // Worked out from the source on the first frame
+      int width = -1;
+      int height = -1;
+      bool active = true;
+      Rung* next = nullptr;
+      std::unique_ptr<SwsContext, decltype(&sws_freeContext)> scaler{nullptr, &sws_freeContext};
+      Packet::pointer workingPacket = Packet::create();
+
+      Rung(const Rendition& settings, size_t queueDepth) : settings(settings), queue(queueDepth) {}
+    };
+
+    std::vector<std::unique_ptr<Rung>> rungs;
+    // The first rendition that's being encoded. Null until the first
+    // frame, or if all of them were skipped.
+    Rung* first = nullptr;
+    // Set from whichever thread subscribes or sends frames, and read
+    // from the rest
+    std::atomic<bool> configured = false;
+    std::atomic<bool> flushed = false;
+    AVRational time_base = {0,0};
+    AVRational avg_frame_rate = {0,0};
+
+    std::mutex drainMutex;
+    std::condition_variable drainedCondition;
+    size_t drained = 0;
+    size_t activeRungs = 0;
+
+    std::atomic<uint64_t> failed = 0;
+
+    // Works out sizes, names and which rungs are running from the
+    // source size, and opens the encoders
+    void configure(int sourceWidth, int sourceHeight, AVRational sampleAspectRatio);
+    // Makes a fresh StreamData for the rung, named after it
+    void setData(Rung* rung);
+    void run(Rung* rung);
+    Frame::pointer scale(Rung* rung, Frame::pointer input);
+    void openEncoder(Rung* rung, AVRational sampleAspectRatio);
+    void encode(Rung* rung, AVFrame* frame);
+    void finish(Rung* rung);
+  };
+
+}
@@ -15,8 +15,11 @@
  *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
  *
  * An audio resampler. Can convert bitrates, formats et al.
+ * Output frames come from FramePool, a new one for every frame.
  */
 
+#pragma once
+
 extern "C" {
 #include <libavutil/opt.h>
 #include <libavutil/channel_layout.h>
@@ -24,9 +27,10 @@ extern "C" {
 #include <libswresample/swresample.h>  
 }
 
-
-
-#pragma once
+#include <cstdint>
+#include <fr/media2/Frame.h>
+#include <fr/media2/FrameSubscriber.h>
+#include <fr/media2/Signal.h>
 
 namespace fr {
   namespace media2 {
@@ -35,8 +39,8 @@ namespace fr {
     public:
       // Resampler outputs a frame that a frame subscriber can
       // subscribe to, via boost signal.
-      boost::signals2::signal<void(Frame::const_pointer,
-				   StreamData::pointer)> frames;
+      Signal<void(Frame::const_pointer,
+				   const StreamData::pointer&)> frames;
       
       // Specify the output format you want (Channel layout,
       // sample format and rate. When we receive the first frame,
@@ -48,17 +52,19 @@ namespace fr {
       virtual ~Resampler() override;
 
     protected:
-      Frame::pointer workingFrame;
+      int64_t layout;
+      AVSampleFormat format;
+      int rate;
       SwrContext *context = nullptr;
-      int maxSamples = 0;
-      
+      // pts of the next frame out, in samples
+      int64_t nextPts = 0;
       
-      // Sets up sws context the first time process handles
+      // Sets up swr context the first time process handles
       // a frame.
       void init(Frame::const_pointer);
       
       void process(Frame::const_pointer,
-                   StreamData::pointer) override;
+                   const StreamData::pointer&) override;
 
 
     };
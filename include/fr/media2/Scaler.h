@@ -17,6 +17,21 @@
  * Rescales video frames. This can change the frame resolution or pixel
  * format. This object is not designed to handle changes to input
  * resolution. That gets set when the first frame is passsed into it.
+ *
+ * Every output frame is a new one from FramePool, so a subscriber that
+ * wants to hang on to one can just Frame::clone it rather than copying
+ * the image before the next frame overwrites it.
+ *
+ * Give it more than one thread and it scales each frame in bands on
+ * that many threads (see SliceScaler.) That's worth it for big frames,
+ * like 4K down to 1080p. For small ones the threads mostly get in each
+ * other's way.
+ *
+ * Conversions PixelKernels has a bit exact fast path for (yuv420p to
+ * nv12 and back at the same size) skip swscale entirely. Call
+ * setApproximate to use its other kernels too (yuvj420p to bgr24, and
+ * halving with a box filter instead of bicubic), which are faster but
+ * don't give exactly the same pixels.
  */
 
 #pragma once
@@ -27,36 +42,62 @@ extern "C" {
 #include <libswscale/swscale.h>
 }
 
-#include <boost/signals2.hpp>
+#include <fr/media2/Signal.h>
 #include <fr/media2/Frame.h>
 #include <fr/media2/FrameSubscriber.h>
+#include <fr/media2/PixelKernels.h>
+#include <fr/media2/SliceScaler.h>
+#include <memory>
 
 namespace fr {
   namespace media2 {
     class Scaler : public FrameSubscriber {
     public:
 
-      boost::signals2::signal<void(Frame::const_pointer,
-	StreamData::pointer)> frames;
+      Signal<void(Frame::const_pointer,
+	const StreamData::pointer&)> frames;
       
       // Pass desired width, height and pixel format
       // in. If you want the same pixel format as the
       // source, use AV_PIX_FMT_NONE. If you want the
       // same resolution as the source, set width and
-      // height to -1.
-      Scaler(int width, int height, AVPixelFormat fmt = AV_PIX_FMT_NONE);
+      // height to -1. threads is how many threads scale each frame
+      // (0 for one per core) and bandHeight is how many output rows
+      // each of them does at a time (0 to split the frame evenly.)
+      Scaler(int width, int height, AVPixelFormat fmt = AV_PIX_FMT_NONE,
+	     int threads = 1, int bandHeight = 0);
       ~Scaler();
       Scaler(const Scaler &copy) = delete;
       Scaler operator=(const Scaler &copy) = delete;
 
+      // Works out an output size for a srcWidth x srcHeight source.
+      // -1 for both keeps the source size. If just one of them is -1,
+      // it's worked out from the other to keep the aspect ratio (and
+      // kept even, since most encoders want that for 4:2:0)
+      static void fitSize(int srcWidth, int srcHeight, int& width, int& height);
+
+      // Lets the approximate PixelKernels be used. Has to be called
+      // before the first frame.
+      void setApproximate(bool approximate = true);
+
     protected:
 
       void process(Frame::const_pointer frame,
-		   StreamData::pointer stream) override;
+		   const StreamData::pointer& stream) override;
       
     private:
       SwsContext *context = nullptr;
-      Frame::pointer outputFrame = Frame::create();
+      int width;
+      int height;
+      AVPixelFormat format;
+      int threads;
+      int bandHeight;
+      // Set up instead of context if we're using more than one thread
+      std::unique_ptr<SliceScaler> slices;
+      // Or this, if there's a fast path for the conversion
+      PixelKernels::Convert fast;
+      PixelKernels::Accuracy accuracy = PixelKernels::Accuracy::exact;
+      bool configured = false;
       
     };
   }
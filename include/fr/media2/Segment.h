@@ -62,6 +62,9 @@ namespace fr::media2 {
     // get recycled as soon as append returns,
     // corrupting the memory in our buffer.
     void append(const Packet::pointer& packet);
+    // Takes ownership of a packet you're done with, so nothing
+    // needs to be copied.
+    void append(Packet::pointer&& packet);
 
     // Returns true if there are no packets in this segment.
     bool empty();
@@ -112,10 +115,11 @@ namespace fr::media2 {
       ar >> parameters;
       size_t pkts;
       ar >> pkts;
+      packets.reserve(packets.size() + pkts);
       for (int i = 0; i < pkts; ++i) {
 	Packet::pointer pkt = Packet::create();
 	ar >> *pkt;
-	append(pkt);
+	append(std::move(pkt));
       }
     }
 
@@ -0,0 +1,335 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Packages segments from a pair of Segmenters (one video, one audio)
+ * for HLS and/or DASH. Each segment that comes in is written out as
+ * one TS or fragmented MP4 media segment, and the playlists are
+ * updated to list it.
+ *
+ * There's one muxer context per track and it lives as long as the
+ * packager does. For fMP4 the header (the init segment) is written
+ * once and every segment after that is just a moof and mdat, flushed
+ * through a ChunkSink straight into the output. For TS the context
+ * keeps its continuity counters going and is told to send the PAT and
+ * PMT again at the start of each segment. Nothing gets set up again
+ * for each segment.
+ *
+ * Audio segments from a Segmenter are a fixed number of packets, so
+ * they don't line up with the video ones. If the packager has both, it
+ * cuts audio where the video segments end, so segment N of each track
+ * covers the same time. The audio for a segment goes out once audio
+ * shows up past the end of the video segment.
+ *
+ * That only holds while the audio is continuous. If a video segment
+ * has no audio at all in it, there's nothing to write for the audio
+ * track, and it doesn't skip a number either ($Number$ in the DASH
+ * template has to count up by one), so from then on audio segment N
+ * is later than video segment N. Players go by the times in the
+ * playlists, so this only matters if you pair segments up by number.
+ *
+ * The muxing and writing happen on a PackagerPool. Each track sticks
+ * to one of the pool's threads, so its segments are written in order,
+ * but different tracks and different channels are written at the same
+ * time. Share one pool between all the channels on a box. The pool's
+ * queues are bounded, so if the output can't keep up, the segmenters
+ * end up waiting for it.
+ *
+ * Files are named after settings.name. With the default of "stream":
+ *
+ *   stream.m3u8                 HLS master playlist
+ *   stream_video.m3u8           HLS media playlist for each track
+ *   stream_video_init.mp4       fMP4 init segment for each track
+ *   stream_video_12.m4s         media segments (.ts for TS)
+ *   stream.mpd                  DASH manifest
+ *
+ * Video and audio are separate renditions (audio is an EXT-X-MEDIA
+ * group in HLS and its own AdaptationSet in DASH), for TS as well as
+ * fMP4. The codec parameters are taken from the first segment of each
+ * track and aren't expected to change.
+ */
+
+#pragma once
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/rational.h>
+}
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fr/media2/IOSink.h>
+#include <fr/media2/Segment.h>
+#include <fr/media2/SegmentSubscriber.h>
+#include <fr/media2/StreamData.h>
+#include <fr/media2/UuidKey.h>
+#include <fr/media2/WorkQueue.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace fr::media2 {
+
+  // Where the packager puts its files. put and remove get called from
+  // the pool's threads, several at a time, but never for the same name
+  // at the same time.
+  class PackageOutput {
+  public:
+    using pointer = std::shared_ptr<PackageOutput>;
+
+    virtual ~PackageOutput() = default;
+
+    // Stores a whole file, replacing whatever had that name before.
+    // data is only good until this returns.
+    virtual void put(const std::string& name, std::span<const uint8_t> data) = 0;
+    // Deletes a segment that's dropped out of the playlists
+    virtual void remove(const std::string& name) = 0;
+  };
+
+  // Keeps the files in memory, for serving them straight out of the
+  // process
+  class MemoryOutput : public PackageOutput {
+  public:
+    using File = std::shared_ptr<const std::vector<uint8_t>>;
+
+    void put(const std::string& name, std::span<const uint8_t> data) override;
+    void remove(const std::string& name) override;
+
+    // Null if there's no such file. Replacing or removing the file
+    // doesn't change the one you already have.
+    File get(const std::string& name) const;
+    std::vector<std::string> names() const;
+
+  private:
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, File> files;
+  };
+
+  // Writes files to a directory. Each one is written to a temp file and
+  // renamed into place, so a web server serving the directory never
+  // hands out half a playlist.
+  class DirectoryOutput : public PackageOutput {
+  public:
+    explicit DirectoryOutput(const std::filesystem::path& directory);
+
+    void put(const std::string& name, std::span<const uint8_t> data) override;
+    void remove(const std::string& name) override;
+
+    const std::filesystem::path& path() const;
+
+  private:
+    std::filesystem::path directory;
+  };
+
+  // Threads to package on. Work posted with the same key always runs
+  // on the same thread, in the order it was posted.
+  class PackagerPool {
+  public:
+    using pointer = std::shared_ptr<PackagerPool>;
+
+    // 0 threads uses one per core. queueCapacity is how much work can
+    // be waiting for each thread before post blocks (0 for no limit.)
+    explicit PackagerPool(int nThreads = 0, size_t queueCapacity = 64);
+    ~PackagerPool();
+    PackagerPool(const PackagerPool& copy) = delete;
+    PackagerPool operator=(const PackagerPool& copy) = delete;
+
+    // Returns false if the pool is closed, in which case work doesn't run
+    bool post(size_t key, std::function<void()> work);
+    // Finishes what's queued and stops the threads
+    void close();
+    size_t size() const;
+
+  private:
+    struct Worker {
+      WorkQueue<std::function<void()>> queue;
+      std::thread thread;
+
+      explicit Worker(size_t capacity) : queue(capacity) {}
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+  };
+
+  class SegmentPackager : public SegmentSubscriber {
+  public:
+
+    enum class Container {
+      ts,
+      fmp4
+    };
+
+    struct Settings {
+      Container container = Container::fmp4;
+      bool hls = true;
+      // DASH needs fmp4
+      bool dash = false;
+      // Tracks to expect. The master playlist isn't written until
+      // every one of them has a segment, and audio is only cut on the
+      // video segments if there's video.
+      bool video = true;
+      bool audio = true;
+      // Base name for all the files
+      std::string name = "stream";
+      // Segments listed in the playlists. 0 lists every segment and
+      // never deletes any, for an event you want to keep.
+      size_t window = 6;
+      // Segments that have dropped out of the window are kept this much
+      // longer before they're deleted, for players that loaded the
+      // playlist just before they dropped out of it
+      size_t linger = 2;
+      // Number of the first segment in each track
+      uint64_t firstSequence = 0;
+    };
+
+    // If you don't give it a pool, it makes a one thread pool of its own
+    SegmentPackager(const Settings& settings, PackageOutput::pointer output,
+                    PackagerPool::pointer pool = nullptr);
+    ~SegmentPackager() override;
+    SegmentPackager(const SegmentPackager& copy) = delete;
+    SegmentPackager operator=(const SegmentPackager& copy) = delete;
+
+    // From a Segmenter. The segment is copied.
+    void process(const Segment::pointer&, StreamData::pointer) override;
+    // Takes ownership of a segment to package. It needs its time_base.
+    void receive(Segment::pointer segment);
+
+    // The end of the stream. Flush the segmenters first. Packages the
+    // audio that's left, waits for everything to be written and ends
+    // the playlists. Segments after this are ignored.
+    void flush();
+    // Waits until everything received so far has been written
+    void wait();
+    // Waits for what's been received and shuts down, without ending
+    // the playlists
+    void close();
+
+    // Media segments written (not counting init segments)
+    uint64_t segments() const;
+    // Bytes of media segments written
+    uint64_t bytes() const;
+    // Segments that couldn't be written. These are dropped (with a
+    // message to cerr) and left out of the playlists.
+    uint64_t failures() const;
+
+  private:
+
+    // One segment in a playlist. Times are in the track's time base,
+    // counting from the start of its first segment.
+    struct Entry {
+      uint64_t sequence = 0;
+      int64_t start = 0;
+      int64_t duration = 0;
+      size_t bytes = 0;
+      std::string name;
+    };
+
+    struct Track {
+      // These are set when the track is created and don't change
+      AVMediaType type = AVMEDIA_TYPE_UNKNOWN;
+      std::string label;
+      UuidKey jobId;
+      size_t key = 0;
+
+      // Only the track's pool thread touches these
+      AVFormatContext* context = nullptr;
+      AVIOContext* io = nullptr;
+      std::unique_ptr<ChunkSink> sink;
+      // Where the next chunk out of the sink goes
+      std::string chunkName;
+      size_t chunkBytes = 0;
+      int64_t firstDts = AV_NOPTS_VALUE;
+
+      // Only touched on the receiving side, under receiveMutex
+      uint64_t nextSequence = 0;
+
+      // Playlist state, under manifestMutex
+      std::deque<Entry> entries;
+      std::deque<std::string> expired;
+      AVRational timeBase = {0, 0};
+      std::string codecs;
+      int width = 0;
+      int height = 0;
+      int sampleRate = 0;
+      int64_t bandwidth = 0;
+      int64_t targetDuration = 1;
+      bool started = false;
+      bool ended = false;
+    };
+
+    Settings settings;
+    PackageOutput::pointer output;
+    PackagerPool::pointer pool;
+    bool ownPool = false;
+
+    std::mutex receiveMutex;
+    std::unique_ptr<Track> video;
+    std::unique_ptr<Track> audio;
+    bool flushed = false;
+    // End of each video segment whose audio hasn't been cut yet, in
+    // the video time base
+    std::deque<int64_t> boundaries;
+    AVRational videoTimeBase = {0, 0};
+    AVRational audioTimeBase = {0, 0};
+    std::deque<Packet::pointer> pendingAudio;
+    // Audio segments are cut from this
+    Segment::pointer audioTemplate;
+
+    std::mutex manifestMutex;
+    // Wall clock time of media time 0, for the MPD
+    double availabilityStart = 0.0;
+    std::string lastMaster;
+
+    std::mutex pendingMutex;
+    std::condition_variable idle;
+    size_t pending = 0;
+
+    std::atomic<uint64_t> written = 0;
+    std::atomic<uint64_t> writtenBytes = 0;
+    std::atomic<uint64_t> failed = 0;
+
+    Track* track(std::unique_ptr<Track>& slot, const Segment& segment, const std::string& label);
+    // Cuts audio segments up to the video boundaries that audio has
+    // reached. At the end, cuts everything that's left.
+    void cutAudio(bool end);
+    void post(Track* track, std::function<void()> work);
+    void done();
+
+    // These run on the track's pool thread
+    void open(Track* track, const Segment& segment);
+    void write(Track* track, uint64_t sequence, Segment& segment);
+    void finish(Track* track);
+    void freeTrack(Track* track);
+
+    // These want manifestMutex
+    void writeManifests(const Track* changed);
+    std::string mediaPlaylist(const Track* track) const;
+    std::string masterPlaylist() const;
+    std::string mpd() const;
+
+    std::string segmentName(const Track* track, uint64_t sequence) const;
+    std::string initName(const Track* track) const;
+    std::string playlistName(const Track* track) const;
+  };
+
+}
@@ -0,0 +1,40 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Anything that produces segments. SegmentSubscribers can subscribe
+ * to any of these, the same way FrameSubscribers subscribe to a
+ * FrameSource.
+ */
+
+#pragma once
+
+#include <boost/signals2.hpp>
+#include <fr/media2/Segment.h>
+#include <fr/media2/StreamData.h>
+
+namespace fr::media2 {
+
+  class SegmentSource {
+  public:
+    SegmentSource() = default;
+    virtual ~SegmentSource() = default;
+    SegmentSource(const SegmentSource& copy) = delete;
+
+    // Boost signal for segments
+    boost::signals2::signal<void(const Segment::pointer &segment, StreamData::pointer stream)> segments;
+  };
+
+}
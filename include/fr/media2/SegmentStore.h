@@ -0,0 +1,229 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Stores segments on disk without making a file for every one of
+ * them. Each stream gets a directory (named after its uuid) under the
+ * store's root with two files in it:
+ *
+ *   segments.log is every segment in the stream, in the SegmentWire
+ *   layout, one after the other. It's only ever appended to.
+ *
+ *   segments.idx is a small header and then one IndexEntry per segment
+ *   (dts, pts, where it is in the log and whether it starts with a
+ *   keyframe.) The entries are fixed size and in dts order, so you can
+ *   mmap the file and binary search it, which is what SegmentIndex does.
+ *
+ * Nothing has to be deserialized to store a segment. The dts and pts
+ * come out of the fixed SegmentWire header.
+ *
+ * Appends go straight into the log (with writev, out of the packet
+ * buffers) but don't wait for the disk. A committer thread syncs the
+ * logs every so often, or once enough has been written, and only then
+ * writes the index entries for what it synced and syncs the indexes.
+ * So one fsync covers however many segments showed up in the meantime,
+ * and the index never points at anything that isn't on disk. If the
+ * process dies, anything in the log past the last indexed segment gets
+ * truncated away the next time the stream is opened.
+ *
+ * Segments for a stream have to arrive in dts order. Ones that don't
+ * (including repeats of a segment that's already stored) are dropped.
+ */
+
+#pragma once
+
+extern "C" {
+#include <libavutil/rational.h>
+}
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fr/media2/Segment.h>
+#include <fr/media2/UuidKey.h>
+#include <memory>
+#include <mutex>
+#include <sys/uio.h>
+#include <thread>
+#include <unordered_map>
+#include <uuid.h>
+#include <vector>
+
+namespace fr::media2 {
+
+  class SegmentStore {
+  public:
+    static constexpr char magic[4] = {'F', 'R', 'S', 'I'};
+    static constexpr uint32_t version = 1;
+
+    // Start of segments.idx
+    struct IndexHeader {
+      char magic[4];
+      uint32_t version;
+      int32_t timeBaseNum;
+      int32_t timeBaseDen;
+    };
+
+    struct IndexEntry {
+      // Set in flags if the segment starts with a keyframe
+      static constexpr uint32_t keyframe = 1;
+
+      int64_t dts;
+      int64_t pts;
+      // Where the segment is in segments.log
+      uint64_t offset;
+      uint32_t length;
+      uint32_t flags;
+
+      bool key() const { return flags & keyframe; }
+    };
+    static_assert(sizeof(IndexHeader) == 16 && sizeof(IndexEntry) == 32,
+                  "The index layout is on disk, so it can't change size");
+
+    struct Settings {
+      // Commit once this many bytes have been appended since the last one
+      size_t commitBytes = 8 * 1024 * 1024;
+      // or once the oldest uncommitted segment is this old
+      std::chrono::milliseconds commitInterval{250};
+      // Set this false to skip the fsyncs. Segments still only get
+      // indexed on commit, but a crash can lose things the index
+      // says are there (those get dropped when the stream is opened.)
+      bool sync = true;
+    };
+
+    explicit SegmentStore(const std::filesystem::path& root);
+    SegmentStore(const std::filesystem::path& root, const Settings& settings);
+    // Commits anything outstanding
+    ~SegmentStore();
+    SegmentStore(const SegmentStore& copy) = delete;
+    SegmentStore operator=(const SegmentStore& copy) = delete;
+
+    // Appends a segment to the log for its job ID, writing straight
+    // out of its packets. Returns false if it was out of order.
+    bool append(const Segment& segment);
+    // Appends a segment that's already in the contiguous SegmentWire
+    // layout (like receivedSegment gives you.)
+    bool append(const uuid_t stream, const uint8_t* data, size_t size);
+
+    // Waits until everything appended so far is on disk and indexed
+    void commit();
+    // Commits and stops the committer thread. Appends after this throw.
+    void close();
+
+    // Finds the segment that contains dts, which is the last one that
+    // starts at or before it. Returns false if the stream has nothing
+    // that early. Only finds committed segments.
+    bool find(const uuid_t stream, int64_t dts, IndexEntry& entry);
+    // Number of committed segments in the stream
+    size_t size(const uuid_t stream);
+    // Reads a segment back out of the log. Its packets all point into
+    // one buffer.
+    Segment::pointer load(const uuid_t stream, const IndexEntry& entry);
+
+    // Number of times the committer has synced anything
+    uint64_t commits() const;
+
+    const std::filesystem::path& root() const;
+    std::filesystem::path streamDir(const uuid_t stream) const;
+    static std::filesystem::path logPath(const std::filesystem::path& streamDir);
+    static std::filesystem::path indexPath(const std::filesystem::path& streamDir);
+
+  private:
+    struct StreamFiles {
+      std::mutex mutex;
+      int log = -1;
+      int index = -1;
+      uint64_t logSize = 0;
+      // Every segment in the stream. The first `committed` of them
+      // are in the index file.
+      std::vector<IndexEntry> entries;
+      size_t committed = 0;
+
+      ~StreamFiles();
+    };
+
+    std::filesystem::path rootDir;
+    Settings settings;
+
+    std::mutex streamsMutex;
+    std::unordered_map<UuidKey, std::unique_ptr<StreamFiles>, UuidKeyHash> streams;
+
+    std::mutex commitMutex;
+    std::condition_variable commitWanted;
+    std::condition_variable committed;
+    size_t pendingBytes = 0;
+    std::chrono::steady_clock::time_point oldestPending;
+    uint64_t requested = 0;
+    uint64_t finished = 0;
+    bool closing = false;
+    bool closed = false;
+    std::atomic<uint64_t> commitCount = 0;
+    std::thread committer;
+
+    // Opens (or recovers) a stream's files. Creates them if create is
+    // set, otherwise returns null for a stream that isn't there.
+    StreamFiles* open(const uuid_t stream, AVRational timeBase, bool create);
+    // Writes a segment's bytes to the end of the log and records it
+    bool write(const uuid_t stream, AVRational timeBase, IndexEntry entry,
+               const iovec* iov, size_t iovcnt);
+    void pending(size_t bytes);
+    void runCommitter();
+    void commitStreams();
+  };
+
+  // Read only view of a stream's segments.idx. It's mmapped, so opening
+  // one doesn't read the whole thing, and lookups only touch the pages
+  // the binary search lands on. It's fine to have one open while a
+  // SegmentStore is appending to the stream; call refresh to pick up
+  // whatever has been committed since.
+  class SegmentIndex {
+  public:
+    using IndexEntry = SegmentStore::IndexEntry;
+
+    // Takes the stream directory or the index file itself
+    explicit SegmentIndex(const std::filesystem::path& path);
+    ~SegmentIndex();
+    SegmentIndex(const SegmentIndex& copy) = delete;
+    SegmentIndex operator=(const SegmentIndex& copy) = delete;
+
+    size_t size() const;
+    bool empty() const;
+    const IndexEntry& operator[](size_t index) const;
+    AVRational timeBase() const;
+
+    // Position of the segment containing dts (the last one starting at
+    // or before it), or size() if everything starts after it.
+    size_t find(int64_t dts) const;
+    // Position of the first segment starting at or after dts
+    size_t lowerBound(int64_t dts) const;
+
+    // Remaps the file if it's grown. Returns true if there are new entries.
+    bool refresh();
+
+  private:
+    std::filesystem::path path;
+    int fd = -1;
+    const uint8_t* map = nullptr;
+    size_t mapSize = 0;
+    size_t count = 0;
+    AVRational time_base = {0, 1};
+
+    const IndexEntry* entries() const;
+    void unmap();
+  };
+
+}
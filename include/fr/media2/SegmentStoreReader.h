@@ -0,0 +1,127 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Plays back a stream that a SegmentStore wrote. Point it at the
+ * stream's directory (<store root>/<stream id>) and ask it for a time
+ * range, and it sends the packets for that range out of a Stream, just
+ * like a PacketReader or SegmentUnpacker would. So you can subscribe a
+ * Muxer or a Decoder to it and not care where the packets came from.
+ *
+ * Finding the range is a binary search of the mmapped index. The log
+ * is mmapped too, and the packets point straight into the mapping, so
+ * nothing gets copied. The mapping sticks around until the last packet
+ * that points into it is gone.
+ *
+ * While the packets for one segment are going out, a prefetch thread
+ * is faulting in and decoding the next few, so a long replay isn't
+ * waiting on the disk a segment at a time.
+ *
+ * Replay always starts at the beginning of the segment containing
+ * start (which is a keyframe for video) so a decoder has what it needs.
+ * Packets with a dts of end or later aren't sent.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fr/media2/Segment.h>
+#include <fr/media2/SegmentStore.h>
+#include <fr/media2/Stream.h>
+#include <fr/media2/StreamCache.h>
+#include <fr/media2/WorkQueue.h>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace fr::media2 {
+
+  class SegmentStoreReader {
+  public:
+    // prefetch is how many segments the prefetch thread gets ahead
+    explicit SegmentStoreReader(const std::filesystem::path& streamDir, size_t prefetch = 8);
+    // Gets the stream from cache, so it's the same stream a
+    // SegmentUnpacker sharing the cache would use for this job.
+    SegmentStoreReader(const std::filesystem::path& streamDir, std::shared_ptr<StreamCache> cache,
+                       size_t prefetch = 8);
+    ~SegmentStoreReader();
+    SegmentStoreReader(const SegmentStoreReader& copy) = delete;
+    SegmentStoreReader operator=(const SegmentStoreReader& copy) = delete;
+
+    // Packets come out of this. It's set up from the first stored
+    // segment, so it's null if nothing had been stored yet when the
+    // reader was opened (refresh and check again.)
+    Stream::pointer stream();
+
+    // Number of segments stored
+    size_t size() const;
+    SegmentStore::IndexEntry entry(size_t position) const;
+    AVRational timeBase() const;
+
+    // Positions [first, last) of the segments that cover [start, end)
+    std::pair<size_t, size_t> range(int64_t start, int64_t end) const;
+
+    // Decodes one segment out of the log
+    Segment::pointer segment(size_t position);
+
+    // Sends the packets for [start, end) to the stream. Runs in your
+    // thread and returns once it's done or stop is called. Returns the
+    // number of segments it sent.
+    size_t replay(int64_t start, int64_t end);
+    // Everything stored
+    size_t replay();
+    // Stops a replay going on in another thread
+    void stop();
+
+    // Picks up segments committed since the reader was opened. Returns
+    // true if there are new ones.
+    bool refresh();
+
+  private:
+    // The log, mapped. Packets hold a reference to it.
+    struct Mapping {
+      uint8_t* data = nullptr;
+      size_t size = 0;
+      ~Mapping();
+    };
+
+    std::filesystem::path dir;
+    SegmentIndex segmentIndex;
+    std::shared_ptr<StreamCache> cache;
+    size_t prefetch;
+    int log = -1;
+
+    // Covers the index, the mapping and the stream, so refresh can
+    // happen while a replay is going on
+    mutable std::mutex mutex;
+    std::shared_ptr<Mapping> mapping;
+    Stream::pointer output;
+
+    std::mutex queueMutex;
+    WorkQueue<Segment::pointer>* queue = nullptr;
+    std::atomic<bool> stopping = false;
+
+    // Maps whatever the index says is in the log
+    void map();
+    void setupStream();
+    Segment::pointer decode(const std::shared_ptr<Mapping>& map, const SegmentStore::IndexEntry& entry);
+    // Faults the pages for a segment in
+    static void touch(const Mapping& map, const SegmentStore::IndexEntry& entry);
+    static void releaseMapping(void* opaque, uint8_t* data);
+  };
+
+}
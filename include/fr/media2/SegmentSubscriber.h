@@ -22,6 +22,7 @@
 #include <boost/signals2.hpp>
 #include <fr/media2/Segment.h>
 #include <fr/media2/Segmenter.h>
+#include <fr/media2/SegmentSource.h>
 
 namespace fr::media2 {
 
@@ -38,7 +39,7 @@ namespace fr::media2 {
      * data.
      */
     
-    virtual void subscribe(Segmenter *to);
+    virtual void subscribe(SegmentSource *to);
     virtual void unsubscribe();
 
     virtual void process(const Segment::pointer&, StreamData::pointer) = 0;
@@ -0,0 +1,146 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Transcodes video segments on a pool of worker threads. A video
+ * segment starts on an iframe and has everything up to the next one,
+ * so each one can be decoded, scaled and encoded again all by itself.
+ * That means a single stream can keep as many cores busy as you have
+ * segments in flight, instead of running through one decoder and one
+ * encoder.
+ *
+ * Transcoded segments come out of the segments signal in the same
+ * order they went in, so each stream's segments stay in dts order.
+ * They keep the job ID of the segment they came from. Segments that
+ * aren't video go straight through untouched (but still in order.)
+ *
+ * You can feed it from a Segmenter (it's a SegmentSubscriber), from a
+ * ZmqSegmentSubscriber, or call receive yourself. Anything that takes
+ * segments from a Segmenter can subscribe to it.
+ */
+
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/pixfmt.h>
+}
+
+#include <atomic>
+#include <boost/signals2.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <fr/media2/DecoderConfig.h>
+#include <fr/media2/Segment.h>
+#include <fr/media2/SegmentSource.h>
+#include <fr/media2/SegmentSubscriber.h>
+#include <fr/media2/StreamData.h>
+#include <fr/media2/UuidKey.h>
+#include <fr/media2/WorkQueue.h>
+#include <fr/media2/ZmqSegmentSubscriber.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace fr::media2 {
+
+  class SegmentTranscoder : public SegmentSubscriber, public SegmentSource {
+  public:
+
+    struct Settings {
+      // Encoder to use, by name
+      std::string codec = "libx264";
+      // Output size. -1 keeps the source size. If only one of them is
+      // -1, it's worked out from the other to keep the aspect ratio.
+      int width = -1;
+      int height = -1;
+      AVPixelFormat format = AV_PIX_FMT_YUV420P;
+      // 0 leaves it up to the encoder
+      int64_t bitRate = 0;
+      // Encoder private options, like preset or crf for x264
+      std::map<std::string, std::string> options;
+      // Threads for each encoder. The parallelism mostly comes from
+      // working on several segments at once, so this defaults to 1.
+      int encoderThreads = 1;
+      // Same deal for the decoders
+      DecoderConfig decoder = DecoderConfig::singleThreaded();
+    };
+
+    // queueCapacity is the number of segments that can be waiting for a
+    // worker before receive blocks (0 for no limit.)
+    SegmentTranscoder(int nThreads, const Settings& settings, size_t queueCapacity = 0);
+    ~SegmentTranscoder() override;
+
+    using SegmentSubscriber::subscribe;
+    // Transcode segments as they arrive from a ZmqSegmentSubscriber
+    void subscribe(ZmqSegmentSubscriber* source);
+
+    // From a Segmenter. The segment is copied.
+    void process(const Segment::pointer&, StreamData::pointer) override;
+    // Takes ownership of a segment to transcode
+    void receive(Segment::pointer segment);
+
+    // Waits until everything received so far has been sent out
+    void flush();
+    // Stops taking segments, finishes the ones it has and shuts down
+    // the workers.
+    void close();
+
+    // Number of segments that couldn't be transcoded. These are
+    // dropped (with a message to cerr).
+    uint64_t failures();
+
+  protected:
+    // Transcodes one video segment. Runs in a worker.
+    virtual Segment::pointer transcode(const Segment& segment);
+
+    Settings settings;
+
+  private:
+    struct Job {
+      uint64_t sequence = 0;
+      Segment::pointer segment;
+    };
+
+    const AVCodec* encoderCodec = nullptr;
+    WorkQueue<Job> work;
+    std::vector<std::thread> workers;
+    std::vector<boost::signals2::connection> sourceSubscriptions;
+
+    std::mutex sequenceMutex;
+    uint64_t nextSequence = 0;
+
+    // Finished segments waiting for the ones ahead of them
+    std::mutex doneMutex;
+    std::condition_variable emitted;
+    std::map<uint64_t, Segment::pointer> done;
+    uint64_t nextOut = 0;
+    bool emitting = false;
+    // Stream data for the output of each job. Only the thread that's
+    // emitting touches this.
+    std::unordered_map<UuidKey, StreamData::pointer, UuidKeyHash> outputStreams;
+
+    std::atomic<uint64_t> failed = 0;
+
+    void doSomeWork();
+    // Hands a finished segment over and sends whatever is ready
+    void finished(uint64_t sequence, Segment::pointer segment);
+    StreamData::pointer outputStream(const Segment::pointer& segment);
+  };
+
+}
@@ -16,9 +16,21 @@
  *
  * Unpacks a segment. This will attempt to retrieve a stream from the stream
  * cache. If this fails, the stream subscriptions will have to be set up again.
- * This can handle segments from multiple sources. It will start a thread
- * for each stream it's handling. Oh, it can also subscribe to multiple
- * SegmentSubscribers.
+ * This can handle segments from multiple sources. Oh, it can also subscribe
+ * to multiple SegmentSubscribers.
+ *
+ * Each worker thread has its own work queue, and segments are handed
+ * to a worker based on their jobId. So all the segments for a stream
+ * are unpacked in the order they arrived, on one thread, while
+ * different streams get unpacked in parallel. If you give the unpacker
+ * a queue capacity, receive blocks while that worker's queue is full,
+ * which pushes back on whoever is feeding it.
+ *
+ * If segments can arrive out of order, set a reorder depth. Each
+ * worker will then hold up to that many segments per stream and
+ * release them in dts order. Held segments are released when the
+ * worker has been idle for reorderTimeout, or when the unpacker
+ * is closed.
  */
 
 #pragma once
@@ -32,8 +44,11 @@
 #include <functional>
 #include <fr/media2/Serialization.h>
 #include <fr/media2/Segment.h>
+#include <fr/media2/SegmentWire.h>
 #include <fr/media2/Stream.h>
 #include <fr/media2/StreamCache.h>
+#include <fr/media2/UuidKey.h>
+#include <fr/media2/WorkQueue.h>
 #include <fr/media2/ZmqSegmentSubscriber.h>
 #include <sstream>
 #include <thread>
@@ -46,10 +61,12 @@ namespace fr::media2 {
   class SegmentUnpacker {
   public:
     // Pass a lambda to set up subscriptions if we get a cache
-    // miss.  
-    SegmentUnpacker(int nThreads, std::function<void(Stream::pointer)>);
+    // miss. queueCapacity is the number of segments that can be
+    // waiting to be unpacked before receive blocks (0 for no limit.)
+    SegmentUnpacker(int nThreads, std::function<void(Stream::pointer)>, size_t queueCapacity = 0);
     // You can also pass in your own cache if you want to
-    SegmentUnpacker(int nThreads, std::shared_ptr<StreamCache>, std::function<void(Stream::pointer)>);
+    SegmentUnpacker(int nThreads, std::shared_ptr<StreamCache>, std::function<void(Stream::pointer)>,
+                    size_t queueCapacity = 0);
     ~SegmentUnpacker();
 
     // Subscribe to a segment subscriber
@@ -61,19 +78,56 @@ namespace fr::media2 {
     void close();
     
     // receive a segment. You can manually feed serialzied segments to
-    // this object this way too.
+    // this object this way too. Either boost serialized segments or
+    // SegmentWire format segments are fine.
     void receive(std::stringstream &);
     // If you never serialized your segment or deserialized it elsewhere,
     // you can feed this object Segments too. This object takes
     // ownership of the pointer, so send a copy if you want to keep it.
+    // Segments received after close are dropped.
     void receive(std::unique_ptr<Segment>);
+
+    // Number of segments waiting to be unpacked
+    size_t queued();
+    // Change the per-worker queue capacity (0 for no limit)
+    void setQueueCapacity(size_t capacity);
+    // Number of segments per stream to hold for reordering by dts.
+    // 0 (the default) unpacks segments in the order they arrive.
+    void setReorderDepth(size_t depth);
+    // How long a worker waits for more work before releasing the
+    // segments it's holding for reordering.
+    void setReorderTimeout(std::chrono::milliseconds timeout);
+    // Number of segments that showed up after a segment with a later
+    // dts had already been unpacked. These are still unpacked, but if
+    // you see a lot of them, your reorder depth is too small.
+    uint64_t lateSegments();
+
+    // Deserializes a segment in either format. This is what receive
+    // does with a stringstream, if you want one without an unpacker.
+    static std::unique_ptr<Segment> segFrom(std::stringstream&);
+
   private:
-    std::vector<std::shared_ptr<std::thread>> workers;
-    std::mutex workMutex;
-    
-    std::atomic<bool> shutdownFlag = false;
-    // Work queue
-    std::deque<std::unique_ptr<Segment>> work;
+    // Segments being held for reordering for one stream. This is
+    // a min-heap on dts.
+    struct Pending {
+      std::vector<std::unique_ptr<Segment>> heap;
+      int64_t lastDts = AV_NOPTS_VALUE;
+    };
+
+    // A worker thread and the work for the streams hashed to it
+    struct Shard {
+      explicit Shard(size_t capacity) : work{capacity} {}
+      WorkQueue<std::unique_ptr<Segment>> work;
+      std::thread thread;
+      // Only touched by this shard's thread
+      std::unordered_map<UuidKey, Pending, UuidKeyHash> pending;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    std::atomic<size_t> reorderDepth = 0;
+    std::atomic<long> reorderTimeoutMs = 100;
+    std::atomic<uint64_t> late = 0;
     // If we get a cache miss, setupStream should be used to set
     // up subscribers to that stream. If it's not anything,
     // Segments will get unpacked but the packets will never
@@ -82,9 +136,17 @@ namespace fr::media2 {
     std::vector<boost::signals2::connection> subscriptions;
     std::shared_ptr<StreamCache> cache;
 
-    std::unique_ptr<Segment> segFrom(std::stringstream&);
+    // Starts the worker threads
+    void start(int nThreads, size_t queueCapacity);
     // Runs in thread until done
-    void doSomeWork();
+    void doSomeWork(Shard& shard);
+    // Unpacks a segment now or holds it for reordering
+    void schedule(Shard& shard, std::unique_ptr<Segment>);
+    // Unpacks a stream's held segments, lowest dts first, until
+    // there are only keep of them left
+    void release(Pending& pending, size_t keep);
+    // Unpacks everything the shard is holding
+    void releaseAll(Shard& shard);
     // Unpacks a segment
     void unpack(std::unique_ptr<Segment>);
   };
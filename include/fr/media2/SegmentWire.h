@@ -0,0 +1,179 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * A flat wire format for segments. Boost serialization has to copy
+ * every packet into a stream (and then usually copy the stream a
+ * couple more times) so this lays a segment out so that it can be
+ * sent straight out of the packet buffers and used straight out of
+ * whatever buffer it was received into.
+ *
+ * The layout is:
+ *
+ *   Header (fixed size, includes the codec parameters)
+ *   Codec extradata (header.extradataSize bytes)
+ *   Packet table (header.npackets PacketEntries)
+ *   Side data table and side data (header.sideDataSize bytes)
+ *   Packet payloads, back to back
+ *
+ * Everything up to the payloads is the "header block". Each payload
+ * is followed by header.padding bytes, which is where LibAV expects
+ * its AV_INPUT_BUFFER_PADDING_SIZE to be, so decoders can use packets
+ * pointing into the payload area directly. PacketEntry::offset is
+ * relative to the start of the payload area.
+ *
+ * The ZmqSegmentPublisher sends the header block in one frame and then
+ * each payload (with its padding) in its own frame, so the whole thing
+ * concatenated together is the same as the contiguous layout.
+ *
+ * Numbers are in host byte order. Boost's binary archives aren't
+ * portable either, so this doesn't lose anything there.
+ */
+
+#pragma once
+
+extern "C" {
+#include <libavcodec/packet.h>
+#include <libavutil/buffer.h>
+}
+
+#include <cstdint>
+#include <fr/media2/Segment.h>
+#include <ostream>
+#include <vector>
+
+namespace fr::media2 {
+
+  class SegmentWire {
+  public:
+    static constexpr char magic[4] = {'F', 'R', 'S', 'W'};
+    static constexpr uint32_t version = 1;
+
+    struct Header {
+      char magic[4];
+      uint32_t version;
+      uint8_t jobId[16];
+      int64_t pts;
+      int64_t dts;
+      int32_t timeBaseNum;
+      int32_t timeBaseDen;
+      uint64_t npackets;
+      uint32_t extradataSize;
+      uint32_t sideDataSize;
+      uint32_t padding;
+      uint32_t reserved;
+      // Codec parameters, in the same order Serialization.h does them
+      int32_t codecType;
+      int32_t codecId;
+      uint32_t codecTag;
+      int32_t format;
+      int64_t bitRate;
+      int32_t bitsPerCodedSample;
+      int32_t bitsPerRawSample;
+      int32_t profile;
+      int32_t level;
+      int32_t width;
+      int32_t height;
+      int32_t sampleAspectNum;
+      int32_t sampleAspectDen;
+      int32_t fieldOrder;
+      int32_t colorRange;
+      int32_t colorPrimaries;
+      int32_t colorTrc;
+      int32_t colorSpace;
+      int32_t chromaLocation;
+      int32_t videoDelay;
+      int32_t channels;
+      uint64_t channelLayout;
+      int32_t sampleRate;
+      int32_t blockAlign;
+      int32_t frameSize;
+      int32_t initialPadding;
+      int32_t trailingPadding;
+      int32_t seekPreroll;
+    };
+
+    struct PacketEntry {
+      int64_t pts;
+      int64_t dts;
+      int64_t duration;
+      int64_t pos;
+      uint64_t offset;
+      int32_t size;
+      int32_t flags;
+      int32_t streamIndex;
+      uint32_t sideDataElems;
+    };
+
+    // Side data is stored as one of these followed by size bytes
+    struct SideDataEntry {
+      uint32_t packet;
+      int32_t type;
+      uint32_t size;
+      uint32_t reserved;
+    };
+
+    // Fills out with the header block for segment. Pass the same
+    // vector in each time and it won't need to be reallocated.
+    static void encodeHeader(const Segment& segment, std::vector<uint8_t>& out);
+
+    // Number of bytes a packet's payload takes up on the wire
+    static size_t payloadSize(const AVPacket& packet);
+
+    // Writes the whole segment to o in the contiguous layout
+    static void write(const Segment& segment, std::ostream& o);
+
+    // True if data starts with a wire format header
+    static bool isWireFormat(const uint8_t* data, size_t size);
+
+    // Copies the header out of data, so you can find out things like the
+    // dts without having to decode the whole segment. Returns false if
+    // data isn't a wire format segment.
+    static bool readHeader(const uint8_t* data, size_t size, Header& header);
+
+    // Copies the table entry for packet index out of data. Returns false
+    // if data isn't a wire format segment or doesn't have that packet.
+    static bool readPacket(const uint8_t* data, size_t size, size_t index, PacketEntry& entry);
+
+    // Decodes a contiguous segment. The packets in the segment you get
+    // back hold a reference to buffer and point straight into it, so
+    // nothing is copied. You keep your reference to buffer.
+    static Segment::pointer decode(AVBufferRef* buffer);
+
+    // Decodes a segment received in pieces. headerBlock only needs to
+    // live for the duration of the call. payloads needs one buffer
+    // per packet, the packets take ownership of those references (the
+    // vector is cleared) and point straight into them.
+    static Segment::pointer decode(const uint8_t* headerBlock, size_t size,
+                                   std::vector<AVBufferRef*>& payloads);
+
+  private:
+    // Size of everything before the payloads
+    static size_t headerBlockSize(const Header& header);
+    // Decodes the header block into header and entries and returns
+    // a segment with everything but the packets filled in.
+    static Segment::pointer decodeHeader(const uint8_t* data, size_t size,
+                                         Header& header,
+                                         std::vector<PacketEntry>& entries);
+    // Adds a packet pointing at data to segment. The packet takes
+    // ownership of ref.
+    static void appendPacket(Segment& segment, const PacketEntry& entry,
+                             AVBufferRef* ref, uint8_t* data);
+    // Attaches side data from the header block to the packets in segment
+    static void decodeSideData(const uint8_t* data, const Header& header,
+                               Segment& segment);
+  };
+
+}
@@ -25,6 +25,7 @@
 
 #include <boost/signals2.hpp>
 #include <fr/media2/Segment.h>
+#include <fr/media2/SegmentSource.h>
 #include <fr/media2/PacketSubscriber.h>
 #include <mutex>
 
@@ -33,19 +34,21 @@ namespace fr::media2 {
   // Subscribe the Segmenter to ONE (1) stream. If you try to subscribe one
   // segmenter to more than one stream, you're going to have a bad time.
   
-  class Segmenter : public PacketSubscriber {
+  class Segmenter : public PacketSubscriber, public SegmentSource {
   public:
     // Constructor takes number of frames to include in a segment,
     // but this will be ignored for video data.
     Segmenter(size_t nframes = 250);
     virtual ~Segmenter() override;
 
-    // Boost signal for segments
-    boost::signals2::signal<void(const Segment::pointer &segment, StreamData::pointer stream)> segments;
-
     // Send the current segment now. Might be handy when you hit EOF.
     void flush();
 
+    // On a discontinuity (the reader seeked) the current segment goes
+    // out as it is. It started on an iframe, so it's still good, it
+    // just ends early. Video waits for the next iframe after that.
+    void streamEvent(StreamEvent event, const StreamData::pointer& stream) override;
+
   protected:
 
     // Generated when the segmenter is created and assigned to the segments
@@ -56,10 +59,12 @@ namespace fr::media2 {
     // Number of frames in current segment.
     size_t currentFrames = 0l;
     Segment::pointer currentSegment;
+    // Set after a discontinuity until a video iframe shows up
+    bool waitForIFrame = false;
     std::mutex currentSegmentMutex;
     StreamData::pointer stream;
     
-    void process(const Packet::pointer& packet, StreamData::pointer stream) override;
+    void process(const Packet::pointer& packet, const StreamData::pointer& stream) override;
   };
   
 }
@@ -27,6 +27,7 @@ extern "C" {
 }
 
 #include <fr/media2/Packet.h>
+#include <fr/media2/PacketPool.h>
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/serialization/binary_object.hpp>
@@ -75,7 +76,10 @@ void load(Archive &ar, AVPacket &packet, const unsigned int version) {
   ar >> packet.pts;
   ar >> packet.dts;
   ar >> packet.size;
-  packet.data = (uint8_t*) malloc(sizeof(uint8_t) * packet.size);
+  // Payload comes out of the packet pool and is refcounted, so it'll
+  // go back to the pool when the packet is unreffed.
+  packet.buf = fr::media2::PacketPool::instance().buffer(packet.size);
+  packet.data = packet.buf->data;
   ar >> boost::serialization::make_binary_object(packet.data, packet.size);
   ar >> packet.stream_index;
   ar >> packet.flags;
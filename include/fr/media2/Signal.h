@@ -0,0 +1,173 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * A stripped down signal for the packet and frame paths, which fire
+ * for every packet or frame and can't afford what boost::signals2
+ * does on each call (lock a mutex, walk a list of shared slots and
+ * track everything.) It's connect and disconnect like a signals2
+ * signal, but the subscribers are kept in an immutable array. Firing
+ * the signal just grabs the current array and calls everything in it.
+ * Connecting or disconnecting builds a new array and swaps it in, so
+ * that's the slow side, which is fine because it hardly ever happens.
+ *
+ * Like signals2, a slot that gets disconnected while another thread is
+ * in the middle of firing the signal may still get called one more
+ * time by that thread.
+ *
+ * There are no return values, combiners, groups or tracking. If you
+ * need any of that, use signals2.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace fr::media2 {
+
+  namespace detail {
+    // Lets a Connection disconnect from any kind of Signal
+    class SignalState {
+    public:
+      virtual ~SignalState() = default;
+      virtual void disconnect(uint64_t id) = 0;
+      virtual bool connected(uint64_t id) = 0;
+    };
+  }
+
+  // Returned by Signal::connect. Copies all refer to the same slot.
+  // Disconnecting after the signal is gone is harmless.
+  class Connection {
+  public:
+    Connection() = default;
+    Connection(std::weak_ptr<detail::SignalState> state, uint64_t id) : state(std::move(state)), id(id) {}
+
+    void disconnect() {
+      if (auto locked = state.lock()) {
+        locked->disconnect(id);
+      }
+    }
+
+    bool connected() const {
+      auto locked = state.lock();
+      return locked && locked->connected(id);
+    }
+
+  private:
+    std::weak_ptr<detail::SignalState> state;
+    uint64_t id = 0;
+  };
+
+  template<typename Signature> class Signal;
+
+  template<typename... Args>
+  class Signal<void(Args...)> {
+  public:
+    using Slot = std::function<void(Args...)>;
+
+    Signal() = default;
+    Signal(const Signal& copy) = delete;
+    Signal operator=(const Signal& copy) = delete;
+
+    Connection connect(Slot slot) {
+      return Connection(state, state->add(std::move(slot)));
+    }
+
+    // Calls everyone who was connected when this started
+    void operator()(Args... args) const {
+      std::shared_ptr<const SlotList> slots = state->slots.load(std::memory_order_acquire);
+      if (!slots) {
+        return;
+      }
+      for (const auto& entry : *slots) {
+        entry.second(args...);
+      }
+    }
+
+    void disconnect_all_slots() {
+      state->clear();
+    }
+
+    size_t num_slots() const {
+      auto slots = state->slots.load(std::memory_order_acquire);
+      return slots ? slots->size() : 0;
+    }
+
+    bool empty() const {
+      return 0 == num_slots();
+    }
+
+  private:
+    using SlotList = std::vector<std::pair<uint64_t, Slot>>;
+
+    class State : public detail::SignalState {
+    public:
+      std::atomic<std::shared_ptr<const SlotList>> slots;
+
+      uint64_t add(Slot slot) {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        auto current = slots.load();
+        auto updated = current ? std::make_shared<SlotList>(*current) : std::make_shared<SlotList>();
+        uint64_t id = nextId++;
+        updated->emplace_back(id, std::move(slot));
+        slots.store(std::move(updated), std::memory_order_release);
+        return id;
+      }
+
+      void disconnect(uint64_t id) override {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        auto current = slots.load();
+        if (!current) {
+          return;
+        }
+        auto updated = std::make_shared<SlotList>();
+        updated->reserve(current->size());
+        for (const auto& entry : *current) {
+          if (entry.first != id) {
+            updated->push_back(entry);
+          }
+        }
+        if (updated->size() != current->size()) {
+          slots.store(std::move(updated), std::memory_order_release);
+        }
+      }
+
+      bool connected(uint64_t id) override {
+        auto current = slots.load(std::memory_order_acquire);
+        return current && std::any_of(current->begin(), current->end(),
+                                      [id](const auto& entry) { return entry.first == id; });
+      }
+
+      void clear() {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        slots.store(nullptr, std::memory_order_release);
+      }
+
+    private:
+      std::mutex writeMutex;
+      uint64_t nextId = 1;
+    };
+
+    std::shared_ptr<State> state = std::make_shared<State>();
+  };
+
+}
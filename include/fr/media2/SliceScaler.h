@@ -0,0 +1,118 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Scales a frame in horizontal bands on several threads. sws_scale
+ * only runs on one core, and a 4K to 1080p bicubic scale is slow
+ * enough to hold up everything behind it.
+ *
+ * swscale won't start a slice in the middle of the picture, so each
+ * band gets its own SwsContext that scales just that part of the
+ * source. Band edges are put on rows where the output and source line
+ * up exactly (and on chroma rows), so every band uses the same filter
+ * positions the whole frame would have. Each band also scales a few
+ * extra rows above and below itself and throws them away, so the
+ * filter has real neighbours at the edges instead of clamping. That
+ * comes out of a scratch frame the band owns.
+ *
+ * If there's no sensible way to split the frame (a palette format, or
+ * sizes that never line up) it just scales the whole thing in one go.
+ *
+ * The calling thread does some of the bands too, so threads is the
+ * total number of threads working on a frame.
+ */
+
+#pragma once
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+#include <libswscale/swscale.h>
+}
+
+#include <condition_variable>
+#include <cstdint>
+#include <fr/media2/Frame.h>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fr::media2 {
+
+  class SliceScaler {
+  public:
+
+    // threads of 0 uses one per core. bandHeight is in output rows. 0
+    // splits the frame evenly between the threads. Either way it gets
+    // rounded to a row where the band can start.
+    SliceScaler(int srcWidth, int srcHeight, AVPixelFormat srcFormat,
+                int dstWidth, int dstHeight, AVPixelFormat dstFormat,
+                int flags = SWS_BICUBIC, int threads = 0, int bandHeight = 0);
+    ~SliceScaler();
+    SliceScaler(const SliceScaler& copy) = delete;
+    SliceScaler operator=(const SliceScaler& copy) = delete;
+
+    // Scales src into dst, which needs buffers of the output size and
+    // format. Returns once the whole frame is done. Throws if any band
+    // fails.
+    void scale(const AVFrame* src, AVFrame* dst);
+
+    size_t bands() const;
+    int threads() const;
+
+  private:
+
+    struct Band {
+      // Output rows this band is responsible for
+      int dstY = 0;
+      int dstHeight = 0;
+      // Source rows it scales, margins included
+      int srcY = 0;
+      int srcHeight = 0;
+      // Margin rows above dstY in the scratch frame
+      int top = 0;
+      std::unique_ptr<SwsContext, decltype(&sws_freeContext)> context{nullptr, &sws_freeContext};
+      // Null if the band has no margins and can scale straight into
+      // the output
+      Frame::pointer scratch{nullptr, &Frame::destroy};
+    };
+
+    AVPixelFormat srcFormat;
+    AVPixelFormat dstFormat;
+    int dstWidth;
+    int srcChromaShift;
+    int dstChromaShift;
+    std::vector<Band> bandList;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    uint64_t generation = 0;
+    bool stopping = false;
+    const AVFrame* source = nullptr;
+    AVFrame* target = nullptr;
+    size_t nextBand = 0;
+    size_t remaining = 0;
+    bool failed = false;
+
+    void work();
+    // Scales bands of frame number frame until there are none left
+    void runBands(uint64_t frame, const AVFrame* src, AVFrame* dst);
+    bool scaleBand(Band& band, const AVFrame* src, AVFrame* dst);
+  };
+
+}
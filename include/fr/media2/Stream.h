@@ -21,7 +21,7 @@
 
 #pragma once
 
-#include <boost/signals2.hpp>
+#include <fr/media2/Signal.h>
 #include <memory>
 #include <fr/media2/Packet.h>
 #include <fr/media2/StreamData.h>
@@ -32,6 +32,16 @@ namespace fr {
 
     class Segment;
 
+    // Things that happen to a stream that aren't packets
+    enum class StreamEvent {
+      // No more packets are coming. Anything holding on to packets or
+      // frames (a frame threaded decoder) should let them go now.
+      endOfStream,
+      // The source seeked. Packets after this don't follow on from the
+      // ones before it, so don't put them together (in a segment, say.)
+      discontinuity
+    };
+
     class Stream {
     public:
       using pointer = std::shared_ptr<Stream>;
@@ -47,7 +57,7 @@ namespace fr {
       StreamData::pointer data;
 
       /**
-       * Expose a boost signal that can be subscribed to. You can subscribe
+       * Expose a signal that can be subscribed to (see Signal.h.) You can subscribe
        * to it with a lambda or a custom object, depending on what you
        * need done. Once subscribed, your callback function will receive
        * packets until you unsubscribe or the stream in question goes dry
@@ -57,23 +67,35 @@ namespace fr {
        * doing fairly simple things, this is fine. If you intend to spend
        * a while processing, it would probably be better if you copied the
        * original packet into a buffer and processed it in its own thread.
-       * That is way more complex and harder on your application memory,
-       * so it really kind of depends on what you're trying to accomplish.
+       * AsyncPacketSubscriber will do that for you. It's harder on your
+       * application memory, so it really kind of depends on what you're
+       * trying to accomplish.
        *
        * Once you return from the callback, you can consider the packet
        * you received to be invalid. Don't just try to push it into a
        * deque or something or you'll just have a deque full of bad data.
        * Copy the packet instead, if you need it. It should be a fairly
        * low-impact operation.
+       *
+       * The stream data comes by reference too. Copy the shared pointer
+       * if you want to hang on to it.
        */
 
-      boost::signals2::signal<void(const Packet::pointer& packet, StreamData::pointer stream)> packets;
+      Signal<void(const Packet::pointer& packet, const StreamData::pointer& stream)> packets;
+
+      /**
+       * Fired in between packets, from the same thread that sends them,
+       * so it always lands in the right place in the stream.
+       * PacketSubscribers get these in streamEvent.
+       */
+      Signal<void(StreamEvent event, const StreamData::pointer& stream)> events;
 
       /**
        * Forward a packet to subscribers. Users of the API don't need to
        * worry about this particularly.
        */
       void forward(const Packet::pointer& packet);
+      void forward(StreamEvent event);
     };
   }
 }
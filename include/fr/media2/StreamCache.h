@@ -25,18 +25,31 @@
  *   will be nullptr. This generally shouldn't be a problem, but
  *   always be sure to check stream->data->stream for nullptr
  *   before trying to use it.
+ *
+ * The cache is split into shards by a hash of the jobId, each with its
+ * own lock, so unpacker threads working on different streams mostly
+ * don't wait on each other. Each shard keeps its entries in a list in
+ * the order they were last used. Since every entry lasts the same
+ * amount of time, that's also the order they expire in, so the cleanup
+ * thread only ever looks at the front of each list, and only holds one
+ * shard's lock at a time while doing it.
  */
 
 #pragma once
 
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <fr/media2/Segment.h>
 #include <fr/media2/Stream.h>
 #include <fr/media2/StreamData.h>
+#include <fr/media2/UuidKey.h>
+#include <list>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 #include <uuid.h>
 
 namespace fr::media2 {
@@ -45,32 +58,56 @@ namespace fr::media2 {
   class StreamCacheRecord {
   public:
     using pointer = std::shared_ptr<StreamCacheRecord>;
+    // Job ID the stream belongs to
+    UuidKey jobId;
     // A stream
     Stream::pointer stream;
     // The time at which the cache entry expires
-    std::chrono::system_clock::time_point expires;
+    std::chrono::steady_clock::time_point expires;
   };
   
   class StreamCache {
   public:
-    
-    StreamCache(long expSeconds = 600, long cleanupFreq = 10);
+
+    // shards is rounded up to a power of 2
+    StreamCache(long expSeconds = 600, long cleanupFreq = 10, size_t shards = 16);
     ~StreamCache();
 
     Stream::pointer get(Segment*);
+    // Same thing, but lets you know if the stream was just created
+    // (so you can set up subscriptions to it.)
+    Stream::pointer get(Segment*, bool& created);
     Stream::pointer get(uuid_t jobId);
 
+    // Number of streams in the cache
+    size_t size();
+
   private:
+
+    struct Shard {
+      std::mutex mutex;
+      // Least recently used at the front
+      std::list<StreamCacheRecord> records;
+      std::unordered_map<UuidKey, std::list<StreamCacheRecord>::iterator, UuidKeyHash> index;
+    };
+
     // Number of seconds cache entries last
-    long expSeconds;
+    std::chrono::seconds expiry;
     // Expire entries every cleanupFreq seconds
-    long cleanupFreq;
-    std::mutex cacheMutex;
-    std::atomic<bool> shutdownFlag = false;
-    std::unordered_map<std::string, StreamCacheRecord::pointer> cache;
+    std::chrono::seconds cleanupFreq;
+    std::vector<std::unique_ptr<Shard>> shards;
+    size_t shardMask = 0;
 
+    std::mutex shutdownMutex;
+    std::condition_variable shutdownCondition;
+    bool shutdownFlag = false;
     std::thread processingThread;
-    
+
+    Shard& shardFor(const UuidKey& key);
+    // Moves a record to the back of its shard and pushes its expiry
+    // out. Shard has to be locked.
+    void touch(Shard& shard, std::list<StreamCacheRecord>::iterator record);
+
     // Runs in a thread. Wakes up every so often to expire
     // cache records
     void expireEntries();
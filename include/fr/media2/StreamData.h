@@ -37,6 +37,7 @@ extern "C" {
 #include <libavcodec/codec_par.h>
 }
 
+#include <fr/media2/DecoderConfig.h>
 #include <ostream>
 #include <memory>
 #include <string>
@@ -54,7 +55,9 @@ namespace fr {
       // Create a StreamData from a Segment, which contains
       // all the information we need. You can include
       // filename if you want it set in the stream data,
-      // but this will not actually open a file.
+      // but this will not actually open a file. The codec
+      // context is set up but not opened -- a Decoder will
+      // open it when it subscribes.
       StreamData(Segment*, const std::string& filename="");
       // You can copy the shared ptr though
       StreamData(const StreamData& toCopy) = delete;
@@ -123,6 +126,22 @@ namespace fr {
        */
 
       void setContext(AVCodecContext** ctx);
+
+      /**
+       * Opens context as a decoder with config. If context is already
+       * open, it's replaced with a new one, since threading can't be
+       * changed once it's open. Returns false if it couldn't be opened.
+       */
+
+      bool openDecoder(const DecoderConfig& config = DecoderConfig{});
+
+      /**
+       * Number of frames the decoder holds on to before you get the
+       * first one back, because of frame threading. 0 if it isn't
+       * frame threaded or isn't open.
+       */
+
+      int decoderDelay() const;
     };
   }
 }
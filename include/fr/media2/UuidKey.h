@@ -0,0 +1,68 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Lets you use a uuid_t as a key in hash maps without having to
+ * uuid_unparse it into a string first. It's just the 16 bytes of
+ * the uuid and a hash that mixes them down to a size_t.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <uuid.h>
+
+namespace fr::media2 {
+
+  struct UuidKey {
+    uint64_t high = 0;
+    uint64_t low = 0;
+
+    UuidKey() = default;
+    UuidKey(const uuid_t id) {
+      memcpy(&high, id, sizeof(high));
+      memcpy(&low, id + sizeof(high), sizeof(low));
+    }
+
+    void copyTo(uuid_t id) const {
+      memcpy(id, &high, sizeof(high));
+      memcpy(id + sizeof(high), &low, sizeof(low));
+    }
+
+    bool operator==(const UuidKey& other) const {
+      return high == other.high && low == other.low;
+    }
+
+    // Random uuids are already pretty well mixed, but time based
+    // ones aren't, so run it through a finalizer anyway (This is
+    // the murmur3 64 bit one.)
+    size_t hash() const {
+      uint64_t h = high ^ (low * 0x9e3779b97f4a7c15ull);
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdull;
+      h ^= h >> 33;
+      h *= 0xc4ceb9fe1a85ec53ull;
+      h ^= h >> 33;
+      return static_cast<size_t>(h);
+    }
+  };
+
+  struct UuidKeyHash {
+    size_t operator()(const UuidKey& key) const { return key.hash(); }
+  };
+
+}
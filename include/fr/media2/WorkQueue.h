@@ -0,0 +1,189 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * A blocking multi-producer, multi-consumer work queue. Consumers
+ * sleep on a condition variable until there's work (or the queue
+ * is closed) instead of polling. If you give it a capacity, push
+ * blocks while the queue is full, so producers slow down to match
+ * consumers rather than piling up an unlimited amount of work.
+ *
+ * Closing the queue stops it from accepting more work. Consumers
+ * keep getting items until it's empty, so nothing that was already
+ * queued gets lost.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace fr::media2 {
+
+  template<typename T>
+  class WorkQueue {
+  public:
+    // A capacity of 0 means no limit
+    explicit WorkQueue(size_t capacity = 0) : capacity(capacity) {}
+    WorkQueue(const WorkQueue& copy) = delete;
+    WorkQueue operator=(const WorkQueue& copy) = delete;
+
+    // Adds an item, waiting for room if the queue is full. Returns
+    // false (and drops item) if the queue has been closed.
+    bool push(T item) {
+      std::unique_lock<std::mutex> lock(mutex);
+      notFull.wait(lock, [this]{ return closed || 0 == capacity || items.size() < capacity; });
+      if (closed) {
+        return false;
+      }
+      items.push_back(std::move(item));
+      lock.unlock();
+      notEmpty.notify_one();
+      return true;
+    }
+
+    // Adds an item if there's room. Returns false and leaves item
+    // alone if the queue is full or closed.
+    bool tryPush(T& item) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closed || (0 != capacity && items.size() >= capacity)) {
+          return false;
+        }
+        items.push_back(std::move(item));
+      }
+      notEmpty.notify_one();
+      return true;
+    }
+
+    // Waits for an item. Returns false once the queue is closed and
+    // there's nothing left in it.
+    bool pop(T& item) {
+      std::unique_lock<std::mutex> lock(mutex);
+      notEmpty.wait(lock, [this]{ return closed || !items.empty(); });
+      if (items.empty()) {
+        return false;
+      }
+      item = std::move(items.front());
+      items.pop_front();
+      bool nowEmpty = items.empty();
+      lock.unlock();
+      notFull.notify_one();
+      if (nowEmpty) {
+        drained.notify_all();
+      }
+      return true;
+    }
+
+    // Waits up to timeout for an item. Returns false if nothing
+    // showed up in time or if the queue is closed and empty (check
+    // isClosed if you need to know which.)
+    template<typename Rep, typename Period>
+    bool pop(T& item, std::chrono::duration<Rep, Period> timeout) {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (!notEmpty.wait_for(lock, timeout, [this]{ return closed || !items.empty(); }) ||
+          items.empty()) {
+        return false;
+      }
+      item = std::move(items.front());
+      items.pop_front();
+      bool nowEmpty = items.empty();
+      lock.unlock();
+      notFull.notify_one();
+      if (nowEmpty) {
+        drained.notify_all();
+      }
+      return true;
+    }
+
+    // Gets an item if there is one, without waiting
+    bool tryPop(T& item) {
+      bool nowEmpty = false;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty()) {
+          return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        nowEmpty = items.empty();
+      }
+      notFull.notify_one();
+      if (nowEmpty) {
+        drained.notify_all();
+      }
+      return true;
+    }
+
+    // Stop accepting work and wake everyone up. Consumers will get
+    // whatever is left in the queue before pop returns false.
+    void close() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+      }
+      notEmpty.notify_all();
+      notFull.notify_all();
+    }
+
+    // Waits until consumers have taken everything out of the queue.
+    // (They may still be working on the last items.)
+    void waitUntilEmpty() {
+      std::unique_lock<std::mutex> lock(mutex);
+      drained.wait(lock, [this]{ return items.empty(); });
+    }
+
+    bool isClosed() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return closed;
+    }
+
+    size_t size() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return items.size();
+    }
+
+    bool empty() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return items.empty();
+    }
+
+    size_t getCapacity() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return capacity;
+    }
+
+    // Changing the capacity wakes up any producers that now have room
+    void setCapacity(size_t capacity) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->capacity = capacity;
+      }
+      notFull.notify_all();
+    }
+
+  private:
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::condition_variable drained;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+  };
+
+}
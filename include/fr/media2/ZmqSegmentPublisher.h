@@ -29,8 +29,10 @@
 #include <fr/media2/Stream.h>
 #include <fr/media2/StreamData.h>
 #include <fr/media2/SegmentSubscriber.h>
+#include <fr/media2/SegmentWire.h>
 #include <string>
 #include <uuid.h>
+#include <vector>
 #include <zmq.hpp>
 
 namespace fr::media2 {
@@ -45,6 +47,10 @@ namespace fr::media2 {
    *
    * Also, don't try to reuse the segment publisher for different streams,
    * just make a new one for each stream you want to send.
+   *
+   * Segments go out in the SegmentWire format. The header block is one
+   * message frame and each packet payload is its own frame, which zmq
+   * sends straight out of the packet's buffer without copying it.
    */
   
   class ZmqSegmentPublisher : public SegmentSubscriber {
@@ -56,7 +62,8 @@ namespace fr::media2 {
 
     // This can also be called manually to send a segment
     void process(const Segment::pointer&, StreamData::pointer) override;
-    // Or via stringstream/uuid
+    // Or via stringstream/uuid. The buffer is sent as-is, in one
+    // frame, so it can be in whatever format your subscriber expects.
     void process(std::stringstream&, uuid_t, AVMediaType mt = AVMEDIA_TYPE_UNKNOWN, int width = 0, int height = 0);
 
     // Set/Reset UUID -- forces publisher to use this uuid
@@ -67,6 +74,14 @@ namespace fr::media2 {
     uuid_t jobId;
     zmq::context_t context;
     zmq::socket_t publisher;
+    // Reused for each segment's header block
+    std::vector<uint8_t> headerBlock;
+
+    // Makes a message frame for a packet's payload. This points at the
+    // packet's buffer if it can.
+    zmq::message_t payloadMessage(const AVPacket& packet);
+    // zmq calls this when it's done with a payload frame
+    static void releaseBuffer(void* data, void* hint);
   };
 
 }
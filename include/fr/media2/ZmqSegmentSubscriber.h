@@ -19,6 +19,14 @@
  * It's up to subscribers to do something with the message.
  *
  * You can receive more than one stream with this object.
+ *
+ * Segments sent by ZmqSegmentPublisher arrive in the SegmentWire format.
+ * If you subscribe to segments, you get them decoded with their packets
+ * pointing straight into the received message frames. If you subscribe
+ * to receivedSegment, you get the frames copied into a stringstream in
+ * the contiguous SegmentWire layout (or whatever got sent, if it was
+ * sent as a stringstream.) Each is only done if something is subscribed
+ * to it.
  */
 
 #pragma once
@@ -29,10 +37,12 @@
 
 extern "C" {
 #include <libavutil/avutil.h>
+#include <libavutil/buffer.h>
 }
 
 #include <atomic>
 #include <boost/signals2.hpp>
+#include <fr/media2/Segment.h>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -62,6 +72,11 @@ namespace fr::media2 {
     // width and height will be 0 for audio streams
     boost::signals2::signal<void(std::stringstream&, uuid_t, AVMediaType, int, int)> receivedSegment;
 
+    // Subscribe to this signal to receive decoded segments (segment, uuid, mediatype,
+    // width, height). The packets reference the message they arrived in, so
+    // Segment::copy is cheap if you want to keep the segment.
+    boost::signals2::signal<void(const Segment::pointer&, uuid_t, AVMediaType, int, int)> segments;
+
   protected:
     std::atomic<bool> shutdownPlox = false;
     std::stringstream buffer;
@@ -70,6 +85,10 @@ namespace fr::media2 {
     std::thread processingThread;
   
     void processPrivately();
+    // Wraps a message frame in an AVBufferRef that owns it
+    static AVBufferRef* wrap(zmq::message_t&& message);
+    // Frees a message wrapped by wrap
+    static void releaseMessage(void* opaque, uint8_t* data);
     
   };
   
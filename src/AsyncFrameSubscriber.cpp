@@ -0,0 +1,93 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fr/media2/AsyncFrameSubscriber.h>
+#include <iostream>
+
+namespace fr::media2 {
+
+  AsyncFrameSubscriber::AsyncFrameSubscriber(size_t capacity, Backpressure policy) :
+    queue(capacity, policy) {
+    worker = std::thread([this]{ run(); });
+  }
+
+  AsyncFrameSubscriber::AsyncFrameSubscriber(FrameSource& source, FrameSubscriber& subscriber,
+                                             size_t capacity, Backpressure policy) :
+    AsyncFrameSubscriber(capacity, policy) {
+    subscribe(source);
+    subscriber.subscribe(this);
+  }
+
+  AsyncFrameSubscriber::~AsyncFrameSubscriber() {
+    close();
+  }
+
+  void AsyncFrameSubscriber::subscribeCallback(FrameSource* source) {
+    avcodec_parameters_copy(parameters, source->parameters);
+    time_base = source->time_base;
+    avg_frame_rate = source->avg_frame_rate;
+    r_frame_rate = source->r_frame_rate;
+  }
+
+  void AsyncFrameSubscriber::process(Frame::const_pointer frame, const StreamData::pointer& stream) {
+    Item item;
+    // Just a reference, the source can reuse its frame
+    item.frame = Frame::clone(frame);
+    item.stream = stream;
+    bool key = frame->key_frame;
+    queue.push(std::move(item), key, 0);
+  }
+
+  void AsyncFrameSubscriber::run() {
+    Item item;
+    while (queue.pop(item)) {
+      try {
+        frames(item.frame, item.stream);
+      } catch (std::exception& e) {
+        std::cerr << "AsyncFrameSubscriber: subscriber threw " << e.what() << std::endl;
+      }
+      item.frame.reset();
+      item.stream.reset();
+      queue.done();
+    }
+  }
+
+  void AsyncFrameSubscriber::flush() {
+    queue.waitUntilIdle();
+  }
+
+  void AsyncFrameSubscriber::close() {
+    unsubscribe();
+    queue.close();
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+
+  void AsyncFrameSubscriber::abort() {
+    unsubscribe();
+    queue.abort();
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+
+  BackpressureStats AsyncFrameSubscriber::stats() {
+    return queue.stats();
+  }
+
+}
@@ -0,0 +1,137 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fr/media2/AsyncPacketSubscriber.h>
+#include <iostream>
+#include <stdexcept>
+
+namespace fr::media2 {
+
+  AsyncPacketSubscriber::AsyncPacketSubscriber(size_t capacity, Backpressure policy) :
+    queue(capacity, policy) {
+    worker = std::thread([this]{ run(); });
+  }
+
+  AsyncPacketSubscriber::AsyncPacketSubscriber(Stream::pointer source, PacketSubscriber& subscriber,
+                                               size_t capacity, Backpressure policy) :
+    AsyncPacketSubscriber(capacity, policy) {
+    subscribe(source);
+    attach(source, subscriber);
+  }
+
+  AsyncPacketSubscriber::~AsyncPacketSubscriber() {
+    close();
+  }
+
+  void AsyncPacketSubscriber::subscribe(Stream::pointer to) {
+    auto out = std::make_shared<Stream>();
+    out->data = to->data;
+    int source = 0;
+    {
+      std::lock_guard<std::mutex> lock(outputsMutex);
+      source = outputs.size();
+      outputs.emplace_back(to, out);
+    }
+    Stream* output = out.get();
+    subscriptions.push_back(to->packets.connect(
+      [this, output, source](const Packet::pointer& packet, const StreamData::pointer&) {
+        Item item;
+        item.packet = Packet::copy(packet);
+        item.output = output;
+        bool key = packet->flags & AV_PKT_FLAG_KEY;
+        queue.push(std::move(item), key, source);
+      }));
+    subscriptions.push_back(to->events.connect(
+      [this, output, source](StreamEvent event, const StreamData::pointer&) {
+        Item item;
+        item.output = output;
+        item.isEvent = true;
+        item.event = event;
+        // Marked as a keyframe so the policies don't throw it away first
+        queue.push(std::move(item), true, source);
+      }));
+    subscribeCallback(to);
+  }
+
+  void AsyncPacketSubscriber::unsubscribe() {
+    PacketSubscriber::unsubscribe();
+    subscriptions.clear();
+  }
+
+  Stream::pointer AsyncPacketSubscriber::output(const Stream::pointer& source) {
+    std::lock_guard<std::mutex> lock(outputsMutex);
+    for (const auto& [in, out] : outputs) {
+      if (in == source) {
+        return out;
+      }
+    }
+    return Stream::pointer{};
+  }
+
+  void AsyncPacketSubscriber::attach(const Stream::pointer& source, PacketSubscriber& subscriber) {
+    Stream::pointer out = output(source);
+    if (!out) {
+      throw std::runtime_error("AsyncPacketSubscriber isn't subscribed to that stream");
+    }
+    subscriber.subscribe(out);
+  }
+
+  void AsyncPacketSubscriber::process(const Packet::pointer& packet, const StreamData::pointer& stream) {
+  }
+
+  void AsyncPacketSubscriber::run() {
+    Item item;
+    while (queue.pop(item)) {
+      try {
+        if (item.isEvent) {
+          item.output->forward(item.event);
+        } else {
+          item.output->packets(item.packet, item.output->data);
+        }
+      } catch (std::exception& e) {
+        std::cerr << "AsyncPacketSubscriber: subscriber threw " << e.what() << std::endl;
+      }
+      item.packet.reset();
+      queue.done();
+    }
+  }
+
+  void AsyncPacketSubscriber::flush() {
+    queue.waitUntilIdle();
+  }
+
+  void AsyncPacketSubscriber::close() {
+    unsubscribe();
+    queue.close();
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+
+  void AsyncPacketSubscriber::abort() {
+    unsubscribe();
+    queue.abort();
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+
+  BackpressureStats AsyncPacketSubscriber::stats() {
+    return queue.stats();
+  }
+
+}
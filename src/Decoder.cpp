@@ -19,34 +19,62 @@
 #include <fr/media2/Decoder.h>
 #include <fr/media2/Frame.h>
 #include <iostream>
+#include <stdexcept>
 
 namespace fr {
   namespace media2 {
 
     void Decoder::process(const Packet::pointer& packet,
-                          StreamData::pointer stream) {
+                          const StreamData::pointer& stream) {
       if (stream.get() && stream->context.get()) {
-        int avret = avcodec_send_packet(stream->context.get(),
-                                        packet.get());
-        while(avret >= 0) {
-          avret = avcodec_receive_frame(stream->context.get(),
-                                        workingFrame.get());
-          if (AVERROR(EAGAIN) == avret || AVERROR_EOF == avret) {
-            break;
-          } else if (avret >= 0) {
-            frames(workingFrame, stream);
-            av_frame_unref(workingFrame.get());
-          }
+        if (avcodec_send_packet(stream->context.get(), packet.get()) >= 0) {
+          receiveFrames(stream);
         }
       }
     }
 
+    void Decoder::streamEvent(StreamEvent event, const StreamData::pointer& stream) {
+      if (StreamEvent::endOfStream != event || !stream || !stream->context ||
+          !avcodec_is_open(stream->context.get())) {
+        return;
+      }
+      // A null packet drains the decoder
+      if (avcodec_send_packet(stream->context.get(), nullptr) >= 0) {
+        receiveFrames(stream);
+      }
+      // Drained decoders won't take any more packets until they're
+      // flushed, and the reader might seek back and play some more
+      avcodec_flush_buffers(stream->context.get());
+    }
+
+    void Decoder::receiveFrames(const StreamData::pointer& stream) {
+      while (true) {
+        int avret = avcodec_receive_frame(stream->context.get(), workingFrame.get());
+        if (avret < 0) {
+          // EAGAIN wants more packets and EOF means it's drained.
+          // A bad packet isn't worth stopping the stream for.
+          break;
+        }
+        frames(workingFrame, stream);
+        av_frame_unref(workingFrame.get());
+      }
+    }
+
     void Decoder::subscribeCallback(Stream::pointer to) {
-      if(to->data && to->data->stream) {
+      if (to->data && to->data->context && !avcodec_is_open(to->data->context.get())) {
+        if (!to->data->openDecoder(config)) {
+          throw std::runtime_error("Could not open decoder for " + to->data->filename);
+        }
+      }
+      if (to->data) {
+        // Streams made from segments don't have an AVStream, but
+        // they do have parameters and a time base
         avcodec_parameters_copy(parameters, to->data->parameters);
         time_base = to->data->time_base;
-        avg_frame_rate = to->data->stream->avg_frame_rate;
-        r_frame_rate = to->data->stream->r_frame_rate;
+        if (to->data->stream) {
+          avg_frame_rate = to->data->stream->avg_frame_rate;
+          r_frame_rate = to->data->stream->r_frame_rate;
+        }
       }
     }
   }
@@ -0,0 +1,71 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fr/media2/DecoderConfig.h>
+#include <fr/media2/FramePool.h>
+
+namespace fr::media2 {
+
+  void DecoderConfig::apply(AVCodecContext* context) const {
+    if (nullptr == context) {
+      return;
+    }
+    int type = (frameThreads ? FF_THREAD_FRAME : 0) | (sliceThreads ? FF_THREAD_SLICE : 0);
+    if (0 == type) {
+      context->thread_count = 1;
+    } else {
+      context->thread_count = threads;
+      context->thread_type = type;
+    }
+    context->skip_frame = skipFrame;
+    context->skip_loop_filter = skipLoopFilter;
+    if (pooledFrames) {
+      context->get_buffer2 = &FramePool::getBuffer2;
+    }
+  }
+
+  DecoderConfig DecoderConfig::preview() {
+    DecoderConfig config;
+    config.skipFrame = AVDISCARD_NONREF;
+    config.skipLoopFilter = AVDISCARD_ALL;
+    return config;
+  }
+
+  DecoderConfig DecoderConfig::lowLatency() {
+    DecoderConfig config;
+    config.threads = 0;
+    config.frameThreads = false;
+    return config;
+  }
+
+  DecoderConfig DecoderConfig::frameThreaded() {
+    DecoderConfig config;
+    config.threads = 0;
+    config.frameThreads = true;
+    config.sliceThreads = true;
+    return config;
+  }
+
+  DecoderConfig DecoderConfig::singleThreaded() {
+    DecoderConfig config;
+    config.threads = 1;
+    config.frameThreads = false;
+    config.sliceThreads = false;
+    return config;
+  }
+
+}
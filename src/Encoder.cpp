@@ -43,7 +43,7 @@ namespace fr::media2 {
   }
 
   void Encoder::process(Frame::const_pointer frame,
-                        StreamData::pointer streamIn) {
+                        const StreamData::pointer& streamIn) {
     if (0 == stream->data->context->time_base.den) {
       stream->data->context->time_base = streamIn->time_base;
     }
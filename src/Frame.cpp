@@ -17,6 +17,11 @@
  */
 
 #include <fr/media2/Frame.h>
+#include <fr/media2/FramePool.h>
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+}
 
 namespace fr {
   namespace media2 {
@@ -29,20 +34,20 @@ namespace fr {
       return Frame::pointer(av_frame_alloc(), &Frame::destroy);
     }
 
-    Frame::pointer create(int width,
-			 int height,
-			 AVPixelFormat fmt,
-			 int align) {
+    Frame::pointer Frame::create(int width,
+				 int height,
+				 AVPixelFormat fmt,
+				 int align) {
       Frame::pointer retval{Frame::create()};
       retval->width = width;
       retval->height = height;
       retval->format = fmt;
-      av_frame_get_buffer(retval.get(), align);
+      FramePool::instance().get(retval.get(), align);
       return retval;
     }
 
-    Frame::pointer create(int64_t layout, AVSampleFormat format, int rate,
-			  int align) {
+    Frame::pointer Frame::create(int64_t layout, AVSampleFormat format, int rate,
+				 int align) {
       Frame::pointer retval{Frame::create()};
       retval->channel_layout = layout;
       retval->format = format;
@@ -50,8 +55,20 @@ namespace fr {
       av_frame_get_buffer(retval.get(), align);
       return retval;
     }
+
+    Frame::pointer Frame::create(int64_t layout, AVSampleFormat format, int rate,
+				 int nbSamples, int align) {
+      Frame::pointer retval{Frame::create()};
+      retval->channel_layout = layout;
+      retval->channels = av_get_channel_layout_nb_channels(layout);
+      retval->format = format;
+      retval->sample_rate = rate;
+      retval->nb_samples = nbSamples;
+      FramePool::instance().get(retval.get(), align);
+      return retval;
+    }
     
-    Frame::pointer clone(Frame::const_pointer copy) {
+    Frame::pointer Frame::clone(Frame::const_pointer copy) {
       return Frame::pointer(av_frame_clone(copy.get()), &Frame::destroy);
     }
   }
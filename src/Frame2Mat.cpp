@@ -16,26 +16,114 @@
  */
 
 #include <fr/media2/Frame2Mat.h>
+#include <stdexcept>
 
 namespace fr {
   namespace media2 {
 
-    void process(Frame::const_pointer frame, StreamData::pointer stream) {
+    namespace {
+
+      // Lets a mat own a reference to an AVBufferRef. OpenCV calls
+      // deallocate when the last mat sharing the data goes away, and
+      // that's where we let go of the buffer. Anything that asks this
+      // allocator for new memory (say, calling create on the mat with
+      // a different size) just gets OpenCV's usual allocator.
+      class AVBufferAllocator : public cv::MatAllocator {
+      public:
+#if CV_VERSION_MAJOR >= 4
+	using Access = cv::AccessFlag;
+#else
+	using Access = int;
+#endif
+
+	cv::UMatData* wrap(AVBufferRef* buffer, uint8_t* data, size_t size) const {
+	  cv::UMatData* u = new cv::UMatData(this);
+	  u->data = u->origdata = data;
+	  u->size = size;
+	  u->userdata = buffer;
+	  u->refcount = 1;
+	  return u;
+	}
+
+	cv::UMatData* allocate(int dims, const int* sizes, int type, void* data,
+			       size_t* step, Access flags,
+			       cv::UMatUsageFlags usageFlags) const override {
+	  return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+	}
+
+	bool allocate(cv::UMatData* data, Access accessFlags,
+		      cv::UMatUsageFlags usageFlags) const override {
+	  return cv::Mat::getStdAllocator()->allocate(data, accessFlags, usageFlags);
+	}
+
+	void deallocate(cv::UMatData* u) const override {
+	  if (nullptr == u) {
+	    return;
+	  }
+	  AVBufferRef* buffer = static_cast<AVBufferRef*>(u->userdata);
+	  av_buffer_unref(&buffer);
+	  delete u;
+	}
+      };
+
+      AVBufferAllocator& allocator() {
+	// Mats can outlive just about anything, so this never goes away
+	static AVBufferAllocator* instance = new AVBufferAllocator();
+	return *instance;
+      }
+
+    }
+
+    Frame2Mat::Frame2Mat(bool zeroCopy) : zeroCopy(zeroCopy) {
+    }
+
+    Frame2Mat::~Frame2Mat() {
+    }
+
+    cv::Mat Frame2Mat::wrap(const AVFrame* frame) {
+      AVBufferRef* owner = frame->buf[0];
+      size_t size = size_t(frame->linesize[0]) * frame->height;
+      // The picture has to be in the buffer we're holding on to
+      if (nullptr == owner || frame->linesize[0] <= 0 || frame->data[0] < owner->data ||
+	  frame->data[0] + size > owner->data + owner->size) {
+	cv::Mat raw(frame->height, frame->width, CV_8UC3, frame->data[0], frame->linesize[0]);
+	return raw.clone();
+      }
+      AVBufferRef* buffer = av_buffer_ref(owner);
+      if (nullptr == buffer) {
+	throw std::runtime_error("Could not reference frame buffer");
+      }
+      cv::Mat mat(frame->height, frame->width, CV_8UC3, frame->data[0], frame->linesize[0]);
+      mat.allocator = &allocator();
+      mat.u = allocator().wrap(buffer, frame->data[0], size);
+      return mat;
+    }
+
+    void Frame2Mat::process(Frame::const_pointer frame, const StreamData::pointer& stream) {
       if (AV_PIX_FMT_BGR24 != frame->format) {
 	if (nullptr == bgrScaler.get()) {
 	  bgrScaler = std::make_unique<Scaler>(frame->width, frame->height, AV_PIX_FMT_BGR24);
 	  bgrScaler->subscribe(this);
+	  // Scaler output frames are new ones from the pool that nobody
+	  // else is holding on to
+	  bgrScaler->frames.connect([this](Frame::const_pointer bgr, const StreamData::pointer& stream) {
+	    processBgr(bgr, stream, true);
+	  });
 	}
 	// Request conversion to correct pixformat
 	frames(frame, stream);
       } else {
 	// Forward BGR frames for mat conversion
-	processBgr(frame, stream);
+	processBgr(frame, stream, false);
       }
     }
 
-    void processBgr(Frame::const_pointer frame, StreamData::pointer stream) {
-      cv::Mat rawMat(frame->width, frame->height, CV_8UC3, frame->data[0],
+    void Frame2Mat::processBgr(Frame::const_pointer frame, const StreamData::pointer& stream, bool owned) {
+      if (zeroCopy && owned) {
+	mats(wrap(frame.get()));
+	return;
+      }
+      cv::Mat rawMat(frame->height, frame->width, CV_8UC3, frame->data[0],
 		     frame->linesize[0]);
       cv::Mat copied;
       rawMat.copyTo(copied);
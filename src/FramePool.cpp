@@ -0,0 +1,244 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fr/media2/FramePool.h>
+#include <stdexcept>
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/common.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+namespace fr::media2 {
+
+  // What av_frame_get_buffer uses when you don't give it an alignment
+  static constexpr int defaultAlign = 64;
+
+  FramePool& FramePool::instance() {
+    // Never destroyed, for the same reason as PacketPool. Frames can
+    // outlive everything else during static destruction.
+    static FramePool* pool = new FramePool();
+    return *pool;
+  }
+
+  FramePool::~FramePool() {
+    for (auto& [key, entry] : pools) {
+      av_buffer_pool_uninit(&entry.pool);
+    }
+  }
+
+  AVBufferRef* FramePool::buffer(const Key& key, size_t size) {
+    // The buffer has to come out while we still hold the lock, or
+    // another thread could evict the pool out from under us
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = pools.find(key);
+    if (found == pools.end()) {
+      evict(maxPools > 0 ? maxPools - 1 : 0);
+      AVBufferPool* pool = av_buffer_pool_init2(size, this, &FramePool::poolAlloc, nullptr);
+      if (nullptr == pool) {
+        return nullptr;
+      }
+      found = pools.emplace(key, Entry{pool, 0}).first;
+    }
+    found->second.lastUse = ++uses;
+    requests++;
+    return av_buffer_pool_get(found->second.pool);
+  }
+
+  void FramePool::evict(size_t keep) {
+    while (pools.size() > keep) {
+      auto oldest = pools.begin();
+      for (auto it = pools.begin(); it != pools.end(); ++it) {
+        if (it->second.lastUse < oldest->second.lastUse) {
+          oldest = it;
+        }
+      }
+      // LibAV holds off freeing the pool until its buffers come back
+      av_buffer_pool_uninit(&oldest->second.pool);
+      pools.erase(oldest);
+    }
+  }
+
+  void FramePool::setMaxPools(size_t maxPools) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->maxPools = maxPools;
+    evict(maxPools);
+  }
+
+  size_t FramePool::getMaxPools() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return maxPools;
+  }
+
+  template<typename Size>
+  AVBufferRef* FramePool::poolAlloc(void* opaque, Size size) {
+    static_cast<FramePool*>(opaque)->misses++;
+    return av_buffer_alloc(size);
+  }
+
+  int FramePool::getVideo(AVFrame* frame, int width, int height, AVPixelFormat format, int align) {
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+    if (nullptr == desc || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL) || width <= 0 || height <= 0) {
+      return AVERROR(EINVAL);
+    }
+    if (align <= 0) {
+      align = defaultAlign;
+    }
+    // Same padding av_frame_get_buffer uses, so SIMD code that reads a
+    // little past the end of a line (or the last line) is safe
+    int linesize[4] = {0, 0, 0, 0};
+    int ret = 0;
+    for (int padded = FFALIGN(width, align); padded <= width + 4 * align; padded += align) {
+      ret = av_image_fill_linesizes(linesize, format, padded);
+      if (ret < 0) {
+        return ret;
+      }
+      bool aligned = true;
+      for (int i = 0; i < 4; ++i) {
+        aligned = aligned && 0 == linesize[i] % align;
+      }
+      if (aligned) {
+        break;
+      }
+    }
+    int paddedHeight = FFALIGN(height, 32);
+    uint8_t* pointers[4] = {nullptr, nullptr, nullptr, nullptr};
+    int size = av_image_fill_pointers(pointers, format, paddedHeight, nullptr, linesize);
+    if (size < 0) {
+      return size;
+    }
+    size += 16 + align - 1;
+
+    AVBufferRef* buf = buffer(Key{0, width, height, format, align}, size);
+    if (nullptr == buf) {
+      return AVERROR(ENOMEM);
+    }
+    uint8_t* base = (uint8_t*) FFALIGN((uintptr_t) buf->data, (uintptr_t) align);
+    av_image_fill_pointers(frame->data, format, paddedHeight, base, linesize);
+    for (int i = 0; i < 4; ++i) {
+      frame->linesize[i] = linesize[i];
+    }
+    frame->buf[0] = buf;
+    frame->extended_data = frame->data;
+    return 0;
+  }
+
+  int FramePool::getAudio(AVFrame* frame, int64_t layout, int channels, AVSampleFormat format,
+                          int nbSamples, int align) {
+    if (0 == channels && 0 != layout) {
+      channels = av_get_channel_layout_nb_channels(layout);
+    }
+    if (channels <= 0 || nbSamples <= 0 || format < 0) {
+      return AVERROR(EINVAL);
+    }
+    int planes = av_sample_fmt_is_planar(format) ? channels : 1;
+    // The extra planes would need their own array. Not worth pooling.
+    if (planes > AV_NUM_DATA_POINTERS) {
+      return AVERROR(ENOSYS);
+    }
+    if (align <= 0) {
+      align = defaultAlign;
+    }
+    int linesize = 0;
+    int size = av_samples_get_buffer_size(&linesize, channels, nbSamples, format, align);
+    if (size < 0) {
+      return size;
+    }
+    AVBufferRef* buf = buffer(Key{1, layout ? layout : channels, nbSamples, format, align}, size + align);
+    if (nullptr == buf) {
+      return AVERROR(ENOMEM);
+    }
+    uint8_t* base = (uint8_t*) FFALIGN((uintptr_t) buf->data, (uintptr_t) align);
+    int ret = av_samples_fill_arrays(frame->data, &linesize, base, channels, nbSamples, format, align);
+    if (ret < 0) {
+      av_buffer_unref(&buf);
+      return ret;
+    }
+    frame->linesize[0] = linesize;
+    frame->buf[0] = buf;
+    frame->extended_data = frame->data;
+    return 0;
+  }
+
+  int FramePool::get(AVFrame* frame, int align) {
+    int ret = AVERROR(EINVAL);
+    if (frame->width > 0 && frame->height > 0) {
+      ret = getVideo(frame, frame->width, frame->height, (AVPixelFormat) frame->format, align);
+    } else if (frame->nb_samples > 0) {
+      ret = getAudio(frame, frame->channel_layout, frame->channels, (AVSampleFormat) frame->format,
+                     frame->nb_samples, align);
+    }
+    if (ret < 0) {
+      fallbacks++;
+      ret = av_frame_get_buffer(frame, align);
+    }
+    return ret;
+  }
+
+  int FramePool::getBuffer2(AVCodecContext* context, AVFrame* frame, int flags) {
+    FramePool& pool = instance();
+    // Without DR1 the decoder can't use buffers it didn't allocate
+    if (nullptr == context->codec || !(context->codec->capabilities & AV_CODEC_CAP_DR1)) {
+      pool.fallbacks++;
+      return avcodec_default_get_buffer2(context, frame, flags);
+    }
+    int ret = AVERROR(EINVAL);
+    if (AVMEDIA_TYPE_VIDEO == context->codec_type) {
+      // Decoders want a bit of room around the picture for motion
+      // vectors that point outside it
+      int width = frame->width;
+      int height = frame->height;
+      int linesizeAlign[AV_NUM_DATA_POINTERS];
+      avcodec_align_dimensions2(context, &width, &height, linesizeAlign);
+      ret = pool.getVideo(frame, width, height, (AVPixelFormat) frame->format);
+    } else if (AVMEDIA_TYPE_AUDIO == context->codec_type) {
+      ret = pool.getAudio(frame, frame->channel_layout, frame->channels,
+                          (AVSampleFormat) frame->format, frame->nb_samples);
+    }
+    if (ret < 0) {
+      pool.fallbacks++;
+      return avcodec_default_get_buffer2(context, frame, flags);
+    }
+    return 0;
+  }
+
+  FramePool::Stats FramePool::stats() {
+    Stats ret;
+    ret.misses = misses;
+    uint64_t total = requests;
+    ret.hits = total > ret.misses ? total - ret.misses : 0;
+    ret.fallbacks = fallbacks;
+    std::lock_guard<std::mutex> lock(mutex);
+    ret.pools = pools.size();
+    return ret;
+  }
+
+  void FramePool::resetStats() {
+    requests = 0;
+    misses = 0;
+    fallbacks = 0;
+  }
+
+}
+
+std::ostream& operator<<(std::ostream& o, const fr::media2::FramePool::Stats& stats) {
+  o << "FramePool: " << stats.hits << " hits, " << stats.misses << " misses, "
+    << stats.fallbacks << " fallbacks, " << stats.pools << " pools";
+  return o;
+}
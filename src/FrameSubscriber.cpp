@@ -35,8 +35,8 @@ namespace fr {
     }
 
     void FrameSubscriber::subscribe(FrameSource *source) {
-      boost::signals2::connection subscription = source->frames.connect(
-	 [this](Frame::const_pointer frame, StreamData::pointer stream) {
+      Connection subscription = source->frames.connect(
+	 [this](Frame::const_pointer frame, const StreamData::pointer& stream) {
 	   this->process(frame, stream);
 	 });
       subscriptions.push_back(subscription);
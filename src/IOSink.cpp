@@ -0,0 +1,237 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fr/media2/IOSink.h>
+
+extern "C" {
+#include <libavutil/avutil.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace fr::media2 {
+
+  namespace {
+
+    int writeDataType(void* opaque, uint8_t* buffer, int size, AVIODataMarkerType type, int64_t time) {
+      return ((IOSink*) opaque)->write(buffer, size, type, time);
+    }
+
+    // Only used if write_data_type isn't, which it always is, but
+    // avio_alloc_context wants one to know it's for writing
+    int writePacket(void* opaque, uint8_t* buffer, int size) {
+      return ((IOSink*) opaque)->write(buffer, size, AVIO_DATA_MARKER_UNKNOWN, AV_NOPTS_VALUE);
+    }
+
+    int64_t seekPacket(void* opaque, int64_t offset, int whence) {
+      return ((IOSink*) opaque)->seek(offset, whence);
+    }
+
+    // True if data of type starts a new chunk after one that started
+    // with current
+    bool startsChunk(AVIODataMarkerType type, AVIODataMarkerType current) {
+      switch (type) {
+      case AVIO_DATA_MARKER_SYNC_POINT:
+      case AVIO_DATA_MARKER_BOUNDARY_POINT:
+        return true;
+      case AVIO_DATA_MARKER_HEADER:
+      case AVIO_DATA_MARKER_TRAILER:
+        return type != current;
+      default:
+        return false;
+      }
+    }
+
+  }
+
+  int64_t IOSink::seek(int64_t, int) {
+    return AVERROR(ENOSYS);
+  }
+
+  bool IOSink::seekable() const {
+    return false;
+  }
+
+  void IOSink::flush() {
+  }
+
+  std::string IOSink::name() const {
+    return "custom";
+  }
+
+  AVIOContext* IOSink::createContext(IOSink* sink) {
+    int size = sink->bufferSize > 0 ? sink->bufferSize : 4096;
+    uint8_t* buffer = (uint8_t*) av_malloc(size);
+    if (nullptr == buffer) {
+      return nullptr;
+    }
+    AVIOContext* context = avio_alloc_context(buffer, size, 1, sink, nullptr, &writePacket,
+                                              sink->seekable() ? &seekPacket : nullptr);
+    if (nullptr == context) {
+      av_free(buffer);
+      return nullptr;
+    }
+    context->write_data_type = &writeDataType;
+    if (!sink->seekable()) {
+      context->seekable = 0;
+    }
+    return context;
+  }
+
+  void IOSink::freeContext(AVIOContext** context) {
+    if (nullptr == *context) {
+      return;
+    }
+    av_freep(&(*context)->buffer);
+    avio_context_free(context);
+  }
+
+  MemorySink::MemorySink(const std::string& name) : sinkName(name) {
+  }
+
+  int MemorySink::write(const uint8_t* data, int size, AVIODataMarkerType, int64_t) {
+    if (size <= 0) {
+      return 0;
+    }
+    size_t end = position + size;
+    if (end > storage.size()) {
+      // Doubling, so a growing output doesn't reallocate on every write
+      storage.resize(std::max(end, storage.size() * 2));
+    }
+    memcpy(storage.data() + position, data, size);
+    position = end;
+    length = std::max(length, end);
+    return size;
+  }
+
+  int64_t MemorySink::seek(int64_t offset, int whence) {
+    int64_t target;
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+      return length;
+    case SEEK_SET:
+      target = offset;
+      break;
+    case SEEK_CUR:
+      target = position + offset;
+      break;
+    case SEEK_END:
+      target = length + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+    }
+    if (target < 0) {
+      return AVERROR(EINVAL);
+    }
+    // Seeking past the end and writing leaves a gap of zeros, like a
+    // file would
+    if ((size_t) target > length) {
+      if ((size_t) target > storage.size()) {
+        storage.resize(target);
+      }
+      std::fill(storage.begin() + length, storage.begin() + target, 0);
+      length = target;
+    }
+    position = target;
+    return target;
+  }
+
+  bool MemorySink::seekable() const {
+    return true;
+  }
+
+  std::string MemorySink::name() const {
+    return sinkName;
+  }
+
+  std::span<const uint8_t> MemorySink::data() const {
+    return std::span<const uint8_t>(storage.data(), length);
+  }
+
+  size_t MemorySink::size() const {
+    return length;
+  }
+
+  void MemorySink::clear() {
+    length = 0;
+    position = 0;
+  }
+
+  ChunkSink::ChunkSink(ChunkFunction callback, size_t maxChunk, const std::string& name) :
+    callback(std::move(callback)), maxChunk(maxChunk), sinkName(name) {
+  }
+
+  int ChunkSink::write(const uint8_t* data, int size, AVIODataMarkerType type, int64_t time) {
+    if (size <= 0) {
+      return 0;
+    }
+    if (!pending.empty() && (startsChunk(type, pendingType) ||
+                             (maxChunk > 0 && pending.size() >= maxChunk))) {
+      emit();
+    }
+    if (pending.empty()) {
+      // A chunk is whatever kind of data it starts with
+      pendingType = type;
+      pendingTime = time;
+    }
+    pending.insert(pending.end(), data, data + size);
+    return size;
+  }
+
+  void ChunkSink::flush() {
+    emit();
+  }
+
+  void ChunkSink::emit() {
+    if (pending.empty()) {
+      return;
+    }
+    Chunk chunk;
+    chunk.data = std::span<const uint8_t>(pending.data(), pending.size());
+    chunk.type = pendingType;
+    chunk.time = pendingTime;
+    chunk.offset = offset;
+    if (callback) {
+      callback(chunk);
+    }
+    offset += pending.size();
+    sent++;
+    // clear keeps the capacity, so the next chunk reuses it
+    pending.clear();
+    pendingType = AVIO_DATA_MARKER_UNKNOWN;
+    pendingTime = AV_NOPTS_VALUE;
+  }
+
+  std::string ChunkSink::name() const {
+    return sinkName;
+  }
+
+  uint64_t ChunkSink::chunks() const {
+    return sent;
+  }
+
+  uint64_t ChunkSink::bytes() const {
+    return offset;
+  }
+
+}
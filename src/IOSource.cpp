@@ -0,0 +1,264 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fr/media2/IOSource.h>
+
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fr::media2 {
+
+  namespace {
+
+    int readPacket(void* opaque, uint8_t* buffer, int size) {
+      return ((IOSource*) opaque)->read(buffer, size);
+    }
+
+    int64_t seekPacket(void* opaque, int64_t offset, int whence) {
+      return ((IOSource*) opaque)->seek(offset, whence);
+    }
+
+    // Where a seek ends up, for sources that know their position and
+    // size. Returns -1 if it's out of range.
+    int64_t seekTarget(int64_t offset, int whence, int64_t position, int64_t size) {
+      int64_t target;
+      switch (whence & ~AVSEEK_FORCE) {
+      case SEEK_SET:
+        target = offset;
+        break;
+      case SEEK_CUR:
+        target = position + offset;
+        break;
+      case SEEK_END:
+        target = size + offset;
+        break;
+      default:
+        return -1;
+      }
+      return (target < 0 || target > size) ? -1 : target;
+    }
+
+  }
+
+  int64_t IOSource::seek(int64_t, int) {
+    return AVERROR(ENOSYS);
+  }
+
+  bool IOSource::seekable() const {
+    return false;
+  }
+
+  std::string IOSource::name() const {
+    return "custom";
+  }
+
+  std::string IOSource::cacheKey() const {
+    return std::string{};
+  }
+
+  AVIOContext* IOSource::createContext(IOSource* source) {
+    int size = source->bufferSize > 0 ? source->bufferSize : 4096;
+    uint8_t* buffer = (uint8_t*) av_malloc(size);
+    if (nullptr == buffer) {
+      return nullptr;
+    }
+    AVIOContext* context = avio_alloc_context(buffer, size, 0, source, &readPacket, nullptr,
+                                              source->seekable() ? &seekPacket : nullptr);
+    if (nullptr == context) {
+      av_free(buffer);
+      return nullptr;
+    }
+    if (!source->seekable()) {
+      context->seekable = 0;
+    }
+    return context;
+  }
+
+  void IOSource::freeContext(AVIOContext** context) {
+    if (nullptr == *context) {
+      return;
+    }
+    // LibAV may have swapped the buffer out for a different one
+    av_freep(&(*context)->buffer);
+    avio_context_free(context);
+  }
+
+  MemorySource::MemorySource(std::span<const uint8_t> data, std::shared_ptr<const void> owner,
+                             const std::string& name) :
+    bytes(data), owner(owner), sourceName(name) {
+  }
+
+  MemorySource::MemorySource(const uint8_t* data, size_t size, std::shared_ptr<const void> owner,
+                             const std::string& name) :
+    MemorySource(std::span<const uint8_t>(data, size), owner, name) {
+  }
+
+  MemorySource::MemorySource(const std::string& name) : sourceName(name) {
+  }
+
+  int MemorySource::read(uint8_t* buffer, int size) {
+    size_t count = std::min(bytes.size() - position, (size_t) std::max(size, 0));
+    if (0 == count) {
+      return AVERROR_EOF;
+    }
+    memcpy(buffer, bytes.data() + position, count);
+    position += count;
+    return (int) count;
+  }
+
+  int64_t MemorySource::seek(int64_t offset, int whence) {
+    if (AVSEEK_SIZE == whence) {
+      return bytes.size();
+    }
+    int64_t target = seekTarget(offset, whence, position, bytes.size());
+    if (target < 0) {
+      return AVERROR(EINVAL);
+    }
+    position = target;
+    return target;
+  }
+
+  bool MemorySource::seekable() const {
+    return true;
+  }
+
+  std::string MemorySource::name() const {
+    return sourceName;
+  }
+
+  std::span<const uint8_t> MemorySource::data() const {
+    return bytes;
+  }
+
+  MmapSource::MmapSource(const std::string& path) : MemorySource(path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      throw std::runtime_error("Could not open " + path + ": " + strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      std::string err = strerror(errno);
+      close(fd);
+      throw std::runtime_error("Could not stat " + path + ": " + err);
+    }
+    // Can't map nothing, but an empty source is fine
+    if (st.st_size > 0) {
+      void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (MAP_FAILED == data) {
+        std::string err = strerror(errno);
+        close(fd);
+        throw std::runtime_error("Could not map " + path + ": " + err);
+      }
+      // Demuxers mostly read straight through
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      bytes = std::span<const uint8_t>((const uint8_t*) data, st.st_size);
+    }
+    // The mapping doesn't need it
+    close(fd);
+  }
+
+  MmapSource::~MmapSource() {
+    if (!bytes.empty()) {
+      munmap((void*) bytes.data(), bytes.size());
+    }
+  }
+
+  std::string MmapSource::cacheKey() const {
+    return sourceName;
+  }
+
+  FileDescriptorSource::FileDescriptorSource(int fd, bool owned, const std::string& name) :
+    fd(fd), owned(owned), sourceName(name) {
+    struct stat st;
+    canSeek = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  }
+
+  FileDescriptorSource::~FileDescriptorSource() {
+    if (owned) {
+      close(fd);
+    }
+  }
+
+  int FileDescriptorSource::read(uint8_t* buffer, int size) {
+    while (true) {
+      ssize_t count = ::read(fd, buffer, size);
+      if (count > 0) {
+        return (int) count;
+      } else if (0 == count) {
+        return AVERROR_EOF;
+      } else if (EINTR != errno) {
+        return AVERROR(errno);
+      }
+    }
+  }
+
+  int64_t FileDescriptorSource::seek(int64_t offset, int whence) {
+    if (!canSeek) {
+      return AVERROR(ESPIPE);
+    }
+    if (AVSEEK_SIZE == whence) {
+      struct stat st;
+      return fstat(fd, &st) < 0 ? AVERROR(errno) : st.st_size;
+    }
+    off_t ret = lseek(fd, offset, whence & ~AVSEEK_FORCE);
+    return ret < 0 ? AVERROR(errno) : ret;
+  }
+
+  bool FileDescriptorSource::seekable() const {
+    return canSeek;
+  }
+
+  std::string FileDescriptorSource::name() const {
+    return sourceName;
+  }
+
+  CallbackSource::CallbackSource(ReadFunction read, SeekFunction seek, const std::string& name) :
+    readFunction(std::move(read)), seekFunction(std::move(seek)), sourceName(name) {
+    if (!readFunction) {
+      throw std::logic_error("CallbackSource needs a read function");
+    }
+  }
+
+  int CallbackSource::read(uint8_t* buffer, int size) {
+    return readFunction(buffer, size);
+  }
+
+  int64_t CallbackSource::seek(int64_t offset, int whence) {
+    return seekFunction ? seekFunction(offset, whence) : AVERROR(ENOSYS);
+  }
+
+  bool CallbackSource::seekable() const {
+    return (bool) seekFunction;
+  }
+
+  std::string CallbackSource::name() const {
+    return sourceName;
+  }
+
+}
@@ -17,6 +17,12 @@
  */
 
 #include <fr/media2/Muxer.h>
+
+extern "C" {
+#include <libavutil/dict.h>
+}
+
+#include <algorithm>
 #include <iostream>
 
 namespace fr::media2 {
@@ -25,6 +31,20 @@ namespace fr::media2 {
     filename(filename),
     format(format),
     bufferMax(bufferMax) {
+    allocateContext();
+    open();
+  }
+
+  Muxer::Muxer(IOSink::pointer sink, std::string format, long bufferMax) :
+    format(format),
+    filename(sink->name()),
+    sink(sink),
+    bufferMax(bufferMax) {
+    allocateContext();
+    open();
+  }
+
+  void Muxer::allocateContext() {
     if (!format.empty()) {
       avformat_alloc_output_context2(&context, nullptr, format.c_str(), filename.c_str());
       if (nullptr == context) {
@@ -42,7 +62,6 @@ namespace fr::media2 {
         throw std::runtime_error(err);
       }
     }
-    open();
   }
 
   Muxer::~Muxer() {
@@ -56,6 +75,10 @@ namespace fr::media2 {
   }
 
   void Muxer::subscribe(Stream::pointer to) {
+    // Streams can show up from other threads while packets are already
+    // being written (SegmentUnpacker workers do this), so this all
+    // happens under the same lock as writing does
+    std::lock_guard<std::mutex> lock(bufferMutex);
     if (!streamStart) {
       // This is an ffmpeg thing -- if you try to add a stream after the
       // muxer has started writing, some stuff in the second stream will
@@ -63,8 +86,6 @@ namespace fr::media2 {
       throw std::runtime_error("Can not add a new stream after muxer has written its header.");
     }
     auto info = std::make_shared<StreamInfo>(this);
-    info->subscribe(to);
-    streaminfo.push_back(info);
     info->stream = avformat_new_stream(context, to->data->codec);
     if (nullptr == info->stream) {
       throw std::runtime_error("Error creating new stream");
@@ -73,6 +94,12 @@ namespace fr::media2 {
     info->stream->avg_frame_rate = to->data->avg_frame_rate;
     info->stream->r_frame_rate = to->data->r_frame_rate;
     avcodec_parameters_copy(info->stream->codecpar, to->data->parameters);
+    if (interleaver) {
+      interleaver->addStream(info->stream->index);
+    }
+    streaminfo.push_back(info);
+    // Last, so packets don't show up before the output stream's ready
+    info->subscribe(to);
   }
 
   void Muxer::unsubscribe() {
@@ -88,7 +115,15 @@ namespace fr::media2 {
 
   void Muxer::open() {
     if (state != States::OPEN) {
-      if (!(context->flags & AVFMT_NOFILE)) {
+      if (sink) {
+        ioContext = IOSink::createContext(sink.get());
+        if (nullptr == ioContext) {
+          state = States::ERROR;
+          throw std::runtime_error("Error allocating IO context for " + filename);
+        }
+        context->pb = ioContext;
+        context->flags |= AVFMT_FLAG_CUSTOM_IO;
+      } else if (!(context->flags & AVFMT_NOFILE)) {
         int avRet = avio_open(&context->pb, filename.c_str(), AVIO_FLAG_WRITE);
         if (avRet < 0) {
           std::string err("Error opening ");
@@ -106,6 +141,10 @@ namespace fr::media2 {
   void Muxer::close() {
     flush();
     if (state == States::OPEN) {
+      if (!streamStart && fragmented && fragmentPackets > 0) {
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        finishFragment();
+      }
       if (! streamStart) {
         // Flush yaddda
         av_interleaved_write_frame(context, nullptr);
@@ -114,28 +153,44 @@ namespace fr::media2 {
         // segv
         av_write_trailer(context);
       }
-      if (!(context->flags & AVFMT_NOFILE)) {
+      if (sink) {
+        avio_flush(context->pb);
+        context->pb = nullptr;
+        IOSink::freeContext(&ioContext);
+        // Whatever the sink is still holding goes out now
+        sink->flush();
+      } else if (!(context->flags & AVFMT_NOFILE)) {
         avio_closep(&context->pb);
       }
       state = States::CLOSED;
       streamStart = true;
+      fragmentSequence = 0;
+      fragmentOffset = 0;
     }
   }
 
-  void Muxer::process(const Packet::pointer& packet, StreamData::pointer stream) {
+  void Muxer::process(const Packet::pointer& packet, const StreamData::pointer& stream) {
     throw std::runtime_error("Wrong process method called.");
   }
 
   void Muxer::write(Packet::pointer &packet) {
+    if (streamStart && context->nb_streams < expectedStreams) {
+      // Not everyone's subscribed yet, and nobody can be added once the
+      // header's out, so this waits for the header
+      held.push_back(std::move(packet));
+      return;
+    }
     // Write header if we haven't yet
     if (streamStart) {
-      streamStart = false;
-      int avRet = avformat_write_header(context, nullptr);
-      if (avRet < 0) {
-        throw std::runtime_error("Could not write media header.");
-      }
+      writeHeader();
+    }
+    if (fragmented) {
+      trackFragment(packet.get());
     }
-    int avRet = av_interleaved_write_frame(context, packet.get());
+    // The interleaver already has packets in order, so there's no
+    // need for LibAV to buffer them again
+    int avRet = interleaver ? av_write_frame(context, packet.get())
+      : av_interleaved_write_frame(context, packet.get());
     if (avRet < 0) {
       std::string err{"Error writing packet. RC = "};
       err.append(std::to_string(avRet));
@@ -143,8 +198,150 @@ namespace fr::media2 {
     }
   }
 
+  void Muxer::writeHeader() {
+    streamStart = false;
+    AVDictionary* headerOptions = nullptr;
+    for (const auto& [key, value] : options) {
+      av_dict_set(&headerOptions, key.c_str(), value.c_str(), 0);
+    }
+    int avRet = avformat_write_header(context, &headerOptions);
+    av_dict_free(&headerOptions);
+    if (avRet < 0) {
+      throw std::runtime_error("Could not write media header.");
+    }
+    if (fragmented) {
+      writeInit();
+    }
+    // Anything that was waiting on the header came out of the
+    // interleaver first, so it goes first
+    while (!held.empty()) {
+      Packet::pointer pkt = std::move(held.front());
+      held.pop_front();
+      write(pkt);
+    }
+  }
+
+  void Muxer::setInterleaving(int64_t maxDelta, size_t streams) {
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    if (!streamStart) {
+      throw std::runtime_error("Can not switch to interleaving after muxer has written its header.");
+    }
+    interleaver = std::make_unique<PacketInterleaver>([this](Packet::pointer& packet) {
+      std::lock_guard<std::mutex> lock(bufferMutex);
+      write(packet);
+    }, maxDelta);
+    expectedStreams = streams;
+    // Output streams are numbered in the order they subscribe, so the
+    // ones that haven't yet can be waited for already
+    for (size_t i = 0; i < streams; ++i) {
+      interleaver->addStream(i);
+    }
+    for (const auto& info : streaminfo) {
+      interleaver->addStream(info->stream->index);
+    }
+  }
+
+  PacketInterleaver::Stats Muxer::interleavingStats() {
+    return interleaver ? interleaver->stats() : PacketInterleaver::Stats{};
+  }
+
+  void Muxer::setFragmented(int64_t minDuration) {
+    if (!streamStart) {
+      throw std::runtime_error("Can not switch to fragmented output after muxer has written its header.");
+    }
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    fragmented = true;
+    fragmentMinDuration = minDuration;
+    // frag_custom means mov only writes a fragment when we tell it to,
+    // so we know exactly when each one is done
+    options["movflags"] = "frag_custom+empty_moov+default_base_moof";
+  }
+
+  bool Muxer::isFragmented() const {
+    return fragmented;
+  }
+
+  void Muxer::writeInit() {
+    fragmentStream = -1;
+    for (unsigned int i = 0; i < context->nb_streams; ++i) {
+      if (AVMEDIA_TYPE_VIDEO == context->streams[i]->codecpar->codec_type) {
+        fragmentStream = i;
+        break;
+      }
+    }
+    fragmentPackets = 0;
+    fragmentKeyed = false;
+    avio_flush(context->pb);
+    Fragment init;
+    init.offset = fragmentOffset;
+    init.size = avio_tell(context->pb) - fragmentOffset;
+    fragmentOffset += init.size;
+    if (sink) {
+      sink->flush();
+    }
+    fragments(init);
+  }
+
+  void Muxer::trackFragment(const AVPacket* packet) {
+    const AVRational microseconds{1, AV_TIME_BASE};
+    AVStream* stream = context->streams[packet->stream_index];
+    int64_t timestamp = AV_NOPTS_VALUE != packet->pts ? packet->pts : packet->dts;
+    bool key = (packet->flags & AV_PKT_FLAG_KEY) &&
+      (fragmentStream < 0 || fragmentStream == packet->stream_index);
+    if (AV_NOPTS_VALUE == timestamp) {
+      fragmentPackets++;
+      return;
+    }
+    int64_t start = av_rescale_q(timestamp, stream->time_base, microseconds);
+    int64_t end = av_rescale_q(timestamp + packet->duration, stream->time_base, microseconds);
+    if (key && fragmentKeyed && fragmentPackets > 0 && start - fragmentStart >= fragmentMinDuration) {
+      finishFragment();
+    }
+    if (0 == fragmentPackets || AV_NOPTS_VALUE == fragmentStart) {
+      fragmentStart = start;
+      fragmentEnd = end;
+    } else {
+      fragmentStart = std::min(fragmentStart, start);
+      fragmentEnd = std::max(fragmentEnd, end);
+    }
+    fragmentKeyed = fragmentKeyed || key;
+    fragmentPackets++;
+  }
+
+  void Muxer::finishFragment() {
+    // Everything the interleaver is holding on to goes in this fragment
+    av_interleaved_write_frame(context, nullptr);
+    // With frag_custom, a null packet is what tells mov to write it
+    av_write_frame(context, nullptr);
+    avio_flush(context->pb);
+    Fragment fragment;
+    fragment.sequence = ++fragmentSequence;
+    fragment.offset = fragmentOffset;
+    fragment.size = avio_tell(context->pb) - fragmentOffset;
+    fragment.startTime = fragmentStart;
+    fragment.duration = AV_NOPTS_VALUE == fragmentStart ? 0 : fragmentEnd - fragmentStart;
+    fragmentOffset += fragment.size;
+    fragmentPackets = 0;
+    fragmentKeyed = false;
+    fragmentStart = AV_NOPTS_VALUE;
+    fragmentEnd = AV_NOPTS_VALUE;
+    if (sink) {
+      sink->flush();
+    }
+    fragments(fragment);
+  }
+
   void Muxer::flush() {
+    // The interleaver takes bufferMutex to write, so this has to happen
+    // first
+    if (interleaver) {
+      interleaver->flush();
+    }
     std::lock_guard<std::mutex> lock(bufferMutex);
+    if (streamStart && !held.empty()) {
+      // Quit waiting for streams that never subscribed
+      writeHeader();
+    }
     while(!buffer.empty()) {
       Packet::pointer pkt = std::move(buffer.front());
       buffer.pop_front();
@@ -153,25 +350,41 @@ namespace fr::media2 {
   }
 
   void Muxer::process(const Packet::pointer& packet, StreamData::pointer stream, StreamInfo* info) {
-    // Remap packet index to the output stream in this object
+    // Packets get written with this held, so the output stream timing
+    // can't change while LibAV is looking at it
+    std::unique_lock<std::mutex> lock(bufferMutex);
     try {
       copyTimingData(stream, info);
     } catch (std::runtime_error &e) {
       std::cerr << "Warning: Ignoring exception in muxer; output file will probably be incorrect." << std::endl;
       std::cerr << e.what() << std::endl;
     }
+    if (interleaver) {
+      // Other threads may be looking at packet, so only the copy gets
+      // the new index
+      Packet::pointer pkt = Packet::copy(packet);
+      pkt->stream_index = info->stream->index;
+      AVRational timeBase = stream->time_base.den > 0 ? stream->time_base : info->stream->time_base;
+      // The interleaver takes bufferMutex itself when it writes
+      lock.unlock();
+      interleaver->push(pkt->stream_index, std::move(pkt), timeBase);
+      return;
+    }
+    // Remap packet index to the output stream in this object
     packet->stream_index = info->stream->index;
-    if (buffer.size() < bufferMax) {
-      std::lock_guard<std::mutex> lock(bufferMutex);
-      buffer.push_back(Packet::copy(packet));
+    if (fragmented) {
+      // No point holding packets back, fragments are only written at
+      // keyframes anyway
+      Packet::pointer pkt = Packet::copy(packet);
+      write(pkt);
     } else {
-      // Start reading off the front
-      Packet::pointer pkt = Packet::nullPacket();
-      std::lock_guard<std::mutex> lock(bufferMutex);
       buffer.push_back(Packet::copy(packet));
-      pkt = std::move(buffer.front());
-      buffer.pop_front();
-      write(pkt);
+      if (buffer.size() > (size_t) bufferMax) {
+        // Start reading off the front
+        Packet::pointer pkt = std::move(buffer.front());
+        buffer.pop_front();
+        write(pkt);
+      }
     }
   }
 
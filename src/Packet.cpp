@@ -16,6 +16,8 @@
  */
 
 #include "fr/media2/Packet.h"
+#include "fr/media2/PacketPool.h"
+#include <cstring>
 extern "C" {
 #include <libavutil/frame.h>
 }
@@ -24,12 +26,22 @@ namespace fr {
   namespace media2 {
 
     Packet::pointer Packet::create() {
-      return pointer{av_packet_alloc(), &Packet::destroy}; 
+      return pointer{PacketPool::instance().acquire(), &Packet::destroy};
     }
 
     Packet::pointer Packet::copy(const Packet::pointer& toCopy) {
       auto copy = create();
-      av_packet_ref(copy.get(), toCopy.get());
+      if (nullptr != toCopy->buf || nullptr == toCopy->data) {
+        av_packet_ref(copy.get(), toCopy.get());
+      } else {
+        // av_packet_ref would allocate a fresh buffer for a packet
+        // that isn't refcounted, so get one from the pool instead.
+        copy->buf = PacketPool::instance().buffer(toCopy->size);
+        copy->data = copy->buf->data;
+        copy->size = toCopy->size;
+        memcpy(copy->data, toCopy->data, toCopy->size);
+        av_packet_copy_props(copy.get(), toCopy.get());
+      }
       return copy;
     }
 
@@ -38,9 +50,8 @@ namespace fr {
     }
 
     void Packet::destroy(AVPacket *pkt) {
-      if (pkt) {
-	av_packet_free(&pkt);
-      }
+      // Goes back to the pool for reuse
+      PacketPool::instance().release(pkt);
     }
 
     bool Packet::containsIFrame(const Packet::pointer& packet) {
@@ -0,0 +1,188 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fr/media2/PacketInterleaver.h>
+
+extern "C" {
+#include <libavutil/avutil.h>
+#include <libavutil/mathematics.h>
+}
+
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+
+namespace fr::media2 {
+
+  PacketInterleaver::PacketInterleaver(WriteFunction write, int64_t maxDelta) :
+    write(std::move(write)), maxDelta(maxDelta) {
+  }
+
+  bool PacketInterleaver::later(const Entry& a, const Entry& b) {
+    return a.key != b.key ? a.key > b.key : a.sequence > b.sequence;
+  }
+
+  PacketInterleaver::StreamQueue& PacketInterleaver::queue(int stream) {
+    if (stream < 0) {
+      throw std::runtime_error("PacketInterleaver stream index can't be negative");
+    }
+    if ((size_t) stream >= streams.size()) {
+      streams.resize(stream + 1);
+    }
+    return streams[stream];
+  }
+
+  void PacketInterleaver::addStream(int stream) {
+    std::lock_guard<std::mutex> lock(mutex);
+    StreamQueue& q = queue(stream);
+    q.active = true;
+    q.finished = false;
+  }
+
+  void PacketInterleaver::finishStream(int stream) {
+    std::unique_lock<std::mutex> lock(mutex);
+    queue(stream).finished = true;
+    // That might have been what everything else was waiting on
+    if (!writing) {
+      writing = true;
+      drain(lock, false);
+    }
+  }
+
+  int64_t PacketInterleaver::watermark() const {
+    int64_t ret = INT64_MAX;
+    // A stream that hasn't sent anything yet is waited for from the
+    // very beginning
+    int64_t beginning = INT64_MAX == first ? INT64_MIN : first - 1;
+    for (const StreamQueue& q : streams) {
+      if (!q.active || q.finished) {
+        continue;
+      }
+      ret = std::min(ret, INT64_MIN == q.newest ? beginning : q.newest);
+    }
+    // Don't wait for anyone who's too far behind
+    if (maxDelta > 0 && INT64_MIN != newest) {
+      ret = std::max(ret, newest - maxDelta);
+    }
+    return ret;
+  }
+
+  void PacketInterleaver::take(std::vector<Packet::pointer>& batch, bool all) {
+    int64_t mark = all ? INT64_MAX : watermark();
+    while (true) {
+      StreamQueue* next = nullptr;
+      for (StreamQueue& q : streams) {
+        if (!q.heap.empty() && q.heap.front().key <= mark &&
+            (nullptr == next || later(next->heap.front(), q.heap.front()))) {
+          next = &q;
+        }
+      }
+      if (nullptr == next) {
+        return;
+      }
+      std::pop_heap(next->heap.begin(), next->heap.end(), &later);
+      Entry& entry = next->heap.back();
+      next->written = entry.key;
+      batch.push_back(std::move(entry.packet));
+      next->heap.pop_back();
+      current.queued--;
+    }
+  }
+
+  void PacketInterleaver::drain(std::unique_lock<std::mutex>& lock, bool all) {
+    std::vector<Packet::pointer> batch;
+    try {
+      while (true) {
+        take(batch, all);
+        if (batch.empty()) {
+          break;
+        }
+        lock.unlock();
+        for (auto& packet : batch) {
+          write(packet);
+        }
+        size_t count = batch.size();
+        batch.clear();
+        lock.lock();
+        current.written += count;
+      }
+    } catch (...) {
+      if (!lock.owns_lock()) {
+        lock.lock();
+      }
+      writing = false;
+      writerDone.notify_all();
+      throw;
+    }
+    writing = false;
+    writerDone.notify_all();
+  }
+
+  void PacketInterleaver::push(int stream, Packet::pointer packet, AVRational timeBase) {
+    const AVRational microseconds{1, AV_TIME_BASE};
+    std::unique_lock<std::mutex> lock(mutex);
+    current.pushed++;
+    StreamQueue& q = queue(stream);
+    q.active = true;
+    int64_t key;
+    if (AV_NOPTS_VALUE == packet->dts) {
+      // Goes with whatever came before it
+      key = INT64_MIN == q.newest ? INT64_MIN : q.newest;
+    } else {
+      key = av_rescale_q(packet->dts, timeBase, microseconds);
+    }
+    if (INT64_MIN != q.written && key < q.written) {
+      current.late++;
+      return;
+    }
+    if (AV_NOPTS_VALUE != packet->dts) {
+      // Only real timestamps say how far along anyone is
+      q.newest = std::max(q.newest, key);
+      newest = std::max(newest, key);
+      first = std::min(first, key);
+    }
+    q.heap.push_back(Entry{key, sequence++, std::move(packet)});
+    std::push_heap(q.heap.begin(), q.heap.end(), &later);
+    current.queued++;
+    current.peakQueued = std::max(current.peakQueued, current.queued);
+    if (writing) {
+      // The writer will get to it
+      return;
+    }
+    writing = true;
+    drain(lock, false);
+  }
+
+  void PacketInterleaver::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    writerDone.wait(lock, [this]{ return !writing; });
+    writing = true;
+    drain(lock, true);
+  }
+
+  PacketInterleaver::Stats PacketInterleaver::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return current;
+  }
+
+}
+
+std::ostream& operator<<(std::ostream& o, const fr::media2::PacketInterleaver::Stats& stats) {
+  o << "PacketInterleaver: " << stats.queued << " packets queued, peak " << stats.peakQueued << "; "
+    << stats.pushed << " pushed, " << stats.written << " written, " << stats.late << " late";
+  return o;
+}
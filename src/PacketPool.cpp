@@ -0,0 +1,176 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fr/media2/PacketPool.h>
+#include <cstring>
+#include <stdexcept>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+namespace fr::media2 {
+
+  PacketPool& PacketPool::instance() {
+    // Deliberately never destroyed. Packets can get destroyed during
+    // static destruction (Globals holding segments, that sort of thing)
+    // and they need somewhere to go when that happens.
+    static PacketPool* pool = new PacketPool();
+    return *pool;
+  }
+
+  PacketPool::PacketPool() {
+    idle.reserve(maxIdle);
+  }
+
+  PacketPool::~PacketPool() {
+    for (AVPacket* packet : idle) {
+      av_packet_free(&packet);
+    }
+    // Pools with outstanding buffers will stick around until the
+    // last buffer is returned.
+    for (AVBufferPool*& pool : bufferPools) {
+      if (nullptr != pool) {
+        av_buffer_pool_uninit(&pool);
+      }
+    }
+  }
+
+  AVPacket* PacketPool::acquire() {
+    {
+      std::lock_guard<std::mutex> lock(packetMutex);
+      if (!idle.empty()) {
+        AVPacket* packet = idle.back();
+        idle.pop_back();
+        packetHits++;
+        return packet;
+      }
+    }
+    packetMisses++;
+    return av_packet_alloc();
+  }
+
+  void PacketPool::release(AVPacket* packet) {
+    if (nullptr == packet) {
+      return;
+    }
+    // Drop our reference to the payload before we hang on to it.
+    // If this was the last reference, the payload goes back to
+    // its buffer pool.
+    av_packet_unref(packet);
+    {
+      std::lock_guard<std::mutex> lock(packetMutex);
+      if (idle.size() < maxIdle) {
+        idle.push_back(packet);
+        return;
+      }
+    }
+    packetDrops++;
+    av_packet_free(&packet);
+  }
+
+  AVBufferRef* PacketPool::buffer(size_t size) {
+    size_t padded = size + AV_INPUT_BUFFER_PADDING_SIZE;
+    size_t shift = minShift;
+    while (shift <= maxShift && (static_cast<size_t>(1) << shift) < padded) {
+      shift++;
+    }
+    bufferRequests++;
+    AVBufferRef* ret = nullptr;
+    if (shift > maxShift) {
+      // Too big to pool
+      bufferMisses++;
+      ret = av_buffer_alloc(padded);
+    } else {
+      ret = av_buffer_pool_get(poolFor(shift - minShift));
+    }
+    if (nullptr == ret) {
+      throw std::runtime_error("Could not allocate packet buffer of size " + std::to_string(size));
+    }
+    // Recycled buffers have whatever was in them last time, and
+    // LibAV expects the padding to be zeroed.
+    memset(ret->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    return ret;
+  }
+
+  AVBufferPool* PacketPool::poolFor(size_t sizeClass) {
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    AVBufferPool*& pool = bufferPools[sizeClass];
+    if (nullptr == pool) {
+      pool = av_buffer_pool_init2(static_cast<size_t>(1) << (sizeClass + minShift), this,
+                                  &PacketPool::poolAlloc, nullptr);
+      if (nullptr == pool) {
+        throw std::runtime_error("Could not create packet buffer pool");
+      }
+    }
+    return pool;
+  }
+
+  // The size type of the pool allocator callback changed from int to
+  // size_t in libavutil 57, so let the compiler pick it out of
+  // av_buffer_pool_init2's signature.
+  template<typename Size>
+  AVBufferRef* PacketPool::poolAlloc(void* opaque, Size size) {
+    static_cast<PacketPool*>(opaque)->bufferMisses++;
+    return av_buffer_alloc(size);
+  }
+
+  void PacketPool::setMaxIdle(size_t maxIdle) {
+    std::lock_guard<std::mutex> lock(packetMutex);
+    this->maxIdle = maxIdle;
+    while (idle.size() > maxIdle) {
+      AVPacket* packet = idle.back();
+      idle.pop_back();
+      av_packet_free(&packet);
+    }
+  }
+
+  size_t PacketPool::getMaxIdle() {
+    std::lock_guard<std::mutex> lock(packetMutex);
+    return maxIdle;
+  }
+
+  PacketPool::Stats PacketPool::stats() {
+    Stats ret;
+    ret.packetHits = packetHits;
+    ret.packetMisses = packetMisses;
+    ret.packetDrops = packetDrops;
+    ret.bufferMisses = bufferMisses;
+    uint64_t requests = bufferRequests;
+    ret.bufferHits = requests > ret.bufferMisses ? requests - ret.bufferMisses : 0;
+    std::lock_guard<std::mutex> lock(packetMutex);
+    ret.idlePackets = idle.size();
+    return ret;
+  }
+
+  void PacketPool::resetStats() {
+    packetHits = 0;
+    packetMisses = 0;
+    packetDrops = 0;
+    bufferRequests = 0;
+    bufferMisses = 0;
+  }
+
+}
+
+std::ostream& operator<<(std::ostream& o, const fr::media2::PacketPool::Stats& stats) {
+  o << "PacketPool packets: " << stats.packetHits << " hits, "
+    << stats.packetMisses << " misses, " << stats.packetDrops << " dropped, "
+    << stats.idlePackets << " idle; buffers: " << stats.bufferHits << " hits, "
+    << stats.bufferMisses << " misses";
+  return o;
+}
@@ -16,12 +16,37 @@
  */
 
 #include <fr/media2/PacketReader.h>
+#include <chrono>
+
+extern "C" {
+#include <libavutil/dict.h>
+}
 
 namespace fr {
   namespace media2 {
 
-    PacketReader::PacketReader(const std::string &filename) :
+    PacketReader::PacketReader(const std::string &filename, const DecoderConfig& config) :
+      PacketReader(filename, InputOptions{}, config) {
+    }
+
+    PacketReader::PacketReader(const std::string &filename, const InputOptions& input,
+                               const DecoderConfig& config) :
       filename(filename),
+      probeKey(filename),
+      inputOptions(input),
+      decoderConfig(config),
+      stateSender{PacketReaderStateMachine::Sender{this}},
+      state{stateSender} {
+      state.process_event(PacketReaderStateMachine::open{});
+    }
+
+    PacketReader::PacketReader(IOSource::pointer source, const InputOptions& input,
+                               const DecoderConfig& config) :
+      filename(source->name()),
+      probeKey(source->cacheKey()),
+      inputOptions(input),
+      decoderConfig(config),
+      ioSource(source),
       stateSender{PacketReaderStateMachine::Sender{this}},
       state{stateSender} {
       state.process_event(PacketReaderStateMachine::open{});
@@ -45,9 +70,13 @@ namespace fr {
 
     void PacketReader::close() {
       signals.shutdown();
+      // The reading thread could be waiting for room in a ring
+      abortDispatch();
       std::lock_guard<std::mutex> lock(streamMutex);
       join();
       avformat_close_input(&formatContext);
+      // avformat_close_input leaves custom IO alone
+      IOSource::freeContext(&ioContext);
       streams.clear();
       audioStreams.clear();
       videoStreams.clear();
@@ -91,13 +120,33 @@ namespace fr {
 
     bool PacketReader::openFormat() {
       bool retval = false;
-      // Parameters 3 and 4 are input format and a dictionary for options.
-      // At some point I need to set it up so the user can set both if they
-      // want to.
-      int apiRet = avformat_open_input(&formatContext, filename.c_str(), nullptr, nullptr);
+      AVDictionary* options = nullptr;
+      if (nullptr != inputOptions.dictionary) {
+        av_dict_copy(&options, inputOptions.dictionary, 0);
+      }
+      for (const auto& [key, value] : inputOptions.options) {
+        av_dict_set(&options, key.c_str(), value.c_str(), 0);
+      }
+      // These are format context options, so they have to be set
+      // before the probe in avformat_open_input
+      if (inputOptions.probeSize > 0) {
+        av_dict_set_int(&options, "probesize", inputOptions.probeSize, 0);
+      }
+      if (inputOptions.analyzeDuration > 0) {
+        av_dict_set_int(&options, "analyzeduration", inputOptions.analyzeDuration, 0);
+      }
+      int apiRet = 0;
+      if (ioSource && !openSource()) {
+        apiRet = AVERROR(ENOMEM);
+      } else {
+        apiRet = avformat_open_input(&formatContext, filename.c_str(),
+                                     (AVInputFormat*) inputOptions.format, &options);
+      }
+      av_dict_free(&options);
       std::string err{"Error opening "};
       err.append(filename);
       if (0 > apiRet) {
+        IOSource::freeContext(&ioContext);
         state.process_event(PacketReaderStateMachine::open_error{err});
       } else {
         retval = true;
@@ -105,9 +154,41 @@ namespace fr {
       return retval;
     }
 
+    bool PacketReader::openSource() {
+      // From the top, in case this is a reopen
+      if (ioSource->seekable()) {
+        ioSource->seek(0, SEEK_SET);
+      }
+      IOSource::freeContext(&ioContext);
+      ioContext = IOSource::createContext(ioSource.get());
+      if (nullptr == ioContext) {
+        return false;
+      }
+      formatContext = avformat_alloc_context();
+      if (nullptr == formatContext) {
+        return false;
+      }
+      // avformat_open_input sees pb and reads from it instead of
+      // opening filename
+      formatContext->pb = ioContext;
+      return true;
+    }
+
+    int PacketReader::findStreamInfo() {
+      bool cached = inputOptions.probeCache && !probeKey.empty();
+      if (cached && inputOptions.probeCache->apply(probeKey, formatContext)) {
+        return 0;
+      }
+      int apiRet = avformat_find_stream_info(formatContext, nullptr);
+      if (0 <= apiRet && cached) {
+        inputOptions.probeCache->store(probeKey, formatContext);
+      }
+      return apiRet;
+    }
+
     bool PacketReader::setupStreams() {
       bool foundStreams = false;
-      int apiRet = avformat_find_stream_info(formatContext, nullptr);
+      int apiRet = findStreamInfo();
       if (0 > apiRet) {
         std::string err{"Could not find any streams in "};
         err.append(filename);
@@ -129,25 +210,17 @@ namespace fr {
             stream->data.reset();
           } else {
             stream->data->mediaType = data->codec->type;
-            AVCodecContext *ctx = avcodec_alloc_context3(data->codec);
-            if (nullptr == ctx) {
+            if (!data->openDecoder(decoderConfig)) {
               stream->data.reset();
             } else {
-              stream->data->setContext(&ctx);
-              // Copy default parameters to context if there are any
-              avcodec_parameters_to_context(stream->data->context.get(), formatContext->streams[i]->codecpar);
-              if(avcodec_open2(data->context.get(), data->codec, nullptr) < 0) {
-                stream->data.reset();
-              } else {
-                foundStreams = true;
-                if (AVMEDIA_TYPE_VIDEO == stream->data->mediaType) {
-                  videoStreams.push_back(stream);
-                } else if (AVMEDIA_TYPE_AUDIO == stream->data->mediaType) {
-                  audioStreams.push_back(stream);
-                }
+              foundStreams = true;
+              if (AVMEDIA_TYPE_VIDEO == stream->data->mediaType) {
+                videoStreams.push_back(stream);
+              } else if (AVMEDIA_TYPE_AUDIO == stream->data->mediaType) {
+                audioStreams.push_back(stream);
               }
-              streams.push_back(stream);
             }
+            streams.push_back(stream);
           }
         }
       }
@@ -161,20 +234,67 @@ namespace fr {
       return foundStreams;
     }
 
+    void PacketReader::setReadAhead(size_t packets, size_t bytes, bool threadPerStream) {
+      std::lock_guard<std::mutex> lock(dispatchMutex);
+      readAheadPackets = packets;
+      readAheadBytes = bytes;
+      dispatchPerStream = threadPerStream;
+    }
+
+    PacketRing::Stats PacketReader::readAheadStats() {
+      PacketRing::Stats ret;
+      std::lock_guard<std::mutex> lock(dispatchMutex);
+      for (auto& ring : rings) {
+        if (ring) {
+          ret += ring->stats();
+        }
+      }
+      return ret;
+    }
+
     void PacketReader::processPrivately() {
       // Will be destroyed when it goes out of scope
       auto packet = Packet::create();
       int apiRet = 0;
       state.process_event(PacketReaderStateMachine::play{});
+      {
+        std::lock_guard<std::mutex> lock(seekMutex);
+        reading = true;
+      }
+      startDispatch();
+      bool readingAhead = !dispatchers.empty();
 
       using namespace boost::sml;
       while(!state.is("done"_s)) {
-        if (state.is("paused"_s)) {
-          std::unique_lock<std::mutex> lock;
-          paused.wait(lock, []{ return true;});
+        while (state.is("paused"_s) && !seekPending) {
+          // unpause notifies before the state actually changes, so
+          // don't sleep for long
+          std::unique_lock<std::mutex> lock(pauseMutex);
+          paused.wait_for(lock, std::chrono::milliseconds(10));
+        }
+        if (seekPending) {
+          // Whatever was read ahead is from before the seek
+          if (readingAhead) {
+            stopDispatch(false);
+          }
+          applySeek();
+          if (readingAhead) {
+            startDispatch();
+          }
+          continue;
         }
         if (av_read_frame(formatContext, packet.get()) < 0) {
+          // Subscribers get everything that was read ahead before
+          // anyone hears about the eof
+          stopDispatch(true);
+          // Frame threaded decoders are still sitting on their last
+          // few frames
+          forwardEvent(StreamEvent::endOfStream);
           state.process_event(PacketReaderStateMachine::eof{});
+        } else if (readingAhead) {
+          if (!queuePacket(packet)) {
+            break;
+          }
         } else {
           std::lock_guard<std::mutex> lock(streamMutex);
           int streamIndex = packet->stream_index;
@@ -187,6 +307,172 @@ namespace fr {
           av_packet_unref(packet.get());
         }
       }
+      stopDispatch(false);
+      // Nothing can seek directly until reading is cleared, so do
+      // anything that showed up while we were finishing
+      applySeek();
+      std::lock_guard<std::mutex> lock(seekMutex);
+      reading = false;
+    }
+
+    void PacketReader::seek(int64_t timestamp, int flags, int streamIndex) {
+      SeekRequest request{timestamp, flags, streamIndex};
+      {
+        std::lock_guard<std::mutex> lock(seekMutex);
+        if (reading) {
+          pendingSeek = request;
+          seekPending = true;
+          paused.notify_all();
+          return;
+        }
+        // Nothing is reading, so it's safe to do it here. Holding the
+        // lock keeps a reading thread from starting until we're done.
+        if (!seekTo(request)) {
+          return;
+        }
+        forwardEvent(StreamEvent::discontinuity);
+      }
+      signals.discontinuity(request.timestamp, request.streamIndex);
+    }
+
+    void PacketReader::applySeek() {
+      SeekRequest request;
+      {
+        std::lock_guard<std::mutex> lock(seekMutex);
+        if (!seekPending) {
+          return;
+        }
+        request = pendingSeek;
+        seekPending = false;
+      }
+      if (seekTo(request)) {
+        forwardEvent(StreamEvent::discontinuity);
+        signals.discontinuity(request.timestamp, request.streamIndex);
+      }
+    }
+
+    void PacketReader::forwardEvent(StreamEvent event) {
+      std::lock_guard<std::mutex> lock(streamMutex);
+      for (auto& stream : streams) {
+        if (stream && stream->data) {
+          stream->forward(event);
+        }
+      }
+    }
+
+    bool PacketReader::seekTo(const SeekRequest& request) {
+      if (nullptr == formatContext) {
+        error("Can not seek " + filename + ", it isn't open");
+        return false;
+      }
+      // Anything up to the timestamp, so without AVSEEK_FLAG_ANY this
+      // is the keyframe at or before it
+      int apiRet = avformat_seek_file(formatContext, request.streamIndex, INT64_MIN,
+                                      request.timestamp, request.timestamp, request.flags);
+      if (apiRet < 0) {
+        error("Could not seek " + filename + " to " + std::to_string(request.timestamp) +
+              " rc = " + std::to_string(apiRet));
+        return false;
+      }
+      // Decoders would otherwise hand back frames from before the seek
+      std::lock_guard<std::mutex> lock(streamMutex);
+      for (auto& stream : streams) {
+        if (stream && stream->data && stream->data->context &&
+            avcodec_is_open(stream->data->context.get())) {
+          avcodec_flush_buffers(stream->data->context.get());
+        }
+      }
+      return true;
+    }
+
+    void PacketReader::startDispatch() {
+      std::lock_guard<std::mutex> lock(dispatchMutex);
+      rings.clear();
+      if (0 == readAheadPackets) {
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> streamLock(streamMutex);
+        dispatchStreams = streams;
+      }
+      if (dispatchPerStream) {
+        for (auto& stream : dispatchStreams) {
+          if (stream && stream->data) {
+            rings.push_back(std::make_unique<PacketRing>(readAheadPackets, readAheadBytes));
+          } else {
+            rings.push_back(nullptr);
+          }
+        }
+      } else {
+        rings.push_back(std::make_unique<PacketRing>(readAheadPackets, readAheadBytes));
+      }
+      for (auto& ring : rings) {
+        if (ring) {
+          PacketRing* r = ring.get();
+          dispatchers.emplace_back([this, r]{ dispatch(*r); });
+        }
+      }
+    }
+
+    bool PacketReader::queuePacket(Packet::pointer& packet) {
+      size_t streamIndex = packet->stream_index;
+      PacketRing* ring = nullptr;
+      if (streamIndex < dispatchStreams.size() && dispatchStreams[streamIndex] &&
+          dispatchStreams[streamIndex]->data) {
+        ring = (1 == rings.size()) ? rings[0].get() : rings[streamIndex].get();
+      }
+      if (nullptr == ring) {
+        av_packet_unref(packet.get());
+        return true;
+      }
+      if (!ring->push(packet)) {
+        av_packet_unref(packet.get());
+        return false;
+      }
+      // The ring has that one now
+      packet = Packet::create();
+      return true;
+    }
+
+    void PacketReader::dispatch(PacketRing& ring) {
+      Packet::pointer packet = Packet::nullPacket();
+      while (ring.pop(packet)) {
+        dispatchStreams[packet->stream_index]->forward(packet);
+        // Back to the pool
+        packet.reset();
+      }
+    }
+
+    void PacketReader::stopDispatch(bool drain) {
+      {
+        std::lock_guard<std::mutex> lock(dispatchMutex);
+        for (auto& ring : rings) {
+          if (!ring) {
+            continue;
+          }
+          if (drain) {
+            ring->close();
+          } else {
+            ring->abort();
+          }
+        }
+      }
+      for (auto& dispatcher : dispatchers) {
+        if (dispatcher.joinable()) {
+          dispatcher.join();
+        }
+      }
+      dispatchers.clear();
+      dispatchStreams.clear();
+    }
+
+    void PacketReader::abortDispatch() {
+      std::lock_guard<std::mutex> lock(dispatchMutex);
+      for (auto& ring : rings) {
+        if (ring) {
+          ring->abort();
+        }
+      }
     }
 
   } // namespace media
@@ -0,0 +1,134 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fr/media2/PacketRing.h>
+#include <algorithm>
+#include <stdexcept>
+
+namespace fr::media2 {
+
+  PacketRing::Stats& PacketRing::Stats::operator+=(const Stats& other) {
+    packets += other.packets;
+    bytes += other.bytes;
+    peakPackets += other.peakPackets;
+    peakBytes += other.peakBytes;
+    pushed += other.pushed;
+    producerStall += other.producerStall;
+    consumerStall += other.consumerStall;
+    return *this;
+  }
+
+  PacketRing::PacketRing(size_t maxPackets, size_t maxBytes) : maxBytes(maxBytes) {
+    if (0 == maxPackets) {
+      throw std::runtime_error("PacketRing needs room for at least one packet");
+    }
+    slots.reserve(maxPackets);
+    for (size_t i = 0; i < maxPackets; ++i) {
+      slots.push_back(Packet::nullPacket());
+    }
+  }
+
+  bool PacketRing::hasRoom(size_t size) const {
+    if (0 == current.packets) {
+      return true;
+    }
+    return current.packets < slots.size() &&
+      (0 == maxBytes || current.bytes + size <= maxBytes);
+  }
+
+  bool PacketRing::push(Packet::pointer& packet) {
+    size_t size = packet->size > 0 ? packet->size : 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!closed && !hasRoom(size)) {
+      auto start = std::chrono::steady_clock::now();
+      notFull.wait(lock, [this, size]{ return closed || hasRoom(size); });
+      current.producerStall += std::chrono::steady_clock::now() - start;
+    }
+    if (closed) {
+      return false;
+    }
+    slots[(head + current.packets) % slots.size()] = std::move(packet);
+    current.packets++;
+    current.bytes += size;
+    current.pushed++;
+    current.peakPackets = std::max(current.peakPackets, current.packets);
+    current.peakBytes = std::max(current.peakBytes, current.bytes);
+    lock.unlock();
+    notEmpty.notify_one();
+    return true;
+  }
+
+  bool PacketRing::pop(Packet::pointer& packet) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!closed && 0 == current.packets) {
+      auto start = std::chrono::steady_clock::now();
+      notEmpty.wait(lock, [this]{ return closed || current.packets > 0; });
+      current.consumerStall += std::chrono::steady_clock::now() - start;
+    }
+    if (0 == current.packets) {
+      return false;
+    }
+    packet = std::move(slots[head]);
+    head = (head + 1) % slots.size();
+    current.packets--;
+    current.bytes -= packet->size > 0 ? packet->size : 0;
+    lock.unlock();
+    notFull.notify_one();
+    return true;
+  }
+
+  void PacketRing::close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+    }
+    notEmpty.notify_all();
+    notFull.notify_all();
+  }
+
+  void PacketRing::abort() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+      while (current.packets > 0) {
+        slots[head].reset();
+        head = (head + 1) % slots.size();
+        current.packets--;
+      }
+      current.bytes = 0;
+    }
+    notEmpty.notify_all();
+    notFull.notify_all();
+  }
+
+  PacketRing::Stats PacketRing::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return current;
+  }
+
+}
+
+std::ostream& operator<<(std::ostream& o, const fr::media2::PacketRing::Stats& stats) {
+  using std::chrono::duration_cast;
+  using std::chrono::milliseconds;
+  o << "PacketRing: " << stats.packets << " packets (" << stats.bytes << " bytes) queued, peak "
+    << stats.peakPackets << " packets (" << stats.peakBytes << " bytes); "
+    << stats.pushed << " pushed; producer stalled "
+    << duration_cast<milliseconds>(stats.producerStall).count() << " ms, consumers stalled "
+    << duration_cast<milliseconds>(stats.consumerStall).count() << " ms";
+  return o;
+}
@@ -26,13 +26,17 @@ namespace fr {
     }
     
     void PacketSubscriber::subscribe(Stream::pointer to) {
-      boost::signals2::connection subscription = to->packets.connect(
-        [this](const Packet::pointer& packet, StreamData::pointer stream) {
+      Connection subscription = to->packets.connect(
+        [this](const Packet::pointer& packet, const StreamData::pointer& stream) {
 	  this->process(packet, stream);
 	});
       std::cout << "Stream data is " << (to->data ? "not null" : "null") << std::endl;
       std::cout << "Stream data stream is " << (to->data->stream ? "not null" : "null") << std::endl;
       subscriptions.push_back(subscription);
+      subscriptions.push_back(to->events.connect(
+        [this](StreamEvent event, const StreamData::pointer& stream) {
+          this->streamEvent(event, stream);
+        }));
       subscribeCallback(to);
     }
 
@@ -43,6 +47,8 @@ namespace fr {
     }
 
     void PacketSubscriber::subscribeCallback(Stream::pointer to) {}
+
+    void PacketSubscriber::streamEvent(StreamEvent event, const StreamData::pointer& stream) {}
     
   }
 }
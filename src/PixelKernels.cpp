@@ -0,0 +1,545 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fr/media2/PixelKernels.h>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
+#include <array>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FR_PIXEL_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#define FR_PIXEL_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace fr::media2 {
+
+  namespace {
+
+    // YUV to RGB in 16 bit fixed point. Luma and chroma get shifted up
+    // 7 bits and multiplied with a rounding high multiply (pmulhrsw on
+    // x86, vqrdmulh on ARM), which leaves RGB with 3 bits of fraction.
+    // The coefficients are the BT.601 ones / 16 * 32768.
+    struct Coefficients {
+      int16_t yOffset;
+      int16_t y;
+      int16_t ub;
+      int16_t ug;
+      int16_t vg;
+      int16_t vr;
+    };
+
+    constexpr Coefficients limitedRange{16, 2385, 4131, 802, 1665, 3269};
+    constexpr Coefficients fullRange{0, 2048, 3629, 705, 1463, 2871};
+
+    using InterleaveRow = void (*)(const uint8_t* u, const uint8_t* v, uint8_t* uv, int n);
+    using SplitRow = void (*)(const uint8_t* uv, uint8_t* u, uint8_t* v, int n);
+    using YuvRow = void (*)(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* bgr,
+                            int width, const Coefficients& c);
+    using HalveRow = void (*)(const uint8_t* top, const uint8_t* bottom, uint8_t* out, int n);
+
+    struct Kernels {
+      InterleaveRow interleave;
+      SplitRow split;
+      YuvRow yuv;
+      HalveRow halve;
+    };
+
+    // Plain C. The SIMD versions use these for whatever is left over
+    // at the end of a row.
+
+    inline int16_t mulhrs(int16_t a, int16_t b) {
+      return static_cast<int16_t>((int32_t(a) * b + 0x4000) >> 15);
+    }
+
+    inline uint8_t clip8(int v) {
+      return static_cast<uint8_t>(v < 0 ? 0 : (v > 255 ? 255 : v));
+    }
+
+    void interleaveC(const uint8_t* u, const uint8_t* v, uint8_t* uv, int n) {
+      for (int i = 0; i < n; ++i) {
+        uv[2 * i] = u[i];
+        uv[2 * i + 1] = v[i];
+      }
+    }
+
+    void splitC(const uint8_t* uv, uint8_t* u, uint8_t* v, int n) {
+      for (int i = 0; i < n; ++i) {
+        u[i] = uv[2 * i];
+        v[i] = uv[2 * i + 1];
+      }
+    }
+
+    void yuvC(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* bgr, int width,
+              const Coefficients& c) {
+      for (int x = 0; x < width; ++x) {
+        int16_t yy = mulhrs(static_cast<int16_t>((y[x] - c.yOffset) * 128), c.y);
+        int16_t uu = static_cast<int16_t>((u[x / 2] - 128) * 128);
+        int16_t vv = static_cast<int16_t>((v[x / 2] - 128) * 128);
+        int b = yy + mulhrs(uu, c.ub);
+        int g = yy - mulhrs(uu, c.ug) - mulhrs(vv, c.vg);
+        int r = yy + mulhrs(vv, c.vr);
+        bgr[3 * x] = clip8((b + 4) >> 3);
+        bgr[3 * x + 1] = clip8((g + 4) >> 3);
+        bgr[3 * x + 2] = clip8((r + 4) >> 3);
+      }
+    }
+
+    void halveC(const uint8_t* top, const uint8_t* bottom, uint8_t* out, int n) {
+      for (int i = 0; i < n; ++i) {
+        out[i] = static_cast<uint8_t>((top[2 * i] + top[2 * i + 1] + bottom[2 * i] + bottom[2 * i + 1] + 2) >> 2);
+      }
+    }
+
+    constexpr Kernels genericKernels{&interleaveC, &splitC, &yuvC, &halveC};
+
+#ifdef FR_PIXEL_X86
+
+    // pshufb masks to weave 16 bytes each of b, g and r into 48 bytes
+    // of bgr. mask[block][channel] picks channel's bytes for output
+    // block (16 bytes) block.
+    constexpr std::array<std::array<std::array<uint8_t, 16>, 3>, 3> bgrMasks = [] {
+      std::array<std::array<std::array<uint8_t, 16>, 3>, 3> masks{};
+      for (int block = 0; block < 3; ++block) {
+        for (int channel = 0; channel < 3; ++channel) {
+          for (int j = 0; j < 16; ++j) {
+            int n = block * 16 + j;
+            masks[block][channel][j] = (n % 3 == channel) ? static_cast<uint8_t>(n / 3) : 0x80;
+          }
+        }
+      }
+      return masks;
+    }();
+
+    __attribute__((target("sse4.1")))
+    inline void storeBgr(uint8_t* out, __m128i b, __m128i g, __m128i r) {
+      for (int block = 0; block < 3; ++block) {
+        __m128i mb = _mm_loadu_si128((const __m128i*) bgrMasks[block][0].data());
+        __m128i mg = _mm_loadu_si128((const __m128i*) bgrMasks[block][1].data());
+        __m128i mr = _mm_loadu_si128((const __m128i*) bgrMasks[block][2].data());
+        __m128i res = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, mb), _mm_shuffle_epi8(g, mg)),
+                                   _mm_shuffle_epi8(r, mr));
+        _mm_storeu_si128((__m128i*) (out + 16 * block), res);
+      }
+    }
+
+    __attribute__((target("sse4.1")))
+    void interleaveSse4(const uint8_t* u, const uint8_t* v, uint8_t* uv, int n) {
+      int i = 0;
+      for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (u + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (v + i));
+        _mm_storeu_si128((__m128i*) (uv + 2 * i), _mm_unpacklo_epi8(a, b));
+        _mm_storeu_si128((__m128i*) (uv + 2 * i + 16), _mm_unpackhi_epi8(a, b));
+      }
+      interleaveC(u + i, v + i, uv + 2 * i, n - i);
+    }
+
+    __attribute__((target("sse4.1")))
+    void splitSse4(const uint8_t* uv, uint8_t* u, uint8_t* v, int n) {
+      const __m128i low = _mm_set1_epi16(0x00ff);
+      int i = 0;
+      for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (uv + 2 * i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (uv + 2 * i + 16));
+        _mm_storeu_si128((__m128i*) (u + i), _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low)));
+        _mm_storeu_si128((__m128i*) (v + i), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+      }
+      splitC(uv + 2 * i, u + i, v + i, n - i);
+    }
+
+    // Eight pixels of b, g and r from eight luma and chroma values,
+    // all 16 bit
+    __attribute__((target("sse4.1")))
+    inline void yuvPixelsSse4(__m128i y, __m128i u, __m128i v, const Coefficients& c,
+                              __m128i& b, __m128i& g, __m128i& r) {
+      const __m128i round = _mm_set1_epi16(4);
+      __m128i yy = _mm_mulhrs_epi16(_mm_slli_epi16(_mm_sub_epi16(y, _mm_set1_epi16(c.yOffset)), 7),
+                                    _mm_set1_epi16(c.y));
+      __m128i uu = _mm_slli_epi16(_mm_sub_epi16(u, _mm_set1_epi16(128)), 7);
+      __m128i vv = _mm_slli_epi16(_mm_sub_epi16(v, _mm_set1_epi16(128)), 7);
+      b = _mm_add_epi16(yy, _mm_mulhrs_epi16(uu, _mm_set1_epi16(c.ub)));
+      g = _mm_sub_epi16(_mm_sub_epi16(yy, _mm_mulhrs_epi16(uu, _mm_set1_epi16(c.ug))),
+                        _mm_mulhrs_epi16(vv, _mm_set1_epi16(c.vg)));
+      r = _mm_add_epi16(yy, _mm_mulhrs_epi16(vv, _mm_set1_epi16(c.vr)));
+      b = _mm_srai_epi16(_mm_add_epi16(b, round), 3);
+      g = _mm_srai_epi16(_mm_add_epi16(g, round), 3);
+      r = _mm_srai_epi16(_mm_add_epi16(r, round), 3);
+    }
+
+    __attribute__((target("sse4.1")))
+    void yuvSse4(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* bgr, int width,
+                 const Coefficients& c) {
+      const __m128i zero = _mm_setzero_si128();
+      int x = 0;
+      for (; x + 16 <= width; x += 16) {
+        __m128i y8 = _mm_loadu_si128((const __m128i*) (y + x));
+        __m128i u8 = _mm_loadl_epi64((const __m128i*) (u + x / 2));
+        __m128i v8 = _mm_loadl_epi64((const __m128i*) (v + x / 2));
+        // One chroma sample for each pair of pixels
+        u8 = _mm_unpacklo_epi8(u8, u8);
+        v8 = _mm_unpacklo_epi8(v8, v8);
+        __m128i b0, g0, r0, b1, g1, r1;
+        yuvPixelsSse4(_mm_unpacklo_epi8(y8, zero), _mm_unpacklo_epi8(u8, zero),
+                      _mm_unpacklo_epi8(v8, zero), c, b0, g0, r0);
+        yuvPixelsSse4(_mm_unpackhi_epi8(y8, zero), _mm_unpackhi_epi8(u8, zero),
+                      _mm_unpackhi_epi8(v8, zero), c, b1, g1, r1);
+        storeBgr(bgr + 3 * x, _mm_packus_epi16(b0, b1), _mm_packus_epi16(g0, g1), _mm_packus_epi16(r0, r1));
+      }
+      yuvC(y + x, u + x / 2, v + x / 2, bgr + 3 * x, width - x, c);
+    }
+
+    __attribute__((target("sse4.1")))
+    void halveSse4(const uint8_t* top, const uint8_t* bottom, uint8_t* out, int n) {
+      const __m128i ones = _mm_set1_epi8(1);
+      const __m128i two = _mm_set1_epi16(2);
+      int i = 0;
+      for (; i + 16 <= n; i += 16) {
+        __m128i s0 = _mm_add_epi16(_mm_maddubs_epi16(_mm_loadu_si128((const __m128i*) (top + 2 * i)), ones),
+                                   _mm_maddubs_epi16(_mm_loadu_si128((const __m128i*) (bottom + 2 * i)), ones));
+        __m128i s1 = _mm_add_epi16(_mm_maddubs_epi16(_mm_loadu_si128((const __m128i*) (top + 2 * i + 16)), ones),
+                                   _mm_maddubs_epi16(_mm_loadu_si128((const __m128i*) (bottom + 2 * i + 16)), ones));
+        s0 = _mm_srli_epi16(_mm_add_epi16(s0, two), 2);
+        s1 = _mm_srli_epi16(_mm_add_epi16(s1, two), 2);
+        _mm_storeu_si128((__m128i*) (out + i), _mm_packus_epi16(s0, s1));
+      }
+      halveC(top + 2 * i, bottom + 2 * i, out + i, n - i);
+    }
+
+    constexpr Kernels sse4Kernels{&interleaveSse4, &splitSse4, &yuvSse4, &halveSse4};
+
+    __attribute__((target("avx2")))
+    void interleaveAvx2(const uint8_t* u, const uint8_t* v, uint8_t* uv, int n) {
+      int i = 0;
+      for (; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (u + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (v + i));
+        // Unpacking works inside each 128 bit lane, so put the lanes
+        // back in order afterwards
+        __m256i lo = _mm256_unpacklo_epi8(a, b);
+        __m256i hi = _mm256_unpackhi_epi8(a, b);
+        _mm256_storeu_si256((__m256i*) (uv + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*) (uv + 2 * i + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+      }
+      interleaveSse4(u + i, v + i, uv + 2 * i, n - i);
+    }
+
+    __attribute__((target("avx2")))
+    void splitAvx2(const uint8_t* uv, uint8_t* u, uint8_t* v, int n) {
+      const __m256i low = _mm256_set1_epi16(0x00ff);
+      int i = 0;
+      for (; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (uv + 2 * i));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (uv + 2 * i + 32));
+        __m256i us = _mm256_packus_epi16(_mm256_and_si256(a, low), _mm256_and_si256(b, low));
+        __m256i vs = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+        _mm256_storeu_si256((__m256i*) (u + i), _mm256_permute4x64_epi64(us, 0xd8));
+        _mm256_storeu_si256((__m256i*) (v + i), _mm256_permute4x64_epi64(vs, 0xd8));
+      }
+      splitSse4(uv + 2 * i, u + i, v + i, n - i);
+    }
+
+    __attribute__((target("avx2")))
+    inline void yuvPixelsAvx2(__m256i y, __m256i u, __m256i v, const Coefficients& c,
+                              __m256i& b, __m256i& g, __m256i& r) {
+      const __m256i round = _mm256_set1_epi16(4);
+      __m256i yy = _mm256_mulhrs_epi16(_mm256_slli_epi16(_mm256_sub_epi16(y, _mm256_set1_epi16(c.yOffset)), 7),
+                                       _mm256_set1_epi16(c.y));
+      __m256i uu = _mm256_slli_epi16(_mm256_sub_epi16(u, _mm256_set1_epi16(128)), 7);
+      __m256i vv = _mm256_slli_epi16(_mm256_sub_epi16(v, _mm256_set1_epi16(128)), 7);
+      b = _mm256_add_epi16(yy, _mm256_mulhrs_epi16(uu, _mm256_set1_epi16(c.ub)));
+      g = _mm256_sub_epi16(_mm256_sub_epi16(yy, _mm256_mulhrs_epi16(uu, _mm256_set1_epi16(c.ug))),
+                           _mm256_mulhrs_epi16(vv, _mm256_set1_epi16(c.vg)));
+      r = _mm256_add_epi16(yy, _mm256_mulhrs_epi16(vv, _mm256_set1_epi16(c.vr)));
+      b = _mm256_srai_epi16(_mm256_add_epi16(b, round), 3);
+      g = _mm256_srai_epi16(_mm256_add_epi16(g, round), 3);
+      r = _mm256_srai_epi16(_mm256_add_epi16(r, round), 3);
+    }
+
+    __attribute__((target("avx2")))
+    void yuvAvx2(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* bgr, int width,
+                 const Coefficients& c) {
+      int x = 0;
+      for (; x + 32 <= width; x += 32) {
+        __m128i u8 = _mm_loadu_si128((const __m128i*) (u + x / 2));
+        __m128i v8 = _mm_loadu_si128((const __m128i*) (v + x / 2));
+        __m256i b0, g0, r0, b1, g1, r1;
+        yuvPixelsAvx2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (y + x))),
+                      _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(u8, u8)),
+                      _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(v8, v8)), c, b0, g0, r0);
+        yuvPixelsAvx2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (y + x + 16))),
+                      _mm256_cvtepu8_epi16(_mm_unpackhi_epi8(u8, u8)),
+                      _mm256_cvtepu8_epi16(_mm_unpackhi_epi8(v8, v8)), c, b1, g1, r1);
+        __m256i b = _mm256_permute4x64_epi64(_mm256_packus_epi16(b0, b1), 0xd8);
+        __m256i g = _mm256_permute4x64_epi64(_mm256_packus_epi16(g0, g1), 0xd8);
+        __m256i r = _mm256_permute4x64_epi64(_mm256_packus_epi16(r0, r1), 0xd8);
+        storeBgr(bgr + 3 * x, _mm256_castsi256_si128(b), _mm256_castsi256_si128(g), _mm256_castsi256_si128(r));
+        storeBgr(bgr + 3 * x + 48, _mm256_extracti128_si256(b, 1), _mm256_extracti128_si256(g, 1),
+                 _mm256_extracti128_si256(r, 1));
+      }
+      yuvSse4(y + x, u + x / 2, v + x / 2, bgr + 3 * x, width - x, c);
+    }
+
+    __attribute__((target("avx2")))
+    void halveAvx2(const uint8_t* top, const uint8_t* bottom, uint8_t* out, int n) {
+      const __m256i ones = _mm256_set1_epi8(1);
+      const __m256i two = _mm256_set1_epi16(2);
+      int i = 0;
+      for (; i + 32 <= n; i += 32) {
+        __m256i s0 = _mm256_add_epi16(_mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i*) (top + 2 * i)), ones),
+                                      _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i*) (bottom + 2 * i)), ones));
+        __m256i s1 = _mm256_add_epi16(_mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i*) (top + 2 * i + 32)), ones),
+                                      _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i*) (bottom + 2 * i + 32)), ones));
+        s0 = _mm256_srli_epi16(_mm256_add_epi16(s0, two), 2);
+        s1 = _mm256_srli_epi16(_mm256_add_epi16(s1, two), 2);
+        _mm256_storeu_si256((__m256i*) (out + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(s0, s1), 0xd8));
+      }
+      halveSse4(top + 2 * i, bottom + 2 * i, out + i, n - i);
+    }
+
+    constexpr Kernels avx2Kernels{&interleaveAvx2, &splitAvx2, &yuvAvx2, &halveAvx2};
+
+#endif
+
+#ifdef FR_PIXEL_NEON
+
+    void interleaveNeon(const uint8_t* u, const uint8_t* v, uint8_t* uv, int n) {
+      int i = 0;
+      for (; i + 16 <= n; i += 16) {
+        uint8x16x2_t pair = {vld1q_u8(u + i), vld1q_u8(v + i)};
+        vst2q_u8(uv + 2 * i, pair);
+      }
+      interleaveC(u + i, v + i, uv + 2 * i, n - i);
+    }
+
+    void splitNeon(const uint8_t* uv, uint8_t* u, uint8_t* v, int n) {
+      int i = 0;
+      for (; i + 16 <= n; i += 16) {
+        uint8x16x2_t pair = vld2q_u8(uv + 2 * i);
+        vst1q_u8(u + i, pair.val[0]);
+        vst1q_u8(v + i, pair.val[1]);
+      }
+      splitC(uv + 2 * i, u + i, v + i, n - i);
+    }
+
+    inline int16x8_t widen(uint8x8_t v) {
+      return vreinterpretq_s16_u16(vmovl_u8(v));
+    }
+
+    inline void yuvPixelsNeon(int16x8_t y, int16x8_t u, int16x8_t v, const Coefficients& c,
+                              uint8x8_t& b, uint8x8_t& g, uint8x8_t& r) {
+      int16x8_t yy = vqrdmulhq_s16(vshlq_n_s16(vsubq_s16(y, vdupq_n_s16(c.yOffset)), 7), vdupq_n_s16(c.y));
+      int16x8_t uu = vshlq_n_s16(vsubq_s16(u, vdupq_n_s16(128)), 7);
+      int16x8_t vv = vshlq_n_s16(vsubq_s16(v, vdupq_n_s16(128)), 7);
+      int16x8_t bs = vaddq_s16(yy, vqrdmulhq_s16(uu, vdupq_n_s16(c.ub)));
+      int16x8_t gs = vsubq_s16(vsubq_s16(yy, vqrdmulhq_s16(uu, vdupq_n_s16(c.ug))),
+                               vqrdmulhq_s16(vv, vdupq_n_s16(c.vg)));
+      int16x8_t rs = vaddq_s16(yy, vqrdmulhq_s16(vv, vdupq_n_s16(c.vr)));
+      const int16x8_t round = vdupq_n_s16(4);
+      b = vqmovun_s16(vshrq_n_s16(vaddq_s16(bs, round), 3));
+      g = vqmovun_s16(vshrq_n_s16(vaddq_s16(gs, round), 3));
+      r = vqmovun_s16(vshrq_n_s16(vaddq_s16(rs, round), 3));
+    }
+
+    void yuvNeon(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* bgr, int width,
+                 const Coefficients& c) {
+      int x = 0;
+      for (; x + 16 <= width; x += 16) {
+        uint8x16_t y8 = vld1q_u8(y + x);
+        uint8x8x2_t u8 = vzip_u8(vld1_u8(u + x / 2), vld1_u8(u + x / 2));
+        uint8x8x2_t v8 = vzip_u8(vld1_u8(v + x / 2), vld1_u8(v + x / 2));
+        uint8x8_t b0, g0, r0, b1, g1, r1;
+        yuvPixelsNeon(widen(vget_low_u8(y8)), widen(u8.val[0]), widen(v8.val[0]), c, b0, g0, r0);
+        yuvPixelsNeon(widen(vget_high_u8(y8)), widen(u8.val[1]), widen(v8.val[1]), c, b1, g1, r1);
+        uint8x16x3_t out = {vcombine_u8(b0, b1), vcombine_u8(g0, g1), vcombine_u8(r0, r1)};
+        vst3q_u8(bgr + 3 * x, out);
+      }
+      yuvC(y + x, u + x / 2, v + x / 2, bgr + 3 * x, width - x, c);
+    }
+
+    void halveNeon(const uint8_t* top, const uint8_t* bottom, uint8_t* out, int n) {
+      int i = 0;
+      for (; i + 16 <= n; i += 16) {
+        uint16x8_t s0 = vpadalq_u8(vpaddlq_u8(vld1q_u8(top + 2 * i)), vld1q_u8(bottom + 2 * i));
+        uint16x8_t s1 = vpadalq_u8(vpaddlq_u8(vld1q_u8(top + 2 * i + 16)), vld1q_u8(bottom + 2 * i + 16));
+        vst1q_u8(out + i, vcombine_u8(vrshrn_n_u16(s0, 2), vrshrn_n_u16(s1, 2)));
+      }
+      halveC(top + 2 * i, bottom + 2 * i, out + i, n - i);
+    }
+
+    constexpr Kernels neonKernels{&interleaveNeon, &splitNeon, &yuvNeon, &halveNeon};
+
+#endif
+
+    const Kernels* kernels(PixelKernels::Isa isa) {
+      if (!PixelKernels::supported(isa)) {
+        return nullptr;
+      }
+      switch (isa) {
+#ifdef FR_PIXEL_X86
+      case PixelKernels::Isa::sse4:
+        return &sse4Kernels;
+      case PixelKernels::Isa::avx2:
+        return &avx2Kernels;
+#endif
+#ifdef FR_PIXEL_NEON
+      case PixelKernels::Isa::neon:
+        return &neonKernels;
+#endif
+      default:
+        return &genericKernels;
+      }
+    }
+
+    // Whole frames
+
+    void yuv420ToNv12(const Kernels& k, const AVFrame* src, AVFrame* dst) {
+      av_image_copy_plane(dst->data[0], dst->linesize[0], src->data[0], src->linesize[0],
+                          src->width, src->height);
+      int width = (src->width + 1) / 2;
+      int height = (src->height + 1) / 2;
+      for (int y = 0; y < height; ++y) {
+        k.interleave(src->data[1] + y * src->linesize[1], src->data[2] + y * src->linesize[2],
+                     dst->data[1] + y * dst->linesize[1], width);
+      }
+    }
+
+    void nv12ToYuv420(const Kernels& k, const AVFrame* src, AVFrame* dst) {
+      av_image_copy_plane(dst->data[0], dst->linesize[0], src->data[0], src->linesize[0],
+                          src->width, src->height);
+      int width = (src->width + 1) / 2;
+      int height = (src->height + 1) / 2;
+      for (int y = 0; y < height; ++y) {
+        k.split(src->data[1] + y * src->linesize[1], dst->data[1] + y * dst->linesize[1],
+                dst->data[2] + y * dst->linesize[2], width);
+      }
+    }
+
+    void yuv420ToBgr(const Kernels& k, const Coefficients& c, const AVFrame* src, AVFrame* dst) {
+      for (int y = 0; y < src->height; ++y) {
+        k.yuv(src->data[0] + y * src->linesize[0], src->data[1] + (y / 2) * src->linesize[1],
+              src->data[2] + (y / 2) * src->linesize[2], dst->data[0] + y * dst->linesize[0],
+              src->width, c);
+      }
+    }
+
+    void halveYuv420(const Kernels& k, const AVFrame* src, AVFrame* dst) {
+      for (int p = 0; p < 3; ++p) {
+        int width = p ? src->width / 4 : src->width / 2;
+        int height = p ? src->height / 4 : src->height / 2;
+        for (int y = 0; y < height; ++y) {
+          k.halve(src->data[p] + (2 * y) * src->linesize[p], src->data[p] + (2 * y + 1) * src->linesize[p],
+                  dst->data[p] + y * dst->linesize[p], width);
+        }
+      }
+    }
+
+    bool isYuv420(AVPixelFormat format) {
+      return AV_PIX_FMT_YUV420P == format || AV_PIX_FMT_YUVJ420P == format;
+    }
+
+  }
+
+  PixelKernels::Convert PixelKernels::find(int srcWidth, int srcHeight, AVPixelFormat srcFormat,
+                                           int dstWidth, int dstHeight, AVPixelFormat dstFormat,
+                                           Accuracy accuracy) {
+    return find(srcWidth, srcHeight, srcFormat, dstWidth, dstHeight, dstFormat, best(), accuracy);
+  }
+
+  PixelKernels::Convert PixelKernels::find(int srcWidth, int srcHeight, AVPixelFormat srcFormat,
+                                           int dstWidth, int dstHeight, AVPixelFormat dstFormat,
+                                           Isa isa, Accuracy accuracy) {
+    const Kernels* k = kernels(isa);
+    if (nullptr == k || srcWidth <= 0 || srcHeight <= 0) {
+      return {};
+    }
+    bool sameSize = srcWidth == dstWidth && srcHeight == dstHeight;
+    if (sameSize && AV_PIX_FMT_YUV420P == srcFormat && AV_PIX_FMT_NV12 == dstFormat) {
+      return [k](const AVFrame* src, AVFrame* dst) { yuv420ToNv12(*k, src, dst); };
+    }
+    if (sameSize && AV_PIX_FMT_NV12 == srcFormat && AV_PIX_FMT_YUV420P == dstFormat) {
+      return [k](const AVFrame* src, AVFrame* dst) { nv12ToYuv420(*k, src, dst); };
+    }
+    // Everything after this comes out a little different from swscale
+    if (Accuracy::exact == accuracy) {
+      return {};
+    }
+    if (sameSize && isYuv420(srcFormat) && AV_PIX_FMT_BGR24 == dstFormat) {
+      const Coefficients* c = AV_PIX_FMT_YUVJ420P == srcFormat ? &fullRange : &limitedRange;
+      return [k, c](const AVFrame* src, AVFrame* dst) { yuv420ToBgr(*k, *c, src, dst); };
+    }
+    // Exactly half, with the chroma planes halving evenly too
+    if (isYuv420(srcFormat) && srcFormat == dstFormat && 0 == srcWidth % 4 && 0 == srcHeight % 4 &&
+        dstWidth * 2 == srcWidth && dstHeight * 2 == srcHeight) {
+      return [k](const AVFrame* src, AVFrame* dst) { halveYuv420(*k, src, dst); };
+    }
+    return {};
+  }
+
+  PixelKernels::Isa PixelKernels::best() {
+    static const Isa isa = [] {
+      for (Isa candidate : {Isa::avx2, Isa::sse4, Isa::neon}) {
+        if (supported(candidate)) {
+          return candidate;
+        }
+      }
+      return Isa::generic;
+    }();
+    return isa;
+  }
+
+  bool PixelKernels::supported(Isa isa) {
+    switch (isa) {
+    case Isa::generic:
+      return true;
+#ifdef FR_PIXEL_X86
+    case Isa::sse4:
+      return __builtin_cpu_supports("sse4.1");
+    case Isa::avx2:
+      return __builtin_cpu_supports("avx2");
+#endif
+#ifdef FR_PIXEL_NEON
+    case Isa::neon:
+      return true;
+#endif
+    default:
+      return false;
+    }
+  }
+
+  const char* PixelKernels::name(Isa isa) {
+    switch (isa) {
+    case Isa::sse4:
+      return "sse4";
+    case Isa::avx2:
+      return "avx2";
+    case Isa::neon:
+      return "neon";
+    default:
+      return "generic";
+    }
+  }
+
+}
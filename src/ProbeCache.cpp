@@ -0,0 +1,325 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fr/media2/ProbeCache.h>
+#include <fr/media2/Serialization.h>
+#include <boost/serialization/string.hpp>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <system_error>
+
+namespace fr::media2 {
+
+  namespace {
+
+    // FNV-1a. Doesn't need to be good, just the same every time.
+    uint64_t fnv1a(const char* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull) {
+      for (size_t i = 0; i < size; ++i) {
+        hash ^= (uint8_t) data[i];
+        hash *= 0x100000001b3ull;
+      }
+      return hash;
+    }
+
+    std::string hex(uint64_t value) {
+      char buffer[17];
+      snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long) value);
+      return buffer;
+    }
+
+    // The local path url refers to, if it's a local file
+    bool localFile(const std::string& url, std::filesystem::path& path) {
+      std::string name = url;
+      if (0 == name.rfind("file:", 0)) {
+        name = name.substr(5);
+      } else if (std::string::npos != name.find("://")) {
+        return false;
+      }
+      std::error_code err;
+      if (!std::filesystem::is_regular_file(name, err)) {
+        return false;
+      }
+      path = std::filesystem::canonical(name, err);
+      return !err;
+    }
+
+  }
+
+  ProbeCache::ProbeCache() = default;
+
+  ProbeCache::ProbeCache(const std::filesystem::path& directory) : ProbeCache(directory, Settings{}) {
+  }
+
+  ProbeCache::ProbeCache(const std::filesystem::path& directory, const Settings& settings) :
+    directory(directory), settings(settings) {
+    if (!directory.empty()) {
+      std::filesystem::create_directories(directory);
+    }
+  }
+
+  void ProbeCache::freeParameters(AVCodecParameters* parameters) {
+    avcodec_parameters_free(&parameters);
+  }
+
+  std::string ProbeCache::key(const std::string& url) const {
+    std::filesystem::path path;
+    if (!localFile(url, path)) {
+      return settings.cacheUrls ? "url|" + url : std::string{};
+    }
+    std::error_code err;
+    uintmax_t size = std::filesystem::file_size(path, err);
+    if (err) {
+      return std::string{};
+    }
+    if (Key::fileStat == settings.key) {
+      auto mtime = std::filesystem::last_write_time(path, err);
+      if (err) {
+        return std::string{};
+      }
+      return "file|" + path.string() + "|" + std::to_string(size) + "|" +
+        std::to_string(mtime.time_since_epoch().count());
+    }
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> buffer(std::min<uintmax_t>(size, settings.hashBytes));
+    in.read(buffer.data(), buffer.size());
+    if (!in) {
+      return std::string{};
+    }
+    return "hash|" + hex(fnv1a(buffer.data(), buffer.size())) + "|" + std::to_string(size);
+  }
+
+  ProbeCache::Stats ProbeCache::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return current;
+  }
+
+  std::filesystem::path ProbeCache::entryPath(const std::string& key) const {
+    return directory / (hex(fnv1a(key.data(), key.size())) + ".probe");
+  }
+
+  std::shared_ptr<const ProbeCache::Entry> ProbeCache::find(const std::string& key) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto found = entries.find(key);
+      if (found != entries.end()) {
+        return found->second;
+      }
+    }
+    if (directory.empty()) {
+      return nullptr;
+    }
+    std::shared_ptr<const Entry> ret;
+    try {
+      ret = load(key);
+    } catch (std::exception& e) {
+      std::cerr << "Ignoring unreadable probe cache entry " << entryPath(key).string() << ": " << e.what() << std::endl;
+      return nullptr;
+    }
+    if (ret) {
+      std::lock_guard<std::mutex> lock(mutex);
+      entries[key] = ret;
+    }
+    return ret;
+  }
+
+  bool ProbeCache::apply(const std::string& url, AVFormatContext* context) {
+    std::string k = key(url);
+    std::shared_ptr<const Entry> entry;
+    if (!k.empty()) {
+      entry = find(k);
+    }
+    bool usable = entry && entry->streams.size() == context->nb_streams;
+    for (unsigned int i = 0; usable && i < context->nb_streams; ++i) {
+      const AVCodecParameters* cached = entry->streams[i].parameters.get();
+      const AVCodecParameters* opened = context->streams[i]->codecpar;
+      // The demuxer usually knows at least this much from the header
+      if ((AVMEDIA_TYPE_UNKNOWN != opened->codec_type && opened->codec_type != cached->codec_type) ||
+          (AV_CODEC_ID_NONE != opened->codec_id && opened->codec_id != cached->codec_id)) {
+        usable = false;
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (usable) {
+        current.hits++;
+      } else {
+        current.misses++;
+      }
+    }
+    if (!usable) {
+      return false;
+    }
+    for (unsigned int i = 0; i < context->nb_streams; ++i) {
+      const StreamEntry& cached = entry->streams[i];
+      AVStream* stream = context->streams[i];
+      if (avcodec_parameters_copy(stream->codecpar, cached.parameters.get()) < 0) {
+        throw std::runtime_error("Could not copy cached codec parameters");
+      }
+      stream->time_base = cached.time_base;
+      stream->avg_frame_rate = cached.avg_frame_rate;
+      stream->r_frame_rate = cached.r_frame_rate;
+      if (AV_NOPTS_VALUE == stream->start_time) {
+        stream->start_time = cached.start_time;
+      }
+      if (AV_NOPTS_VALUE == stream->duration) {
+        stream->duration = cached.duration;
+      }
+    }
+    if (AV_NOPTS_VALUE == context->start_time) {
+      context->start_time = entry->start_time;
+    }
+    if (AV_NOPTS_VALUE == context->duration) {
+      context->duration = entry->duration;
+    }
+    if (0 == context->bit_rate) {
+      context->bit_rate = entry->bit_rate;
+    }
+    return true;
+  }
+
+  void ProbeCache::store(const std::string& url, const AVFormatContext* context) {
+    std::string k = key(url);
+    if (k.empty()) {
+      return;
+    }
+    auto entry = std::make_shared<Entry>();
+    entry->key = k;
+    entry->start_time = context->start_time;
+    entry->duration = context->duration;
+    entry->bit_rate = context->bit_rate;
+    for (unsigned int i = 0; i < context->nb_streams; ++i) {
+      const AVStream* stream = context->streams[i];
+      StreamEntry s;
+      s.parameters.reset(avcodec_parameters_alloc());
+      if (!s.parameters || avcodec_parameters_copy(s.parameters.get(), stream->codecpar) < 0) {
+        throw std::runtime_error("Could not copy codec parameters");
+      }
+      s.time_base = stream->time_base;
+      s.avg_frame_rate = stream->avg_frame_rate;
+      s.r_frame_rate = stream->r_frame_rate;
+      s.start_time = stream->start_time;
+      s.duration = stream->duration;
+      entry->streams.push_back(std::move(s));
+    }
+    if (!directory.empty()) {
+      try {
+        save(*entry);
+      } catch (std::exception& e) {
+        // Still good in memory
+        std::cerr << "Could not save probe cache entry for " << url << ": " << e.what() << std::endl;
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    entries[k] = entry;
+    current.stores++;
+  }
+
+  void ProbeCache::remove(const std::string& url) {
+    std::string k = key(url);
+    if (k.empty()) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      entries.erase(k);
+    }
+    if (!directory.empty()) {
+      std::error_code err;
+      std::filesystem::remove(entryPath(k), err);
+    }
+  }
+
+  void ProbeCache::save(const Entry& entry) const {
+    std::filesystem::path path = entryPath(entry.key);
+    // Write it somewhere else and move it into place, so nobody ever
+    // reads half an entry
+    std::filesystem::path temp = path;
+    temp += "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+    {
+      std::ofstream out(temp, std::ios::binary);
+      if (!out) {
+        throw std::runtime_error("Could not create " + temp.string());
+      }
+      boost::archive::binary_oarchive ar(out);
+      uint32_t v = version;
+      uint64_t nstreams = entry.streams.size();
+      ar << v;
+      ar << entry.key;
+      ar << entry.start_time;
+      ar << entry.duration;
+      ar << entry.bit_rate;
+      ar << nstreams;
+      for (const StreamEntry& stream : entry.streams) {
+        ar << *stream.parameters;
+        ar << stream.time_base.num << stream.time_base.den;
+        ar << stream.avg_frame_rate.num << stream.avg_frame_rate.den;
+        ar << stream.r_frame_rate.num << stream.r_frame_rate.den;
+        ar << stream.start_time;
+        ar << stream.duration;
+      }
+    }
+    std::filesystem::rename(temp, path);
+  }
+
+  std::shared_ptr<const ProbeCache::Entry> ProbeCache::load(const std::string& key) const {
+    std::ifstream in(entryPath(key), std::ios::binary);
+    if (!in) {
+      return nullptr;
+    }
+    boost::archive::binary_iarchive ar(in);
+    auto entry = std::make_shared<Entry>();
+    uint32_t v;
+    uint64_t nstreams;
+    ar >> v;
+    if (version != v) {
+      return nullptr;
+    }
+    ar >> entry->key;
+    // Two keys with the same hash
+    if (key != entry->key) {
+      return nullptr;
+    }
+    ar >> entry->start_time;
+    ar >> entry->duration;
+    ar >> entry->bit_rate;
+    ar >> nstreams;
+    for (uint64_t i = 0; i < nstreams; ++i) {
+      StreamEntry stream;
+      stream.parameters.reset(avcodec_parameters_alloc());
+      if (!stream.parameters) {
+        throw std::runtime_error("Could not allocate codec parameters");
+      }
+      ar >> *stream.parameters;
+      ar >> stream.time_base.num >> stream.time_base.den;
+      ar >> stream.avg_frame_rate.num >> stream.avg_frame_rate.den;
+      ar >> stream.r_frame_rate.num >> stream.r_frame_rate.den;
+      ar >> stream.start_time;
+      ar >> stream.duration;
+      entry->streams.push_back(std::move(stream));
+    }
+    return entry;
+  }
+
+}
@@ -0,0 +1,319 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fr/media2/RenditionLadder.h>
+#include <fr/media2/Scaler.h>
+
+extern "C" {
+#include <libavutil/dict.h>
+}
+
+#include <iostream>
+#include <stdexcept>
+
+namespace fr::media2 {
+
+  std::vector<RenditionLadder::Rendition> RenditionLadder::hd() {
+    std::vector<Rendition> renditions(2);
+    renditions[0].height = 1080;
+    renditions[1].height = 720;
+    return renditions;
+  }
+
+  RenditionLadder::RenditionLadder(const std::vector<Rendition>& renditions, size_t queueDepth) {
+    if (0 == queueDepth) {
+      queueDepth = 1;
+    }
+    for (const Rendition& rendition : renditions) {
+      auto rung = std::make_unique<Rung>(rendition, queueDepth);
+      if (rung->settings.name.empty() && rendition.height > 0) {
+        rung->settings.name = std::to_string(rendition.height) + "p";
+      }
+      rung->codec = avcodec_find_encoder_by_name(rendition.codec.c_str());
+      if (nullptr == rung->codec) {
+        std::string err{"Could not find codec "};
+        err.append(rendition.codec);
+        throw std::logic_error(err);
+      }
+      setData(rung.get());
+      rungs.push_back(std::move(rung));
+    }
+    for (auto& rung : rungs) {
+      Rung* r = rung.get();
+      r->thread = std::thread([this, r]{ run(r); });
+    }
+  }
+
+  RenditionLadder::~RenditionLadder() {
+    close();
+  }
+
+  void RenditionLadder::setData(Rung* rung) {
+    rung->stream->data = std::make_shared<StreamData>(rung->settings.name);
+    rung->stream->data->mediaType = AVMEDIA_TYPE_VIDEO;
+    rung->stream->data->codec = (AVCodec*) rung->codec;
+  }
+
+  void RenditionLadder::subscribeCallback(FrameSource* source) {
+    time_base = source->time_base;
+    avg_frame_rate = source->avg_frame_rate;
+    AVCodecParameters* par = source->parameters;
+    if (configured || nullptr == par || par->width <= 0 || par->height <= 0 || time_base.den <= 0) {
+      return;
+    }
+    // Everything's known already, so the streams can have their
+    // parameters before anyone subscribes to them
+    configure(par->width, par->height, par->sample_aspect_ratio);
+  }
+
+  size_t RenditionLadder::size() const {
+    return rungs.size();
+  }
+
+  const RenditionLadder::Rendition& RenditionLadder::rendition(size_t index) const {
+    return rungs.at(index)->settings;
+  }
+
+  Stream::pointer RenditionLadder::stream(size_t index) const {
+    return rungs.at(index)->stream;
+  }
+
+  bool RenditionLadder::isConfigured() const {
+    return configured;
+  }
+
+  bool RenditionLadder::active(size_t index) const {
+    return rungs.at(index)->active;
+  }
+
+  uint64_t RenditionLadder::failures() const {
+    return failed;
+  }
+
+  void RenditionLadder::configure(int sourceWidth, int sourceHeight, AVRational sampleAspectRatio) {
+    Rung* previous = nullptr;
+    for (auto& rung : rungs) {
+      int width = rung->settings.width;
+      int height = rung->settings.height;
+      Scaler::fitSize(sourceWidth, sourceHeight, width, height);
+      rung->width = width;
+      rung->height = height;
+      if (rung->settings.name.empty()) {
+        // Only had a width, so now we know what to call it
+        rung->settings.name = std::to_string(height) + "p";
+        setData(rung.get());
+      }
+      // No point encoding a copy of the source or blowing it up
+      rung->active = width < sourceWidth || height < sourceHeight;
+      if (!rung->active) {
+        continue;
+      }
+      activeRungs++;
+      if (nullptr == previous) {
+        first = rung.get();
+      } else {
+        previous->next = rung.get();
+      }
+      previous = rung.get();
+      // The rung threads don't touch the encoder until their first
+      // frame, which can't show up before this is done
+      try {
+        openEncoder(rung.get(), sampleAspectRatio);
+      } catch (std::exception& e) {
+        // encode tries again on the first frame
+        std::cerr << "Could not open encoder for " << rung->settings.name << ": " << e.what() << std::endl;
+      }
+    }
+    configured = true;
+  }
+
+  void RenditionLadder::process(Frame::const_pointer frame, const StreamData::pointer& stream) {
+    if (flushed) {
+      return;
+    }
+    if (!configured) {
+      if (0 == time_base.den && stream) {
+        time_base = stream->time_base;
+      }
+      configure(frame->width, frame->height, frame->sample_aspect_ratio);
+    }
+    if (nullptr == first) {
+      return;
+    }
+    // This is just a reference, so the decoder can reuse its frame
+    Job job;
+    job.frame = Frame::clone(frame);
+    first->queue.push(std::move(job));
+  }
+
+  void RenditionLadder::run(Rung* rung) {
+    Job job;
+    while (rung->queue.pop(job)) {
+      if (!job.frame) {
+        if (rung->next) {
+          rung->next->queue.push(Job{});
+        }
+        finish(rung);
+        continue;
+      }
+      Frame::pointer frame{nullptr, &Frame::destroy};
+      try {
+        frame = scale(rung, std::move(job.frame));
+      } catch (std::exception& e) {
+        failed++;
+        std::cerr << "Could not scale frame for " << rung->settings.name << ": " << e.what() << std::endl;
+        continue;
+      }
+      if (rung->next) {
+        Job down;
+        down.frame = Frame::clone(frame);
+        rung->next->queue.push(std::move(down));
+      }
+      try {
+        encode(rung, frame.get());
+      } catch (std::exception& e) {
+        failed++;
+        std::cerr << "Could not encode frame for " << rung->settings.name << ": " << e.what() << std::endl;
+      }
+    }
+  }
+
+  Frame::pointer RenditionLadder::scale(Rung* rung, Frame::pointer input) {
+    if (input->width == rung->width && input->height == rung->height &&
+        input->format == rung->settings.format) {
+      return input;
+    }
+    if (!rung->scaler) {
+      rung->scaler.reset(sws_getContext(input->width, input->height, (AVPixelFormat) input->format,
+                                        rung->width, rung->height, rung->settings.format,
+                                        SWS_BICUBIC, nullptr, nullptr, nullptr));
+      if (!rung->scaler) {
+        throw std::runtime_error("Could not create scaler context");
+      }
+    }
+    // A new frame every time, since the rung below and the encoder
+    // may both be hanging on to the last one
+    Frame::pointer output = Frame::create(rung->width, rung->height, rung->settings.format);
+    if (nullptr == output->data[0]) {
+      throw std::runtime_error("Could not allocate scaled frame");
+    }
+    av_frame_copy_props(output.get(), input.get());
+    sws_scale(rung->scaler.get(), input->data, input->linesize, 0, input->height,
+              output->data, output->linesize);
+    return output;
+  }
+
+  void RenditionLadder::openEncoder(Rung* rung, AVRational sampleAspectRatio) {
+    AVCodecContext* ctx = avcodec_alloc_context3(rung->codec);
+    if (nullptr == ctx) {
+      throw std::runtime_error("Could not create encoder context");
+    }
+    ctx->width = rung->width;
+    ctx->height = rung->height;
+    ctx->pix_fmt = rung->settings.format;
+    ctx->time_base = time_base;
+    ctx->framerate = avg_frame_rate;
+    ctx->sample_aspect_ratio = sampleAspectRatio;
+    ctx->thread_count = rung->settings.encoderThreads;
+    // Parameters go in the stream data, so segments carry them
+    ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    if (rung->settings.bitRate > 0) {
+      ctx->bit_rate = rung->settings.bitRate;
+    }
+    StreamData::pointer data = rung->stream->data;
+    data->setContext(&ctx);
+    AVDictionary* options = nullptr;
+    for (const auto& [key, value] : rung->settings.options) {
+      av_dict_set(&options, key.c_str(), value.c_str(), 0);
+    }
+    int ret = avcodec_open2(data->context.get(), rung->codec, &options);
+    av_dict_free(&options);
+    if (ret < 0) {
+      throw std::runtime_error("Could not open encoder " + rung->settings.codec);
+    }
+    avcodec_parameters_from_context(data->parameters, data->context.get());
+    data->time_base = data->context->time_base;
+    data->avg_frame_rate = avg_frame_rate;
+  }
+
+  void RenditionLadder::encode(Rung* rung, AVFrame* frame) {
+    StreamData::pointer data = rung->stream->data;
+    if (nullptr != frame) {
+      if (!data->context) {
+        openEncoder(rung, frame->sample_aspect_ratio);
+      }
+      frame->pts = frame->best_effort_timestamp;
+      // Keep the GOPs lined up with the source
+      frame->pict_type = frame->key_frame ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+    } else if (!data->context) {
+      return;
+    }
+    int retval = avcodec_send_frame(data->context.get(), frame);
+    if (retval < 0) {
+      throw std::runtime_error("Error encoding frame: " + std::to_string(retval));
+    }
+    while (true) {
+      retval = avcodec_receive_packet(data->context.get(), rung->workingPacket.get());
+      if (AVERROR(EAGAIN) == retval || AVERROR_EOF == retval) {
+        break;
+      } else if (retval < 0) {
+        throw std::runtime_error("Error encoding frame: " + std::to_string(retval));
+      }
+      rung->stream->packets(rung->workingPacket, data);
+      av_packet_unref(rung->workingPacket.get());
+    }
+  }
+
+  void RenditionLadder::finish(Rung* rung) {
+    try {
+      encode(rung, nullptr);
+    } catch (std::exception& e) {
+      failed++;
+      std::cerr << "Could not drain encoder for " << rung->settings.name << ": " << e.what() << std::endl;
+    }
+    {
+      std::lock_guard<std::mutex> lock(drainMutex);
+      drained++;
+    }
+    drainedCondition.notify_all();
+  }
+
+  void RenditionLadder::flush() {
+    if (flushed.exchange(true)) {
+      return;
+    }
+    if (nullptr == first) {
+      return;
+    }
+    first->queue.push(Job{});
+    std::unique_lock<std::mutex> lock(drainMutex);
+    drainedCondition.wait(lock, [this]{ return drained >= activeRungs; });
+  }
+
+  void RenditionLadder::close() {
+    unsubscribe();
+    for (auto& rung : rungs) {
+      rung->queue.close();
+    }
+    for (auto& rung : rungs) {
+      if (rung->thread.joinable()) {
+        rung->thread.join();
+      }
+    }
+  }
+
+}
@@ -18,59 +18,68 @@
 #include <fr/media2/Resampler.h>
 #include <stdexcept>
 
+extern "C" {
+#include <libavutil/mathematics.h>
+}
+
 namespace fr::media2 {
 
   Resampler::Resampler(int64_t layout,
 		       AVSampleFormat format,
 		       int rate) :
-    workingFrame{Frame::create(layout, format, rate)} {
-    workingFrame->nb_samples = 0;
+    layout(layout), format(format), rate(rate) {
   }
 
   Resampler::~Resampler() {
-    if (nullptr == context) {
-      swr_free(context);
+    if (nullptr != context) {
+      swr_free(&context);
     }
   }
 
-  void init(AVFrame::const_pointer frame) {
-    context = swr_alloc_set_opts(context, workingFrame->channel_layout,
-				 (AVSampleFormat) workingFrame->format, workingFrame->sample_rate,
-				 frame->channel_layout, (AVSampleFormat) frame->format,
+  void Resampler::init(Frame::const_pointer frame) {
+    int64_t inputLayout = frame->channel_layout;
+    if (0 == inputLayout) {
+      inputLayout = av_get_default_channel_layout(frame->channels);
+    }
+    context = swr_alloc_set_opts(context, layout, format, rate,
+				 inputLayout, (AVSampleFormat) frame->format,
 				 frame->sample_rate, 0, nullptr);
-    workingFrame->channels = av_get_channel_layout_nb_channels(workingFrame->channel_layout);
+    if (nullptr == context) {
+      throw std::runtime_error("Could not create resampler context");
+    }
     // set context options for input ("ich") and output ("och") channels
-    if (0 == frame->channel_layout) {
-      av_opt_set_int(context, "ich", frame->channels, 0);
-    } else {
-      av_opt_set_int(context, "ich", av_get_channel_layout_nb_channels(frame->channel_layout), 0);
+    av_opt_set_int(context, "ich", av_get_channel_layout_nb_channels(inputLayout), 0);
+    av_opt_set_int(context, "och", av_get_channel_layout_nb_channels(layout), 0);
+    if (swr_init(context) < 0) {
+      throw std::runtime_error("Could not initialize resampler context");
     }
-    av_opt_set_int(context, "och", workingFrame->channels, 0);
-    swr_init(context);
   }
   
-  void process(AVFrame::const_pointer frame, StreamData::pointer stream) {
+  void Resampler::process(Frame::const_pointer frame, const StreamData::pointer& stream) {
     if (nullptr == context) {
       init(frame);
     }
-    // Compute the number of samples we have to output
-    workingFrame->nb_samples = av_rescale_rnd(frame->nb_samples, workingFrame->sample_rate, frame->sample_rate, AV_ROUND_UP);
-    if (workingFrame->nb_samples > maxSamples) {
-      maxSamples = workingFrame->nb_samples;
-      workingFrame->channels = av_get_channel_layout_nb_channels(workingFrame->channel_layout);
-      int fillRc = av_samples_alloc_array_and_samples(&workingFrame->data, &workingFrame->linesize, workingFrame->channels, workingFrame->nb_samples, workingFrame->format, 0);
-      if (0 > fillRc) {
-	throw std::logic_error("Resample error filling buffers.");
-      }
+    // Room for this frame plus whatever swr is still holding on to
+    int samples = swr_get_out_samples(context, frame->nb_samples);
+    if (samples <= 0) {
+      return;
     }
-
-    int convertRc = swr_convert(context, &workingFrame->data[0], workingFrame->nb_samples, (const uint8_t **) &frame->data[0], frame->nb_samples);
-    if (0 >= convertRc) {
-      throw std::logic_error("Resmaple error converting data.");
+    Frame::pointer outputFrame = Frame::create(layout, format, rate, samples, 0);
+    if (nullptr == outputFrame->data[0]) {
+      throw std::runtime_error("Resample error allocating buffers.");
+    }
+    int convertRc = swr_convert(context, outputFrame->extended_data, samples,
+				(const uint8_t **) frame->extended_data, frame->nb_samples);
+    if (0 > convertRc) {
+      throw std::runtime_error("Resample error converting data.");
+    }
+    if (0 == convertRc) {
+      return;
     }
-    workingFrame->nb_samples = convertRc;
-    workingFrame->pts += workingFrame->nb_samples;
-    frames(workingFrame);
+    outputFrame->nb_samples = convertRc;
+    outputFrame->pts = nextPts;
+    nextPts += convertRc;
+    frames(outputFrame, stream);
   }
   
 }
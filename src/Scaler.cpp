@@ -17,13 +17,19 @@
 
 #include <fr/media2/Scaler.h>
 
+extern "C" {
+#include <libavutil/mathematics.h>
+}
+
+#include <stdexcept>
+
 namespace fr {
   namespace media2 {
 
-    Scaler::Scaler(int width, int height, AVPixelFormat fmt) {
-      outputFrame->width = width;
-      outputFrame->height = height;
-      outputFrame->format = (int)fmt;
+    Scaler::Scaler(int width, int height, AVPixelFormat fmt,
+		   int threads, int bandHeight) :
+      width(width), height(height), format(fmt), threads(threads),
+      bandHeight(bandHeight) {
     }
 
     Scaler::~Scaler() {
@@ -32,25 +38,67 @@ namespace fr {
       }
     }
 
+    void Scaler::fitSize(int srcWidth, int srcHeight, int& width, int& height) {
+      if (width < 0 && height < 0) {
+	width = srcWidth;
+	height = srcHeight;
+      } else if (width < 0) {
+	width = static_cast<int>(av_rescale(height, srcWidth, srcHeight)) & ~1;
+      } else if (height < 0) {
+	height = static_cast<int>(av_rescale(width, srcHeight, srcWidth)) & ~1;
+      }
+    }
+
+    void Scaler::setApproximate(bool approximate) {
+      if (configured) {
+	throw std::logic_error("Scaler kernels have to be picked before the first frame");
+      }
+      accuracy = approximate ? PixelKernels::Accuracy::approximate : PixelKernels::Accuracy::exact;
+    }
+
     void Scaler::process(Frame::const_pointer frame,
-			 StreamData::pointer stream) {
-      if (nullptr == context) {
-	if (outputFrame->height < 0 || outputFrame->width < 0) {
-	  outputFrame->width = frame->width;
-	  outputFrame->height = frame->height;
+			 const StreamData::pointer& stream) {
+      if (!configured) {
+	if (height < 0 || width < 0) {
+	  width = frame->width;
+	  height = frame->height;
 	}
-	if (outputFrame->format == -1) {
-	  outputFrame->format = frame->format;
+	if (format == AV_PIX_FMT_NONE) {
+	  format = (AVPixelFormat) frame->format;
 	}
-	context = sws_getCachedContext(context, frame->width,
-	   frame->height, (AVPixelFormat) frame->format,
-	   outputFrame->width, outputFrame->height,
-	   (AVPixelFormat)outputFrame->format, SWS_BICUBIC, nullptr,
-	   nullptr, nullptr);
-	
+	fast = PixelKernels::find(frame->width, frame->height,
+	  (AVPixelFormat) frame->format, width, height, format, accuracy);
+	if (fast) {
+	  // Nothing else to set up
+	} else if (1 != threads) {
+	  slices = std::make_unique<SliceScaler>(frame->width, frame->height,
+	    (AVPixelFormat) frame->format, width, height, format,
+	    SWS_BICUBIC, threads, bandHeight);
+	} else {
+	  context = sws_getCachedContext(context, frame->width,
+	     frame->height, (AVPixelFormat) frame->format,
+	     width, height, format, SWS_BICUBIC, nullptr,
+	     nullptr, nullptr);
+	  if (nullptr == context) {
+	    throw std::runtime_error("Could not create scaler context");
+	  }
+	}
+	configured = true;
+      }
+      // Pooled, so this is usually just taking a buffer back off a list
+      Frame::pointer outputFrame = Frame::create(width, height, format);
+      if (nullptr == outputFrame->data[0]) {
+	throw std::runtime_error("Could not allocate scaler output frame");
+      }
+      av_frame_copy_props(outputFrame.get(), frame.get());
+      if (fast) {
+	fast(frame.get(), outputFrame.get());
+      } else if (slices) {
+	slices->scale(frame.get(), outputFrame.get());
+      } else {
+	sws_scale(context, frame->data, frame->linesize, 0,
+		  frame->height, outputFrame->data, outputFrame->linesize);
       }
-      sws_scale(context, frame->data, frame->linesize, 0,
-		frame->height, outputFrame->data, outputFrame->linesize);
       frames(outputFrame, stream);
     }
     
@@ -50,7 +50,7 @@ namespace fr::media2 {
     ret->dts = toCopy->dts;
     ret->time_base = toCopy->time_base;
     for (const auto& packet : toCopy->packets) {
-      ret->append(Packet::copy(packet));
+      ret->append(packet);
     }
     return ret;
   }
@@ -62,6 +62,8 @@ namespace fr::media2 {
   Segment::pointer Segment::next() {
     auto n = create(jobId, parameters);
     n->time_base = time_base;
+    // Segments in a stream tend to be about the same size
+    n->packets.reserve(npackets);
     return n;
   }
   
@@ -73,5 +75,14 @@ namespace fr::media2 {
     packets.push_back(std::move(Packet::copy(packet)));
     npackets++;
   }
+
+  void Segment::append(Packet::pointer&& packet) {
+    if (0 == packets.size()) {
+      pts = packet->pts;
+      dts = packet->dts;
+    }
+    packets.push_back(std::move(packet));
+    npackets++;
+  }
   
 }
@@ -0,0 +1,796 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fr/media2/SegmentPackager.h>
+
+extern "C" {
+#include <libavutil/avutil.h>
+#include <libavutil/dict.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/opt.h>
+}
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+namespace fr::media2 {
+
+  namespace {
+
+    // RFC 6381 codec string, for CODECS in the master playlist and
+    // codecs in the MPD
+    std::string codecString(const AVCodecParameters* parameters) {
+      char buffer[32];
+      switch (parameters->codec_id) {
+      case AV_CODEC_ID_H264: {
+        // Profile, constraint flags and level, which are the first
+        // three bytes of the SPS. avcC has a copy of them right after
+        // its version byte.
+        const uint8_t* extradata = parameters->extradata;
+        int size = parameters->extradata_size;
+        const uint8_t* sps = nullptr;
+        if (size >= 4 && 1 == extradata[0]) {
+          sps = extradata + 1;
+        } else {
+          for (int i = 0; i + 6 < size; ++i) {
+            if (0 == extradata[i] && 0 == extradata[i + 1] && 1 == extradata[i + 2] &&
+                7 == (extradata[i + 3] & 0x1f)) {
+              sps = extradata + i + 4;
+              break;
+            }
+          }
+        }
+        if (nullptr != sps) {
+          snprintf(buffer, sizeof(buffer), "avc1.%02x%02x%02x", sps[0], sps[1], sps[2]);
+        } else {
+          snprintf(buffer, sizeof(buffer), "avc1.%02x00%02x", parameters->profile & 0xff, parameters->level & 0xff);
+        }
+        return buffer;
+      }
+      case AV_CODEC_ID_HEVC:
+        snprintf(buffer, sizeof(buffer), "hvc1.%d.4.L%d.B0",
+                 parameters->profile > 0 ? parameters->profile : 1,
+                 parameters->level > 0 ? parameters->level : 93);
+        return buffer;
+      case AV_CODEC_ID_AAC:
+        // The audio object type is one more than the profile
+        snprintf(buffer, sizeof(buffer), "mp4a.40.%d", parameters->profile >= 0 ? parameters->profile + 1 : 2);
+        return buffer;
+      case AV_CODEC_ID_MP3:
+        return "mp4a.40.34";
+      case AV_CODEC_ID_AC3:
+        return "ac-3";
+      case AV_CODEC_ID_EAC3:
+        return "ec-3";
+      case AV_CODEC_ID_OPUS:
+        return "Opus";
+      default:
+        return avcodec_get_name(parameters->codec_id);
+      }
+    }
+
+    // Where a segment ends, in its own time base. That's the end of its
+    // last packet, or if the last packet doesn't know how long it is,
+    // the average spacing of the packets.
+    int64_t segmentEnd(const Segment& segment) {
+      const Packet::pointer& last = segment.packets.back();
+      int64_t duration = last->duration;
+      if (duration <= 0 && segment.packets.size() > 1) {
+        duration = (last->dts - segment.packets.front()->dts) / (int64_t) (segment.packets.size() - 1);
+      }
+      return last->dts + std::max<int64_t>(duration, 0);
+    }
+
+    double seconds(int64_t time, AVRational timeBase) {
+      return time * av_q2d(timeBase);
+    }
+
+    double now() {
+      return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    std::string isoTime(double when) {
+      time_t whole = (time_t) when;
+      struct tm utc;
+      gmtime_r(&whole, &utc);
+      char buffer[40];
+      size_t length = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &utc);
+      snprintf(buffer + length, sizeof(buffer) - length, ".%03dZ", (int) ((when - whole) * 1000));
+      return buffer;
+    }
+
+    std::string isoDuration(double length) {
+      char buffer[32];
+      snprintf(buffer, sizeof(buffer), "PT%.3fS", length);
+      return buffer;
+    }
+
+  }
+
+  void MemoryOutput::put(const std::string& name, std::span<const uint8_t> data) {
+    // Copy outside the lock
+    auto file = std::make_shared<const std::vector<uint8_t>>(data.begin(), data.end());
+    std::lock_guard<std::mutex> lock(mutex);
+    files[name] = std::move(file);
+  }
+
+  void MemoryOutput::remove(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    files.erase(name);
+  }
+
+  MemoryOutput::File MemoryOutput::get(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = files.find(name);
+    return found == files.end() ? nullptr : found->second;
+  }
+
+  std::vector<std::string> MemoryOutput::names() const {
+    std::vector<std::string> ret;
+    std::lock_guard<std::mutex> lock(mutex);
+    ret.reserve(files.size());
+    for (const auto& [name, file] : files) {
+      ret.push_back(name);
+    }
+    return ret;
+  }
+
+  DirectoryOutput::DirectoryOutput(const std::filesystem::path& directory) : directory(directory) {
+    std::filesystem::create_directories(directory);
+  }
+
+  void DirectoryOutput::put(const std::string& name, std::span<const uint8_t> data) {
+    std::filesystem::path target = directory / name;
+    std::filesystem::path temp = target;
+    temp += ".tmp";
+    {
+      std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+      file.write((const char*) data.data(), data.size());
+      if (!file) {
+        throw std::runtime_error("Could not write " + temp.string());
+      }
+    }
+    std::filesystem::rename(temp, target);
+  }
+
+  void DirectoryOutput::remove(const std::string& name) {
+    // Already gone is fine
+    std::error_code ignored;
+    std::filesystem::remove(directory / name, ignored);
+  }
+
+  const std::filesystem::path& DirectoryOutput::path() const {
+    return directory;
+  }
+
+  PackagerPool::PackagerPool(int nThreads, size_t queueCapacity) {
+    if (nThreads < 1) {
+      nThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (int i = 0; i < nThreads; ++i) {
+      workers.push_back(std::make_unique<Worker>(queueCapacity));
+    }
+    for (auto& worker : workers) {
+      Worker* w = worker.get();
+      w->thread = std::thread([w]{
+        std::function<void()> work;
+        while (w->queue.pop(work)) {
+          work();
+        }
+      });
+    }
+  }
+
+  PackagerPool::~PackagerPool() {
+    close();
+  }
+
+  bool PackagerPool::post(size_t key, std::function<void()> work) {
+    return workers[key % workers.size()]->queue.push(std::move(work));
+  }
+
+  void PackagerPool::close() {
+    for (auto& worker : workers) {
+      worker->queue.close();
+    }
+    for (auto& worker : workers) {
+      if (worker->thread.joinable()) {
+        worker->thread.join();
+      }
+    }
+  }
+
+  size_t PackagerPool::size() const {
+    return workers.size();
+  }
+
+  SegmentPackager::SegmentPackager(const Settings& settings, PackageOutput::pointer output,
+                                   PackagerPool::pointer pool) :
+    settings(settings), output(std::move(output)), pool(std::move(pool)) {
+    if (!this->output) {
+      throw std::logic_error("SegmentPackager needs somewhere to put its files");
+    }
+    if (settings.dash && Container::fmp4 != settings.container) {
+      throw std::logic_error("DASH needs fmp4 segments");
+    }
+    if (!settings.hls && !settings.dash) {
+      throw std::logic_error("SegmentPackager needs hls or dash turned on");
+    }
+    if (!settings.video && !settings.audio) {
+      throw std::logic_error("SegmentPackager needs a video or an audio track");
+    }
+    if (!this->pool) {
+      this->pool = std::make_shared<PackagerPool>(1);
+      ownPool = true;
+    }
+  }
+
+  SegmentPackager::~SegmentPackager() {
+    close();
+  }
+
+  void SegmentPackager::process(const Segment::pointer& segment, StreamData::pointer stream) {
+    if (!segment || segment->empty()) {
+      return;
+    }
+    Segment::pointer copy = Segment::copy(segment);
+    // The segmenter only sets the time base if its stream came from a
+    // container
+    if ((copy->time_base.num <= 0 || copy->time_base.den <= 0) && stream) {
+      copy->time_base = stream->time_base;
+    }
+    receive(std::move(copy));
+  }
+
+  void SegmentPackager::receive(Segment::pointer segment) {
+    if (!segment || segment->empty()) {
+      return;
+    }
+    if (segment->time_base.num <= 0 || segment->time_base.den <= 0) {
+      failed++;
+      std::cerr << "Can't package a segment without a time base" << std::endl;
+      return;
+    }
+    std::lock_guard<std::mutex> lock(receiveMutex);
+    if (flushed) {
+      return;
+    }
+    AVMediaType type = segment->parameters.codec_type;
+    if (AVMEDIA_TYPE_VIDEO == type && settings.video) {
+      Track* t = track(video, *segment, "video");
+      if (nullptr == t) {
+        return;
+      }
+      if (settings.audio) {
+        videoTimeBase = segment->time_base;
+        boundaries.push_back(segmentEnd(*segment));
+      }
+      uint64_t sequence = t->nextSequence++;
+      std::shared_ptr<Segment> shared{std::move(segment)};
+      post(t, [this, t, sequence, shared]{ write(t, sequence, *shared); });
+      if (settings.audio) {
+        cutAudio(false);
+      }
+    } else if (AVMEDIA_TYPE_AUDIO == type && settings.audio) {
+      Track* t = track(audio, *segment, "audio");
+      if (nullptr == t) {
+        return;
+      }
+      if (!settings.video) {
+        uint64_t sequence = t->nextSequence++;
+        std::shared_ptr<Segment> shared{std::move(segment)};
+        post(t, [this, t, sequence, shared]{ write(t, sequence, *shared); });
+        return;
+      }
+      audioTimeBase = segment->time_base;
+      if (!audioTemplate) {
+        audioTemplate = segment->next();
+      }
+      for (Packet::pointer& packet : segment->packets) {
+        pendingAudio.push_back(std::move(packet));
+      }
+      cutAudio(false);
+    }
+  }
+
+  SegmentPackager::Track* SegmentPackager::track(std::unique_ptr<Track>& slot, const Segment& segment,
+                                                 const std::string& label) {
+    UuidKey jobId(segment.jobId);
+    if (slot) {
+      // One stream of each kind. Anything else is ignored.
+      return slot->jobId == jobId ? slot.get() : nullptr;
+    }
+    auto created = std::make_unique<Track>();
+    created->type = segment.parameters.codec_type;
+    created->label = label;
+    created->jobId = jobId;
+    created->key = jobId.hash();
+    created->nextSequence = settings.firstSequence;
+    // The pool threads look at the tracks when they write the manifests
+    std::lock_guard<std::mutex> lock(manifestMutex);
+    slot = std::move(created);
+    return slot.get();
+  }
+
+  void SegmentPackager::cutAudio(bool end) {
+    if (!audio || !audioTemplate) {
+      return;
+    }
+    while (!pendingAudio.empty()) {
+      Segment::pointer cut = audioTemplate->next();
+      if (!boundaries.empty()) {
+        int64_t boundary = boundaries.front();
+        // The segment isn't finished until audio shows up past the end
+        // of the video one
+        if (!end && av_compare_ts(pendingAudio.back()->dts, audioTimeBase, boundary, videoTimeBase) < 0) {
+          break;
+        }
+        while (!pendingAudio.empty() &&
+               av_compare_ts(pendingAudio.front()->dts, audioTimeBase, boundary, videoTimeBase) < 0) {
+          cut->append(std::move(pendingAudio.front()));
+          pendingAudio.pop_front();
+        }
+        boundaries.pop_front();
+      } else if (end) {
+        // Whatever's left after the last video segment
+        while (!pendingAudio.empty()) {
+          cut->append(std::move(pendingAudio.front()));
+          pendingAudio.pop_front();
+        }
+      } else {
+        break;
+      }
+      // No audio at all during that video segment. There's nothing to
+      // write, and the numbers can't have a hole in them, so audio
+      // numbering falls behind video's here (see the header.)
+      if (cut->empty()) {
+        continue;
+      }
+      Track* t = audio.get();
+      uint64_t sequence = t->nextSequence++;
+      std::shared_ptr<Segment> shared{std::move(cut)};
+      post(t, [this, t, sequence, shared]{ write(t, sequence, *shared); });
+    }
+    if (end) {
+      boundaries.clear();
+    }
+  }
+
+  void SegmentPackager::post(Track* track, std::function<void()> work) {
+    {
+      std::lock_guard<std::mutex> lock(pendingMutex);
+      pending++;
+    }
+    if (!pool->post(track->key, [this, work = std::move(work)]{ work(); done(); })) {
+      done();
+    }
+  }
+
+  void SegmentPackager::done() {
+    bool nowIdle = false;
+    {
+      std::lock_guard<std::mutex> lock(pendingMutex);
+      pending--;
+      nowIdle = 0 == pending;
+    }
+    if (nowIdle) {
+      idle.notify_all();
+    }
+  }
+
+  void SegmentPackager::wait() {
+    std::unique_lock<std::mutex> lock(pendingMutex);
+    idle.wait(lock, [this]{ return 0 == pending; });
+  }
+
+  void SegmentPackager::flush() {
+    {
+      std::lock_guard<std::mutex> lock(receiveMutex);
+      if (!flushed) {
+        flushed = true;
+        cutAudio(true);
+        for (Track* t : {video.get(), audio.get()}) {
+          if (nullptr != t) {
+            post(t, [this, t]{ finish(t); });
+          }
+        }
+      }
+    }
+    wait();
+  }
+
+  void SegmentPackager::close() {
+    unsubscribe();
+    {
+      std::lock_guard<std::mutex> lock(receiveMutex);
+      flushed = true;
+    }
+    wait();
+    if (ownPool) {
+      pool->close();
+    }
+    // Nothing's running for this packager any more, so the contexts can
+    // go from here
+    for (Track* t : {video.get(), audio.get()}) {
+      if (nullptr != t) {
+        freeTrack(t);
+      }
+    }
+  }
+
+  uint64_t SegmentPackager::segments() const {
+    return written;
+  }
+
+  uint64_t SegmentPackager::bytes() const {
+    return writtenBytes;
+  }
+
+  uint64_t SegmentPackager::failures() const {
+    return failed;
+  }
+
+  void SegmentPackager::open(Track* track, const Segment& segment) {
+    bool fmp4 = Container::fmp4 == settings.container;
+    try {
+      avformat_alloc_output_context2(&track->context, nullptr, fmp4 ? "mp4" : "mpegts", nullptr);
+      if (nullptr == track->context) {
+        throw std::runtime_error("Could not create output context");
+      }
+      AVStream* stream = avformat_new_stream(track->context, nullptr);
+      if (nullptr == stream) {
+        throw std::runtime_error("Could not create output stream");
+      }
+      if (avcodec_parameters_copy(stream->codecpar, &segment.parameters) < 0) {
+        throw std::runtime_error("Could not copy codec parameters");
+      }
+      // The tag from the source container may not mean anything in this one
+      stream->codecpar->codec_tag = 0;
+      stream->time_base = segment.time_base;
+
+      track->sink = std::make_unique<ChunkSink>([this, track](const ChunkSink::Chunk& chunk) {
+        // No name means it's what was left after an error
+        if (track->chunkName.empty()) {
+          return;
+        }
+        output->put(track->chunkName, chunk.data);
+        track->chunkBytes += chunk.data.size();
+      }, 0, track->label);
+      track->io = IOSink::createContext(track->sink.get());
+      if (nullptr == track->io) {
+        throw std::runtime_error("Could not create IO context");
+      }
+      track->context->pb = track->io;
+      track->context->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+      AVDictionary* options = nullptr;
+      track->chunkBytes = 0;
+      if (fmp4) {
+        // Every segment is one fragment, which only ends when I say so,
+        // and the header is nothing but the init segment
+        av_dict_set(&options, "movflags", "frag_custom+empty_moov+default_base_moof", 0);
+        track->chunkName = initName(track);
+      } else {
+        // TS doesn't have an init segment. Anything the header writes
+        // stays in the sink and goes out with the first segment.
+        track->chunkName.clear();
+      }
+      int ret = avformat_write_header(track->context, &options);
+      av_dict_free(&options);
+      if (ret < 0) {
+        throw std::runtime_error("Could not write header: " + std::to_string(ret));
+      }
+      if (fmp4) {
+        avio_flush(track->io);
+        track->sink->flush();
+        if (0 == track->chunkBytes) {
+          throw std::runtime_error("Muxer didn't write an init segment");
+        }
+      }
+    } catch (...) {
+      // So the next segment tries again from scratch
+      freeTrack(track);
+      throw;
+    }
+
+    AVStream* stream = track->context->streams[0];
+    std::lock_guard<std::mutex> lock(manifestMutex);
+    // The muxer picks its own time base when it writes the header
+    track->timeBase = stream->time_base;
+    track->codecs = codecString(stream->codecpar);
+    track->width = stream->codecpar->width;
+    track->height = stream->codecpar->height;
+    track->sampleRate = stream->codecpar->sample_rate;
+    track->bandwidth = stream->codecpar->bit_rate;
+    track->started = true;
+  }
+
+  void SegmentPackager::write(Track* track, uint64_t sequence, Segment& segment) {
+    std::vector<std::string> expiredNames;
+    try {
+      if (nullptr == track->context) {
+        open(track, segment);
+      }
+      AVStream* stream = track->context->streams[0];
+      if (AV_NOPTS_VALUE == track->firstDts) {
+        track->firstDts = segment.dts;
+      }
+      Entry entry;
+      entry.sequence = sequence;
+      entry.name = segmentName(track, sequence);
+      // Rescaling from the start of the track each time, so the
+      // rounding doesn't add up
+      entry.start = av_rescale_q(segment.dts - track->firstDts, segment.time_base, stream->time_base);
+      entry.duration = av_rescale_q(segmentEnd(segment) - track->firstDts, segment.time_base,
+                                    stream->time_base) - entry.start;
+
+      if (Container::ts == settings.container) {
+        // Each segment has to start with a PAT and PMT so a player can
+        // start with it
+        av_opt_set(track->context->priv_data, "mpegts_flags", "+resend_headers", 0);
+      }
+      track->chunkName = entry.name;
+      track->chunkBytes = 0;
+      for (Packet::pointer& packet : segment.packets) {
+        packet->stream_index = 0;
+        packet->pos = -1;
+        av_packet_rescale_ts(packet.get(), segment.time_base, stream->time_base);
+        int ret = av_write_frame(track->context, packet.get());
+        if (ret < 0) {
+          throw std::runtime_error("Error writing packet: " + std::to_string(ret));
+        }
+      }
+      // A null packet ends the fragment for fMP4, and writes out the
+      // PES packets that are still being put together for TS
+      av_write_frame(track->context, nullptr);
+      avio_flush(track->io);
+      track->sink->flush();
+      if (0 == track->chunkBytes) {
+        throw std::runtime_error("Muxer didn't write anything");
+      }
+      entry.bytes = track->chunkBytes;
+      written++;
+      writtenBytes += entry.bytes;
+
+      std::lock_guard<std::mutex> lock(manifestMutex);
+      double length = seconds(entry.duration, track->timeBase);
+      if (0.0 == availabilityStart) {
+        availabilityStart = now() - seconds(entry.start + entry.duration, track->timeBase);
+      }
+      track->targetDuration = std::max<int64_t>(track->targetDuration, std::lround(length));
+      if (length > 0.0) {
+        track->bandwidth = std::max<int64_t>(track->bandwidth, entry.bytes * 8 / length);
+      }
+      track->entries.push_back(std::move(entry));
+      if (settings.window > 0) {
+        while (track->entries.size() > settings.window) {
+          track->expired.push_back(track->entries.front().name);
+          track->entries.pop_front();
+        }
+        while (track->expired.size() > settings.linger) {
+          expiredNames.push_back(track->expired.front());
+          track->expired.pop_front();
+        }
+      }
+      writeManifests(track);
+    } catch (std::exception& e) {
+      failed++;
+      std::cerr << "Could not package " << track->label << " segment " << sequence << ": " << e.what() << std::endl;
+      // Throw away whatever part of the segment made it into the sink
+      track->chunkName.clear();
+      if (nullptr != track->io) {
+        avio_flush(track->io);
+        track->sink->flush();
+      }
+    }
+    for (const std::string& name : expiredNames) {
+      output->remove(name);
+    }
+  }
+
+  void SegmentPackager::finish(Track* track) {
+    std::lock_guard<std::mutex> lock(manifestMutex);
+    track->ended = true;
+    try {
+      writeManifests(track);
+    } catch (std::exception& e) {
+      failed++;
+      std::cerr << "Could not write the last " << track->label << " manifests: " << e.what() << std::endl;
+    }
+  }
+
+  void SegmentPackager::freeTrack(Track* track) {
+    if (nullptr != track->context) {
+      avformat_free_context(track->context);
+      track->context = nullptr;
+    }
+    IOSink::freeContext(&track->io);
+    track->sink.reset();
+  }
+
+  void SegmentPackager::writeManifests(const Track* changed) {
+    auto put = [this](const std::string& name, const std::string& text) {
+      output->put(name, std::span<const uint8_t>((const uint8_t*) text.data(), text.size()));
+    };
+    bool videoReady = video && video->started;
+    bool audioReady = audio && audio->started;
+    bool allEnded = (!videoReady || video->ended) && (!audioReady || audio->ended);
+    // Wait for all the tracks before saying what's in the stream, unless
+    // that's all there's going to be
+    bool ready = (videoReady || audioReady) &&
+      (((!settings.video || videoReady) && (!settings.audio || audioReady)) || allEnded);
+    if (settings.hls) {
+      if (changed->started) {
+        put(playlistName(changed), mediaPlaylist(changed));
+      }
+      if (ready) {
+        std::string master = masterPlaylist();
+        // It only changes if the bandwidth goes up
+        if (master != lastMaster) {
+          put(settings.name + ".m3u8", master);
+          lastMaster = std::move(master);
+        }
+      }
+    }
+    if (settings.dash && ready) {
+      put(settings.name + ".mpd", mpd());
+    }
+  }
+
+  std::string SegmentPackager::mediaPlaylist(const Track* track) const {
+    bool fmp4 = Container::fmp4 == settings.container;
+    std::ostringstream out;
+    out << "#EXTM3U\n"
+        << "#EXT-X-VERSION:" << (fmp4 ? 7 : 3) << "\n"
+        << "#EXT-X-TARGETDURATION:" << track->targetDuration << "\n"
+        << "#EXT-X-MEDIA-SEQUENCE:"
+        << (track->entries.empty() ? settings.firstSequence : track->entries.front().sequence) << "\n";
+    if (0 == settings.window) {
+      out << "#EXT-X-PLAYLIST-TYPE:EVENT\n";
+    }
+    if (fmp4) {
+      out << "#EXT-X-MAP:URI=\"" << initName(track) << "\"\n";
+    }
+    char extinf[48];
+    for (const Entry& entry : track->entries) {
+      snprintf(extinf, sizeof(extinf), "#EXTINF:%.3f,\n", seconds(entry.duration, track->timeBase));
+      out << extinf << entry.name << "\n";
+    }
+    if (track->ended) {
+      out << "#EXT-X-ENDLIST\n";
+    }
+    return out.str();
+  }
+
+  std::string SegmentPackager::masterPlaylist() const {
+    const Track* v = (video && video->started) ? video.get() : nullptr;
+    const Track* a = (audio && audio->started) ? audio.get() : nullptr;
+    const Track* main = v ? v : a;
+    std::ostringstream out;
+    out << "#EXTM3U\n"
+        << "#EXT-X-VERSION:" << (Container::fmp4 == settings.container ? 7 : 3) << "\n"
+        << "#EXT-X-INDEPENDENT-SEGMENTS\n";
+    int64_t bandwidth = main->bandwidth;
+    std::string codecs = main->codecs;
+    if (v && a) {
+      out << "#EXT-X-MEDIA:TYPE=AUDIO,GROUP-ID=\"audio\",NAME=\"audio\",DEFAULT=YES,AUTOSELECT=YES,URI=\""
+          << playlistName(a) << "\"\n";
+      bandwidth += a->bandwidth;
+      codecs += "," + a->codecs;
+    }
+    out << "#EXT-X-STREAM-INF:BANDWIDTH=" << std::max<int64_t>(bandwidth, 1) << ",CODECS=\"" << codecs << "\"";
+    if (v && v->width > 0 && v->height > 0) {
+      out << ",RESOLUTION=" << v->width << "x" << v->height;
+    }
+    if (v && a) {
+      out << ",AUDIO=\"audio\"";
+    }
+    out << "\n" << playlistName(main) << "\n";
+    return out.str();
+  }
+
+  std::string SegmentPackager::mpd() const {
+    std::vector<const Track*> tracks;
+    for (const Track* t : {video.get(), audio.get()}) {
+      if (nullptr != t && t->started) {
+        tracks.push_back(t);
+      }
+    }
+    bool ended = true;
+    int64_t targetDuration = 1;
+    double end = 0.0;
+    for (const Track* t : tracks) {
+      ended = ended && t->ended;
+      targetDuration = std::max(targetDuration, t->targetDuration);
+      if (!t->entries.empty()) {
+        end = std::max(end, seconds(t->entries.back().start + t->entries.back().duration, t->timeBase));
+      }
+    }
+
+    std::ostringstream out;
+    out << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+        << "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" profiles=\"urn:mpeg:dash:profile:isoff-live:2011\""
+        << " type=\"dynamic\" availabilityStartTime=\"" << isoTime(availabilityStart) << "\""
+        << " publishTime=\"" << isoTime(now()) << "\""
+        << " minBufferTime=\"" << isoDuration(targetDuration) << "\"";
+    if (ended) {
+      out << " mediaPresentationDuration=\"" << isoDuration(end) << "\"";
+    } else {
+      out << " minimumUpdatePeriod=\"" << isoDuration(targetDuration) << "\"";
+    }
+    if (settings.window > 0) {
+      out << " timeShiftBufferDepth=\"" << isoDuration(settings.window * targetDuration) << "\"";
+    }
+    out << ">\n"
+        << "  <Period id=\"0\" start=\"PT0S\">\n";
+    int id = 0;
+    for (const Track* t : tracks) {
+      bool isVideo = AVMEDIA_TYPE_VIDEO == t->type;
+      out << "    <AdaptationSet id=\"" << id++ << "\" contentType=\"" << t->label << "\""
+          << " mimeType=\"" << (isVideo ? "video/mp4" : "audio/mp4") << "\""
+          << " segmentAlignment=\"true\" startWithSAP=\"1\">\n"
+          << "      <Representation id=\"" << t->label << "\" codecs=\"" << t->codecs << "\""
+          << " bandwidth=\"" << std::max<int64_t>(t->bandwidth, 1) << "\"";
+      if (isVideo && t->width > 0 && t->height > 0) {
+        out << " width=\"" << t->width << "\" height=\"" << t->height << "\"";
+      } else if (!isVideo && t->sampleRate > 0) {
+        out << " audioSamplingRate=\"" << t->sampleRate << "\"";
+      }
+      // The timescale has to be a whole number of ticks a second, so
+      // times are in 1/den and get multiplied by num
+      int64_t scale = t->timeBase.num;
+      out << ">\n"
+          << "        <SegmentTemplate timescale=\"" << t->timeBase.den << "\""
+          << " initialization=\"" << initName(t) << "\""
+          << " media=\"" << settings.name << "_" << t->label << "_$Number$.m4s\""
+          << " startNumber=\"" << (t->entries.empty() ? settings.firstSequence : t->entries.front().sequence) << "\">\n"
+          << "          <SegmentTimeline>\n";
+      for (const Entry& entry : t->entries) {
+        out << "            <S t=\"" << entry.start * scale << "\" d=\"" << entry.duration * scale << "\"/>\n";
+      }
+      out << "          </SegmentTimeline>\n"
+          << "        </SegmentTemplate>\n"
+          << "      </Representation>\n"
+          << "    </AdaptationSet>\n";
+    }
+    out << "  </Period>\n"
+        << "</MPD>\n";
+    return out.str();
+  }
+
+  std::string SegmentPackager::segmentName(const Track* track, uint64_t sequence) const {
+    return settings.name + "_" + track->label + "_" + std::to_string(sequence) +
+      (Container::fmp4 == settings.container ? ".m4s" : ".ts");
+  }
+
+  std::string SegmentPackager::initName(const Track* track) const {
+    return settings.name + "_" + track->label + "_init.mp4";
+  }
+
+  std::string SegmentPackager::playlistName(const Track* track) const {
+    return settings.name + "_" + track->label + ".m3u8";
+  }
+
+}
@@ -0,0 +1,595 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fr/media2/SegmentStore.h>
+#include <fr/media2/SegmentWire.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fr::media2 {
+
+  namespace {
+
+    std::string errorString(const std::string& what, const std::filesystem::path& path) {
+      return what + " " + path.string() + ": " + strerror(errno);
+    }
+
+    // pwrite that doesn't give up on short writes
+    void writeAll(int fd, const void* data, size_t size, off_t offset) {
+      const uint8_t* pos = (const uint8_t*) data;
+      while (size > 0) {
+        ssize_t written = pwrite(fd, pos, size, offset);
+        if (written < 0) {
+          if (EINTR == errno) {
+            continue;
+          }
+          throw std::runtime_error(std::string("Could not write segment index: ") + strerror(errno));
+        }
+        pos += written;
+        size -= written;
+        offset += written;
+      }
+    }
+
+    // Same deal for pwritev. Eats through iov as it goes.
+    void writeAll(int fd, iovec* iov, size_t iovcnt, off_t offset) {
+      while (iovcnt > 0) {
+        int count = (int) std::min<size_t>(iovcnt, IOV_MAX);
+        ssize_t written = pwritev(fd, iov, count, offset);
+        if (written < 0) {
+          if (EINTR == errno) {
+            continue;
+          }
+          throw std::runtime_error(std::string("Could not write segment log: ") + strerror(errno));
+        }
+        offset += written;
+        while (iovcnt > 0 && (size_t) written >= iov->iov_len) {
+          written -= iov->iov_len;
+          iov++;
+          iovcnt--;
+        }
+        if (iovcnt > 0) {
+          iov->iov_base = (uint8_t*) iov->iov_base + written;
+          iov->iov_len -= written;
+        }
+      }
+    }
+
+    void syncDirectory(const std::filesystem::path& dir) {
+      int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (fd < 0) {
+        throw std::runtime_error(errorString("Could not open", dir));
+      }
+      int ret = fsync(fd);
+      ::close(fd);
+      if (ret < 0) {
+        throw std::runtime_error(errorString("Could not sync", dir));
+      }
+    }
+
+    std::string uuidString(const uuid_t id) {
+      char idchars[40];
+      uuid_unparse(id, idchars);
+      return std::string(idchars);
+    }
+
+  }
+
+  SegmentStore::StreamFiles::~StreamFiles() {
+    if (log >= 0) {
+      ::close(log);
+    }
+    if (index >= 0) {
+      ::close(index);
+    }
+  }
+
+  SegmentStore::SegmentStore(const std::filesystem::path& root) : SegmentStore(root, Settings{}) {
+  }
+
+  SegmentStore::SegmentStore(const std::filesystem::path& root, const Settings& settings) :
+    rootDir(root), settings(settings) {
+    std::filesystem::create_directories(rootDir);
+    committer = std::thread([this]{ runCommitter(); });
+  }
+
+  SegmentStore::~SegmentStore() {
+    try {
+      close();
+    } catch (std::exception& e) {
+      std::cerr << "Could not commit segment store " << rootDir.string() << ": " << e.what() << std::endl;
+    }
+  }
+
+  const std::filesystem::path& SegmentStore::root() const {
+    return rootDir;
+  }
+
+  std::filesystem::path SegmentStore::streamDir(const uuid_t stream) const {
+    return rootDir / uuidString(stream);
+  }
+
+  std::filesystem::path SegmentStore::logPath(const std::filesystem::path& streamDir) {
+    return streamDir / "segments.log";
+  }
+
+  std::filesystem::path SegmentStore::indexPath(const std::filesystem::path& streamDir) {
+    return streamDir / "segments.idx";
+  }
+
+  uint64_t SegmentStore::commits() const {
+    return commitCount;
+  }
+
+  SegmentStore::StreamFiles* SegmentStore::open(const uuid_t stream, AVRational timeBase, bool create) {
+    std::lock_guard<std::mutex> lock(streamsMutex);
+    UuidKey key(stream);
+    auto found = streams.find(key);
+    if (found != streams.end()) {
+      return found->second.get();
+    }
+    std::filesystem::path dir = streamDir(stream);
+    std::filesystem::path logFile = logPath(dir);
+    std::filesystem::path indexFile = indexPath(dir);
+    if (!create && !std::filesystem::exists(indexFile)) {
+      return nullptr;
+    }
+    bool created = std::filesystem::create_directories(dir);
+
+    auto files = std::make_unique<StreamFiles>();
+    files->log = ::open(logFile.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (files->log < 0) {
+      throw std::runtime_error(errorString("Could not open", logFile));
+    }
+    files->index = ::open(indexFile.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (files->index < 0) {
+      throw std::runtime_error(errorString("Could not open", indexFile));
+    }
+
+    struct stat st;
+    if (fstat(files->index, &st) < 0) {
+      throw std::runtime_error(errorString("Could not stat", indexFile));
+    }
+    IndexHeader header;
+    if ((size_t) st.st_size < sizeof(IndexHeader)) {
+      // New stream (or we died before the header made it out)
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, magic, sizeof(header.magic));
+      header.version = version;
+      header.timeBaseNum = timeBase.num;
+      header.timeBaseDen = timeBase.den;
+      if (ftruncate(files->index, 0) < 0) {
+        throw std::runtime_error(errorString("Could not truncate", indexFile));
+      }
+      writeAll(files->index, &header, sizeof(header), 0);
+    } else {
+      if (pread(files->index, &header, sizeof(header), 0) != sizeof(header) ||
+          0 != memcmp(header.magic, magic, sizeof(magic)) || version != header.version) {
+        throw std::runtime_error(indexFile.string() + " is not a segment index");
+      }
+      size_t count = (st.st_size - sizeof(IndexHeader)) / sizeof(IndexEntry);
+      files->entries.resize(count);
+      size_t bytes = count * sizeof(IndexEntry);
+      if (bytes > 0 && pread(files->index, files->entries.data(), bytes, sizeof(IndexHeader)) != (ssize_t) bytes) {
+        throw std::runtime_error(errorString("Could not read", indexFile));
+      }
+    }
+
+    // Drop anything the log doesn't actually have (only possible if
+    // sync is off) and anything in the log that never got indexed.
+    if (fstat(files->log, &st) < 0) {
+      throw std::runtime_error(errorString("Could not stat", logFile));
+    }
+    while (!files->entries.empty() &&
+           files->entries.back().offset + files->entries.back().length > (uint64_t) st.st_size) {
+      files->entries.pop_back();
+    }
+    files->committed = files->entries.size();
+    files->logSize = files->entries.empty() ? 0 :
+      files->entries.back().offset + files->entries.back().length;
+    if ((uint64_t) st.st_size != files->logSize && ftruncate(files->log, files->logSize) < 0) {
+      throw std::runtime_error(errorString("Could not truncate", logFile));
+    }
+    off_t indexSize = sizeof(IndexHeader) + files->committed * sizeof(IndexEntry);
+    if (fstat(files->index, &st) < 0 || (st.st_size != indexSize && ftruncate(files->index, indexSize) < 0)) {
+      throw std::runtime_error(errorString("Could not truncate", indexFile));
+    }
+
+    if (created && settings.sync) {
+      // Otherwise the files themselves could vanish in a crash
+      syncDirectory(dir);
+      syncDirectory(rootDir);
+    }
+
+    StreamFiles* ret = files.get();
+    streams.emplace(key, std::move(files));
+    return ret;
+  }
+
+  bool SegmentStore::append(const Segment& segment) {
+    static const uint8_t zeroes[AV_INPUT_BUFFER_PADDING_SIZE] = {};
+    std::vector<uint8_t> headerBlock;
+    SegmentWire::encodeHeader(segment, headerBlock);
+
+    std::vector<iovec> iov;
+    iov.reserve(1 + 2 * segment.packets.size());
+    iov.push_back(iovec{headerBlock.data(), headerBlock.size()});
+    uint64_t length = headerBlock.size();
+    for (const Packet::pointer& packet : segment.packets) {
+      iov.push_back(iovec{packet->data, (size_t) packet->size});
+      iov.push_back(iovec{(void*) zeroes, sizeof(zeroes)});
+      length += SegmentWire::payloadSize(*packet);
+    }
+
+    IndexEntry entry;
+    entry.dts = segment.dts;
+    entry.pts = segment.pts;
+    entry.offset = 0;
+    entry.length = length;
+    entry.flags = (!segment.packets.empty() && (segment.packets.front()->flags & AV_PKT_FLAG_KEY)) ?
+      IndexEntry::keyframe : 0;
+    if (length > UINT32_MAX) {
+      throw std::runtime_error("Segment is too big to store");
+    }
+    return write(segment.jobId, segment.time_base, entry, iov.data(), iov.size());
+  }
+
+  bool SegmentStore::append(const uuid_t stream, const uint8_t* data, size_t size) {
+    SegmentWire::Header header;
+    if (!SegmentWire::readHeader(data, size, header)) {
+      throw std::runtime_error("Segment is not in the wire format");
+    }
+    if (size > UINT32_MAX) {
+      throw std::runtime_error("Segment is too big to store");
+    }
+    SegmentWire::PacketEntry first;
+    IndexEntry entry;
+    entry.dts = header.dts;
+    entry.pts = header.pts;
+    entry.offset = 0;
+    entry.length = size;
+    entry.flags = (SegmentWire::readPacket(data, size, 0, first) && (first.flags & AV_PKT_FLAG_KEY)) ?
+      IndexEntry::keyframe : 0;
+    iovec iov{(void*) data, size};
+    return write(stream, AVRational{header.timeBaseNum, header.timeBaseDen}, entry, &iov, 1);
+  }
+
+  bool SegmentStore::write(const uuid_t stream, AVRational timeBase, IndexEntry entry,
+                           const iovec* iov, size_t iovcnt) {
+    {
+      std::lock_guard<std::mutex> lock(commitMutex);
+      if (closing) {
+        throw std::runtime_error("Segment store is closed");
+      }
+    }
+    StreamFiles* files = open(stream, timeBase, true);
+    std::lock_guard<std::mutex> lock(files->mutex);
+    if (!files->entries.empty() && entry.dts <= files->entries.back().dts) {
+      return false;
+    }
+    entry.offset = files->logSize;
+    std::vector<iovec> remaining(iov, iov + iovcnt);
+    try {
+      writeAll(files->log, remaining.data(), remaining.size(), entry.offset);
+    } catch (...) {
+      // Don't leave half a segment in there
+      if (ftruncate(files->log, files->logSize) < 0) {
+        std::cerr << "Could not truncate " << logPath(streamDir(stream)).string() << std::endl;
+      }
+      throw;
+    }
+    files->logSize += entry.length;
+    files->entries.push_back(entry);
+    pending(entry.length);
+    return true;
+  }
+
+  void SegmentStore::pending(size_t bytes) {
+    bool wake;
+    {
+      std::lock_guard<std::mutex> lock(commitMutex);
+      if (0 == pendingBytes) {
+        oldestPending = std::chrono::steady_clock::now();
+      }
+      pendingBytes += bytes;
+      wake = pendingBytes >= settings.commitBytes;
+    }
+    if (wake) {
+      commitWanted.notify_one();
+    }
+  }
+
+  void SegmentStore::commit() {
+    std::unique_lock<std::mutex> lock(commitMutex);
+    if (closed) {
+      return;
+    }
+    uint64_t wanted = ++requested;
+    commitWanted.notify_one();
+    committed.wait(lock, [this, wanted]{ return finished >= wanted || closed; });
+  }
+
+  void SegmentStore::close() {
+    {
+      std::lock_guard<std::mutex> lock(commitMutex);
+      if (closing) {
+        return;
+      }
+      closing = true;
+    }
+    commitWanted.notify_one();
+    if (committer.joinable()) {
+      committer.join();
+    }
+    // One last time from here, so any error gets thrown to the caller
+    auto finish = [this]{
+      {
+        std::lock_guard<std::mutex> lock(commitMutex);
+        closed = true;
+      }
+      committed.notify_all();
+    };
+    try {
+      commitStreams();
+    } catch (...) {
+      finish();
+      throw;
+    }
+    finish();
+  }
+
+  void SegmentStore::runCommitter() {
+    std::unique_lock<std::mutex> lock(commitMutex);
+    while (true) {
+      auto due = [this]{
+        return closing || requested > finished || pendingBytes >= settings.commitBytes;
+      };
+      if (0 == pendingBytes) {
+        commitWanted.wait(lock, [this, &due]{ return due() || pendingBytes > 0; });
+      }
+      if (!due() && pendingBytes > 0) {
+        commitWanted.wait_until(lock, oldestPending + settings.commitInterval, due);
+      }
+      if (closing) {
+        break;
+      }
+      uint64_t target = requested;
+      pendingBytes = 0;
+      lock.unlock();
+      try {
+        commitStreams();
+      } catch (std::exception& e) {
+        std::cerr << "Could not commit segment store " << rootDir.string() << ": " << e.what() << std::endl;
+      }
+      lock.lock();
+      finished = std::max(finished, target);
+      committed.notify_all();
+    }
+    // close does the last commit
+    lock.unlock();
+  }
+
+  void SegmentStore::commitStreams() {
+    std::vector<StreamFiles*> toCommit;
+    {
+      std::lock_guard<std::mutex> lock(streamsMutex);
+      for (auto& [key, files] : streams) {
+        toCommit.push_back(files.get());
+      }
+    }
+    bool any = false;
+    for (StreamFiles* files : toCommit) {
+      std::vector<IndexEntry> newEntries;
+      size_t first;
+      {
+        std::lock_guard<std::mutex> lock(files->mutex);
+        first = files->committed;
+        newEntries.assign(files->entries.begin() + first, files->entries.end());
+      }
+      if (newEntries.empty()) {
+        continue;
+      }
+      any = true;
+      // Log first, so the index never gets ahead of it
+      if (settings.sync && fdatasync(files->log) < 0) {
+        throw std::runtime_error(std::string("Could not sync segment log: ") + strerror(errno));
+      }
+      writeAll(files->index, newEntries.data(), newEntries.size() * sizeof(IndexEntry),
+               sizeof(IndexHeader) + first * sizeof(IndexEntry));
+      if (settings.sync && fdatasync(files->index) < 0) {
+        throw std::runtime_error(std::string("Could not sync segment index: ") + strerror(errno));
+      }
+      std::lock_guard<std::mutex> lock(files->mutex);
+      files->committed = first + newEntries.size();
+    }
+    if (any) {
+      commitCount++;
+    }
+  }
+
+  bool SegmentStore::find(const uuid_t stream, int64_t dts, IndexEntry& entry) {
+    StreamFiles* files = open(stream, AVRational{0, 1}, false);
+    if (nullptr == files) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(files->mutex);
+    auto end = files->entries.begin() + files->committed;
+    auto found = std::upper_bound(files->entries.begin(), end, dts,
+                                  [](int64_t dts, const IndexEntry& e) { return dts < e.dts; });
+    if (found == files->entries.begin()) {
+      return false;
+    }
+    entry = *(found - 1);
+    return true;
+  }
+
+  size_t SegmentStore::size(const uuid_t stream) {
+    StreamFiles* files = open(stream, AVRational{0, 1}, false);
+    if (nullptr == files) {
+      return 0;
+    }
+    std::lock_guard<std::mutex> lock(files->mutex);
+    return files->committed;
+  }
+
+  Segment::pointer SegmentStore::load(const uuid_t stream, const IndexEntry& entry) {
+    StreamFiles* files = open(stream, AVRational{0, 1}, false);
+    if (nullptr == files) {
+      throw std::runtime_error("No segments stored for stream " + uuidString(stream));
+    }
+    AVBufferRef* buffer = av_buffer_alloc(entry.length);
+    if (nullptr == buffer) {
+      throw std::runtime_error("Could not allocate segment buffer");
+    }
+    size_t done = 0;
+    while (done < entry.length) {
+      ssize_t got = pread(files->log, buffer->data + done, entry.length - done, entry.offset + done);
+      if (got < 0 && EINTR == errno) {
+        continue;
+      }
+      if (got <= 0) {
+        av_buffer_unref(&buffer);
+        throw std::runtime_error("Could not read segment from " + logPath(streamDir(stream)).string());
+      }
+      done += got;
+    }
+    Segment::pointer ret;
+    try {
+      ret = SegmentWire::decode(buffer);
+    } catch (...) {
+      av_buffer_unref(&buffer);
+      throw;
+    }
+    av_buffer_unref(&buffer);
+    return ret;
+  }
+
+  SegmentIndex::SegmentIndex(const std::filesystem::path& p) :
+    path(std::filesystem::is_directory(p) ? SegmentStore::indexPath(p) : p) {
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      throw std::runtime_error(errorString("Could not open", path));
+    }
+    SegmentStore::IndexHeader header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        0 != memcmp(header.magic, SegmentStore::magic, sizeof(header.magic)) ||
+        SegmentStore::version != header.version) {
+      ::close(fd);
+      throw std::runtime_error(path.string() + " is not a segment index");
+    }
+    time_base = AVRational{header.timeBaseNum, header.timeBaseDen};
+    try {
+      refresh();
+    } catch (...) {
+      ::close(fd);
+      throw;
+    }
+  }
+
+  SegmentIndex::~SegmentIndex() {
+    unmap();
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+
+  void SegmentIndex::unmap() {
+    if (nullptr != map) {
+      munmap((void*) map, mapSize);
+      map = nullptr;
+      mapSize = 0;
+    }
+  }
+
+  bool SegmentIndex::refresh() {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      throw std::runtime_error(errorString("Could not stat", path));
+    }
+    size_t newCount = ((size_t) st.st_size - sizeof(SegmentStore::IndexHeader)) / sizeof(IndexEntry);
+    if (newCount <= count) {
+      return false;
+    }
+    size_t newSize = sizeof(SegmentStore::IndexHeader) + newCount * sizeof(IndexEntry);
+    void* mapped = mmap(nullptr, newSize, PROT_READ, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == mapped) {
+      throw std::runtime_error(errorString("Could not map", path));
+    }
+    // Lookups mostly binary search, but replay walks it front to back
+    madvise(mapped, newSize, MADV_WILLNEED);
+    unmap();
+    map = (const uint8_t*) mapped;
+    mapSize = newSize;
+    count = newCount;
+    return true;
+  }
+
+  const SegmentIndex::IndexEntry* SegmentIndex::entries() const {
+    return (const IndexEntry*) (map + sizeof(SegmentStore::IndexHeader));
+  }
+
+  size_t SegmentIndex::size() const {
+    return count;
+  }
+
+  bool SegmentIndex::empty() const {
+    return 0 == count;
+  }
+
+  const SegmentIndex::IndexEntry& SegmentIndex::operator[](size_t index) const {
+    return entries()[index];
+  }
+
+  AVRational SegmentIndex::timeBase() const {
+    return time_base;
+  }
+
+  size_t SegmentIndex::find(int64_t dts) const {
+    if (0 == count) {
+      return 0;
+    }
+    const IndexEntry* begin = entries();
+    const IndexEntry* found = std::upper_bound(begin, begin + count, dts,
+                                               [](int64_t dts, const IndexEntry& e) { return dts < e.dts; });
+    return found == begin ? count : (found - begin) - 1;
+  }
+
+  size_t SegmentIndex::lowerBound(int64_t dts) const {
+    if (0 == count) {
+      return 0;
+    }
+    const IndexEntry* begin = entries();
+    const IndexEntry* found = std::lower_bound(begin, begin + count, dts,
+                                               [](const IndexEntry& e, int64_t dts) { return e.dts < dts; });
+    return found - begin;
+  }
+
+}
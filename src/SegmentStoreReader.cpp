@@ -0,0 +1,288 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fr/media2/SegmentStoreReader.h>
+#include <fr/media2/SegmentWire.h>
+
+extern "C" {
+#include <libavutil/buffer.h>
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fr::media2 {
+
+  SegmentStoreReader::Mapping::~Mapping() {
+    if (nullptr != data) {
+      munmap(data, size);
+    }
+  }
+
+  SegmentStoreReader::SegmentStoreReader(const std::filesystem::path& streamDir, size_t prefetch) :
+    SegmentStoreReader(streamDir, nullptr, prefetch) {
+  }
+
+  SegmentStoreReader::SegmentStoreReader(const std::filesystem::path& streamDir,
+                                         std::shared_ptr<StreamCache> cache, size_t prefetch) :
+    dir(streamDir), segmentIndex(streamDir), cache(cache), prefetch(prefetch > 0 ? prefetch : 1) {
+    std::filesystem::path logFile = SegmentStore::logPath(dir);
+    log = open(logFile.c_str(), O_RDONLY | O_CLOEXEC);
+    if (log < 0) {
+      throw std::runtime_error("Could not open " + logFile.string() + ": " + strerror(errno));
+    }
+    try {
+      map();
+      setupStream();
+    } catch (...) {
+      close(log);
+      throw;
+    }
+  }
+
+  SegmentStoreReader::~SegmentStoreReader() {
+    stop();
+    if (log >= 0) {
+      close(log);
+    }
+  }
+
+  void SegmentStoreReader::map() {
+    if (segmentIndex.empty()) {
+      return;
+    }
+    const SegmentStore::IndexEntry& last = segmentIndex[segmentIndex.size() - 1];
+    size_t needed = last.offset + last.length;
+    if (mapping && mapping->size >= needed) {
+      return;
+    }
+    struct stat st;
+    if (fstat(log, &st) < 0 || (size_t) st.st_size < needed) {
+      throw std::runtime_error("Segment log in " + dir.string() + " is shorter than its index");
+    }
+    void* data = mmap(nullptr, needed, PROT_READ, MAP_SHARED, log, 0);
+    if (MAP_FAILED == data) {
+      throw std::runtime_error("Could not map segment log in " + dir.string() + ": " + strerror(errno));
+    }
+    madvise(data, needed, MADV_SEQUENTIAL);
+    // Anything still pointing into the old mapping keeps it alive
+    auto updated = std::make_shared<Mapping>();
+    updated->data = (uint8_t*) data;
+    updated->size = needed;
+    mapping = updated;
+  }
+
+  void SegmentStoreReader::setupStream() {
+    if (output || !mapping) {
+      return;
+    }
+    auto first = decode(mapping, segmentIndex[0]);
+    output = cache ? cache->get(first.get()) : std::make_shared<Stream>(first.get());
+  }
+
+  Stream::pointer SegmentStoreReader::stream() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return output;
+  }
+
+  size_t SegmentStoreReader::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return segmentIndex.size();
+  }
+
+  SegmentStore::IndexEntry SegmentStoreReader::entry(size_t position) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (position >= segmentIndex.size()) {
+      throw std::out_of_range("No stored segment " + std::to_string(position));
+    }
+    return segmentIndex[position];
+  }
+
+  AVRational SegmentStoreReader::timeBase() const {
+    return segmentIndex.timeBase();
+  }
+
+  std::pair<size_t, size_t> SegmentStoreReader::range(int64_t start, int64_t end) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t first = segmentIndex.find(start);
+    if (first == segmentIndex.size()) {
+      // Everything starts after start, so begin at the beginning
+      first = 0;
+    }
+    size_t last = segmentIndex.lowerBound(end);
+    if (last < first) {
+      last = first;
+    }
+    return {first, last};
+  }
+
+  bool SegmentStoreReader::refresh() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!segmentIndex.refresh()) {
+      return false;
+    }
+    map();
+    setupStream();
+    return true;
+  }
+
+  void SegmentStoreReader::releaseMapping(void* opaque, uint8_t*) {
+    delete (std::shared_ptr<Mapping>*) opaque;
+  }
+
+  Segment::pointer SegmentStoreReader::decode(const std::shared_ptr<Mapping>& map,
+                                              const SegmentStore::IndexEntry& entry) {
+    if (entry.offset + entry.length > map->size) {
+      throw std::runtime_error("Stored segment is outside the segment log");
+    }
+    auto holder = new std::shared_ptr<Mapping>(map);
+    AVBufferRef* buffer = av_buffer_create(map->data + entry.offset, entry.length,
+                                           &releaseMapping, holder, AV_BUFFER_FLAG_READONLY);
+    if (nullptr == buffer) {
+      delete holder;
+      throw std::runtime_error("Could not reference segment log");
+    }
+    Segment::pointer ret;
+    try {
+      ret = SegmentWire::decode(buffer);
+    } catch (...) {
+      av_buffer_unref(&buffer);
+      throw;
+    }
+    // The packets have their own references
+    av_buffer_unref(&buffer);
+    return ret;
+  }
+
+  Segment::pointer SegmentStoreReader::segment(size_t position) {
+    std::shared_ptr<Mapping> map;
+    SegmentStore::IndexEntry e;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (position >= segmentIndex.size()) {
+        throw std::out_of_range("No stored segment " + std::to_string(position));
+      }
+      e = segmentIndex[position];
+      map = mapping;
+    }
+    return decode(map, e);
+  }
+
+  void SegmentStoreReader::touch(const Mapping& map, const SegmentStore::IndexEntry& entry) {
+    static const size_t pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t) (map.data + entry.offset) & ~(pageSize - 1);
+    uintptr_t end = (uintptr_t) (map.data + entry.offset + entry.length);
+    // Start the read for the whole segment, and then wait for it here
+    // rather than in whoever is sending the packets
+    madvise((void*) begin, end - begin, MADV_WILLNEED);
+    for (uintptr_t page = begin; page < end; page += pageSize) {
+      (void) *(volatile const uint8_t*) page;
+    }
+  }
+
+  size_t SegmentStoreReader::replay() {
+    return replay(INT64_MIN, INT64_MAX);
+  }
+
+  size_t SegmentStoreReader::replay(int64_t start, int64_t end) {
+    auto [first, last] = range(start, end);
+    std::vector<SegmentStore::IndexEntry> entries;
+    std::shared_ptr<Mapping> map;
+    Stream::pointer out;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t i = first; i < last; ++i) {
+        entries.push_back(segmentIndex[i]);
+      }
+      map = mapping;
+      out = output;
+    }
+    if (entries.empty() || !out) {
+      return 0;
+    }
+
+    WorkQueue<Segment::pointer> work(prefetch);
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      if (nullptr != queue) {
+        throw std::logic_error("SegmentStoreReader is already replaying");
+      }
+      stopping = false;
+      queue = &work;
+    }
+    std::thread prefetcher([this, &work, &entries, &map]{
+      for (const auto& entry : entries) {
+        if (stopping) {
+          break;
+        }
+        Segment::pointer seg;
+        try {
+          touch(*map, entry);
+          seg = decode(map, entry);
+        } catch (std::exception& e) {
+          std::cerr << "Could not read segment " << entry.dts << " from " << dir.string() << ": " << e.what() << std::endl;
+          continue;
+        }
+        if (!work.push(std::move(seg))) {
+          break;
+        }
+      }
+      work.close();
+    });
+
+    size_t sent = 0;
+    Segment::pointer seg;
+    while (work.pop(seg)) {
+      for (const Packet::pointer& packet : seg->packets) {
+        if (stopping) {
+          break;
+        }
+        if (AV_NOPTS_VALUE != packet->dts && packet->dts >= end) {
+          continue;
+        }
+        out->forward(packet);
+      }
+      if (stopping) {
+        break;
+      }
+      sent++;
+    }
+    work.close();
+    prefetcher.join();
+    std::lock_guard<std::mutex> lock(queueMutex);
+    queue = nullptr;
+    return sent;
+  }
+
+  void SegmentStoreReader::stop() {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    stopping = true;
+    if (nullptr != queue) {
+      queue->close();
+    }
+  }
+
+}
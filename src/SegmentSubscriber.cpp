@@ -23,7 +23,7 @@ namespace fr::media2 {
   SegmentSubscriber::SegmentSubscriber() {}
   SegmentSubscriber::~SegmentSubscriber() { unsubscribe(); }
 
-  void SegmentSubscriber::subscribe(Segmenter *to) {
+  void SegmentSubscriber::subscribe(SegmentSource *to) {
     // I don't really need the stream information in this case
     boost::signals2::connection sub =
       to->segments.connect([this](const Segment::pointer &segment, StreamData::pointer stream) {
@@ -0,0 +1,321 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fr/media2/SegmentTranscoder.h>
+#include <fr/media2/Frame.h>
+#include <fr/media2/Packet.h>
+#include <fr/media2/Scaler.h>
+
+extern "C" {
+#include <libavutil/dict.h>
+#include <libswscale/swscale.h>
+}
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+namespace fr::media2 {
+
+  SegmentTranscoder::SegmentTranscoder(int nThreads, const Settings& settings, size_t queueCapacity) :
+    settings(settings), work{queueCapacity} {
+    encoderCodec = avcodec_find_encoder_by_name(settings.codec.c_str());
+    if (nullptr == encoderCodec) {
+      std::string err{"Could not find codec "};
+      err.append(settings.codec);
+      throw std::logic_error(err);
+    }
+    if (nThreads < 1) {
+      nThreads = 1;
+    }
+    for (int i = 0; i < nThreads; ++i) {
+      workers.emplace_back([this]{ doSomeWork(); });
+    }
+  }
+
+  SegmentTranscoder::~SegmentTranscoder() {
+    close();
+  }
+
+  void SegmentTranscoder::subscribe(ZmqSegmentSubscriber* source) {
+    sourceSubscriptions.push_back(source->segments.connect(
+      [this](const Segment::pointer& segment, uuid_t, AVMediaType, int, int) {
+        if (segment && !segment->empty()) {
+          receive(Segment::copy(segment));
+        }
+      }));
+  }
+
+  void SegmentTranscoder::process(const Segment::pointer& segment, StreamData::pointer stream) {
+    if (segment && !segment->empty()) {
+      receive(Segment::copy(segment));
+    }
+  }
+
+  void SegmentTranscoder::receive(Segment::pointer segment) {
+    Job job;
+    {
+      std::lock_guard<std::mutex> lock(sequenceMutex);
+      job.sequence = nextSequence++;
+    }
+    job.segment = std::move(segment);
+    uint64_t sequence = job.sequence;
+    if (!work.push(std::move(job))) {
+      // Closed. Don't leave a hole for flush to wait on.
+      finished(sequence, nullptr);
+    }
+  }
+
+  void SegmentTranscoder::flush() {
+    uint64_t target = 0;
+    {
+      std::lock_guard<std::mutex> lock(sequenceMutex);
+      target = nextSequence;
+    }
+    std::unique_lock<std::mutex> lock(doneMutex);
+    // nextOut goes up before the segment is actually sent, so wait for
+    // whoever's sending to finish too
+    emitted.wait(lock, [this, target]{ return nextOut >= target && !emitting; });
+  }
+
+  void SegmentTranscoder::close() {
+    for (auto& subscription : sourceSubscriptions) {
+      subscription.disconnect();
+    }
+    sourceSubscriptions.clear();
+    unsubscribe();
+    work.close();
+    for (auto& worker : workers) {
+      if (worker.joinable()) {
+        worker.join();
+      }
+    }
+    workers.clear();
+  }
+
+  uint64_t SegmentTranscoder::failures() {
+    return failed;
+  }
+
+  void SegmentTranscoder::doSomeWork() {
+    Job job;
+    while (work.pop(job)) {
+      Segment::pointer result;
+      if (AVMEDIA_TYPE_VIDEO != job.segment->parameters.codec_type) {
+        result = std::move(job.segment);
+      } else {
+        try {
+          result = transcode(*job.segment);
+        } catch (std::exception &e) {
+          failed++;
+          std::cerr << "Could not transcode segment: " << e.what() << std::endl;
+        }
+      }
+      finished(job.sequence, std::move(result));
+    }
+  }
+
+  void SegmentTranscoder::finished(uint64_t sequence, Segment::pointer segment) {
+    std::unique_lock<std::mutex> lock(doneMutex);
+    done[sequence] = std::move(segment);
+    // Whoever is already sending will pick this one up
+    if (emitting) {
+      return;
+    }
+    emitting = true;
+    while (!done.empty() && done.begin()->first == nextOut) {
+      Segment::pointer ready = std::move(done.begin()->second);
+      done.erase(done.begin());
+      nextOut++;
+      lock.unlock();
+      if (ready && !ready->empty()) {
+        segments(ready, outputStream(ready));
+      }
+      lock.lock();
+    }
+    emitting = false;
+    lock.unlock();
+    emitted.notify_all();
+  }
+
+  StreamData::pointer SegmentTranscoder::outputStream(const Segment::pointer& segment) {
+    UuidKey key(segment->jobId);
+    auto found = outputStreams.find(key);
+    if (found != outputStreams.end()) {
+      return found->second;
+    }
+    char uuidstr[40];
+    memset(uuidstr, '\0', sizeof(uuidstr));
+    uuid_unparse(segment->jobId, uuidstr);
+    auto data = std::make_shared<StreamData>(segment.get(), std::string(uuidstr));
+    data->mediaType = segment->parameters.codec_type;
+    outputStreams[key] = data;
+    return data;
+  }
+
+  Segment::pointer SegmentTranscoder::transcode(const Segment& segment) {
+    const AVCodec* decoderCodec = avcodec_find_decoder(segment.parameters.codec_id);
+    if (nullptr == decoderCodec) {
+      throw std::runtime_error("No decoder for codec id " + std::to_string((int) segment.parameters.codec_id));
+    }
+    StreamData::ContextPointer decoder{avcodec_alloc_context3(decoderCodec), &StreamData::destroyContext};
+    if (!decoder) {
+      throw std::runtime_error("Could not create decoder context");
+    }
+    avcodec_parameters_to_context(decoder.get(), &segment.parameters);
+    decoder->pkt_timebase = segment.time_base;
+    settings.decoder.apply(decoder.get());
+    if (avcodec_open2(decoder.get(), decoderCodec, nullptr) < 0) {
+      throw std::runtime_error("Could not open decoder");
+    }
+
+    StreamData::ContextPointer encoder{nullptr, &StreamData::destroyContext};
+    std::unique_ptr<SwsContext, decltype(&sws_freeContext)> scaler{nullptr, &sws_freeContext};
+    Frame::pointer decoded = Frame::create();
+    Frame::pointer scaled = Frame::pointer{nullptr, &Frame::destroy};
+    Segment::pointer out;
+    int streamIndex = segment.packets.empty() ? 0 : segment.packets[0]->stream_index;
+    bool firstFrame = true;
+
+    auto openEncoder = [&](const AVFrame* frame) {
+      int width = settings.width;
+      int height = settings.height;
+      Scaler::fitSize(frame->width, frame->height, width, height);
+      AVCodecContext* ctx = avcodec_alloc_context3(encoderCodec);
+      if (nullptr == ctx) {
+        throw std::runtime_error("Could not create encoder context");
+      }
+      encoder = StreamData::ContextPointer{ctx, &StreamData::destroyContext};
+      ctx->width = width;
+      ctx->height = height;
+      ctx->pix_fmt = settings.format;
+      ctx->time_base = segment.time_base;
+      ctx->sample_aspect_ratio = frame->sample_aspect_ratio;
+      // One keyframe at the start, like the segment we came from
+      ctx->gop_size = segment.packets.size() + 1;
+      ctx->thread_count = settings.encoderThreads;
+      // Parameters go in the segment instead of in the stream
+      ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+      if (settings.bitRate > 0) {
+        ctx->bit_rate = settings.bitRate;
+      }
+      AVDictionary* options = nullptr;
+      for (const auto& [key, value] : settings.options) {
+        av_dict_set(&options, key.c_str(), value.c_str(), 0);
+      }
+      int ret = avcodec_open2(ctx, encoderCodec, &options);
+      av_dict_free(&options);
+      if (ret < 0) {
+        throw std::runtime_error("Could not open encoder " + settings.codec);
+      }
+
+      if (width != frame->width || height != frame->height || settings.format != frame->format) {
+        scaler.reset(sws_getContext(frame->width, frame->height, (AVPixelFormat) frame->format,
+                                    width, height, settings.format, SWS_BICUBIC,
+                                    nullptr, nullptr, nullptr));
+        if (!scaler) {
+          throw std::runtime_error("Could not create scaler");
+        }
+        scaled = Frame::create(width, height, settings.format);
+      }
+
+      AVCodecParameters* parameters = avcodec_parameters_alloc();
+      avcodec_parameters_from_context(parameters, ctx);
+      uuid_t jobId;
+      uuid_copy(jobId, segment.jobId);
+      out = Segment::create(jobId, *parameters);
+      out->time_base = segment.time_base;
+      avcodec_parameters_free(&parameters);
+    };
+
+    auto receivePackets = [&]() {
+      while (true) {
+        Packet::pointer packet = Packet::create();
+        int ret = avcodec_receive_packet(encoder.get(), packet.get());
+        if (AVERROR(EAGAIN) == ret || AVERROR_EOF == ret) {
+          break;
+        } else if (ret < 0) {
+          throw std::runtime_error("Error encoding frame: " + std::to_string(ret));
+        }
+        packet->stream_index = streamIndex;
+        out->append(std::move(packet));
+      }
+    };
+
+    auto encode = [&](AVFrame* frame) {
+      if (nullptr == frame) {
+        if (encoder) {
+          avcodec_send_frame(encoder.get(), nullptr);
+          receivePackets();
+        }
+        return;
+      }
+      if (!encoder) {
+        openEncoder(frame);
+      }
+      AVFrame* input = frame;
+      if (scaler) {
+        // The encoder may still have a reference to the last one
+        if (av_frame_make_writable(scaled.get()) < 0) {
+          throw std::runtime_error("Could not get a writable frame for the scaler");
+        }
+        sws_scale(scaler.get(), frame->data, frame->linesize, 0, frame->height,
+                  scaled->data, scaled->linesize);
+        input = scaled.get();
+      }
+      input->pts = frame->best_effort_timestamp;
+      input->pict_type = firstFrame ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+      firstFrame = false;
+      int ret = avcodec_send_frame(encoder.get(), input);
+      if (ret < 0) {
+        throw std::runtime_error("Error encoding frame: " + std::to_string(ret));
+      }
+      receivePackets();
+    };
+
+    auto receiveFrames = [&]() {
+      while (true) {
+        int ret = avcodec_receive_frame(decoder.get(), decoded.get());
+        if (AVERROR(EAGAIN) == ret || AVERROR_EOF == ret) {
+          break;
+        } else if (ret < 0) {
+          throw std::runtime_error("Error decoding segment: " + std::to_string(ret));
+        }
+        encode(decoded.get());
+        av_frame_unref(decoded.get());
+      }
+    };
+
+    for (const Packet::pointer& packet : segment.packets) {
+      if (avcodec_send_packet(decoder.get(), packet.get()) < 0) {
+        throw std::runtime_error("Error sending packet to decoder");
+      }
+      receiveFrames();
+    }
+    // Drain the decoder and then the encoder
+    avcodec_send_packet(decoder.get(), nullptr);
+    receiveFrames();
+    encode(nullptr);
+
+    if (!out) {
+      throw std::runtime_error("Segment had no frames in it");
+    }
+    return out;
+  }
+
+}
@@ -17,48 +17,59 @@
  */
 
 #include <fr/media2/SegmentUnpacker.h>
+#include <algorithm>
 
 namespace fr::media2 {
 
-  SegmentUnpacker::SegmentUnpacker(int nThreads, std::function<void(Stream::pointer)> setupStream) :
+  SegmentUnpacker::SegmentUnpacker(int nThreads, std::function<void(Stream::pointer)> setupStream,
+                                   size_t queueCapacity) :
     setupStream{setupStream},
     cache{std::make_shared<StreamCache>()}
   {
-    // Start thread pool
-    for (int i = 0; i < nThreads; ++i) {
-      workers.push_back(std::make_shared<std::thread>([this]{this->doSomeWork();}));
-    }
+    start(nThreads, queueCapacity);
   }
     
   SegmentUnpacker::SegmentUnpacker(int nThreads, std::shared_ptr<StreamCache> cache,
-				   std::function<void(Stream::pointer)> setupStream) :
+				   std::function<void(Stream::pointer)> setupStream,
+                                   size_t queueCapacity) :
     setupStream{setupStream}, cache{cache} {
-    // Start thread pool
-    for (int i = 0; i < nThreads; ++i) {
-      workers.push_back(std::make_shared<std::thread>([this]{this->doSomeWork();}));
-    }
+    start(nThreads, queueCapacity);
   }
   
   SegmentUnpacker::~SegmentUnpacker() { close(); }
 
+  void SegmentUnpacker::start(int nThreads, size_t queueCapacity) {
+    if (nThreads < 1) {
+      nThreads = 1;
+    }
+    for (int i = 0; i < nThreads; ++i) {
+      shards.push_back(std::make_unique<Shard>(queueCapacity));
+    }
+    // Don't start any threads until the shard vector stops moving around
+    for (auto& shard : shards) {
+      Shard* s = shard.get();
+      shard->thread = std::thread([this, s]{ this->doSomeWork(*s); });
+    }
+  }
+
   void SegmentUnpacker::close() {
     unsubscribe();
-    shutdownFlag = true;
-    while (!work.empty()) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    // Workers finish whatever is still queued and then exit
+    for (auto& shard : shards) {
+      shard->work.close();
     }
-    for (auto thread : workers) {
-      if (thread->joinable()) {
-	thread->join();
+    for (auto& shard : shards) {
+      if (shard->thread.joinable()) {
+	shard->thread.join();
       }
     }
     cache.reset();
-    workers.clear();
   }
   
   void SegmentUnpacker::subscribe(ZmqSegmentSubscriber* source) {
-    auto sub = source->receivedSegment.connect([this](std::stringstream &buffer, uuid_t /* notused */, AVMediaType /* mediaType*/,  int /* width*/, int /* height */){
-      this->receive(buffer);
+    auto sub = source->segments.connect([this](const Segment::pointer &segment, uuid_t /* notused */, AVMediaType /* mediaType*/,  int /* width*/, int /* height */){
+      // Packets just get reffed, so this doesn't copy the payloads
+      this->receive(Segment::copy(segment));
     });
     subscriptions.push_back(sub);
   }
@@ -75,41 +86,137 @@ namespace fr::media2 {
   }
 
   void SegmentUnpacker::receive(std::unique_ptr<Segment> seg) {
-    std::lock_guard<std::mutex> lock(workMutex);
-    work.push_back(std::move(seg));
+    // Everything for one job goes to the same worker, so the job's
+    // stream only ever gets packets from one thread
+    Shard& shard = *shards[UuidKey(seg->jobId).hash() % shards.size()];
+    // Blocks if the queue is full
+    shard.work.push(std::move(seg));
+  }
+
+  size_t SegmentUnpacker::queued() {
+    size_t ret = 0;
+    for (auto& shard : shards) {
+      ret += shard->work.size();
+    }
+    return ret;
+  }
+
+  void SegmentUnpacker::setQueueCapacity(size_t capacity) {
+    for (auto& shard : shards) {
+      shard->work.setCapacity(capacity);
+    }
+  }
+
+  void SegmentUnpacker::setReorderDepth(size_t depth) {
+    reorderDepth = depth;
+  }
+
+  void SegmentUnpacker::setReorderTimeout(std::chrono::milliseconds timeout) {
+    reorderTimeoutMs = timeout.count();
+  }
+
+  uint64_t SegmentUnpacker::lateSegments() {
+    return late;
   }
 
   std::unique_ptr<Segment> SegmentUnpacker::segFrom(std::stringstream& buffer) {
+    char magic[sizeof(SegmentWire::magic)];
+    auto start = buffer.tellg();
+    buffer.read(magic, sizeof(magic));
+    bool wire = buffer.good() && 0 == memcmp(magic, SegmentWire::magic, sizeof(magic));
+    buffer.clear();
+    buffer.seekg(start);
+    if (wire) {
+      buffer.seekg(0, std::ios::end);
+      size_t size = buffer.tellg() - start;
+      buffer.seekg(start);
+      AVBufferRef* data = av_buffer_alloc(size);
+      if (nullptr == data) {
+        throw std::runtime_error("Could not allocate segment buffer");
+      }
+      buffer.read((char*) data->data, size);
+      std::unique_ptr<Segment> ptr;
+      try {
+        ptr = SegmentWire::decode(data);
+      } catch (...) {
+        av_buffer_unref(&data);
+        throw;
+      }
+      // The packets hold their own references
+      av_buffer_unref(&data);
+      return ptr;
+    }
     auto ptr = std::make_unique<Segment>();
     boost::archive::binary_iarchive ar(buffer);
     ar >> *ptr;
     return ptr;
   }
 
-  void SegmentUnpacker::doSomeWork() {
-    while (!shutdownFlag || work.size() > 0) {
-      if (work.empty()) {
-	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  // Heap comparison, puts the lowest dts at the front
+  static bool laterDts(const std::unique_ptr<Segment>& a, const std::unique_ptr<Segment>& b) {
+    return a->dts > b->dts;
+  }
+
+  void SegmentUnpacker::doSomeWork(Shard& shard) {
+    std::unique_ptr<Segment> seg;
+    while (true) {
+      if (0 == reorderDepth) {
+        // pop waits for work and returns false once we're closed and
+        // the queue is empty
+        if (!shard.work.pop(seg)) {
+          break;
+        }
+        schedule(shard, std::move(seg));
+      } else if (shard.work.pop(seg, std::chrono::milliseconds(reorderTimeoutMs))) {
+        schedule(shard, std::move(seg));
+      } else if (shard.work.isClosed() && shard.work.empty()) {
+        break;
       } else {
-	std::unique_ptr<Segment> seg;
-	{
-	  std::lock_guard<std::mutex> lock(workMutex);
-	  // Doublecheck work empty now that it's locked
-	  if (!work.empty()) {
-	    seg = std::move(work.front());
-	    work.pop_front();
-	  }
-	  // Reliquish lock ASAP
-	}
-	unpack(std::move(seg));	
+        // Nothing's shown up for a while, so don't keep sitting on
+        // the segments we have
+        releaseAll(shard);
       }
     }
+    releaseAll(shard);
+  }
+
+  void SegmentUnpacker::schedule(Shard& shard, std::unique_ptr<Segment> seg) {
+    if (0 == reorderDepth || seg->empty()) {
+      unpack(std::move(seg));
+      return;
+    }
+    Pending& pending = shard.pending[UuidKey(seg->jobId)];
+    if (AV_NOPTS_VALUE != pending.lastDts && seg->dts < pending.lastDts) {
+      late++;
+    }
+    pending.heap.push_back(std::move(seg));
+    std::push_heap(pending.heap.begin(), pending.heap.end(), laterDts);
+    release(pending, reorderDepth);
+  }
+
+  void SegmentUnpacker::release(Pending& pending, size_t keep) {
+    while (pending.heap.size() > keep) {
+      std::pop_heap(pending.heap.begin(), pending.heap.end(), laterDts);
+      std::unique_ptr<Segment> seg = std::move(pending.heap.back());
+      pending.heap.pop_back();
+      pending.lastDts = seg->dts;
+      unpack(std::move(seg));
+    }
+  }
+
+  void SegmentUnpacker::releaseAll(Shard& shard) {
+    for (auto& [id, pending] : shard.pending) {
+      release(pending, 0);
+    }
+    // Forget about the streams so the map doesn't grow forever. A
+    // straggler for one of these won't be counted as late.
+    shard.pending.clear();
   }
   
   void SegmentUnpacker::unpack(std::unique_ptr<Segment> seg) {
-    auto stream = cache->get(seg->jobId);
-    if (nullptr == stream.get()) {
-      stream = cache->get(seg.get());
+    bool created = false;
+    auto stream = cache->get(seg.get(), created);
+    if (created) {
       setupStream(stream);
     }
 
@@ -0,0 +1,332 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fr/media2/SegmentWire.h>
+#include <cstring>
+#include <stdexcept>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+namespace fr::media2 {
+
+  void SegmentWire::encodeHeader(const Segment& segment, std::vector<uint8_t>& out) {
+    Header header;
+    memset(&header, 0, sizeof(Header));
+    memcpy(header.magic, magic, sizeof(header.magic));
+    header.version = version;
+    memcpy(header.jobId, segment.jobId, sizeof(header.jobId));
+    header.pts = segment.pts;
+    header.dts = segment.dts;
+    header.timeBaseNum = segment.time_base.num;
+    header.timeBaseDen = segment.time_base.den;
+    header.npackets = segment.packets.size();
+    header.padding = AV_INPUT_BUFFER_PADDING_SIZE;
+
+    const AVCodecParameters& par = segment.parameters;
+    header.extradataSize = (nullptr != par.extradata) ? par.extradata_size : 0;
+    header.codecType = par.codec_type;
+    header.codecId = par.codec_id;
+    header.codecTag = par.codec_tag;
+    header.format = par.format;
+    header.bitRate = par.bit_rate;
+    header.bitsPerCodedSample = par.bits_per_coded_sample;
+    header.bitsPerRawSample = par.bits_per_raw_sample;
+    header.profile = par.profile;
+    header.level = par.level;
+    header.width = par.width;
+    header.height = par.height;
+    header.sampleAspectNum = par.sample_aspect_ratio.num;
+    header.sampleAspectDen = par.sample_aspect_ratio.den;
+    header.fieldOrder = par.field_order;
+    header.colorRange = par.color_range;
+    header.colorPrimaries = par.color_primaries;
+    header.colorTrc = par.color_trc;
+    header.colorSpace = par.color_space;
+    header.chromaLocation = par.chroma_location;
+    header.videoDelay = par.video_delay;
+    header.channels = par.channels;
+    header.channelLayout = par.channel_layout;
+    header.sampleRate = par.sample_rate;
+    header.blockAlign = par.block_align;
+    header.frameSize = par.frame_size;
+    header.initialPadding = par.initial_padding;
+    header.trailingPadding = par.trailing_padding;
+    header.seekPreroll = par.seek_preroll;
+
+    size_t sideDataSize = 0;
+    for (const Packet::pointer& packet : segment.packets) {
+      for (int i = 0; i < packet->side_data_elems; ++i) {
+        sideDataSize += sizeof(SideDataEntry) + packet->side_data[i].size;
+      }
+    }
+    header.sideDataSize = sideDataSize;
+
+    out.resize(headerBlockSize(header));
+    uint8_t* pos = out.data();
+    memcpy(pos, &header, sizeof(Header));
+    pos += sizeof(Header);
+    if (header.extradataSize) {
+      memcpy(pos, par.extradata, header.extradataSize);
+      pos += header.extradataSize;
+    }
+
+    uint64_t offset = 0;
+    for (const Packet::pointer& packet : segment.packets) {
+      PacketEntry entry;
+      entry.pts = packet->pts;
+      entry.dts = packet->dts;
+      entry.duration = packet->duration;
+      entry.pos = packet->pos;
+      entry.offset = offset;
+      entry.size = packet->size;
+      entry.flags = packet->flags;
+      entry.streamIndex = packet->stream_index;
+      entry.sideDataElems = packet->side_data_elems;
+      memcpy(pos, &entry, sizeof(PacketEntry));
+      pos += sizeof(PacketEntry);
+      offset += payloadSize(*packet);
+    }
+
+    for (uint32_t i = 0; i < segment.packets.size(); ++i) {
+      const AVPacket& packet = *segment.packets[i];
+      for (int j = 0; j < packet.side_data_elems; ++j) {
+        SideDataEntry entry;
+        entry.packet = i;
+        entry.type = packet.side_data[j].type;
+        entry.size = packet.side_data[j].size;
+        entry.reserved = 0;
+        memcpy(pos, &entry, sizeof(SideDataEntry));
+        pos += sizeof(SideDataEntry);
+        memcpy(pos, packet.side_data[j].data, entry.size);
+        pos += entry.size;
+      }
+    }
+  }
+
+  size_t SegmentWire::payloadSize(const AVPacket& packet) {
+    return packet.size + AV_INPUT_BUFFER_PADDING_SIZE;
+  }
+
+  void SegmentWire::write(const Segment& segment, std::ostream& o) {
+    static const char zeroes[AV_INPUT_BUFFER_PADDING_SIZE] = {};
+    std::vector<uint8_t> headerBlock;
+    encodeHeader(segment, headerBlock);
+    o.write((const char*) headerBlock.data(), headerBlock.size());
+    for (const Packet::pointer& packet : segment.packets) {
+      o.write((const char*) packet->data, packet->size);
+      o.write(zeroes, sizeof(zeroes));
+    }
+  }
+
+  bool SegmentWire::isWireFormat(const uint8_t* data, size_t size) {
+    return size >= sizeof(Header) && 0 == memcmp(data, magic, sizeof(magic));
+  }
+
+  bool SegmentWire::readHeader(const uint8_t* data, size_t size, Header& header) {
+    if (!isWireFormat(data, size)) {
+      return false;
+    }
+    memcpy(&header, data, sizeof(Header));
+    return true;
+  }
+
+  bool SegmentWire::readPacket(const uint8_t* data, size_t size, size_t index, PacketEntry& entry) {
+    Header header;
+    if (!readHeader(data, size, header) || index >= header.npackets) {
+      return false;
+    }
+    size_t pos = sizeof(Header) + header.extradataSize + index * sizeof(PacketEntry);
+    if (pos + sizeof(PacketEntry) > size) {
+      return false;
+    }
+    memcpy(&entry, data + pos, sizeof(PacketEntry));
+    return true;
+  }
+
+  size_t SegmentWire::headerBlockSize(const Header& header) {
+    return sizeof(Header) + header.extradataSize +
+      header.npackets * sizeof(PacketEntry) + header.sideDataSize;
+  }
+
+  Segment::pointer SegmentWire::decodeHeader(const uint8_t* data, size_t size,
+                                             Header& header,
+                                             std::vector<PacketEntry>& entries) {
+    if (!readHeader(data, size, header)) {
+      throw std::runtime_error("Buffer does not contain a wire format segment");
+    }
+    if (version != header.version) {
+      throw std::runtime_error("Unsupported segment wire format version " +
+                               std::to_string(header.version));
+    }
+    if (headerBlockSize(header) > size) {
+      throw std::runtime_error("Segment header block is truncated");
+    }
+
+    auto segment = std::make_unique<Segment>();
+    memcpy(segment->jobId, header.jobId, sizeof(uuid_t));
+    segment->pts = header.pts;
+    segment->dts = header.dts;
+    segment->time_base = AVRational{header.timeBaseNum, header.timeBaseDen};
+
+    AVCodecParameters& par = segment->parameters;
+    par.codec_type = (AVMediaType) header.codecType;
+    par.codec_id = (AVCodecID) header.codecId;
+    par.codec_tag = header.codecTag;
+    par.format = header.format;
+    par.bit_rate = header.bitRate;
+    par.bits_per_coded_sample = header.bitsPerCodedSample;
+    par.bits_per_raw_sample = header.bitsPerRawSample;
+    par.profile = header.profile;
+    par.level = header.level;
+    par.width = header.width;
+    par.height = header.height;
+    par.sample_aspect_ratio = AVRational{header.sampleAspectNum, header.sampleAspectDen};
+    par.field_order = (AVFieldOrder) header.fieldOrder;
+    par.color_range = (AVColorRange) header.colorRange;
+    par.color_primaries = (AVColorPrimaries) header.colorPrimaries;
+    par.color_trc = (AVColorTransferCharacteristic) header.colorTrc;
+    par.color_space = (AVColorSpace) header.colorSpace;
+    par.chroma_location = (AVChromaLocation) header.chromaLocation;
+    par.video_delay = header.videoDelay;
+    par.channels = header.channels;
+    par.channel_layout = header.channelLayout;
+    par.sample_rate = header.sampleRate;
+    par.block_align = header.blockAlign;
+    par.frame_size = header.frameSize;
+    par.initial_padding = header.initialPadding;
+    par.trailing_padding = header.trailingPadding;
+    par.seek_preroll = header.seekPreroll;
+
+    const uint8_t* pos = data + sizeof(Header);
+    if (header.extradataSize) {
+      // Segment frees this with free()
+      par.extradata = (uint8_t*) calloc(header.extradataSize + AV_INPUT_BUFFER_PADDING_SIZE, 1);
+      memcpy(par.extradata, pos, header.extradataSize);
+      par.extradata_size = header.extradataSize;
+      pos += header.extradataSize;
+    }
+
+    entries.resize(header.npackets);
+    if (header.npackets) {
+      memcpy(entries.data(), pos, header.npackets * sizeof(PacketEntry));
+    }
+    segment->packets.reserve(header.npackets);
+    return segment;
+  }
+
+  void SegmentWire::appendPacket(Segment& segment, const PacketEntry& entry,
+                                 AVBufferRef* ref, uint8_t* data) {
+    Packet::pointer packet = Packet::create();
+    packet->buf = ref;
+    packet->data = data;
+    packet->size = entry.size;
+    packet->pts = entry.pts;
+    packet->dts = entry.dts;
+    packet->duration = entry.duration;
+    packet->pos = entry.pos;
+    packet->flags = entry.flags;
+    packet->stream_index = entry.streamIndex;
+    segment.append(std::move(packet));
+  }
+
+  void SegmentWire::decodeSideData(const uint8_t* data, const Header& header,
+                                   Segment& segment) {
+    if (0 == header.sideDataSize) {
+      return;
+    }
+    const uint8_t* pos = data + sizeof(Header) + header.extradataSize +
+      header.npackets * sizeof(PacketEntry);
+    const uint8_t* end = pos + header.sideDataSize;
+    while (pos + sizeof(SideDataEntry) <= end) {
+      SideDataEntry entry;
+      memcpy(&entry, pos, sizeof(SideDataEntry));
+      pos += sizeof(SideDataEntry);
+      if (entry.packet >= segment.packets.size() || pos + entry.size > end) {
+        throw std::runtime_error("Corrupt side data in segment");
+      }
+      uint8_t* sideData = av_packet_new_side_data(segment.packets[entry.packet].get(),
+                                                  (AVPacketSideDataType) entry.type,
+                                                  entry.size);
+      if (nullptr == sideData) {
+        throw std::runtime_error("Could not allocate packet side data");
+      }
+      memcpy(sideData, pos, entry.size);
+      pos += entry.size;
+    }
+  }
+
+  Segment::pointer SegmentWire::decode(AVBufferRef* buffer) {
+    Header header;
+    std::vector<PacketEntry> entries;
+    auto segment = decodeHeader(buffer->data, buffer->size, header, entries);
+    size_t payloadStart = headerBlockSize(header);
+    for (const PacketEntry& entry : entries) {
+      if (entry.size < 0 ||
+          payloadStart + entry.offset + entry.size + header.padding > buffer->size) {
+        throw std::runtime_error("Segment packet is outside the buffer");
+      }
+      AVBufferRef* ref = av_buffer_ref(buffer);
+      if (nullptr == ref) {
+        throw std::runtime_error("Could not reference segment buffer");
+      }
+      appendPacket(*segment, entry, ref, buffer->data + payloadStart + entry.offset);
+    }
+    decodeSideData(buffer->data, header, *segment);
+    // append sets these from the first packet, but the header
+    // is authoritative
+    segment->pts = header.pts;
+    segment->dts = header.dts;
+    return segment;
+  }
+
+  Segment::pointer SegmentWire::decode(const uint8_t* headerBlock, size_t size,
+                                       std::vector<AVBufferRef*>& payloads) {
+    Header header;
+    std::vector<PacketEntry> entries;
+    Segment::pointer segment;
+    try {
+      segment = decodeHeader(headerBlock, size, header, entries);
+      if (payloads.size() != entries.size()) {
+        throw std::runtime_error("Expected " + std::to_string(entries.size()) +
+                                 " packet payloads but got " +
+                                 std::to_string(payloads.size()));
+      }
+      for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].size < 0 || payloads[i]->size < (size_t) entries[i].size) {
+          throw std::runtime_error("Segment packet payload is truncated");
+        }
+      }
+    } catch (...) {
+      for (AVBufferRef*& payload : payloads) {
+        av_buffer_unref(&payload);
+      }
+      payloads.clear();
+      throw;
+    }
+    for (size_t i = 0; i < entries.size(); ++i) {
+      appendPacket(*segment, entries[i], payloads[i], payloads[i]->data);
+    }
+    payloads.clear();
+    decodeSideData(headerBlock, header, *segment);
+    segment->pts = header.pts;
+    segment->dts = header.dts;
+    return segment;
+  }
+
+}
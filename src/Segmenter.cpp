@@ -39,10 +39,29 @@ namespace fr::media2 {
       segments(currentSegment, stream);
   }
 
-  void Segmenter::process(const Packet::pointer &packet, StreamData::pointer stream) {
+  void Segmenter::streamEvent(StreamEvent event, const StreamData::pointer& stream) {
+    if (StreamEvent::discontinuity != event || nullptr == currentSegment.get() ||
+        currentSegment->empty()) {
+      return;
+    }
+    segments(currentSegment, this->stream);
+    currentSegment = currentSegment->next();
+    currentFrames = 0l;
+    // Seeking to any frame (not just keyframes) can land in the middle
+    // of a GOP
+    waitForIFrame = (AVMEDIA_TYPE_VIDEO == this->stream->mediaType);
+  }
+
+  void Segmenter::process(const Packet::pointer &packet, const StreamData::pointer& stream) {
     if (nullptr == this->stream.get()) {
       this->stream = stream;
     }
+    if (waitForIFrame) {
+      if (!Packet::containsIFrame(packet)) {
+	return;
+      }
+      waitForIFrame = false;
+    }
     if (nullptr == currentSegment.get()) {
       if (nullptr == stream.get() || nullptr == stream->parameters) {
 	// If you get one of these, I probably forgot to copy the parameters
@@ -63,8 +82,10 @@ namespace fr::media2 {
       currentSegment->append(packet);
       currentFrames++;
     } else {
-      if (((AVMEDIA_TYPE_VIDEO == stream->mediaType) && Packet::containsIFrame(packet)) ||
-	  ((AVMEDIA_TYPE_VIDEO != stream->mediaType) && (currentFrames >= nframes))) {
+      // (It's empty right after a discontinuity, and there's nothing to send)
+      if (!currentSegment->empty() &&
+	  (((AVMEDIA_TYPE_VIDEO == stream->mediaType) && Packet::containsIFrame(packet)) ||
+	   ((AVMEDIA_TYPE_VIDEO != stream->mediaType) && (currentFrames >= nframes)))) {
 	segments(currentSegment, stream);
 	currentSegment = currentSegment->next();
 	currentFrames = 0l;
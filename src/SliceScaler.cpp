@@ -0,0 +1,240 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fr/media2/SliceScaler.h>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace fr::media2 {
+
+  // Vertical chroma shift for plane, if it's a chroma plane
+  static int planeShift(int plane, int chromaShift) {
+    return (1 == plane || 2 == plane) ? chromaShift : 0;
+  }
+
+  // Rows in a plane for height rows of picture, rounded up like LibAV does
+  static int planeRows(int height, int shift) {
+    return -((-height) >> shift);
+  }
+
+  SliceScaler::SliceScaler(int srcWidth, int srcHeight, AVPixelFormat srcFormat,
+                           int dstWidth, int dstHeight, AVPixelFormat dstFormat,
+                           int flags, int threads, int bandHeight) :
+    srcFormat(srcFormat), dstFormat(dstFormat), dstWidth(dstWidth) {
+    const AVPixFmtDescriptor* srcDesc = av_pix_fmt_desc_get(srcFormat);
+    const AVPixFmtDescriptor* dstDesc = av_pix_fmt_desc_get(dstFormat);
+    if (nullptr == srcDesc || nullptr == dstDesc || srcWidth <= 0 || srcHeight <= 0 ||
+        dstWidth <= 0 || dstHeight <= 0) {
+      throw std::runtime_error("Invalid scaler size or format");
+    }
+    srcChromaShift = srcDesc->log2_chroma_h;
+    dstChromaShift = dstDesc->log2_chroma_h;
+    if (threads <= 0) {
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Smallest step in output rows where the source row is a whole
+    // number and both sides are on a chroma row
+    int unit = 0;
+    bool splittable = threads > 1 && !((srcDesc->flags | dstDesc->flags) &
+                                       (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL));
+    for (int u = 1; splittable && u <= dstHeight / 2; ++u) {
+      int64_t src = int64_t(u) * srcHeight;
+      if (0 == u % (1 << dstChromaShift) && 0 == src % dstHeight &&
+          0 == (src / dstHeight) % (1 << srcChromaShift)) {
+        unit = u;
+        break;
+      }
+    }
+    if (0 == bandHeight) {
+      bandHeight = (dstHeight + threads - 1) / threads;
+    }
+    if (unit > 0) {
+      bandHeight = std::max(unit, (bandHeight + unit / 2) / unit * unit);
+    }
+
+    if (0 == unit || bandHeight >= dstHeight) {
+      // One band for the whole thing, straight into the output
+      Band band;
+      band.dstHeight = dstHeight;
+      band.srcHeight = srcHeight;
+      band.context.reset(sws_getContext(srcWidth, srcHeight, srcFormat, dstWidth, dstHeight,
+                                        dstFormat, flags, nullptr, nullptr, nullptr));
+      if (!band.context) {
+        throw std::runtime_error("Could not create scaler context");
+      }
+      bandList.push_back(std::move(band));
+      return;
+    }
+
+    // Enough extra rows for the filter taps on either side, in output
+    // rows, and more if the chroma is subsampled
+    int taps = 2 + (2 * dstHeight + srcHeight - 1) / srcHeight;
+    int margin = (taps << std::max(srcChromaShift, dstChromaShift)) + 2;
+    margin = (margin + unit - 1) / unit * unit;
+
+    for (int y = 0; y < dstHeight; y += bandHeight) {
+      Band band;
+      band.dstY = y;
+      band.dstHeight = std::min(bandHeight, dstHeight - y);
+      int top = std::max(0, y - margin);
+      int bottom = std::min(dstHeight, y + band.dstHeight + margin);
+      band.top = y - top;
+      band.srcY = static_cast<int>(int64_t(top) * srcHeight / dstHeight);
+      band.srcHeight = static_cast<int>(int64_t(bottom) * srcHeight / dstHeight) - band.srcY;
+      band.context.reset(sws_getContext(srcWidth, band.srcHeight, srcFormat, dstWidth, bottom - top,
+                                        dstFormat, flags, nullptr, nullptr, nullptr));
+      if (!band.context) {
+        throw std::runtime_error("Could not create scaler context");
+      }
+      band.scratch = Frame::create(dstWidth, bottom - top, dstFormat);
+      if (nullptr == band.scratch->data[0]) {
+        throw std::runtime_error("Could not allocate scaler band");
+      }
+      bandList.push_back(std::move(band));
+    }
+
+    size_t nWorkers = std::min<size_t>(threads, bandList.size()) - 1;
+    for (size_t i = 0; i < nWorkers; ++i) {
+      workers.emplace_back([this]{ work(); });
+    }
+  }
+
+  SliceScaler::~SliceScaler() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  }
+
+  size_t SliceScaler::bands() const {
+    return bandList.size();
+  }
+
+  int SliceScaler::threads() const {
+    return static_cast<int>(workers.size()) + 1;
+  }
+
+  void SliceScaler::scale(const AVFrame* src, AVFrame* dst) {
+    if (1 == bandList.size()) {
+      if (!scaleBand(bandList[0], src, dst)) {
+        throw std::runtime_error("Could not scale frame");
+      }
+      return;
+    }
+    uint64_t current;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      source = src;
+      target = dst;
+      nextBand = 0;
+      remaining = bandList.size();
+      failed = false;
+      current = ++generation;
+    }
+    wake.notify_all();
+    runBands(current, src, dst);
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this]{ return 0 == remaining; });
+    if (failed) {
+      throw std::runtime_error("Could not scale frame");
+    }
+  }
+
+  void SliceScaler::work() {
+    uint64_t seen = 0;
+    while (true) {
+      const AVFrame* src;
+      AVFrame* dst;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this, seen]{ return stopping || generation != seen; });
+        if (stopping) {
+          return;
+        }
+        seen = generation;
+        src = source;
+        dst = target;
+      }
+      runBands(seen, src, dst);
+    }
+  }
+
+  void SliceScaler::runBands(uint64_t frame, const AVFrame* src, AVFrame* dst) {
+    while (true) {
+      size_t i;
+      {
+        // A thread that woke up late may still think it's on the last
+        // frame, so check that before taking a band
+        std::lock_guard<std::mutex> lock(mutex);
+        if (frame != generation || nextBand >= bandList.size()) {
+          return;
+        }
+        i = nextBand++;
+      }
+      bool ok = scaleBand(bandList[i], src, dst);
+      bool last;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        failed = failed || !ok;
+        last = 0 == --remaining;
+      }
+      if (last) {
+        finished.notify_all();
+      }
+    }
+  }
+
+  bool SliceScaler::scaleBand(Band& band, const AVFrame* src, AVFrame* dst) {
+    const uint8_t* srcData[4] = {nullptr, nullptr, nullptr, nullptr};
+    for (int p = 0; p < 4; ++p) {
+      if (nullptr != src->data[p]) {
+        srcData[p] = src->data[p] + int64_t(band.srcY >> planeShift(p, srcChromaShift)) * src->linesize[p];
+      }
+    }
+    AVFrame* out = band.scratch ? band.scratch.get() : dst;
+    int ret = sws_scale(band.context.get(), srcData, src->linesize, 0, band.srcHeight,
+                        out->data, out->linesize);
+    if (ret <= 0) {
+      return false;
+    }
+    if (!band.scratch) {
+      return true;
+    }
+    // Keep our rows and drop the margins
+    int planes = av_pix_fmt_count_planes(dstFormat);
+    for (int p = 0; p < planes; ++p) {
+      int shift = planeShift(p, dstChromaShift);
+      av_image_copy_plane(dst->data[p] + int64_t(band.dstY >> shift) * dst->linesize[p], dst->linesize[p],
+                          out->data[p] + int64_t(band.top >> shift) * out->linesize[p], out->linesize[p],
+                          av_image_get_linesize(dstFormat, dstWidth, p),
+                          planeRows(band.dstHeight, shift));
+    }
+    return true;
+  }
+
+}
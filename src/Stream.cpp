@@ -36,5 +36,9 @@ namespace fr {
     void Stream::forward(const Packet::pointer& packet) {
       packets(packet, data);
     }
+
+    void Stream::forward(StreamEvent event) {
+      events(event, data);
+    }
   }
 }
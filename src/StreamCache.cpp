@@ -20,70 +20,111 @@
 
 namespace fr::media2 {
 
-  StreamCache::StreamCache(long expSeconds, long cleanupFreq) : expSeconds(expSeconds), cleanupFreq(cleanupFreq) {
+  StreamCache::StreamCache(long expSeconds, long cleanupFreq, size_t nShards) :
+    expiry(expSeconds), cleanupFreq(cleanupFreq) {
+    size_t count = 1;
+    while (count < nShards) {
+      count <<= 1;
+    }
+    shardMask = count - 1;
+    for (size_t i = 0; i < count; ++i) {
+      shards.push_back(std::make_unique<Shard>());
+    }
     processingThread = std::thread([this]{this->expireEntries();});    
   }
 
   StreamCache::~StreamCache() {
-    shutdownFlag = true;
+    {
+      std::lock_guard<std::mutex> lock(shutdownMutex);
+      shutdownFlag = true;
+    }
+    shutdownCondition.notify_all();
     if (processingThread.joinable()) {
       processingThread.join();
     }
   }
 
+  StreamCache::Shard& StreamCache::shardFor(const UuidKey& key) {
+    // The low bits of the hash pick the bucket in the shard's map, so
+    // use the high ones here.
+    return *shards[(key.hash() >> 48) & shardMask];
+  }
+
+  void StreamCache::touch(Shard& shard, std::list<StreamCacheRecord>::iterator record) {
+    record->expires = std::chrono::steady_clock::now() + expiry;
+    shard.records.splice(shard.records.end(), shard.records, record);
+  }
+
   Stream::pointer StreamCache::get(Segment* seg) {
-    // TODO: Throw together a utils and set up uuid_to_str in it.
-    char uuidStr[40];
-    memset(uuidStr, '\0', sizeof(uuidStr));
-    uuid_unparse(seg->jobId, uuidStr);
-    std::string idStr{uuidStr};
+    bool created = false;
+    return get(seg, created);
+  }
 
-    std::lock_guard<std::mutex> lock(cacheMutex);
-    if (cache.contains(idStr)) {
-      // Refresh expiry
-      cache.at(idStr)->expires = std::chrono::system_clock::now() +
-	std::chrono::system_clock::duration(expSeconds);
-      return cache.at(idStr)->stream;
-    } else {
-      auto rec = std::make_shared<StreamCacheRecord>();
-      rec->stream = std::make_shared<Stream>(seg);
-      rec->expires = std::chrono::system_clock::now() + std::chrono::system_clock::duration(expSeconds);
-      cache[idStr] = rec;
-      return rec->stream;
+  Stream::pointer StreamCache::get(Segment* seg, bool& created) {
+    UuidKey key(seg->jobId);
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(key);
+    if (found != shard.index.end()) {
+      created = false;
+      touch(shard, found->second);
+      return found->second->stream;
     }
+    StreamCacheRecord rec;
+    rec.jobId = key;
+    rec.stream = std::make_shared<Stream>(seg);
+    rec.expires = std::chrono::steady_clock::now() + expiry;
+    shard.records.push_back(std::move(rec));
+    shard.index.emplace(key, std::prev(shard.records.end()));
+    created = true;
+    return shard.records.back().stream;
   }
 
   // jobId version of get returns a nullptr if we get a cache miss
   Stream::pointer StreamCache::get(uuid_t jobId) {
-    char uuidStr[40];
-    memset(uuidStr, '\0', sizeof(uuidStr));
-    uuid_unparse(jobId, uuidStr);
-    std::string idStr{uuidStr};
-    Stream::pointer ret;
+    UuidKey key(jobId);
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(key);
+    if (found == shard.index.end()) {
+      return Stream::pointer{};
+    }
+    touch(shard, found->second);
+    return found->second->stream;
+  }
 
-    std::lock_guard<std::mutex> lock(cacheMutex);
-    if (cache.contains(idStr)) {
-      cache.at(idStr)->expires = std::chrono::system_clock::now() +
-	std::chrono::system_clock::duration(expSeconds);
-      ret = cache.at(idStr)->stream;
+  size_t StreamCache::size() {
+    size_t total = 0;
+    for (auto& shard : shards) {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      total += shard->records.size();
     }
-    return ret;
+    return total;
   }
 
   void StreamCache::expireEntries() {
-    while(!shutdownFlag) {
+    while (true) {
       {
-	std::lock_guard<std::mutex> lock(cacheMutex);
-	for (const auto& [key, value] : cache) {
-	  if (shutdownFlag) {
-	    return;
-	  }
-	  if (std::chrono::system_clock::now() > value->expires) {
-	    cache.erase(key);
+	std::unique_lock<std::mutex> lock(shutdownMutex);
+	if (shutdownCondition.wait_for(lock, cleanupFreq, [this]{ return shutdownFlag; })) {
+	  return;
 	}
+      }
+      for (auto& shard : shards) {
+	// Streams are released after the lock is dropped, in case
+	// somebody's destructor takes a while
+	std::list<StreamCacheRecord> expired;
+	{
+	  std::lock_guard<std::mutex> lock(shard->mutex);
+	  auto now = std::chrono::steady_clock::now();
+	  auto end = shard->records.begin();
+	  while (end != shard->records.end() && end->expires < now) {
+	    shard->index.erase(end->jobId);
+	    ++end;
+	  }
+	  expired.splice(expired.end(), shard->records, shard->records.begin(), end);
 	}
       }
-      std::this_thread::sleep_for(std::chrono::seconds(cleanupFreq));
     }
   }
   
@@ -58,6 +58,34 @@ namespace fr {
       // This is fine...
     }
 
+    bool StreamData::openDecoder(const DecoderConfig& config) {
+      if (nullptr == codec) {
+	codec = (AVCodec*) avcodec_find_decoder(parameters->codec_id);
+	if (nullptr == codec) {
+	  return false;
+	}
+      }
+      if (nullptr == context.get() || avcodec_is_open(context.get())) {
+	AVCodecContext *ctx = avcodec_alloc_context3(codec);
+	if (nullptr == ctx) {
+	  return false;
+	}
+	ctx->time_base = time_base;
+	avcodec_parameters_to_context(ctx, parameters);
+	setContext(&ctx);
+      }
+      config.apply(context.get());
+      return avcodec_open2(context.get(), codec, nullptr) >= 0;
+    }
+
+    int StreamData::decoderDelay() const {
+      if (nullptr == context.get() || !avcodec_is_open(context.get()) ||
+	  !(context->active_thread_type & FF_THREAD_FRAME)) {
+	return 0;
+      }
+      return context->thread_count > 1 ? context->thread_count - 1 : 0;
+    }
+
   }
 }
 
@@ -19,6 +19,7 @@
 #include <fr/media2/ZmqSegmentPublisher.h>
 #include <zmq.h>
 #include <zmq_addon.hpp>
+#include <cstring>
 #include <sstream>
 
 namespace fr::media2 {
@@ -36,9 +37,7 @@ namespace fr::media2 {
   ZmqSegmentPublisher::~ZmqSegmentPublisher() {}
 
   void ZmqSegmentPublisher::process(const Segment::pointer& segment, StreamData::pointer stream) {
-    std::stringstream buffer;
-    boost::archive::binary_oarchive ar(buffer);
-    ar << *segment;
+    SegmentWire::encodeHeader(*segment, headerBlock);
     zmq::multipart_t multimessage;
     if (uuid_is_null(jobId)) {
       multimessage.addmem(segment->jobId, sizeof(uuid_t));
@@ -48,7 +47,10 @@ namespace fr::media2 {
     multimessage.addmem(&stream->mediaType, sizeof(AVMediaType));
     multimessage.addmem(&stream->parameters->width, sizeof(int));
     multimessage.addmem(&stream->parameters->height, sizeof(int));
-    multimessage.addstr(buffer.str());
+    multimessage.addmem(headerBlock.data(), headerBlock.size());
+    for (const Packet::pointer& packet : segment->packets) {
+      multimessage.add(payloadMessage(*packet));
+    }
     multimessage.send(publisher);
   }
 
@@ -62,5 +64,29 @@ namespace fr::media2 {
     multimessage.send(publisher);
   }
 
-  
+  zmq::message_t ZmqSegmentPublisher::payloadMessage(const AVPacket& packet) {
+    size_t wireSize = SegmentWire::payloadSize(packet);
+    // The padding after the packet data goes out with it, so only send
+    // straight out of the buffer if the padding is in there too.
+    if (nullptr != packet.buf && packet.data >= packet.buf->data &&
+        packet.data + wireSize <= packet.buf->data + packet.buf->size) {
+      AVBufferRef* ref = av_buffer_ref(packet.buf);
+      if (nullptr != ref) {
+        return zmq::message_t(packet.data, wireSize, &ZmqSegmentPublisher::releaseBuffer, ref);
+      }
+    }
+    zmq::message_t copy(wireSize);
+    uint8_t* data = static_cast<uint8_t*>(copy.data());
+    if (packet.size > 0) {
+      memcpy(data, packet.data, packet.size);
+    }
+    memset(data + packet.size, 0, wireSize - packet.size);
+    return copy;
+  }
+
+  void ZmqSegmentPublisher::releaseBuffer(void* /* data */, void* hint) {
+    AVBufferRef* ref = static_cast<AVBufferRef*>(hint);
+    av_buffer_unref(&ref);
+  }
+
 }
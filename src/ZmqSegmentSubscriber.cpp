@@ -16,6 +16,8 @@
  */
 
 #include <fr/media2/ZmqSegmentSubscriber.h>
+#include <fr/media2/SegmentWire.h>
+#include <iostream>
 
 namespace fr::media2 {
 
@@ -48,28 +50,79 @@ namespace fr::media2 {
     zmq::active_poller_t poller;
     
     poller.add(socket, zmq::event_flags::pollin, [this](zmq::event_flags flags) {
-      std::stringstream buffer;
       zmq::multipart_t multimsg;
       uuid_t jobId;
       AVMediaType mt;
       int width;
       int height;
       multimsg.recv(socket);
+      if (multimsg.size() < 5) {
+        std::cerr << "Ignoring segment message with " << multimsg.size() << " frames" << std::endl;
+        return;
+      }
       auto msgiter = multimsg.begin();
       zmq::message_t& uuidMsg = *msgiter++;
       zmq::message_t& mediaTypemessage = *msgiter++;
       zmq::message_t& widthMsg = *msgiter++;
       zmq::message_t& heightMsg = *msgiter++;
-      zmq::message_t& bufferMsg = *msgiter;
-      
-      char idMsgStr[40];
-      memcpy(jobId, uuidMsg.data(), uuidMsg.size());
-      uuid_unparse(jobId, idMsgStr);
-      memcpy(&mt, mediaTypemessage.data(), mediaTypemessage.size());
-      memcpy(&width, widthMsg.data(), widthMsg.size());
-      memcpy(&height, heightMsg.data(), heightMsg.size());
-      buffer << bufferMsg.to_string();
-      this->receivedSegment(buffer, jobId, mt, width, height);
+      zmq::message_t& bufferMsg = *msgiter++;
+
+      memcpy(jobId, uuidMsg.data(), sizeof(uuid_t));
+      memcpy(&mt, mediaTypemessage.data(), sizeof(AVMediaType));
+      memcpy(&width, widthMsg.data(), sizeof(int));
+      memcpy(&height, heightMsg.data(), sizeof(int));
+
+      if (!this->receivedSegment.empty()) {
+        // Frames concatenated together are the contiguous layout
+        std::stringstream buffer;
+        for (auto part = multimsg.begin() + 4; part != multimsg.end(); ++part) {
+          buffer.write(part->data<char>(), part->size());
+        }
+        this->receivedSegment(buffer, jobId, mt, width, height);
+      }
+
+      if (!this->segments.empty()) {
+        try {
+          Segment::pointer segment;
+          const uint8_t* headerBlock = bufferMsg.data<uint8_t>();
+          if (SegmentWire::isWireFormat(headerBlock, bufferMsg.size()) && msgiter == multimsg.end()) {
+            // Nothing after the header, so it's the contiguous layout
+            // (a receivedSegment buffer being sent on, say)
+            AVBufferRef* buffer = wrap(std::move(bufferMsg));
+            try {
+              segment = SegmentWire::decode(buffer);
+            } catch (...) {
+              av_buffer_unref(&buffer);
+              throw;
+            }
+            av_buffer_unref(&buffer);
+          } else if (SegmentWire::isWireFormat(headerBlock, bufferMsg.size())) {
+            std::vector<AVBufferRef*> payloads;
+            payloads.reserve(multimsg.size() - 5);
+            try {
+              for (; msgiter != multimsg.end(); ++msgiter) {
+                payloads.push_back(wrap(std::move(*msgiter)));
+              }
+            } catch (...) {
+              for (AVBufferRef*& payload : payloads) {
+                av_buffer_unref(&payload);
+              }
+              throw;
+            }
+            segment = SegmentWire::decode(headerBlock, bufferMsg.size(), payloads);
+          } else {
+            // Somebody sent us a boost serialized segment
+            std::stringstream buffer;
+            buffer.write(bufferMsg.data<char>(), bufferMsg.size());
+            segment = std::make_unique<Segment>();
+            boost::archive::binary_iarchive ar(buffer);
+            ar >> *segment;
+          }
+          this->segments(segment, jobId, mt, width, height);
+        } catch (std::exception &e) {
+          std::cerr << "Error decoding segment: " << e.what() << std::endl;
+        }
+      }
     });
     // This can be fairly long as we only want to pull the message off the
     // transport and dispatch it to listeners. The only reason to make it
@@ -83,5 +136,20 @@ namespace fr::media2 {
       auto nsocks = poller.wait(timeout);
     }
   }
+
+  AVBufferRef* ZmqSegmentSubscriber::wrap(zmq::message_t&& message) {
+    auto held = new zmq::message_t(std::move(message));
+    AVBufferRef* ref = av_buffer_create(held->data<uint8_t>(), held->size(),
+                                        &ZmqSegmentSubscriber::releaseMessage, held, 0);
+    if (nullptr == ref) {
+      delete held;
+      throw std::runtime_error("Could not wrap segment message");
+    }
+    return ref;
+  }
+
+  void ZmqSegmentSubscriber::releaseMessage(void* opaque, uint8_t* /* data */) {
+    delete static_cast<zmq::message_t*>(opaque);
+  }
   
 }
@@ -0,0 +1,186 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <fr/media2/AsyncPacketSubscriber.h>
+#include <fr/media2/BackpressureQueue.h>
+#include <fr/media2/Packet.h>
+#include <fr/media2/PacketSubscriber.h>
+#include <fr/media2/Stream.h>
+#include <thread>
+#include <vector>
+
+using namespace fr::media2;
+
+// Fills a queue of 4 with items 0-3, item 0 being a keyframe, then
+// pushes 4 (a keyframe if key4 is set) and 5 (not a keyframe) without
+// anything taking them out. Returns what's left in the queue.
+static std::vector<int> overfill(Backpressure policy, bool key4, BackpressureStats& stats) {
+  BackpressureQueue<int> queue(4, policy);
+  for (int i = 0; i < 4; ++i) {
+    queue.push(i, 0 == i, 0);
+  }
+  queue.push(4, key4, 0);
+  queue.push(5, false, 0);
+  stats = queue.stats();
+  queue.close();
+  std::vector<int> ret;
+  int item;
+  while (queue.pop(item)) {
+    ret.push_back(item);
+    queue.done();
+  }
+  return ret;
+}
+
+TEST(BackpressureQueueTest, dropOldest) {
+  BackpressureStats stats;
+  ASSERT_EQ((std::vector<int>{2, 3, 4, 5}), overfill(Backpressure::dropOldest, false, stats));
+  ASSERT_EQ(2, stats.dropped);
+  ASSERT_EQ(4, stats.peakDepth);
+}
+
+TEST(BackpressureQueueTest, dropNonKey) {
+  BackpressureStats stats;
+  // The keyframe at the front survives
+  ASSERT_EQ((std::vector<int>{0, 3, 4, 5}), overfill(Backpressure::dropNonKey, false, stats));
+  ASSERT_EQ(2, stats.dropped);
+}
+
+TEST(BackpressureQueueTest, dropUntilKeyframe) {
+  BackpressureStats stats;
+  // 4 gets dropped for lack of room, so 5 has to go too, even though
+  // there'd be room for it if something took 0 out first
+  ASSERT_EQ((std::vector<int>{0, 1, 2, 3}), overfill(Backpressure::dropUntilKeyframe, false, stats));
+  ASSERT_EQ(2, stats.dropped);
+
+  BackpressureQueue<int> queue(2, Backpressure::dropUntilKeyframe);
+  queue.push(0, true, 0);
+  queue.push(1, false, 0);
+  ASSERT_FALSE(queue.push(2, false, 0));
+  // Other sources aren't affected once there's room
+  int item;
+  queue.pop(item);
+  queue.done();
+  ASSERT_TRUE(queue.push(10, false, 1));
+  queue.pop(item);
+  queue.done();
+  ASSERT_FALSE(queue.push(3, false, 0));
+  ASSERT_TRUE(queue.push(4, true, 0));
+  queue.pop(item);
+  queue.done();
+  ASSERT_TRUE(queue.push(5, false, 0));
+}
+
+TEST(BackpressureQueueTest, block) {
+  BackpressureQueue<int> queue(2, Backpressure::block);
+  queue.push(0, true, 0);
+  queue.push(1, false, 0);
+  std::atomic<bool> pushed = false;
+  std::thread producer([&] {
+    queue.push(2, false, 0);
+    pushed = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_FALSE(pushed);
+  int item;
+  queue.pop(item);
+  queue.done();
+  producer.join();
+  ASSERT_TRUE(pushed);
+  auto stats = queue.stats();
+  ASSERT_EQ(0, stats.dropped);
+  ASSERT_EQ(2, stats.depth);
+  ASSERT_GT(stats.producerStall.count(), 0);
+}
+
+// Counts packets, slowly
+
+class SlowSubscriber : public PacketSubscriber {
+public:
+  std::atomic<int> packets = 0;
+  std::thread::id thread;
+
+protected:
+  void process(const Packet::pointer& packet, const StreamData::pointer& stream) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    thread = std::this_thread::get_id();
+    packets++;
+  }
+};
+
+// The source shouldn't have to wait for a slow subscriber, which gets
+// its packets in another thread
+
+TEST(AsyncPacketSubscriberTest, decouples) {
+  auto source = std::make_shared<Stream>();
+  source->data = std::make_shared<StreamData>("async");
+  SlowSubscriber slow;
+  AsyncPacketSubscriber async(source, slow, 100);
+
+  auto packet = Packet::create();
+  packet->flags = AV_PKT_FLAG_KEY;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < 50; ++i) {
+    source->forward(packet);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  ASSERT_LT(elapsed, std::chrono::milliseconds(50));
+  async.flush();
+  ASSERT_EQ(50, slow.packets);
+  ASSERT_NE(std::this_thread::get_id(), slow.thread);
+  ASSERT_EQ(50, async.stats().delivered);
+}
+
+// Stream events go through the queue, so they come out after the
+// packets that were sent before them
+
+class EventSubscriber : public PacketSubscriber {
+public:
+  int packets = 0;
+  int packetsAtEnd = -1;
+
+protected:
+  void process(const Packet::pointer& packet, const StreamData::pointer& stream) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    packets++;
+  }
+
+  void streamEvent(StreamEvent event, const StreamData::pointer& stream) override {
+    if (StreamEvent::endOfStream == event) {
+      packetsAtEnd = packets;
+    }
+  }
+};
+
+TEST(AsyncPacketSubscriberTest, eventsInOrder) {
+  auto source = std::make_shared<Stream>();
+  source->data = std::make_shared<StreamData>("async");
+  EventSubscriber subscriber;
+  AsyncPacketSubscriber async(source, subscriber, 100);
+
+  auto packet = Packet::create();
+  packet->flags = AV_PKT_FLAG_KEY;
+  for (int i = 0; i < 20; ++i) {
+    source->forward(packet);
+  }
+  source->forward(StreamEvent::endOfStream);
+  async.flush();
+  ASSERT_EQ(20, subscriber.packetsAtEnd);
+}
@@ -22,13 +22,16 @@
 #include <gtest/gtest.h>
 #include <chrono>
 #include <fr/media2/Decoder.h>
+#include <fr/media2/DecoderConfig.h>
 #include <fr/media2/PacketReader.h>
 #include <fr/media2/PacketSubscriber.h>
 #include <fr/media2/FrameSubscriber.h>
 #include <memory>
 #include <vector>
+#include "TestHelpers.h"
 
 using namespace fr::media2;
+using namespace fr::media2::test;
 
 class DecoderTest : public ::testing::Test {
 
@@ -46,7 +49,7 @@ public:
 
 class FrameProcessor : public FrameSubscriber {
 protected:
-  void process(Frame::const_pointer frame, StreamData::pointer stream) override {
+  void process(Frame::const_pointer frame, const StreamData::pointer& stream) override {
     nframes++;
   }
   
@@ -72,3 +75,77 @@ TEST_F(DecoderTest, decodeFrames) {
     ASSERT_GT(processor->nframes, 0);
   }
 }
+
+// Counts the video frames decoded with config
+static long countVideoFrames(const DecoderConfig& config, int* delay = nullptr) {
+  PacketReader reader(TEST_FILE, config);
+  EXPECT_GT(reader.videoStreams.size(), 0);
+  if (reader.videoStreams.empty()) {
+    return 0;
+  }
+  if (nullptr != delay) {
+    *delay = reader.videoStreams[0]->data->decoderDelay();
+  }
+  Decoder decoder;
+  FrameProcessor processor;
+  decoder.subscribe(reader.videoStreams[0]);
+  processor.subscribe(&decoder);
+  reader.sendEvent(PacketReaderStateMachine::play{});
+  reader.join();
+  return processor.nframes;
+}
+
+TEST(DecoderConfig, threading) {
+  // Nobody gets frame threading unless they ask for it
+  int defaultDelay = -1;
+  long defaultFrames = countVideoFrames(DecoderConfig{}, &defaultDelay);
+  ASSERT_EQ(0, defaultDelay);
+  ASSERT_FALSE(DecoderConfig{}.frameThreads);
+  ASSERT_TRUE(DecoderConfig::frameThreaded().frameThreads);
+
+  DecoderConfig frameThreaded = DecoderConfig::frameThreaded();
+  frameThreaded.threads = 4;
+  frameThreaded.sliceThreads = false;
+  int delay = -1;
+  long frames = countVideoFrames(frameThreaded, &delay);
+  ASSERT_EQ(3, delay);
+
+  int lowDelay = -1;
+  long lowLatencyFrames = countVideoFrames(DecoderConfig::lowLatency(), &lowDelay);
+  ASSERT_EQ(0, lowDelay);
+  ASSERT_GT(lowLatencyFrames, 0);
+  // The decoder gets drained at the end of the stream, so the frames
+  // it was sitting on still come out
+  ASSERT_EQ(lowLatencyFrames, frames);
+  ASSERT_EQ(countVideoFrames(DecoderConfig::singleThreaded()), frames);
+  ASSERT_EQ(defaultFrames, frames);
+}
+
+TEST(DecoderConfig, preview) {
+  long full = countVideoFrames(DecoderConfig::lowLatency());
+  long preview = countVideoFrames(DecoderConfig::preview());
+  ASSERT_GT(preview, 0);
+  ASSERT_LE(preview, full);
+}
+
+// Streams made from segments don't have an open decoder until a
+// Decoder subscribes to them
+
+TEST(DecoderConfig, segmentStream) {
+  auto segments = videoSegments();
+  ASSERT_GT(segments.size(), 0);
+
+  auto stream = std::make_shared<Stream>(segments[0].get());
+  ASSERT_FALSE(avcodec_is_open(stream->data->context.get()));
+  Decoder decoder(DecoderConfig::lowLatency());
+  FrameProcessor processor;
+  decoder.subscribe(stream);
+  processor.subscribe(&decoder);
+  ASSERT_TRUE(avcodec_is_open(stream->data->context.get()));
+  for (auto& segment : segments) {
+    for (auto& packet : segment->packets) {
+      stream->forward(packet);
+    }
+  }
+  ASSERT_GT(processor.nframes, 0);
+}
@@ -0,0 +1,152 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Tests Frame2Mat. The mats should have the right picture in them, and
+ * the zero copy ones should keep their frame buffers out of the pool
+ * until the last mat using them is gone.
+ */
+
+#include <gtest/gtest.h>
+#include <cstring>
+#include <fr/media2/Frame.h>
+#include <fr/media2/Frame2Mat.h>
+#include <fr/media2/FramePool.h>
+#include <fr/media2/FrameSource.h>
+#include <vector>
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+using namespace fr::media2;
+
+static Frame::pointer picture(int seed) {
+  auto frame = Frame::create(640, 360, AV_PIX_FMT_YUVJ420P);
+  for (int p = 0; p < 3; ++p) {
+    int rows = p ? 180 : 360;
+    int width = p ? 320 : 640;
+    for (int y = 0; y < rows; ++y) {
+      for (int x = 0; x < width; ++x) {
+        frame->data[p][y * frame->linesize[p] + x] = static_cast<uint8_t>(x + y * 3 + seed * 17 + p * 50);
+      }
+    }
+  }
+  return frame;
+}
+
+// Same thing Frame2Mat's scaler does
+static Frame::pointer toBgr(const Frame::pointer& frame) {
+  auto bgr = Frame::create(frame->width, frame->height, AV_PIX_FMT_BGR24);
+  SwsContext* sws = sws_getContext(frame->width, frame->height, (AVPixelFormat) frame->format,
+                                   frame->width, frame->height, AV_PIX_FMT_BGR24, SWS_BICUBIC,
+                                   nullptr, nullptr, nullptr);
+  sws_scale(sws, frame->data, frame->linesize, 0, frame->height, bgr->data, bgr->linesize);
+  sws_freeContext(sws);
+  return bgr;
+}
+
+// What the mat for a frame ought to look like
+static bool matches(const cv::Mat& mat, const Frame::pointer& frame) {
+  auto bgr = toBgr(frame);
+  if (mat.rows != frame->height || mat.cols != frame->width || mat.type() != CV_8UC3) {
+    return false;
+  }
+  for (int y = 0; y < mat.rows; ++y) {
+    if (0 != memcmp(mat.ptr<uint8_t>(y), bgr->data[0] + y * bgr->linesize[0], mat.cols * 3)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+class Frame2MatTest : public ::testing::Test {
+public:
+  FrameSource source;
+  std::vector<cv::Mat> mats;
+  std::vector<Frame::pointer> frames;
+
+  void run(Frame2Mat& converter, int n) {
+    converter.subscribe(&source);
+    auto connection = converter.mats.connect([this](cv::Mat mat) { mats.push_back(mat); });
+    for (int i = 0; i < n; ++i) {
+      frames.push_back(picture(i));
+      source.frames(frames.back(), nullptr);
+    }
+    connection.disconnect();
+  }
+};
+
+TEST_F(Frame2MatTest, zeroCopy) {
+  Frame2Mat converter;
+  FramePool::instance().resetStats();
+  run(converter, 5);
+  ASSERT_EQ(5, mats.size());
+  // Every mat kept its own buffer, so none of them got overwritten
+  for (size_t i = 0; i < mats.size(); ++i) {
+    ASSERT_TRUE(matches(mats[i], frames[i])) << "mat " << i;
+    for (size_t j = i + 1; j < mats.size(); ++j) {
+      ASSERT_NE(mats[i].data, mats[j].data);
+    }
+  }
+  // Copies share the buffer and keep it alive after the original goes
+  cv::Mat copy = mats[0];
+  uint8_t* data = mats[0].data;
+  mats.clear();
+  ASSERT_EQ(data, copy.data);
+  ASSERT_TRUE(matches(copy, frames[0]));
+}
+
+TEST_F(Frame2MatTest, buffersGoBack) {
+  Frame2Mat converter;
+  converter.subscribe(&source);
+  auto first = picture(0);
+  // Warm the pool up
+  source.frames(first, nullptr);
+  FramePool::instance().resetStats();
+  size_t count = 0;
+  auto connection = converter.mats.connect([&count](cv::Mat mat) { count++; });
+  for (int i = 0; i < 10; ++i) {
+    source.frames(first, nullptr);
+  }
+  connection.disconnect();
+  ASSERT_EQ(10, count);
+  // Nobody kept a mat, so the same buffer kept coming back
+  ASSERT_EQ(0, FramePool::instance().stats().misses);
+}
+
+TEST_F(Frame2MatTest, copy) {
+  Frame2Mat converter(false);
+  run(converter, 3);
+  ASSERT_EQ(3, mats.size());
+  for (size_t i = 0; i < mats.size(); ++i) {
+    ASSERT_TRUE(matches(mats[i], frames[i]));
+    ASSERT_TRUE(mats[i].isContinuous());
+  }
+}
+
+// Frames that are already BGR aren't ours, so they get copied
+TEST_F(Frame2MatTest, bgrInput) {
+  Frame2Mat converter;
+  converter.subscribe(&source);
+  auto yuv = picture(1);
+  auto bgr = toBgr(yuv);
+  auto connection = converter.mats.connect([this](cv::Mat mat) { mats.push_back(mat); });
+  source.frames(bgr, nullptr);
+  connection.disconnect();
+  ASSERT_EQ(1, mats.size());
+  ASSERT_NE(bgr->data[0], mats[0].data);
+  ASSERT_TRUE(matches(mats[0], yuv));
+}
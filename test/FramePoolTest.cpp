@@ -0,0 +1,208 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Tests the frame pool. Buffers should come back and get reused,
+ * different shapes of frames shouldn't share buffers, and decoding
+ * through the pool should give the same frames as decoding without it.
+ */
+
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <cstring>
+#include <fr/media2/Decoder.h>
+#include <fr/media2/DecoderConfig.h>
+#include <fr/media2/Frame.h>
+#include <fr/media2/FramePool.h>
+#include <fr/media2/FrameSubscriber.h>
+#include <fr/media2/PacketReader.h>
+#include <fr/media2/Scaler.h>
+#include <vector>
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+}
+
+using namespace fr::media2;
+
+TEST(FramePoolTest, reuse) {
+  FramePool& pool = FramePool::instance();
+  pool.resetStats();
+  for (int i = 0; i < 10; ++i) {
+    auto frame = Frame::create(640, 360, AV_PIX_FMT_YUV420P);
+    ASSERT_NE(nullptr, frame->data[0]);
+    ASSERT_NE(nullptr, frame->buf[0]);
+  }
+  auto stats = pool.stats();
+  // One allocation, then the same buffer over and over
+  ASSERT_EQ(1, stats.misses);
+  ASSERT_EQ(9, stats.hits);
+  ASSERT_EQ(0, stats.fallbacks);
+}
+
+TEST(FramePoolTest, shapes) {
+  FramePool& pool = FramePool::instance();
+  pool.resetStats();
+  auto small = Frame::create(320, 180, AV_PIX_FMT_YUV420P);
+  auto big = Frame::create(1280, 720, AV_PIX_FMT_YUV420P);
+  auto rgb = Frame::create(320, 180, AV_PIX_FMT_RGB24);
+  ASSERT_EQ(3, pool.stats().misses);
+  ASSERT_NE(small->buf[0]->data, big->buf[0]->data);
+  ASSERT_NE(small->buf[0]->data, rgb->buf[0]->data);
+  // Every plane is aligned and the image is writable
+  for (auto* frame : {small.get(), big.get(), rgb.get()}) {
+    for (int i = 0; i < 4 && frame->data[i]; ++i) {
+      ASSERT_EQ(0, reinterpret_cast<uintptr_t>(frame->data[i]) % 32);
+      ASSERT_EQ(0, frame->linesize[i] % 32);
+    }
+    ASSERT_GE(av_frame_make_writable(frame), 0);
+  }
+  memset(big->data[0], 0xff, big->linesize[0] * big->height);
+}
+
+// Lots of different shapes don't pile up pools forever, and frames
+// from a pool that got dropped are still fine
+
+TEST(FramePoolTest, bounded) {
+  FramePool& pool = FramePool::instance();
+  size_t maxPools = pool.getMaxPools();
+  pool.setMaxPools(8);
+  auto held = Frame::create(64, 64, AV_PIX_FMT_YUV420P);
+  memset(held->data[0], 0x7f, held->linesize[0] * held->height);
+  for (int i = 0; i < 200; ++i) {
+    auto video = Frame::create(64 + 2 * i, 64, AV_PIX_FMT_YUV420P);
+    ASSERT_NE(nullptr, video->buf[0]);
+    auto audio = Frame::create(AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_FLTP, 48000, 32 + i, 0);
+    ASSERT_NE(nullptr, audio->buf[0]);
+    ASSERT_LE(pool.stats().pools, 8);
+  }
+  ASSERT_EQ(0x7f, held->data[0][0]);
+  held.reset();
+  pool.setMaxPools(2);
+  ASSERT_LE(pool.stats().pools, 2);
+  pool.setMaxPools(maxPools);
+}
+
+// A clone keeps the buffer out of the pool until it's gone too
+
+TEST(FramePoolTest, clone) {
+  FramePool& pool = FramePool::instance();
+  auto frame = Frame::create(1920, 1080, AV_PIX_FMT_YUV420P);
+  pool.resetStats();
+  auto copy = Frame::clone(frame);
+  ASSERT_EQ(frame->data[0], copy->data[0]);
+  frame.reset();
+  auto other = Frame::create(1920, 1080, AV_PIX_FMT_YUV420P);
+  ASSERT_NE(copy->data[0], other->data[0]);
+  ASSERT_EQ(1, pool.stats().misses);
+}
+
+TEST(FramePoolTest, audio) {
+  FramePool& pool = FramePool::instance();
+  pool.resetStats();
+  for (int i = 0; i < 5; ++i) {
+    auto frame = Frame::create(AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_FLTP, 48000, 1024, 0);
+    ASSERT_NE(nullptr, frame->data[0]);
+    ASSERT_NE(nullptr, frame->data[1]);
+    ASSERT_EQ(1024, frame->nb_samples);
+    ASSERT_EQ(2, frame->channels);
+  }
+  auto stats = pool.stats();
+  ASSERT_EQ(1, stats.misses);
+  ASSERT_EQ(4, stats.hits);
+}
+
+class FrameCollector : public FrameSubscriber {
+public:
+  std::vector<Frame::pointer> frames;
+  long nframes = 0;
+  // Only hang on to the first few, or we'd never give anything back
+  size_t keep = 0;
+
+protected:
+  void process(Frame::const_pointer frame, const StreamData::pointer& stream) override {
+    nframes++;
+    if (frames.size() < keep) {
+      frames.push_back(Frame::clone(frame));
+    }
+  }
+};
+
+static long decodeVideo(const DecoderConfig& config, FrameCollector& collector) {
+  PacketReader reader(TEST_FILE, config);
+  if (reader.videoStreams.empty()) {
+    return 0;
+  }
+  Decoder decoder;
+  decoder.subscribe(reader.videoStreams[0]);
+  collector.subscribe(&decoder);
+  reader.sendEvent(PacketReaderStateMachine::play{});
+  reader.join();
+  return collector.nframes;
+}
+
+TEST(FramePoolTest, decode) {
+  DecoderConfig plain;
+  plain.pooledFrames = false;
+  FrameCollector expected;
+  expected.keep = 3;
+  long nframes = decodeVideo(plain, expected);
+  ASSERT_GT(nframes, 0);
+
+  FramePool& pool = FramePool::instance();
+  pool.resetStats();
+  FrameCollector pooled;
+  pooled.keep = 3;
+  ASSERT_EQ(nframes, decodeVideo(DecoderConfig{}, pooled));
+  auto stats = pool.stats();
+  ASSERT_GT(stats.hits + stats.misses + stats.fallbacks, 0);
+
+  // Same pictures either way
+  ASSERT_EQ(expected.frames.size(), pooled.frames.size());
+  for (size_t i = 0; i < pooled.frames.size(); ++i) {
+    const AVFrame* a = expected.frames[i].get();
+    const AVFrame* b = pooled.frames[i].get();
+    ASSERT_EQ(a->width, b->width);
+    ASSERT_EQ(a->height, b->height);
+    for (int y = 0; y < a->height; ++y) {
+      ASSERT_EQ(0, memcmp(a->data[0] + y * a->linesize[0], b->data[0] + y * b->linesize[0], a->width));
+    }
+  }
+}
+
+// Scaler frames are all new, so ones a subscriber kept don't get
+// overwritten by the next frame
+
+TEST(FramePoolTest, scalerFrames) {
+  PacketReader reader(TEST_FILE);
+  ASSERT_GT(reader.videoStreams.size(), 0);
+  Decoder decoder;
+  decoder.subscribe(reader.videoStreams[0]);
+  Scaler scaler(160, 90, AV_PIX_FMT_YUV420P);
+  scaler.subscribe(&decoder);
+  std::vector<Frame::pointer> frames;
+  auto connection = scaler.frames.connect([&frames](Frame::const_pointer frame, const StreamData::pointer&) {
+    if (frames.size() < 2) {
+      frames.push_back(Frame::clone(frame));
+    }
+  });
+  reader.sendEvent(PacketReaderStateMachine::play{});
+  reader.join();
+  connection.disconnect();
+  ASSERT_EQ(2, frames.size());
+  ASSERT_NE(frames[0]->data[0], frames[1]->data[0]);
+  ASSERT_EQ(160, frames[0]->width);
+  ASSERT_EQ(90, frames[0]->height);
+}
@@ -0,0 +1,177 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Demux the test video from memory, a mapping and a pipe, and make sure
+ * it comes out the same as reading the file.
+ */
+
+#include <fr/media2.h>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "TestHelpers.h"
+
+using namespace fr::media2;
+using namespace fr::media2::test;
+
+namespace {
+
+  std::shared_ptr<std::vector<uint8_t>> loadFile() {
+    std::ifstream in(TEST_FILE, std::ios::binary);
+    return std::make_shared<std::vector<uint8_t>>(std::istreambuf_iterator<char>(in),
+                                                  std::istreambuf_iterator<char>());
+  }
+
+}
+
+TEST(IOSource, memoryReadAndSeek) {
+  std::vector<uint8_t> data{1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+  MemorySource source(data);
+  uint8_t buffer[4];
+  ASSERT_EQ(4, source.read(buffer, 4));
+  ASSERT_EQ(1, buffer[0]);
+  ASSERT_EQ(10, source.seek(0, AVSEEK_SIZE));
+  ASSERT_EQ(8, source.seek(-2, SEEK_END));
+  ASSERT_EQ(2, source.read(buffer, 4));
+  ASSERT_EQ(9, buffer[0]);
+  ASSERT_EQ(AVERROR_EOF, source.read(buffer, 4));
+  ASSERT_EQ(3, source.seek(-7, SEEK_CUR));
+  ASSERT_EQ(4, source.read(buffer, 1));
+  // Can't go past either end
+  ASSERT_LT(source.seek(11, SEEK_SET), 0);
+  ASSERT_LT(source.seek(-1, SEEK_SET), 0);
+}
+
+TEST(IOSource, memory) {
+  PacketReader file(TEST_FILE);
+  auto expected = readDts(file);
+  auto data = loadFile();
+  ASSERT_FALSE(data->empty());
+  auto source = std::make_shared<MemorySource>(*data, data);
+  PacketReader reader(source);
+  ASSERT_EQ(file.streams.size(), reader.streams.size());
+  ASSERT_EQ(expected, readDts(reader));
+}
+
+TEST(IOSource, mmap) {
+  PacketReader file(TEST_FILE);
+  auto expected = readDts(file);
+  auto source = std::make_shared<MmapSource>(TEST_FILE);
+  ASSERT_EQ(std::string{TEST_FILE}, source->name());
+  PacketReader reader(source);
+  ASSERT_EQ(expected, readDts(reader));
+  ASSERT_THROW(MmapSource("/this/does/not/exist"), std::runtime_error);
+}
+
+TEST(IOSource, callback) {
+  PacketReader file(TEST_FILE);
+  auto expected = readDts(file);
+  auto data = loadFile();
+  MemorySource memory(*data);
+  int reads = 0;
+  auto source = std::make_shared<CallbackSource>(
+    [&](uint8_t* buffer, int size) { reads++; return memory.read(buffer, size); },
+    [&](int64_t offset, int whence) { return memory.seek(offset, whence); });
+  PacketReader reader(source);
+  ASSERT_EQ(expected, readDts(reader));
+  ASSERT_GT(reads, 0);
+}
+
+TEST(IOSource, pipe) {
+  auto data = loadFile();
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  std::thread writer([&data, fds]{
+    size_t written = 0;
+    while (written < data->size()) {
+      ssize_t count = write(fds[1], data->data() + written, data->size() - written);
+      if (count <= 0) {
+        break;
+      }
+      written += count;
+    }
+    close(fds[1]);
+  });
+  FileDescriptorSource source(fds[0], true);
+  ASSERT_FALSE(source.seekable());
+  ASSERT_LT(source.seek(0, SEEK_SET), 0);
+  std::vector<uint8_t> read;
+  uint8_t buffer[4096];
+  int count;
+  while ((count = source.read(buffer, sizeof(buffer))) > 0) {
+    read.insert(read.end(), buffer, buffer + count);
+  }
+  writer.join();
+  ASSERT_EQ(AVERROR_EOF, count);
+  ASSERT_EQ(*data, read);
+}
+
+TEST(IOSource, reopen) {
+  PacketReader file(TEST_FILE);
+  auto expected = readDts(file);
+  auto source = std::make_shared<MmapSource>(TEST_FILE);
+  PacketReader reader(source);
+  ASSERT_EQ(expected, readDts(reader));
+  // Reopening has to start back at the beginning of the source
+  reader.sendEvent(PacketReaderStateMachine::reset{});
+  reader.sendEvent(PacketReaderStateMachine::open{});
+  ASSERT_EQ(expected, readDts(reader));
+}
+
+// Two different inputs in memory are both called "memory", so they
+// mustn't share a probe cache entry, even with cacheUrls on
+
+TEST(IOSource, probeCache) {
+  auto data = loadFile();
+  auto sink = std::make_shared<MemorySink>("video.mp4");
+  {
+    PacketReader file(TEST_FILE);
+    ASSERT_GT(file.audioStreams.size(), 0);
+    Muxer muxer(sink);
+    muxer.subscribe(file.videoStreams.at(0));
+    file.sendEvent(PacketReaderStateMachine::play{});
+    file.join();
+    muxer.close();
+  }
+  std::vector<uint8_t> videoOnly(sink->data().begin(), sink->data().end());
+
+  InputOptions options;
+  ProbeCache::Settings settings;
+  settings.cacheUrls = true;
+  options.probeCache = std::make_shared<ProbeCache>(std::filesystem::path{}, settings);
+  auto full = std::make_shared<MemorySource>(*data, data);
+  auto video = std::make_shared<MemorySource>(videoOnly);
+  ASSERT_EQ(full->name(), video->name());
+  ASSERT_TRUE(full->cacheKey().empty());
+  PacketReader fullReader(full, options);
+  PacketReader videoReader(video, options);
+  ASSERT_EQ(1, videoReader.streams.size());
+  ASSERT_EQ(0, videoReader.audioStreams.size());
+  ASSERT_GT(fullReader.streams.size(), videoReader.streams.size());
+  ASSERT_EQ(0, options.probeCache->stats().hits);
+  ASSERT_EQ(0, options.probeCache->stats().stores);
+
+  // A mapped file is keyed on its path
+  PacketReader mapped(std::make_shared<MmapSource>(TEST_FILE), options);
+  PacketReader mappedAgain(std::make_shared<MmapSource>(TEST_FILE), options);
+  ASSERT_EQ(1, options.probeCache->stats().stores);
+  ASSERT_EQ(1, options.probeCache->stats().hits);
+  ASSERT_EQ(fullReader.streams.size(), mappedAgain.streams.size());
+}
@@ -18,14 +18,19 @@
 
 #include <filesystem>
 #include <gtest/gtest.h>
+#include <atomic>
 #include <chrono>
+#include <cstring>
 #include <memory>
+#include <thread>
 #include <vector>
 #include <iostream>
 
 #include <fr/media2/Decoder.h>
 #include <fr/media2/PacketReader.h>
 #include <fr/media2/Encoder.h>
+#include <fr/media2/IOSink.h>
+#include <fr/media2/IOSource.h>
 #include <fr/media2/Muxer.h>
 
 using namespace fr::media2;
@@ -78,3 +83,233 @@ TEST(MuxerTest, endToEnd) {
 
   ASSERT_TRUE(std::filesystem::exists(outputFile));
 }
+
+// Remuxes the test file into muxer and returns the number of packets
+// that went in
+static size_t remux(Muxer& muxer) {
+  PacketReader reader(TEST_FILE);
+  size_t packets = 0;
+  for (auto stream : reader.streams) {
+    muxer.subscribe(stream);
+    stream->packets.connect([&packets](const Packet::pointer&, const StreamData::pointer&) {
+      packets++;
+    });
+  }
+  reader.sendEvent(PacketReaderStateMachine::play{});
+  reader.join();
+  muxer.close();
+  return packets;
+}
+
+static size_t countPackets(IOSource::pointer source) {
+  PacketReader reader(source);
+  size_t packets = 0;
+  for (auto stream : reader.streams) {
+    stream->packets.connect([&packets](const Packet::pointer&, const StreamData::pointer&) {
+      packets++;
+    });
+  }
+  reader.sendEvent(PacketReaderStateMachine::play{});
+  reader.join();
+  return packets;
+}
+
+TEST(MuxerTest, memorySink) {
+  auto sink = std::make_shared<MemorySink>("remux.mp4");
+  // Format comes from the sink name
+  Muxer muxer(sink);
+  size_t written = remux(muxer);
+  ASSERT_GT(written, 0);
+  ASSERT_GT(sink->size(), 0);
+  // Regular mp4 goes back to fill in the mdat size, so the output
+  // only reads back if the seeks worked
+  ASSERT_EQ(written, countPackets(std::make_shared<MemorySource>(sink->data())));
+  sink->clear();
+  ASSERT_EQ(0, sink->size());
+}
+
+TEST(MuxerTest, chunkSink) {
+  std::vector<ChunkSink::Chunk> chunks;
+  std::vector<uint8_t> output;
+  auto sink = std::make_shared<ChunkSink>([&](const ChunkSink::Chunk& chunk) {
+    chunks.push_back(chunk);
+    output.insert(output.end(), chunk.data.begin(), chunk.data.end());
+  });
+  Muxer muxer(sink, "mp4");
+  muxer.options["movflags"] = "frag_keyframe+empty_moov+default_base_moof";
+  size_t written = remux(muxer);
+  // An init segment and at least one fragment
+  ASSERT_GT(chunks.size(), 1);
+  ASSERT_EQ(AVIO_DATA_MARKER_HEADER, chunks[0].type);
+  ASSERT_EQ(chunks.size(), sink->chunks());
+  ASSERT_EQ(output.size(), sink->bytes());
+  uint64_t offset = 0;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    ASSERT_EQ(offset, chunks[i].offset);
+    offset += chunks[i].data.size();
+    if (i > 0 && AVIO_DATA_MARKER_TRAILER != chunks[i].type) {
+      // Every fragment starts with its moof
+      ASSERT_TRUE(AVIO_DATA_MARKER_SYNC_POINT == chunks[i].type ||
+                  AVIO_DATA_MARKER_BOUNDARY_POINT == chunks[i].type);
+      ASSERT_EQ(0, memcmp(output.data() + chunks[i].offset + 4, "moof", 4));
+    }
+  }
+  ASSERT_EQ(written, countPackets(std::make_shared<MemorySource>(output)));
+}
+
+static size_t countKeyframes() {
+  PacketReader reader(TEST_FILE);
+  size_t keyframes = 0;
+  reader.videoStreams.at(0)->packets.connect([&keyframes](const Packet::pointer& packet, const StreamData::pointer&) {
+    if (packet->flags & AV_PKT_FLAG_KEY) {
+      keyframes++;
+    }
+  });
+  reader.sendEvent(PacketReaderStateMachine::play{});
+  reader.join();
+  return keyframes;
+}
+
+TEST(MuxerTest, fragmented) {
+  size_t keyframes = countKeyframes();
+  auto sink = std::make_shared<MemorySink>();
+  Muxer muxer(sink, "mp4");
+  muxer.setFragmented();
+  ASSERT_TRUE(muxer.isFragmented());
+  std::vector<Muxer::Fragment> fragments;
+  muxer.fragments.connect([&](const Muxer::Fragment& fragment) {
+    // Everything up to the end of the fragment is already out
+    ASSERT_LE(fragment.offset + fragment.size, sink->size());
+    fragments.push_back(fragment);
+  });
+  size_t written = remux(muxer);
+  // The init segment, then one fragment per GOP
+  ASSERT_EQ(keyframes + 1, fragments.size());
+  ASSERT_EQ(0, fragments[0].sequence);
+  ASSERT_EQ(0, fragments[0].offset);
+  ASSERT_GT(fragments[0].size, 0);
+  auto data = sink->data();
+  for (size_t i = 1; i < fragments.size(); ++i) {
+    ASSERT_EQ(i, fragments[i].sequence);
+    ASSERT_EQ(fragments[i - 1].offset + fragments[i - 1].size, fragments[i].offset);
+    ASSERT_EQ(0, memcmp(data.data() + fragments[i].offset + 4, "moof", 4));
+    ASSERT_GT(fragments[i].duration, 0);
+    if (i > 1) {
+      ASSERT_GT(fragments[i].startTime, fragments[i - 1].startTime);
+    }
+  }
+  ASSERT_EQ(written, countPackets(std::make_shared<MemorySource>(data)));
+}
+
+TEST(MuxerTest, fragmentDuration) {
+  auto sink = std::make_shared<MemorySink>();
+  Muxer muxer(sink, "mp4");
+  // Longer than the test video, so it all goes in one fragment
+  muxer.setFragmented(3600ll * AV_TIME_BASE);
+  std::vector<Muxer::Fragment> fragments;
+  muxer.fragments.connect([&](const Muxer::Fragment& fragment) {
+    fragments.push_back(fragment);
+  });
+  size_t written = remux(muxer);
+  ASSERT_EQ(2, fragments.size());
+  ASSERT_EQ(written, countPackets(std::make_shared<MemorySource>(sink->data())));
+}
+
+// Each stream's packets come from their own thread, like they would
+// from a SegmentUnpacker with a worker per job
+
+TEST(MuxerTest, interleaving) {
+  PacketReader reader(TEST_FILE);
+  std::vector<std::vector<Packet::pointer>> packets(reader.streams.size());
+  for (size_t i = 0; i < reader.streams.size(); ++i) {
+    reader.streams[i]->packets.connect([&packets, i](const Packet::pointer& packet, const StreamData::pointer&) {
+      packets[i].push_back(Packet::copy(packet));
+    });
+  }
+  reader.sendEvent(PacketReaderStateMachine::play{});
+  reader.join();
+  size_t total = 0;
+  for (const auto& stream : packets) {
+    total += stream.size();
+  }
+
+  auto sink = std::make_shared<MemorySink>();
+  Muxer muxer(sink, "mp4");
+  muxer.setInterleaving();
+  std::vector<Stream::pointer> inputs;
+  for (auto& stream : reader.streams) {
+    auto input = std::make_shared<Stream>();
+    input->data = stream->data;
+    muxer.subscribe(input);
+    inputs.push_back(input);
+  }
+  std::vector<std::thread> producers;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    producers.emplace_back([&inputs, &packets, i]{
+      for (const auto& packet : packets[i]) {
+        inputs[i]->packets(packet, inputs[i]->data);
+      }
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  muxer.close();
+  auto stats = muxer.interleavingStats();
+  ASSERT_EQ(total, stats.pushed);
+  ASSERT_EQ(total, stats.written);
+  ASSERT_EQ(0, stats.late);
+  ASSERT_EQ(total, countPackets(std::make_shared<MemorySource>(sink->data())));
+}
+
+// Same thing, but each thread subscribes its own stream, and the last
+// one doesn't get around to it until the others are already sending
+
+TEST(MuxerTest, subscribeFromThreads) {
+  PacketReader reader(TEST_FILE);
+  ASSERT_GT(reader.streams.size(), 1);
+  std::vector<std::vector<Packet::pointer>> packets(reader.streams.size());
+  for (size_t i = 0; i < reader.streams.size(); ++i) {
+    reader.streams[i]->packets.connect([&packets, i](const Packet::pointer& packet, const StreamData::pointer&) {
+      packets[i].push_back(Packet::copy(packet));
+    });
+  }
+  reader.sendEvent(PacketReaderStateMachine::play{});
+  reader.join();
+  size_t total = 0;
+  for (const auto& stream : packets) {
+    total += stream.size();
+  }
+
+  auto sink = std::make_shared<MemorySink>();
+  Muxer muxer(sink, "mp4");
+  muxer.setInterleaving(10000000, packets.size());
+  std::atomic<size_t> sent = 0;
+  std::vector<std::thread> producers;
+  for (size_t i = 0; i < packets.size(); ++i) {
+    producers.emplace_back([&, i]{
+      auto input = std::make_shared<Stream>();
+      input->data = reader.streams[i]->data;
+      if (i + 1 == packets.size()) {
+        while (sent < 10) {
+          std::this_thread::yield();
+        }
+      }
+      muxer.subscribe(input);
+      for (const auto& packet : packets[i]) {
+        input->packets(packet, input->data);
+        sent++;
+      }
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  muxer.close();
+  ASSERT_EQ(packets.size(), muxer.streaminfo.size());
+  auto stats = muxer.interleavingStats();
+  ASSERT_EQ(total, stats.pushed);
+  ASSERT_EQ(total, stats.written);
+  ASSERT_EQ(0, stats.late);
+  ASSERT_EQ(total, countPackets(std::make_shared<MemorySource>(sink->data())));
+}
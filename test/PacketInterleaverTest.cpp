@@ -0,0 +1,185 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Feed the interleaver from a bunch of threads and make sure what comes
+ * out is in order.
+ */
+
+#include <atomic>
+#include <fr/media2/PacketInterleaver.h>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace fr::media2;
+
+namespace {
+
+  Packet::pointer packetAt(int64_t dts) {
+    auto packet = Packet::create();
+    packet->dts = dts;
+    packet->pts = dts;
+    return packet;
+  }
+
+  struct Written {
+    std::vector<int64_t> dts;
+    std::vector<int> streams;
+
+    PacketInterleaver::WriteFunction function() {
+      return [this](Packet::pointer& packet) {
+        dts.push_back(packet->dts);
+        streams.push_back(packet->stream_index);
+      };
+    }
+  };
+
+}
+
+TEST(PacketInterleaver, waitsForEveryStream) {
+  Written written;
+  PacketInterleaver interleaver(written.function());
+  interleaver.addStream(0);
+  interleaver.addStream(1);
+  // Stream 0 is in milliseconds and stream 1 in 90KHz, so 1 ms is 90
+  AVRational ms{1, 1000};
+  AVRational ts{1, 90000};
+  for (int64_t i = 0; i < 10; ++i) {
+    auto packet = packetAt(i * 10);
+    packet->stream_index = 0;
+    interleaver.push(0, std::move(packet), ms);
+  }
+  // Nothing from stream 1 yet, so nothing can go
+  ASSERT_TRUE(written.dts.empty());
+  auto packet = packetAt(45 * 90);
+  packet->stream_index = 1;
+  interleaver.push(1, std::move(packet), ts);
+  // Everyone's at 45 now, so 0, 10, 20, 30 and 40 from stream 0 and
+  // the 45 itself can go
+  ASSERT_EQ(6, written.dts.size());
+  interleaver.flush();
+  ASSERT_EQ(11, written.dts.size());
+  std::vector<int> expected{0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0};
+  ASSERT_EQ(expected, written.streams);
+  auto stats = interleaver.stats();
+  ASSERT_EQ(11, stats.pushed);
+  ASSERT_EQ(11, stats.written);
+  ASSERT_EQ(0, stats.queued);
+  ASSERT_EQ(11, stats.peakQueued);
+}
+
+TEST(PacketInterleaver, quietStream) {
+  Written written;
+  // Half a second
+  PacketInterleaver interleaver(written.function(), 500000);
+  interleaver.addStream(0);
+  interleaver.addStream(1);
+  AVRational ms{1, 1000};
+  for (int64_t i = 0; i <= 1000; i += 100) {
+    interleaver.push(0, packetAt(i), ms);
+  }
+  // Stream 1 never showed up, so the packets more than 500ms behind
+  // stream 0's newest went anyway
+  ASSERT_EQ(6, written.dts.size());
+  // Stream 1 shows up, behind what's been written, so it goes right
+  // away
+  interleaver.push(1, packetAt(100), ms);
+  ASSERT_EQ(7, written.dts.size());
+  interleaver.finishStream(1);
+  // Nothing left to wait for
+  ASSERT_EQ(12, written.dts.size());
+}
+
+TEST(PacketInterleaver, late) {
+  Written written;
+  PacketInterleaver interleaver(written.function());
+  interleaver.addStream(0);
+  AVRational ms{1, 1000};
+  interleaver.push(0, packetAt(10), ms);
+  interleaver.push(0, packetAt(20), ms);
+  ASSERT_EQ(2, written.dts.size());
+  interleaver.push(0, packetAt(15), ms);
+  ASSERT_EQ(2, written.dts.size());
+  ASSERT_EQ(1, interleaver.stats().late);
+}
+
+// Packets without a dts don't count as a stream getting anywhere
+
+TEST(PacketInterleaver, noDts) {
+  Written written;
+  PacketInterleaver interleaver(written.function());
+  interleaver.addStream(0);
+  interleaver.addStream(1);
+  AVRational ms{1, 1000};
+  interleaver.push(0, packetAt(AV_NOPTS_VALUE), ms);
+  interleaver.push(0, packetAt(10), ms);
+  interleaver.push(0, packetAt(20), ms);
+  // Stream 1 is still waited for from the beginning, which is 10 and
+  // not whatever the first packet had
+  ASSERT_EQ(1, written.dts.size());
+  ASSERT_EQ(AV_NOPTS_VALUE, written.dts[0]);
+  interleaver.push(1, packetAt(15), ms);
+  interleaver.push(1, packetAt(AV_NOPTS_VALUE), ms);
+  std::vector<int64_t> expected{AV_NOPTS_VALUE, 10, 15, AV_NOPTS_VALUE};
+  ASSERT_EQ(expected, written.dts);
+  interleaver.flush();
+  ASSERT_EQ(5, written.dts.size());
+  ASSERT_EQ(0, interleaver.stats().late);
+}
+
+TEST(PacketInterleaver, threads) {
+  std::mutex lock;
+  std::vector<int64_t> dts;
+  std::atomic<int> writers = 0;
+  std::atomic<bool> overlapped = false;
+  PacketInterleaver interleaver([&](Packet::pointer& packet) {
+    // Only one thread should ever be in here
+    if (writers++ > 0) {
+      overlapped = true;
+    }
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      dts.push_back(packet->dts);
+    }
+    writers--;
+  });
+  const int nStreams = 4;
+  const int nPackets = 2000;
+  for (int i = 0; i < nStreams; ++i) {
+    interleaver.addStream(i);
+  }
+  std::vector<std::thread> producers;
+  for (int i = 0; i < nStreams; ++i) {
+    producers.emplace_back([&interleaver, i]{
+      AVRational ms{1, 1000};
+      for (int j = 0; j < nPackets; ++j) {
+        // Streams are offset a bit from each other so the order matters
+        interleaver.push(i, packetAt(j * nStreams + i), ms);
+      }
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  interleaver.flush();
+  ASSERT_FALSE(overlapped);
+  ASSERT_EQ(nStreams * nPackets, dts.size());
+  for (size_t i = 1; i < dts.size(); ++i) {
+    ASSERT_LT(dts[i - 1], dts[i]);
+  }
+  ASSERT_EQ(0, interleaver.stats().late);
+}
@@ -20,12 +20,21 @@
 
 #include <gtest/gtest.h>
 #include <chrono>
+#include <filesystem>
 #include <fr/media2/PacketReader.h>
+#include <fr/media2/PacketRing.h>
+#include <fr/media2/ProbeCache.h>
 #include <fr/media2/PacketSubscriber.h>
+#include <fr/media2/Segmenter.h>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
+#include "TestHelpers.h"
 
 using namespace fr::media2;
+using namespace fr::media2::test;
 
 // Set up a fixture for a reader
 class PacketReaderTest : public ::testing::Test {
@@ -72,7 +81,7 @@ TEST_F(PacketReaderTest, countPackets) {
 class PacketReaderTestSubscriber : public PacketSubscriber {
 protected:
   void process(const Packet::pointer &packet,
-	       StreamData::pointer stream) override {
+	       const StreamData::pointer& stream) override {
     if (nullptr != owner.get()) {
       owner->sendEvent(PacketReaderStateMachine::pause{});
       unsubscribe();
@@ -104,3 +113,291 @@ TEST_F(PacketReaderTest, subscribeAndPause) {
   ASSERT_FALSE(reader->state.is("paused"_s));
   reader->join();
 }
+
+// Read-ahead should hand subscribers the same packets in the same
+// order as reading them directly
+
+TEST_F(PacketReaderTest, readAhead) {
+  auto expected = readDts(*reader);
+  PacketReader readAhead(TEST_FILE);
+  readAhead.setReadAhead(16, 256 * 1024);
+  auto actual = readDts(readAhead);
+  ASSERT_EQ(expected, actual);
+  auto stats = readAhead.readAheadStats();
+  size_t total = 0;
+  for (auto& dts : actual) {
+    total += dts.size();
+  }
+  ASSERT_EQ(total, stats.pushed);
+  ASSERT_EQ(0, stats.packets);
+  ASSERT_LE(stats.peakPackets, 16);
+}
+
+TEST_F(PacketReaderTest, readAheadPerStream) {
+  auto expected = readDts(*reader);
+  PacketReader readAhead(TEST_FILE);
+  readAhead.setReadAhead(8, 0, true);
+  auto actual = readDts(readAhead);
+  ASSERT_EQ(expected, actual);
+}
+
+// A cached probe should open the file just like probing it does
+
+TEST_F(PacketReaderTest, probeCache) {
+  auto expected = readDts(*reader);
+  InputOptions options;
+  options.probeCache = std::make_shared<ProbeCache>();
+  PacketReader first(TEST_FILE, options);
+  ASSERT_EQ(1, options.probeCache->stats().misses);
+  ASSERT_EQ(1, options.probeCache->stats().stores);
+  PacketReader cached(TEST_FILE, options);
+  ASSERT_EQ(1, options.probeCache->stats().hits);
+  ASSERT_EQ(first.streams.size(), cached.streams.size());
+  for (size_t i = 0; i < first.streams.size(); ++i) {
+    const AVCodecParameters* probed = first.streams[i]->data->parameters;
+    const AVCodecParameters* restored = cached.streams[i]->data->parameters;
+    ASSERT_EQ(probed->codec_id, restored->codec_id);
+    ASSERT_EQ(probed->width, restored->width);
+    ASSERT_EQ(probed->height, restored->height);
+    ASSERT_EQ(probed->sample_rate, restored->sample_rate);
+    ASSERT_EQ(probed->extradata_size, restored->extradata_size);
+    ASSERT_EQ(0, av_cmp_q(first.streams[i]->data->time_base, cached.streams[i]->data->time_base));
+  }
+  ASSERT_EQ(expected, readDts(cached));
+}
+
+TEST_F(PacketReaderTest, probeCacheOnDisk) {
+  auto directory = std::filesystem::temp_directory_path() / "PacketReaderTest.probeCache";
+  std::filesystem::remove_all(directory);
+  auto expected = readDts(*reader);
+  {
+    InputOptions options;
+    options.probeCache = std::make_shared<ProbeCache>(directory);
+    PacketReader first(TEST_FILE, options);
+    ASSERT_EQ(1, options.probeCache->stats().stores);
+  }
+  // A new cache should find what the last one saved
+  InputOptions options;
+  options.probeCache = std::make_shared<ProbeCache>(directory);
+  PacketReader cached(TEST_FILE, options);
+  ASSERT_EQ(1, options.probeCache->stats().hits);
+  ASSERT_EQ(0, options.probeCache->stats().misses);
+  ASSERT_EQ(expected, readDts(cached));
+  std::filesystem::remove_all(directory);
+}
+
+TEST_F(PacketReaderTest, inputOptions) {
+  using namespace boost::sml;
+  auto expected = readDts(*reader);
+  InputOptions options;
+  options.format = av_find_input_format("mov");
+  ASSERT_NE(nullptr, options.format);
+  options.probeSize = 64 * 1024;
+  options.analyzeDuration = 1000000;
+  options.options["ignore_editlist"] = "0";
+  PacketReader explicitFormat(TEST_FILE, options);
+  ASSERT_TRUE(explicitFormat.state.is("opened"_s));
+  ASSERT_EQ(expected, readDts(explicitFormat));
+}
+
+// Seeking picks up from the keyframe before the timestamp, without
+// reopening anything
+
+// Video dts and keyframe flags, in the order they come out
+struct VideoPackets {
+  std::vector<int64_t> dts;
+  std::vector<bool> key;
+  int discontinuities = 0;
+  // Index into dts of the first packet after the last discontinuity
+  size_t afterSeek = 0;
+};
+
+static void watchVideo(PacketReader& reader, VideoPackets& seen,
+                       std::function<void(size_t)> onPacket = nullptr) {
+  reader.videoStreams[0]->packets.connect(
+    [&seen, onPacket](const Packet::pointer& packet, const StreamData::pointer&) {
+      seen.dts.push_back(packet->dts);
+      seen.key.push_back(packet->flags & AV_PKT_FLAG_KEY);
+      if (onPacket) {
+        onPacket(seen.dts.size());
+      }
+    });
+  reader.signals.discontinuity.connect([&seen](int64_t, int) {
+    seen.discontinuities++;
+    seen.afterSeek = seen.dts.size();
+  });
+}
+
+// A timestamp about two thirds of the way in that isn't on a keyframe
+static int64_t seekTarget(const VideoPackets& all) {
+  size_t i = all.dts.size() * 2 / 3;
+  while (i < all.dts.size() && all.key[i]) {
+    i++;
+  }
+  return all.dts[i];
+}
+
+TEST_F(PacketReaderTest, seekFromOpened) {
+  VideoPackets all;
+  watchVideo(*reader, all);
+  reader->sendEvent(PacketReaderStateMachine::play{});
+  reader->join();
+  ASSERT_GT(all.dts.size(), 10);
+  int64_t target = seekTarget(all);
+
+  PacketReader seeking(TEST_FILE);
+  VideoPackets seen;
+  watchVideo(seeking, seen);
+  int videoIndex = seeking.videoStreams[0]->data->stream->index;
+  seeking.sendEvent(PacketReaderStateMachine::seek{target, 0, videoIndex});
+  using namespace boost::sml;
+  ASSERT_TRUE(seeking.state.is("opened"_s));
+  ASSERT_EQ(1, seen.discontinuities);
+  seeking.sendEvent(PacketReaderStateMachine::play{});
+  seeking.join();
+
+  ASSERT_GT(seen.dts.size(), 0);
+  ASSERT_LT(seen.dts.size(), all.dts.size());
+  // Started on a keyframe at or before the target
+  ASSERT_TRUE(seen.key[0]);
+  ASSERT_LE(seen.dts[0], target);
+  ASSERT_EQ(all.dts.back(), seen.dts.back());
+}
+
+TEST_F(PacketReaderTest, seekWhilePlaying) {
+  VideoPackets all;
+  watchVideo(*reader, all);
+  reader->sendEvent(PacketReaderStateMachine::play{});
+  reader->join();
+  ASSERT_GT(all.dts.size(), 10);
+  int64_t target = seekTarget(all);
+
+  PacketReader seeking(TEST_FILE);
+  seeking.setReadAhead(8);
+  int videoIndex = seeking.videoStreams[0]->data->stream->index;
+  VideoPackets seen;
+  // Jump ahead after a few packets (this runs on a dispatch thread)
+  watchVideo(seeking, seen, [&seeking, target, videoIndex](size_t count) {
+    if (5 == count) {
+      seeking.sendEvent(PacketReaderStateMachine::seek{target, 0, videoIndex});
+    }
+  });
+  seeking.sendEvent(PacketReaderStateMachine::play{});
+  seeking.join();
+
+  ASSERT_EQ(1, seen.discontinuities);
+  ASSERT_GE(seen.afterSeek, 5);
+  ASSERT_LT(seen.afterSeek, seen.dts.size());
+  ASSERT_TRUE(seen.key[seen.afterSeek]);
+  ASSERT_LE(seen.dts[seen.afterSeek], target);
+  ASSERT_GT(seen.dts[seen.afterSeek], seen.dts[0]);
+  // Nothing out of order after the seek
+  for (size_t i = seen.afterSeek + 1; i < seen.dts.size(); ++i) {
+    ASSERT_GT(seen.dts[i], seen.dts[i - 1]);
+  }
+}
+
+TEST_F(PacketReaderTest, seekWhilePaused) {
+  using namespace boost::sml;
+  VideoPackets seen;
+  watchVideo(*reader, seen, [this](size_t count) {
+    if (1 == count) {
+      reader->sendEvent(PacketReaderStateMachine::pause{});
+    }
+  });
+  reader->sendEvent(PacketReaderStateMachine::play{});
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  ASSERT_TRUE(reader->state.is("paused"_s));
+  size_t beforeSeek = seen.dts.size();
+  // Back to the start
+  reader->sendEvent(PacketReaderStateMachine::seek{0});
+  ASSERT_TRUE(reader->state.is("paused"_s));
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  // Still paused, so nothing new
+  ASSERT_EQ(1, seen.discontinuities);
+  ASSERT_EQ(beforeSeek, seen.dts.size());
+  reader->sendEvent(PacketReaderStateMachine::play{});
+  reader->join();
+  ASSERT_GT(seen.dts.size(), beforeSeek);
+  ASSERT_TRUE(seen.key[seen.afterSeek]);
+}
+
+// Seek in the middle of the first GOP. The segmenter sends off what it
+// had and starts over at the keyframe the seek landed on, so nothing
+// from before the seek ends up in a segment with anything after it.
+
+TEST_F(PacketReaderTest, segmenterSeek) {
+  VideoPackets all;
+  watchVideo(*reader, all);
+  reader->sendEvent(PacketReaderStateMachine::play{});
+  reader->join();
+  size_t gop = 1;
+  while (gop < all.dts.size() && !all.key[gop]) {
+    gop++;
+  }
+  ASSERT_GT(gop, 2);
+  size_t beforeSeek = gop / 2;
+  int64_t target = seekTarget(all);
+
+  PacketReader seeking(TEST_FILE);
+  int videoIndex = seeking.videoStreams[0]->data->stream->index;
+  Segmenter segmenter;
+  SegmentCollector collector;
+  collector.subscribe(&segmenter);
+  segmenter.subscribe(seeking.videoStreams[0]);
+  VideoPackets seen;
+  // Without read-ahead this runs on the reading thread, which seeks
+  // before it reads anything else
+  watchVideo(seeking, seen, [&seeking, target, videoIndex, beforeSeek](size_t count) {
+    if (beforeSeek == count) {
+      seeking.sendEvent(PacketReaderStateMachine::seek{target, 0, videoIndex});
+    }
+  });
+  seeking.sendEvent(PacketReaderStateMachine::play{});
+  seeking.join();
+  segmenter.flush();
+
+  ASSERT_EQ(1, seen.discontinuities);
+  ASSERT_EQ(beforeSeek, seen.afterSeek);
+  ASSERT_GT(collector.collected.size(), 1);
+  // Just what came before the seek
+  ASSERT_EQ(beforeSeek, collector.collected[0]->packets.size());
+  for (size_t i = 0; i < beforeSeek; ++i) {
+    ASSERT_EQ(all.dts[i], collector.collected[0]->packets[i]->dts);
+  }
+  // Then the keyframe the seek landed on
+  ASSERT_EQ(seen.dts[beforeSeek], collector.collected[1]->packets[0]->dts);
+  ASSERT_LE(collector.collected[1]->packets[0]->dts, target);
+  size_t total = 0;
+  for (const auto& segment : collector.collected) {
+    ASSERT_TRUE(Packet::containsIFrame(segment->packets[0]));
+    total += segment->packets.size();
+  }
+  ASSERT_EQ(seen.dts.size(), total);
+}
+
+TEST(PacketRing, byteLimit) {
+  PacketRing ring(4, 100);
+  auto big = Packet::create();
+  av_new_packet(big.get(), 150);
+  // Too big, but the ring is empty so it goes in anyway
+  ASSERT_TRUE(ring.push(big));
+  auto small = Packet::create();
+  av_new_packet(small.get(), 10);
+  std::thread consumer([&ring]{
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    auto packet = Packet::nullPacket();
+    ring.pop(packet);
+  });
+  // Has to wait for the consumer to make room
+  ASSERT_TRUE(ring.push(small));
+  consumer.join();
+  auto stats = ring.stats();
+  ASSERT_EQ(1, stats.packets);
+  ASSERT_EQ(10, stats.bytes);
+  ASSERT_GT(stats.producerStall.count(), 0);
+  ring.close();
+  auto packet = Packet::nullPacket();
+  ASSERT_TRUE(ring.pop(packet));
+  ASSERT_FALSE(ring.pop(packet));
+}
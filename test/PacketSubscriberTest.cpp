@@ -28,7 +28,7 @@ using fr::media2::Packet;
 
 class DummySubscriber : public PacketSubscriber {
 protected:
-  void process(const Packet::pointer &packet, StreamData::pointer data) override {
+  void process(const Packet::pointer &packet, const StreamData::pointer& data) override {
     failed = false;
   }
 public:
@@ -16,9 +16,16 @@
  */
 
 #include <gtest/gtest.h>
+#include <cstring>
 #include <fr/media2/Packet.h>
+#include <fr/media2/PacketPool.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
 
 using fr::media2::Packet;
+using fr::media2::PacketPool;
 
 // Just create and destroy some packets, make sure the address sanitizer
 // doesn't yell at us.
@@ -31,3 +38,54 @@ TEST(PacketTest, copy) {
   Packet::pointer pkt = Packet::create();
   Packet::pointer copy = Packet::copy(pkt);
 }
+
+// Destroyed packets should go back to the pool and come back
+// out the next time we create one.
+
+TEST(PacketTest, poolReuse) {
+  PacketPool& pool = PacketPool::instance();
+  AVPacket* raw = nullptr;
+  {
+    Packet::pointer pkt = Packet::create();
+    raw = pkt.get();
+  }
+  PacketPool::Stats before = pool.stats();
+  Packet::pointer reused = Packet::create();
+  PacketPool::Stats after = pool.stats();
+  ASSERT_EQ(raw, reused.get());
+  ASSERT_EQ(before.packetHits + 1, after.packetHits);
+  ASSERT_EQ(before.packetMisses, after.packetMisses);
+}
+
+TEST(PacketTest, copyUnrefcounted) {
+  uint8_t payload[16];
+  for (int i = 0; i < sizeof(payload); ++i) {
+    payload[i] = i;
+  }
+  Packet::pointer pkt = Packet::create();
+  pkt->data = payload;
+  pkt->size = sizeof(payload);
+  pkt->pts = 42;
+  Packet::pointer copy = Packet::copy(pkt);
+  ASSERT_NE(nullptr, copy->buf);
+  ASSERT_NE(pkt->data, copy->data);
+  ASSERT_EQ(0, memcmp(payload, copy->data, sizeof(payload)));
+  ASSERT_EQ(42, copy->pts);
+  // Don't leave a pooled packet pointing at our stack
+  pkt->data = nullptr;
+  pkt->size = 0;
+}
+
+TEST(PacketTest, poolBuffer) {
+  PacketPool& pool = PacketPool::instance();
+  AVBufferRef* first = pool.buffer(1000);
+  ASSERT_GE(first->size, 1000 + AV_INPUT_BUFFER_PADDING_SIZE);
+  uint8_t* firstData = first->data;
+  av_buffer_unref(&first);
+  PacketPool::Stats before = pool.stats();
+  AVBufferRef* second = pool.buffer(1100);
+  PacketPool::Stats after = pool.stats();
+  ASSERT_EQ(firstData, second->data);
+  ASSERT_EQ(before.bufferHits + 1, after.bufferHits);
+  av_buffer_unref(&second);
+}
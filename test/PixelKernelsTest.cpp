@@ -0,0 +1,193 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Tests the pixel conversion fast paths. Every instruction set has to
+ * give exactly what the plain C version gives, and all of them have to
+ * be close to what swscale gives on noise (exactly the same for the
+ * ones that just move bytes around, which are the only ones find hands
+ * out unless you ask for approximate ones.)
+ */
+
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <fr/media2/Frame.h>
+#include <fr/media2/PixelKernels.h>
+#include <fr/media2/Scaler.h>
+#include <random>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+using namespace fr::media2;
+
+static const PixelKernels::Isa allIsas[] = {
+  PixelKernels::Isa::generic, PixelKernels::Isa::sse4, PixelKernels::Isa::avx2, PixelKernels::Isa::neon
+};
+
+static int planeRows(const AVFrame* frame, int plane) {
+  const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat) frame->format);
+  return (1 == plane || 2 == plane) ? -((-frame->height) >> desc->log2_chroma_h) : frame->height;
+}
+
+static Frame::pointer noise(int width, int height, AVPixelFormat format) {
+  auto frame = Frame::create(width, height, format);
+  std::mt19937 random(width * height);
+  for (int p = 0; p < av_pix_fmt_count_planes(format); ++p) {
+    int bytes = av_image_get_linesize(format, width, p);
+    int rows = planeRows(frame.get(), p);
+    for (int y = 0; y < rows; ++y) {
+      uint8_t* line = frame->data[p] + y * frame->linesize[p];
+      for (int x = 0; x < bytes; ++x) {
+        line[x] = random();
+      }
+    }
+  }
+  return frame;
+}
+
+static int maxDifference(const AVFrame* a, const AVFrame* b) {
+  AVPixelFormat format = (AVPixelFormat) a->format;
+  int ret = 0;
+  for (int p = 0; p < av_pix_fmt_count_planes(format); ++p) {
+    int bytes = av_image_get_linesize(format, a->width, p);
+    for (int y = 0; y < planeRows(a, p); ++y) {
+      const uint8_t* la = a->data[p] + y * a->linesize[p];
+      const uint8_t* lb = b->data[p] + y * b->linesize[p];
+      for (int x = 0; x < bytes; ++x) {
+        ret = std::max(ret, std::abs(la[x] - lb[x]));
+      }
+    }
+  }
+  return ret;
+}
+
+struct Case {
+  int srcWidth;
+  int srcHeight;
+  AVPixelFormat srcFormat;
+  int dstWidth;
+  int dstHeight;
+  AVPixelFormat dstFormat;
+  // Most swscale is allowed to differ by
+  int tolerance;
+  // What to ask swscale for. The half size kernel is a box filter, so
+  // it's compared with swscale's area filter rather than bicubic
+  int swsFlags;
+};
+
+// Odd sizes so the SIMD loops have leftovers to deal with
+static const Case cases[] = {
+  {1918, 1080, AV_PIX_FMT_YUV420P, 1918, 1080, AV_PIX_FMT_NV12, 0, SWS_BICUBIC},
+  {1918, 1080, AV_PIX_FMT_NV12, 1918, 1080, AV_PIX_FMT_YUV420P, 0, SWS_BICUBIC},
+  {1278, 720, AV_PIX_FMT_YUV420P, 1278, 720, AV_PIX_FMT_BGR24, 4, SWS_BICUBIC},
+  {1278, 720, AV_PIX_FMT_YUVJ420P, 1278, 720, AV_PIX_FMT_BGR24, 4, SWS_BICUBIC},
+  {1928, 1084, AV_PIX_FMT_YUV420P, 964, 542, AV_PIX_FMT_YUV420P, 2, SWS_AREA},
+};
+
+TEST(PixelKernelsTest, simdMatchesC) {
+  for (const Case& c : cases) {
+    auto source = noise(c.srcWidth, c.srcHeight, c.srcFormat);
+    auto expected = Frame::create(c.dstWidth, c.dstHeight, c.dstFormat);
+    auto generic = PixelKernels::find(c.srcWidth, c.srcHeight, c.srcFormat, c.dstWidth, c.dstHeight,
+                                      c.dstFormat, PixelKernels::Isa::generic,
+                                      PixelKernels::Accuracy::approximate);
+    ASSERT_TRUE(generic);
+    generic(source.get(), expected.get());
+    for (auto isa : allIsas) {
+      auto convert = PixelKernels::find(c.srcWidth, c.srcHeight, c.srcFormat, c.dstWidth, c.dstHeight,
+                                        c.dstFormat, isa, PixelKernels::Accuracy::approximate);
+      ASSERT_EQ(PixelKernels::supported(isa), (bool) convert);
+      if (!convert) {
+        continue;
+      }
+      auto actual = Frame::create(c.dstWidth, c.dstHeight, c.dstFormat);
+      convert(source.get(), actual.get());
+      ASSERT_EQ(0, maxDifference(expected.get(), actual.get()))
+        << PixelKernels::name(isa) << " " << av_get_pix_fmt_name(c.srcFormat) << " to "
+        << av_get_pix_fmt_name(c.dstFormat);
+    }
+  }
+}
+
+TEST(PixelKernelsTest, matchesSwscale) {
+  for (const Case& c : cases) {
+    auto source = noise(c.srcWidth, c.srcHeight, c.srcFormat);
+    auto expected = Frame::create(c.dstWidth, c.dstHeight, c.dstFormat);
+    SwsContext* sws = sws_getContext(c.srcWidth, c.srcHeight, c.srcFormat, c.dstWidth, c.dstHeight,
+                                     c.dstFormat, c.swsFlags, nullptr, nullptr, nullptr);
+    ASSERT_NE(nullptr, sws);
+    sws_scale(sws, source->data, source->linesize, 0, c.srcHeight, expected->data, expected->linesize);
+    sws_freeContext(sws);
+    auto actual = Frame::create(c.dstWidth, c.dstHeight, c.dstFormat);
+    auto convert = PixelKernels::find(c.srcWidth, c.srcHeight, c.srcFormat, c.dstWidth, c.dstHeight,
+                                      c.dstFormat, PixelKernels::Accuracy::approximate);
+    ASSERT_TRUE(convert);
+    // Only the exact ones get handed out by default
+    ASSERT_EQ(0 == c.tolerance, (bool) PixelKernels::find(c.srcWidth, c.srcHeight, c.srcFormat,
+                                                          c.dstWidth, c.dstHeight, c.dstFormat));
+    convert(source.get(), actual.get());
+    ASSERT_LE(maxDifference(expected.get(), actual.get()), c.tolerance)
+      << av_get_pix_fmt_name(c.srcFormat) << " to " << av_get_pix_fmt_name(c.dstFormat);
+  }
+}
+
+TEST(PixelKernelsTest, noFastPath) {
+  ASSERT_FALSE(PixelKernels::find(1920, 1080, AV_PIX_FMT_YUV420P, 1280, 720, AV_PIX_FMT_YUV420P));
+  ASSERT_FALSE(PixelKernels::find(1920, 1080, AV_PIX_FMT_YUV420P, 1920, 1080, AV_PIX_FMT_RGB24));
+  // Half size, but the chroma planes wouldn't halve evenly
+  ASSERT_FALSE(PixelKernels::find(1922, 1080, AV_PIX_FMT_YUV420P, 961, 540, AV_PIX_FMT_YUV420P,
+                                  PixelKernels::Accuracy::approximate));
+}
+
+// Runs a picture through a Scaler to bgr24
+static Frame::pointer scale(const Frame::pointer& source, bool approximate) {
+  Scaler scaler(-1, -1, AV_PIX_FMT_BGR24);
+  scaler.setApproximate(approximate);
+  Frame::pointer scaled{nullptr, &Frame::destroy};
+  auto connection = scaler.frames.connect([&scaled](Frame::const_pointer frame, const StreamData::pointer&) {
+    scaled = Frame::clone(frame);
+  });
+  // Scaler::process is protected, but FrameSubscriber gets it from a
+  // source's signal
+  FrameSource decoder;
+  scaler.subscribe(&decoder);
+  decoder.frames(source, nullptr);
+  connection.disconnect();
+  return scaled;
+}
+
+// Scaler leaves the approximate kernels alone unless it's asked
+TEST(PixelKernelsTest, scaler) {
+  auto source = noise(640, 360, AV_PIX_FMT_YUVJ420P);
+  auto scaled = scale(source, false);
+  ASSERT_TRUE(scaled);
+  auto expected = Frame::create(640, 360, AV_PIX_FMT_BGR24);
+  SwsContext* sws = sws_getContext(640, 360, AV_PIX_FMT_YUVJ420P, 640, 360, AV_PIX_FMT_BGR24,
+                                   SWS_BICUBIC, nullptr, nullptr, nullptr);
+  ASSERT_NE(nullptr, sws);
+  sws_scale(sws, source->data, source->linesize, 0, 360, expected->data, expected->linesize);
+  sws_freeContext(sws);
+  ASSERT_EQ(0, maxDifference(expected.get(), scaled.get()));
+
+  scaled = scale(source, true);
+  ASSERT_TRUE(scaled);
+  PixelKernels::find(640, 360, AV_PIX_FMT_YUVJ420P, 640, 360, AV_PIX_FMT_BGR24,
+                     PixelKernels::Accuracy::approximate)(source.get(), expected.get());
+  ASSERT_EQ(0, maxDifference(expected.get(), scaled.get()));
+}
@@ -0,0 +1,138 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Decodes the test video once and encodes a couple of smaller renditions
+ * of it. Every rendition should get every frame, at the right size, with
+ * keyframes where the source had them.
+ */
+
+#include <gtest/gtest.h>
+#include <fr/media2/Decoder.h>
+#include <fr/media2/Packet.h>
+#include <fr/media2/PacketReader.h>
+#include <fr/media2/RenditionLadder.h>
+#include <fr/media2/Scaler.h>
+#include <mutex>
+#include <set>
+#include <vector>
+
+using namespace fr::media2;
+
+struct RenditionCount {
+  std::mutex mutex;
+  long packets = 0;
+  std::set<int64_t> keyframes;
+};
+
+TEST(RenditionLadder, encodeAll) {
+  std::vector<RenditionLadder::Rendition> renditions(2);
+  renditions[0].width = 640;
+  renditions[1].width = 320;
+  for (auto& rendition : renditions) {
+    rendition.options["preset"] = "ultrafast";
+  }
+  if (nullptr == avcodec_find_encoder_by_name(renditions[0].codec.c_str())) {
+    GTEST_SKIP() << renditions[0].codec << " isn't available";
+  }
+
+  PacketReader reader(TEST_FILE);
+  ASSERT_GT(reader.videoStreams.size(), 0);
+  Decoder decoder;
+  decoder.subscribe(reader.videoStreams[0]);
+  ASSERT_GT(decoder.parameters->width, 640);
+
+  long frames = 0;
+  std::set<int64_t> sourceKeyframes;
+  decoder.frames.connect([&](Frame::const_pointer frame, const StreamData::pointer&) {
+    frames++;
+    if (frame->key_frame) {
+      sourceKeyframes.insert(frame->best_effort_timestamp);
+    }
+  });
+
+  RenditionLadder ladder(renditions);
+  ladder.subscribe(&decoder);
+  // The decoder knows the source size, so the streams are ready for a
+  // muxer before any frames go through
+  ASSERT_TRUE(ladder.isConfigured());
+  for (size_t i = 0; i < ladder.size(); ++i) {
+    auto data = ladder.stream(i)->data;
+    ASSERT_EQ(ladder.rendition(i).name, data->filename);
+    ASSERT_NE(AV_CODEC_ID_NONE, data->parameters->codec_id);
+    ASSERT_EQ(renditions[i].width, data->parameters->width);
+    ASSERT_GT(data->time_base.den, 0);
+  }
+  // Only had a width, so it's named after the height that works out to
+  int width = renditions[0].width;
+  int height = -1;
+  Scaler::fitSize(decoder.parameters->width, decoder.parameters->height, width, height);
+  ASSERT_EQ(std::to_string(height) + "p", ladder.rendition(0).name);
+  std::vector<RenditionCount> counts(ladder.size());
+  for (size_t i = 0; i < ladder.size(); ++i) {
+    ladder.stream(i)->packets.connect([&counts, i](const Packet::pointer& packet, const StreamData::pointer&) {
+      std::lock_guard<std::mutex> lock(counts[i].mutex);
+      counts[i].packets++;
+      if (packet->flags & AV_PKT_FLAG_KEY) {
+        counts[i].keyframes.insert(packet->pts);
+      }
+    });
+  }
+
+  reader.sendEvent(PacketReaderStateMachine::play{});
+  reader.join();
+  ladder.flush();
+
+  ASSERT_EQ(0, ladder.failures());
+  ASSERT_GT(frames, 0);
+  for (size_t i = 0; i < ladder.size(); ++i) {
+    ASSERT_TRUE(ladder.active(i));
+    auto data = ladder.stream(i)->data;
+    ASSERT_EQ(renditions[i].width, data->parameters->width);
+    ASSERT_EQ(frames, counts[i].packets);
+    for (int64_t pts : sourceKeyframes) {
+      ASSERT_EQ(1, counts[i].keyframes.count(pts)) << data->filename << " missing keyframe at " << pts;
+    }
+  }
+}
+
+TEST(RenditionLadder, skipLarger) {
+  std::vector<RenditionLadder::Rendition> renditions(2);
+  renditions[0].width = 100000;
+  renditions[1].width = 320;
+  if (nullptr == avcodec_find_encoder_by_name(renditions[0].codec.c_str())) {
+    GTEST_SKIP() << renditions[0].codec << " isn't available";
+  }
+
+  PacketReader reader(TEST_FILE);
+  ASSERT_GT(reader.videoStreams.size(), 0);
+  Decoder decoder;
+  decoder.subscribe(reader.videoStreams[0]);
+  RenditionLadder ladder(renditions);
+  ladder.subscribe(&decoder);
+  long big = 0;
+  long small = 0;
+  ladder.stream(0)->packets.connect([&big](const Packet::pointer&, const StreamData::pointer&) { big++; });
+  ladder.stream(1)->packets.connect([&small](const Packet::pointer&, const StreamData::pointer&) { small++; });
+
+  reader.sendEvent(PacketReaderStateMachine::play{});
+  reader.join();
+  ladder.flush();
+
+  ASSERT_FALSE(ladder.active(0));
+  ASSERT_TRUE(ladder.active(1));
+  ASSERT_EQ(0, big);
+  ASSERT_GT(small, 0);
+}
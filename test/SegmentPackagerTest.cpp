@@ -0,0 +1,263 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Package the test video for HLS and DASH and make sure the playlists
+ * point at segments that are there and that play back.
+ */
+
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fr/media2/IOSource.h>
+#include <fr/media2/PacketReader.h>
+#include <fr/media2/SegmentPackager.h>
+#include <fr/media2/Segmenter.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace fr::media2;
+
+// Counts how many times each file gets written
+class CountingOutput : public MemoryOutput {
+public:
+  void put(const std::string& name, std::span<const uint8_t> data) override {
+    {
+      std::lock_guard<std::mutex> lock(countMutex);
+      puts[name]++;
+    }
+    MemoryOutput::put(name, data);
+  }
+
+  size_t count(const std::string& name) {
+    std::lock_guard<std::mutex> lock(countMutex);
+    return puts[name];
+  }
+
+  // Distinct files that have been written whose names start with prefix
+  size_t written(const std::string& prefix) {
+    std::lock_guard<std::mutex> lock(countMutex);
+    size_t ret = 0;
+    for (const auto& [name, count] : puts) {
+      if (0 == name.rfind(prefix, 0)) {
+        ret++;
+      }
+    }
+    return ret;
+  }
+
+  std::string text(const std::string& name) {
+    File file = get(name);
+    return file ? std::string(file->begin(), file->end()) : std::string();
+  }
+
+private:
+  std::mutex countMutex;
+  std::map<std::string, size_t> puts;
+};
+
+static void package(const std::vector<SegmentPackager*>& packagers) {
+  PacketReader reader(TEST_FILE);
+  ASSERT_GT(reader.videoStreams.size(), 0);
+  ASSERT_GT(reader.audioStreams.size(), 0);
+  Segmenter videoSegmenter;
+  // Doesn't line up with the video on purpose
+  Segmenter audioSegmenter(100);
+  videoSegmenter.subscribe(reader.videoStreams[0]);
+  audioSegmenter.subscribe(reader.audioStreams[0]);
+  for (SegmentPackager* packager : packagers) {
+    packager->subscribe(&videoSegmenter);
+    packager->subscribe(&audioSegmenter);
+  }
+  reader.sendEvent(PacketReaderStateMachine::play{});
+  reader.join();
+  videoSegmenter.flush();
+  audioSegmenter.flush();
+  for (SegmentPackager* packager : packagers) {
+    packager->flush();
+    packager->unsubscribe();
+  }
+}
+
+static size_t countLines(const std::string& text, const std::string& start) {
+  size_t ret = 0;
+  std::istringstream in(text);
+  std::string line;
+  while (std::getline(in, line)) {
+    if (0 == line.rfind(start, 0)) {
+      ret++;
+    }
+  }
+  return ret;
+}
+
+// Segment names in a media playlist
+static std::vector<std::string> listed(const std::string& playlist) {
+  std::vector<std::string> ret;
+  std::istringstream in(playlist);
+  std::string line;
+  while (std::getline(in, line)) {
+    if (!line.empty() && '#' != line[0]) {
+      ret.push_back(line);
+    }
+  }
+  return ret;
+}
+
+static size_t countPackets(const std::shared_ptr<PacketReader>& reader) {
+  size_t packets = 0;
+  for (auto stream : reader->streams) {
+    stream->packets.connect([&packets](const Packet::pointer&, const StreamData::pointer&) {
+      packets++;
+    });
+  }
+  reader->sendEvent(PacketReaderStateMachine::play{});
+  reader->join();
+  return packets;
+}
+
+TEST(SegmentPackagerTest, fmp4) {
+  auto output = std::make_shared<CountingOutput>();
+  SegmentPackager::Settings settings;
+  settings.dash = true;
+  settings.window = 0;
+  SegmentPackager packager(settings, output);
+  package({&packager});
+
+  ASSERT_EQ(0, packager.failures());
+  ASSERT_GT(packager.segments(), 2);
+  // The init segments are only written once
+  ASSERT_EQ(1, output->count("stream_video_init.mp4"));
+  ASSERT_EQ(1, output->count("stream_audio_init.mp4"));
+
+  std::string videoPlaylist = output->text("stream_video.m3u8");
+  std::string audioPlaylist = output->text("stream_audio.m3u8");
+  ASSERT_NE(std::string::npos, videoPlaylist.find("#EXT-X-MAP:URI=\"stream_video_init.mp4\""));
+  ASSERT_NE(std::string::npos, videoPlaylist.find("#EXT-X-ENDLIST"));
+  ASSERT_NE(std::string::npos, audioPlaylist.find("#EXT-X-ENDLIST"));
+  // Nothing drops out of the window when there's no window
+  size_t videoSegments = countLines(videoPlaylist, "#EXTINF:");
+  size_t audioSegments = countLines(audioPlaylist, "#EXTINF:");
+  ASSERT_GT(videoSegments, 1);
+  ASSERT_EQ(videoSegments, output->written("stream_video_") - 1);
+  ASSERT_EQ(audioSegments, output->written("stream_audio_") - 1);
+  ASSERT_EQ(packager.segments(), videoSegments + audioSegments);
+  // Audio is cut on the video segments, so there's one for each video
+  // segment (and maybe a bit left over at the end)
+  ASSERT_GE(audioSegments, videoSegments);
+  ASSERT_LE(audioSegments, videoSegments + 1);
+
+  std::string master = output->text("stream.m3u8");
+  ASSERT_NE(std::string::npos, master.find("CODECS=\"avc1."));
+  ASSERT_NE(std::string::npos, master.find("AUDIO=\"audio\""));
+  ASSERT_NE(std::string::npos, master.find("stream_video.m3u8"));
+
+  std::string mpd = output->text("stream.mpd");
+  ASSERT_EQ(2, countLines(mpd, "    <AdaptationSet"));
+  ASSERT_EQ(videoSegments + audioSegments, countLines(mpd, "            <S t="));
+  ASSERT_NE(std::string::npos, mpd.find("mediaPresentationDuration"));
+
+  // The init segment and any one segment after it make a file that
+  // plays
+  for (std::string track : {"video", "audio"}) {
+    auto init = output->get("stream_" + track + "_init.mp4");
+    std::vector<std::string> names = listed(output->text("stream_" + track + ".m3u8"));
+    auto segment = output->get(names[names.size() / 2]);
+    ASSERT_TRUE(init);
+    ASSERT_TRUE(segment);
+    auto joined = std::make_shared<std::vector<uint8_t>>(*init);
+    joined->insert(joined->end(), segment->begin(), segment->end());
+    auto reader = std::make_shared<PacketReader>(std::make_shared<MemorySource>(*joined, joined));
+    ASSERT_GT(countPackets(reader), 0);
+  }
+}
+
+TEST(SegmentPackagerTest, tsWindow) {
+  std::filesystem::path directory = std::filesystem::temp_directory_path() /
+    ("SegmentPackagerTest_" + std::to_string(getpid()));
+  std::filesystem::remove_all(directory);
+  auto output = std::make_shared<DirectoryOutput>(directory);
+  SegmentPackager::Settings settings;
+  settings.container = SegmentPackager::Container::ts;
+  settings.window = 2;
+  settings.linger = 1;
+  SegmentPackager packager(settings, output);
+  package({&packager});
+  ASSERT_EQ(0, packager.failures());
+
+  std::ifstream in(directory / "stream_video.m3u8");
+  std::stringstream playlist;
+  playlist << in.rdbuf();
+  std::vector<std::string> names = listed(playlist.str());
+  ASSERT_GT(names.size(), 0);
+  ASSERT_LE(names.size(), 2);
+  ASSERT_EQ(std::string::npos, playlist.str().find("#EXT-X-MAP"));
+  ASSERT_NE(std::string::npos, playlist.str().find("#EXT-X-ENDLIST"));
+
+  // The window and the lingering segment are all that's left, and no
+  // temp files
+  size_t videoFiles = 0;
+  for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+    std::string name = entry.path().filename().string();
+    ASSERT_EQ(std::string::npos, name.find(".tmp"));
+    if (0 == name.rfind("stream_video_", 0) && name.ends_with(".ts")) {
+      videoFiles++;
+    }
+  }
+  ASSERT_LE(videoFiles, 3);
+  ASSERT_GE(videoFiles, names.size());
+
+  // Every TS segment starts with a sync byte and plays by itself
+  for (const std::string& name : names) {
+    std::ifstream segment(directory / name, std::ios::binary);
+    ASSERT_EQ(0x47, segment.get());
+    ASSERT_GT(countPackets(std::make_shared<PacketReader>((directory / name).string())), 0);
+  }
+  std::filesystem::remove_all(directory);
+}
+
+TEST(SegmentPackagerTest, sharedPool) {
+  auto pool = std::make_shared<PackagerPool>(2);
+  auto output = std::make_shared<CountingOutput>();
+  std::vector<std::unique_ptr<SegmentPackager>> channels;
+  std::vector<SegmentPackager*> packagers;
+  for (int i = 0; i < 4; ++i) {
+    SegmentPackager::Settings settings;
+    settings.name = "channel" + std::to_string(i);
+    channels.push_back(std::make_unique<SegmentPackager>(settings, output, pool));
+    packagers.push_back(channels.back().get());
+  }
+  package(packagers);
+
+  // Every channel got the same thing
+  for (auto& channel : channels) {
+    ASSERT_EQ(0, channel->failures());
+    ASSERT_EQ(channels[0]->segments(), channel->segments());
+    ASSERT_EQ(channels[0]->bytes(), channel->bytes());
+  }
+  for (int i = 0; i < 4; ++i) {
+    std::string name = "channel" + std::to_string(i);
+    std::string playlist = output->text(name + "_video.m3u8");
+    ASSERT_NE(std::string::npos, playlist.find("#EXT-X-ENDLIST"));
+    for (const std::string& segment : listed(playlist)) {
+      ASSERT_TRUE(output->get(segment)) << segment;
+    }
+    ASSERT_TRUE(output->get(name + ".m3u8"));
+  }
+}
@@ -0,0 +1,158 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Store the test video's segments and play them back
+ */
+
+#include <fr/media2.h>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TestHelpers.h"
+
+using namespace fr::media2;
+using namespace fr::media2::test;
+
+namespace {
+
+  class FrameCounter : public FrameSubscriber {
+  protected:
+    void process(Frame::const_pointer frame, const StreamData::pointer& stream) override {
+      nframes++;
+    }
+
+  public:
+    long nframes = 0;
+  };
+
+  // Stores the video stream and returns its segments
+  std::vector<Segment::pointer> storeVideo(const std::filesystem::path& root, std::filesystem::path& streamDir) {
+    std::filesystem::remove_all(root);
+    auto segments = videoSegments();
+
+    SegmentStore store(root);
+    for (const auto& segment : segments) {
+      store.append(*segment);
+    }
+    store.close();
+    streamDir = store.streamDir(segments[0]->jobId);
+    return segments;
+  }
+
+  size_t packetCount(const std::vector<Segment::pointer>& segments, size_t first, size_t last) {
+    size_t ret = 0;
+    for (size_t i = first; i < last; ++i) {
+      ret += segments[i]->packets.size();
+    }
+    return ret;
+  }
+
+}
+
+TEST(SegmentStoreReader, replayEverything) {
+  std::filesystem::path dir;
+  auto segments = storeVideo(std::filesystem::temp_directory_path() / "SegmentStoreReaderTest.everything", dir);
+  ASSERT_GT(segments.size(), 2);
+
+  SegmentStoreReader reader(dir, 2);
+  ASSERT_EQ(segments.size(), reader.size());
+  ASSERT_TRUE(reader.stream());
+  ASSERT_EQ(AVMEDIA_TYPE_VIDEO, reader.stream()->data->parameters->codec_type);
+
+  size_t packets = 0;
+  int64_t lastDts = AV_NOPTS_VALUE;
+  long outOfOrder = 0;
+  auto connection = reader.stream()->packets.connect([&](const Packet::pointer& packet, const StreamData::pointer&) {
+    if (AV_NOPTS_VALUE != lastDts && packet->dts < lastDts) {
+      outOfOrder++;
+    }
+    lastDts = packet->dts;
+    packets++;
+  });
+  ASSERT_EQ(segments.size(), reader.replay());
+  connection.disconnect();
+  ASSERT_EQ(packetCount(segments, 0, segments.size()), packets);
+  ASSERT_EQ(0, outOfOrder);
+}
+
+// A range in the middle starts at the segment containing start and
+// stops short of end
+
+TEST(SegmentStoreReader, replayRange) {
+  std::filesystem::path dir;
+  auto segments = storeVideo(std::filesystem::temp_directory_path() / "SegmentStoreReaderTest.range", dir);
+  ASSERT_GT(segments.size(), 3);
+
+  SegmentStoreReader reader(dir);
+  int64_t start = segments[1]->dts + 1;
+  int64_t end = segments[3]->dts;
+  auto [first, last] = reader.range(start, end);
+  ASSERT_EQ(1, first);
+  ASSERT_EQ(3, last);
+
+  size_t packets = 0;
+  int64_t firstDts = AV_NOPTS_VALUE;
+  auto connection = reader.stream()->packets.connect([&](const Packet::pointer& packet, const StreamData::pointer&) {
+    if (AV_NOPTS_VALUE == firstDts) {
+      firstDts = packet->dts;
+    }
+    ASSERT_LT(packet->dts, end);
+    packets++;
+  });
+  ASSERT_EQ(2, reader.replay(start, end));
+  connection.disconnect();
+  ASSERT_EQ(segments[1]->dts, firstDts);
+  ASSERT_EQ(packetCount(segments, 1, 3), packets);
+
+  // Nothing in there
+  ASSERT_EQ(0, reader.replay(end, start));
+}
+
+// Packets from the store go straight into a decoder
+
+TEST(SegmentStoreReader, decode) {
+  std::filesystem::path dir;
+  auto segments = storeVideo(std::filesystem::temp_directory_path() / "SegmentStoreReaderTest.decode", dir);
+  ASSERT_GT(segments.size(), 0);
+
+  SegmentStoreReader reader(dir);
+  Decoder decoder;
+  FrameCounter counter;
+  decoder.subscribe(reader.stream());
+  counter.subscribe(&decoder);
+  reader.replay();
+  ASSERT_GT(counter.nframes, 0);
+}
+
+// Stopping from another thread cuts a replay short
+
+TEST(SegmentStoreReader, stop) {
+  std::filesystem::path dir;
+  auto segments = storeVideo(std::filesystem::temp_directory_path() / "SegmentStoreReaderTest.stop", dir);
+  ASSERT_GT(segments.size(), 2);
+
+  SegmentStoreReader reader(dir, 1);
+  size_t packets = 0;
+  auto connection = reader.stream()->packets.connect([&](const Packet::pointer&, const StreamData::pointer&) {
+    if (1 == ++packets) {
+      std::thread([&reader]{ reader.stop(); }).join();
+    }
+  });
+  ASSERT_LT(reader.replay(), segments.size());
+  connection.disconnect();
+}
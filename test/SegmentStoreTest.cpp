@@ -0,0 +1,154 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Store segments from the test video and read them back
+ */
+
+#include <fr/media2.h>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "TestHelpers.h"
+
+using namespace fr::media2;
+using namespace fr::media2::test;
+
+namespace {
+
+  std::filesystem::path freshRoot(const std::string& name) {
+    std::filesystem::path root = std::filesystem::temp_directory_path() / name;
+    std::filesystem::remove_all(root);
+    return root;
+  }
+
+}
+
+TEST(SegmentStore, appendAndFind) {
+  auto segments = videoSegments();
+  ASSERT_GT(segments.size(), 2);
+  std::filesystem::path root = freshRoot("SegmentStoreTest.appendAndFind");
+  uuid_t stream;
+  uuid_copy(stream, segments[0]->jobId);
+
+  SegmentStore store(root);
+  for (const auto& segment : segments) {
+    ASSERT_TRUE(store.append(*segment));
+  }
+  // Already have that one
+  ASSERT_FALSE(store.append(*segments[0]));
+  store.commit();
+  ASSERT_EQ(segments.size(), store.size(stream));
+  ASSERT_GT(store.commits(), 0);
+
+  SegmentStore::IndexEntry entry;
+  ASSERT_FALSE(store.find(stream, segments[0]->dts - 1, entry));
+  for (size_t i = 0; i < segments.size(); ++i) {
+    ASSERT_TRUE(store.find(stream, segments[i]->dts, entry));
+    ASSERT_EQ(segments[i]->dts, entry.dts);
+    ASSERT_EQ(segments[i]->pts, entry.pts);
+    ASSERT_TRUE(entry.key());
+  }
+  // Somewhere in the middle of the second segment is still the second segment
+  ASSERT_TRUE(store.find(stream, segments[2]->dts - 1, entry));
+  ASSERT_EQ(segments[1]->dts, entry.dts);
+
+  auto loaded = store.load(stream, entry);
+  ASSERT_EQ(segments[1]->dts, loaded->dts);
+  ASSERT_EQ(segments[1]->packets.size(), loaded->packets.size());
+  for (size_t i = 0; i < loaded->packets.size(); ++i) {
+    ASSERT_EQ(segments[1]->packets[i]->size, loaded->packets[i]->size);
+    ASSERT_EQ(0, memcmp(segments[1]->packets[i]->data, loaded->packets[i]->data, loaded->packets[i]->size));
+  }
+}
+
+// The mmapped index sees the same thing the store does
+
+TEST(SegmentStore, index) {
+  auto segments = videoSegments();
+  ASSERT_GT(segments.size(), 2);
+  std::filesystem::path root = freshRoot("SegmentStoreTest.index");
+  uuid_t stream;
+  uuid_copy(stream, segments[0]->jobId);
+
+  SegmentStore store(root);
+  size_t half = segments.size() / 2;
+  for (size_t i = 0; i < half; ++i) {
+    store.append(*segments[i]);
+  }
+  store.commit();
+
+  SegmentIndex index(store.streamDir(stream));
+  ASSERT_EQ(half, index.size());
+  ASSERT_EQ(segments[0]->time_base.num, index.timeBase().num);
+  ASSERT_EQ(segments[0]->time_base.den, index.timeBase().den);
+  ASSERT_EQ(index.size(), index.find(segments[0]->dts - 1));
+  ASSERT_EQ(1, index.find(segments[1]->dts));
+  ASSERT_EQ(1, index.lowerBound(segments[0]->dts + 1));
+
+  for (size_t i = half; i < segments.size(); ++i) {
+    store.append(*segments[i]);
+  }
+  store.commit();
+  ASSERT_TRUE(index.refresh());
+  ASSERT_EQ(segments.size(), index.size());
+  ASSERT_EQ(segments.back()->dts, index[index.size() - 1].dts);
+  ASSERT_FALSE(index.refresh());
+}
+
+// Wire format blobs go in without being decoded, and anything written
+// after the last commit is gone when the stream is opened again
+
+TEST(SegmentStore, wireBlobsAndRecovery) {
+  auto segments = videoSegments();
+  ASSERT_GT(segments.size(), 2);
+  std::filesystem::path root = freshRoot("SegmentStoreTest.wireBlobsAndRecovery");
+  uuid_t stream;
+  uuid_copy(stream, segments[0]->jobId);
+  uint64_t logSize = 0;
+  std::filesystem::path log;
+
+  {
+    SegmentStore store(root);
+    log = SegmentStore::logPath(store.streamDir(stream));
+    for (const auto& segment : segments) {
+      std::stringstream buffer;
+      SegmentWire::write(*segment, buffer);
+      std::string data = buffer.str();
+      ASSERT_TRUE(store.append(stream, (const uint8_t*) data.data(), data.size()));
+      logSize += data.size();
+    }
+    store.close();
+    ASSERT_EQ(segments.size(), store.size(stream));
+  }
+  ASSERT_EQ(logSize, std::filesystem::file_size(log));
+
+  // Half a segment that never got committed
+  {
+    std::ofstream junk(log, std::ios::app | std::ios::binary);
+    junk << "not a whole segment";
+  }
+
+  SegmentStore store(root);
+  ASSERT_EQ(segments.size(), store.size(stream));
+  ASSERT_EQ(logSize, std::filesystem::file_size(log));
+  SegmentStore::IndexEntry entry;
+  ASSERT_TRUE(store.find(stream, segments.back()->dts, entry));
+  auto loaded = store.load(stream, entry);
+  ASSERT_EQ(segments.back()->packets.size(), loaded->packets.size());
+}
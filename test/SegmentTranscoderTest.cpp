@@ -0,0 +1,74 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Transcode the test video a segment at a time on several threads and
+ * make sure what comes out is in order and the size we asked for.
+ */
+
+#include <gtest/gtest.h>
+#include <fr/media2/Packet.h>
+#include <fr/media2/PacketReader.h>
+#include <fr/media2/Segmenter.h>
+#include <fr/media2/SegmentSubscriber.h>
+#include <fr/media2/SegmentTranscoder.h>
+#include <memory>
+#include <vector>
+#include "TestHelpers.h"
+
+using namespace fr::media2;
+using namespace fr::media2::test;
+
+TEST(SegmentTranscoder, transcode) {
+  SegmentTranscoder::Settings settings;
+  settings.width = 320;
+  settings.options["preset"] = "ultrafast";
+  if (nullptr == avcodec_find_encoder_by_name(settings.codec.c_str())) {
+    GTEST_SKIP() << settings.codec << " isn't available";
+  }
+
+  PacketReader reader(TEST_FILE);
+  ASSERT_GT(reader.videoStreams.size(), 0);
+  Segmenter segmenter;
+  SegmentCollector source;
+  SegmentTranscoder transcoder(4, settings);
+  SegmentCollector output;
+  segmenter.subscribe(reader.videoStreams[0]);
+  source.subscribe(&segmenter);
+  transcoder.subscribe(&segmenter);
+  output.subscribe(&transcoder);
+
+  reader.sendEvent(PacketReaderStateMachine::play{});
+  reader.join();
+  segmenter.flush();
+  transcoder.flush();
+
+  ASSERT_EQ(0, transcoder.failures());
+  ASSERT_GT(source.collected.size(), 1);
+  ASSERT_EQ(source.collected.size(), output.collected.size());
+  for (size_t i = 0; i < output.collected.size(); ++i) {
+    auto& in = source.collected[i];
+    auto& out = output.collected[i];
+    // Same segment, smaller picture
+    ASSERT_EQ(in->packets.size(), out->packets.size());
+    ASSERT_EQ(320, out->parameters.width);
+    ASSERT_EQ(180, out->parameters.height);
+    ASSERT_TRUE(Packet::containsIFrame(out->packets[0]));
+    ASSERT_EQ(0, uuid_compare(in->jobId, out->jobId));
+    if (i > 0) {
+      ASSERT_GT(out->dts, output.collected[i - 1]->dts);
+    }
+  }
+}
@@ -32,7 +32,7 @@ using namespace boost::serialization;
 class PacketHelper : public PacketSubscriber {
 protected:
   void process(const Packet::pointer &packet,
-	       StreamData::pointer stream) override {
+	       const StreamData::pointer& stream) override {
     testPacket = Packet::copy(packet);
     hasPacket = true;
     unsubscribe();
@@ -77,7 +77,7 @@ TEST(SerializationTest, serializePacket) {
 class SegmentHelper : public PacketSubscriber {
 protected:
   void process(const Packet::pointer &packet,
-	       StreamData::pointer stream) override {
+	       const StreamData::pointer& stream) override {
     if (nullptr == segment.get()) {
      // We don't need a UUID right now
 
@@ -131,6 +131,55 @@ TEST(SerializationTest, serializeSegment) {
   ASSERT_EQ(helper.segment->packets.size(), result->packets.size());
 }
 
+// Same thing with the flat wire format. Packets in the decoded segment
+// should point into the buffer they were decoded from.
+
+TEST(SerializationTest, wireSegment) {
+  std::stringstream buffer;
+
+  auto reader = std::make_shared<PacketReader>(TEST_FILE);
+  SegmentHelper helper;
+  ASSERT_GT(reader->videoStreams.size(), 0);
+  helper.subscribe(reader->videoStreams[0]);
+  reader->sendEvent(PacketReaderStateMachine::play{});
+  reader->join();
+  ASSERT_NE(helper.segment.get(), nullptr);
+  ASSERT_GT(helper.segment->packets.size(), 0);
+
+  SegmentWire::write(*helper.segment, buffer);
+  std::string flat = buffer.str();
+  AVBufferRef* data = av_buffer_alloc(flat.size());
+  memcpy(data->data, flat.data(), flat.size());
+
+  SegmentWire::Header header;
+  ASSERT_TRUE(SegmentWire::readHeader(data->data, data->size, header));
+  ASSERT_EQ(helper.segment->dts, header.dts);
+
+  Segment::pointer result = SegmentWire::decode(data);
+  ASSERT_EQ(helper.segment->pts, result->pts);
+  ASSERT_EQ(helper.segment->dts, result->dts);
+  ASSERT_EQ(helper.segment->parameters.codec_id, result->parameters.codec_id);
+  ASSERT_EQ(helper.segment->parameters.extradata_size, result->parameters.extradata_size);
+  ASSERT_EQ(helper.segment->packets.size(), result->packets.size());
+  for (size_t i = 0; i < result->packets.size(); ++i) {
+    const AVPacket& expected = *helper.segment->packets[i];
+    const AVPacket& actual = *result->packets[i];
+    ASSERT_EQ(expected.dts, actual.dts);
+    ASSERT_EQ(expected.flags, actual.flags);
+    ASSERT_EQ(expected.size, actual.size);
+    ASSERT_EQ(0, memcmp(expected.data, actual.data, expected.size));
+    ASSERT_GE(actual.data, data->data);
+    ASSERT_LT(actual.data, data->data + data->size);
+  }
+  av_buffer_unref(&data);
+
+  // SegmentUnpacker should recognize it in a stringstream too
+  std::stringstream again(flat);
+  SegmentUnpacker unpacker(1, [](Stream::pointer) {});
+  unpacker.receive(again);
+  unpacker.close();
+}
+
 // Well segments seem to work. What if I have a LOT of segments?
 // 
 
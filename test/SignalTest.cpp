@@ -0,0 +1,108 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <fr/media2/Signal.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using fr::media2::Connection;
+using fr::media2::Signal;
+
+TEST(SignalTest, connectAndDisconnect) {
+  Signal<void(int)> signal;
+  int first = 0;
+  int second = 0;
+  Connection a = signal.connect([&first](int i) { first += i; });
+  Connection b = signal.connect([&second](int i) { second += i; });
+  ASSERT_EQ(2, signal.num_slots());
+  signal(2);
+  ASSERT_EQ(2, first);
+  ASSERT_EQ(2, second);
+  a.disconnect();
+  ASSERT_FALSE(a.connected());
+  ASSERT_TRUE(b.connected());
+  signal(3);
+  ASSERT_EQ(2, first);
+  ASSERT_EQ(5, second);
+  signal.disconnect_all_slots();
+  ASSERT_TRUE(signal.empty());
+  ASSERT_FALSE(b.connected());
+}
+
+// Slots can disconnect themselves (or connect new ones) while the
+// signal is firing. New ones don't get called until the next time.
+
+TEST(SignalTest, changeWhileFiring) {
+  Signal<void()> signal;
+  int calls = 0;
+  int added = 0;
+  Connection self;
+  self = signal.connect([&] {
+    calls++;
+    self.disconnect();
+    signal.connect([&added] { added++; });
+  });
+  signal();
+  ASSERT_EQ(1, calls);
+  ASSERT_EQ(0, added);
+  signal();
+  ASSERT_EQ(1, calls);
+  ASSERT_EQ(1, added);
+}
+
+TEST(SignalTest, outlivesSignal) {
+  Connection connection;
+  {
+    Signal<void()> signal;
+    connection = signal.connect([] {});
+    ASSERT_TRUE(connection.connected());
+  }
+  ASSERT_FALSE(connection.connected());
+  connection.disconnect();
+}
+
+// Several threads firing while another one subscribes and unsubscribes
+
+TEST(SignalTest, concurrent) {
+  Signal<void(int)> signal;
+  std::atomic<long> total = 0;
+  Connection always = signal.connect([&total](int i) { total += i; });
+  std::atomic<bool> done = false;
+  std::thread churn([&] {
+    while (!done) {
+      auto connection = signal.connect([](int) {});
+      connection.disconnect();
+    }
+  });
+  std::vector<std::thread> firing;
+  for (int t = 0; t < 4; ++t) {
+    firing.emplace_back([&signal] {
+      for (int i = 0; i < 10000; ++i) {
+        signal(1);
+      }
+    });
+  }
+  for (auto& thread : firing) {
+    thread.join();
+  }
+  done = true;
+  churn.join();
+  ASSERT_EQ(40000, total);
+}
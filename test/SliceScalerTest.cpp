@@ -0,0 +1,116 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Tests the banded scaler. Scaling on several threads should give the
+ * same picture as scaling the whole frame at once.
+ */
+
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <fr/media2/Frame.h>
+#include <fr/media2/SliceScaler.h>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+using namespace fr::media2;
+
+// Something with detail in it, so a bad band edge would show
+static Frame::pointer pattern(int width, int height, AVPixelFormat format) {
+  auto frame = Frame::create(width, height, format);
+  const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+  for (int p = 0; p < av_pix_fmt_count_planes(format); ++p) {
+    int rows = (1 == p || 2 == p) ? -((-height) >> desc->log2_chroma_h) : height;
+    int bytes = av_image_get_linesize(format, width, p);
+    for (int y = 0; y < rows; ++y) {
+      uint8_t* line = frame->data[p] + y * frame->linesize[p];
+      for (int x = 0; x < bytes; ++x) {
+        line[x] = static_cast<uint8_t>((x * 7 + y * 3 + ((x / 16 + y / 16) % 2) * 100) & 0xff);
+      }
+    }
+  }
+  return frame;
+}
+
+// Largest difference between any two bytes of the picture
+static int maxDifference(const AVFrame* a, const AVFrame* b) {
+  AVPixelFormat format = (AVPixelFormat) a->format;
+  const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+  int ret = 0;
+  for (int p = 0; p < av_pix_fmt_count_planes(format); ++p) {
+    int rows = (1 == p || 2 == p) ? -((-a->height) >> desc->log2_chroma_h) : a->height;
+    int bytes = av_image_get_linesize(format, a->width, p);
+    for (int y = 0; y < rows; ++y) {
+      const uint8_t* la = a->data[p] + y * a->linesize[p];
+      const uint8_t* lb = b->data[p] + y * b->linesize[p];
+      for (int x = 0; x < bytes; ++x) {
+        ret = std::max(ret, std::abs(la[x] - lb[x]));
+      }
+    }
+  }
+  return ret;
+}
+
+static void compare(int srcWidth, int srcHeight, AVPixelFormat srcFormat,
+                    int dstWidth, int dstHeight, AVPixelFormat dstFormat,
+                    int threads, int bandHeight = 0) {
+  auto source = pattern(srcWidth, srcHeight, srcFormat);
+  SliceScaler whole(srcWidth, srcHeight, srcFormat, dstWidth, dstHeight, dstFormat, SWS_BICUBIC, 1);
+  SliceScaler banded(srcWidth, srcHeight, srcFormat, dstWidth, dstHeight, dstFormat, SWS_BICUBIC,
+                     threads, bandHeight);
+  ASSERT_EQ(1, whole.bands());
+  auto expected = Frame::create(dstWidth, dstHeight, dstFormat);
+  auto actual = Frame::create(dstWidth, dstHeight, dstFormat);
+  whole.scale(source.get(), expected.get());
+  // Twice, to make sure the threads pick up the second frame too
+  for (int i = 0; i < 2; ++i) {
+    banded.scale(source.get(), actual.get());
+    ASSERT_LE(maxDifference(expected.get(), actual.get()), 2);
+  }
+}
+
+TEST(SliceScalerTest, uhdToHd) {
+  SliceScaler scaler(3840, 2160, AV_PIX_FMT_YUV420P, 1920, 1080, AV_PIX_FMT_YUV420P, SWS_BICUBIC, 4);
+  ASSERT_EQ(4, scaler.bands());
+  ASSERT_EQ(4, scaler.threads());
+  compare(3840, 2160, AV_PIX_FMT_YUV420P, 1920, 1080, AV_PIX_FMT_YUV420P, 4);
+}
+
+TEST(SliceScalerTest, hdTo720) {
+  compare(1920, 1080, AV_PIX_FMT_YUV420P, 1280, 720, AV_PIX_FMT_YUV420P, 3);
+}
+
+TEST(SliceScalerTest, convertFormat) {
+  compare(1920, 1080, AV_PIX_FMT_YUV420P, 640, 360, AV_PIX_FMT_BGR24, 4);
+  compare(1280, 720, AV_PIX_FMT_BGR24, 1920, 1080, AV_PIX_FMT_YUV420P, 4);
+}
+
+TEST(SliceScalerTest, bandHeight) {
+  SliceScaler scaler(3840, 2160, AV_PIX_FMT_YUV420P, 1920, 1080, AV_PIX_FMT_YUV420P, SWS_BICUBIC, 2, 64);
+  ASSERT_EQ(17, scaler.bands());
+  ASSERT_EQ(2, scaler.threads());
+  compare(3840, 2160, AV_PIX_FMT_YUV420P, 1920, 1080, AV_PIX_FMT_YUV420P, 2, 64);
+}
+
+// Sizes that never line up fall back to one band
+
+TEST(SliceScalerTest, noSplit) {
+  SliceScaler scaler(1001, 563, AV_PIX_FMT_YUV420P, 640, 359, AV_PIX_FMT_YUV420P, SWS_BICUBIC, 4);
+  ASSERT_EQ(1, scaler.bands());
+  compare(1001, 563, AV_PIX_FMT_YUV420P, 640, 359, AV_PIX_FMT_YUV420P, 4);
+}
@@ -0,0 +1,90 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <fr/media2/Segment.h>
+#include <fr/media2/StreamCache.h>
+#include <thread>
+#include <uuid.h>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+using namespace fr::media2;
+
+static Segment::pointer makeSegment() {
+  uuid_t id;
+  uuid_generate(id);
+  AVCodecParameters* parameters = avcodec_parameters_alloc();
+  parameters->codec_type = AVMEDIA_TYPE_VIDEO;
+  parameters->codec_id = AV_CODEC_ID_H264;
+  auto segment = Segment::create(id, *parameters);
+  avcodec_parameters_free(&parameters);
+  return segment;
+}
+
+TEST(StreamCacheTest, hitAndMiss) {
+  StreamCache cache;
+  auto segment = makeSegment();
+  ASSERT_FALSE(cache.get(segment->jobId));
+  bool created = false;
+  auto stream = cache.get(segment.get(), created);
+  ASSERT_TRUE(created);
+  ASSERT_TRUE(stream);
+  ASSERT_EQ(stream, cache.get(segment.get(), created));
+  ASSERT_FALSE(created);
+  ASSERT_EQ(stream, cache.get(segment->jobId));
+  ASSERT_EQ(1, cache.size());
+}
+
+// Lots of streams should all land somewhere and all be found again,
+// however many shards there are
+
+TEST(StreamCacheTest, shards) {
+  for (size_t shards : {1, 3, 16}) {
+    StreamCache cache(600, 10, shards);
+    std::vector<Segment::pointer> segments;
+    std::vector<Stream::pointer> streams;
+    for (int i = 0; i < 500; ++i) {
+      segments.push_back(makeSegment());
+      streams.push_back(cache.get(segments.back().get()));
+    }
+    ASSERT_EQ(500, cache.size());
+    for (size_t i = 0; i < segments.size(); ++i) {
+      ASSERT_EQ(streams[i], cache.get(segments[i]->jobId));
+    }
+  }
+}
+
+// Entries that aren't used expire. Ones that keep getting used don't.
+
+TEST(StreamCacheTest, expiry) {
+  StreamCache cache(2, 1);
+  auto idle = makeSegment();
+  auto busy = makeSegment();
+  cache.get(idle.get());
+  cache.get(busy.get());
+  for (int i = 0; i < 8; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    ASSERT_TRUE(cache.get(busy->jobId));
+  }
+  ASSERT_FALSE(cache.get(idle->jobId));
+  ASSERT_EQ(1, cache.size());
+}
@@ -0,0 +1,80 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Helpers the tests (and the benchmarks) kept writing for themselves.
+ * Everything reads TEST_FILE, so whatever includes this needs that
+ * defined.
+ */
+
+#pragma once
+
+#include <fr/media2/Packet.h>
+#include <fr/media2/PacketReader.h>
+#include <fr/media2/Segment.h>
+#include <fr/media2/Segmenter.h>
+#include <fr/media2/SegmentSubscriber.h>
+#include <mutex>
+#include <vector>
+
+namespace fr::media2::test {
+
+  // Holds on to copies of every non-empty segment it's sent
+  class SegmentCollector : public SegmentSubscriber {
+  public:
+    std::vector<Segment::pointer> collected;
+    // Stream data that came with the last segment
+    StreamData::pointer stream;
+
+    void process(const Segment::pointer& segment, StreamData::pointer stream) override {
+      if (segment && !segment->empty()) {
+        collected.push_back(Segment::copy(segment));
+        this->stream = stream;
+      }
+    }
+  };
+
+  // Plays reader through and returns every stream's dts, in the order
+  // they came out
+  inline std::vector<std::vector<int64_t>> readDts(PacketReader& reader) {
+    std::vector<std::vector<int64_t>> ret(reader.streams.size());
+    std::mutex lock;
+    for (size_t i = 0; i < reader.streams.size(); ++i) {
+      reader.streams[i]->packets.connect(
+        [&ret, &lock, i](const Packet::pointer& packet, const StreamData::pointer&) {
+          std::lock_guard<std::mutex> guard(lock);
+          ret[i].push_back(packet->dts);
+        });
+    }
+    reader.sendEvent(PacketReaderStateMachine::play{});
+    reader.join();
+    return ret;
+  }
+
+  // The test file's first video stream, chopped into segments
+  inline std::vector<Segment::pointer> videoSegments() {
+    PacketReader reader{TEST_FILE};
+    Segmenter segmenter;
+    SegmentCollector collector;
+    segmenter.subscribe(reader.videoStreams.at(0));
+    collector.subscribe(&segmenter);
+    reader.sendEvent(PacketReaderStateMachine::play{});
+    reader.join();
+    segmenter.flush();
+    collector.unsubscribe();
+    return std::move(collector.collected);
+  }
+
+}
@@ -26,9 +26,14 @@
 #include <vector>
 #include <iostream>
 #include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
 #include <uuid.h>
+#include "TestHelpers.h"
 
 using namespace fr::media2;
+using namespace fr::media2::test;
 
 TEST(Transport, lowLevelSegments) {
   PacketReader reader{TEST_FILE};
@@ -94,12 +99,9 @@ TEST(Transport, lowLevelSegments) {
 }
 
 /**
- * Transport reassembly -- Muxer really isn't geared toward multi-threaded
- * input, which is going to be a problem eventually. But I can test my
- * transport reassembly anyway by running my SegmentUnpacker with one
- * thread. That should be linear (enough) not to overwhelm
- * av_interleaved_write_frame. Eventually I'll need to write a smarter
- * (probably threaded) muxer.
+ * Transport reassembly -- Segments come back out of the unpacker on
+ * several worker threads, so the muxer has to interleave them and put
+ * up with streams subscribing from those threads as they show up.
  */
 
 TEST(Transport, reassembly) {
@@ -111,19 +113,18 @@ TEST(Transport, reassembly) {
   if (std::filesystem::exists(outputFile)) {
     std::filesystem::remove(outputFile);
   }
-  // Set up muxer
+  // Set up muxer. It holds off on the header until every stream in
+  // the file has subscribed.
   Muxer muxer(outputFile);
+  muxer.setInterleaving(10000000, reader.streams.size());
   // Get segment subscriber waiting
   ZmqSegmentSubscriber subscriber(addr);
-  // If I make a segmentunpacker with one thread, processing should
-  // be linear (or at least linear enough.)
-  SegmentUnpacker unpacker(1, [&muxer](Stream::pointer stream) {
+  SegmentUnpacker unpacker(2, [&muxer](Stream::pointer stream) {
     std::cout << "Subscribing muxer to " << stream->data->filename << std::endl;
     try {
       muxer.subscribe(stream);
     } catch (std::exception &e) {
-      // I'm actually expecting an exception here, it's fine.
-      std::cout << e.what() << std::endl;
+      ADD_FAILURE() << e.what();
     }
   });
   unpacker.subscribe(&subscriber);
@@ -148,3 +149,95 @@ TEST(Transport, reassembly) {
   publishers.clear();
 }
 
+
+// Feed the unpacker segments that are a little out of order and make
+// sure the stream still gets its packets in dts order.
+
+TEST(Transport, orderedUnpack) {
+  auto segments = videoSegments();
+  ASSERT_GT(segments.size(), 2);
+
+  // Swap neighboring pairs
+  for (size_t i = 0; i + 1 < segments.size(); i += 2) {
+    std::swap(segments[i], segments[i + 1]);
+  }
+
+  int64_t lastDts = AV_NOPTS_VALUE;
+  long outOfOrder = 0;
+  long packets = 0;
+  std::vector<Connection> connections;
+  {
+    SegmentUnpacker unpacker(4, [&](Stream::pointer stream) {
+      connections.push_back(stream->packets.connect([&](const Packet::pointer& packet, const StreamData::pointer&) {
+        if (AV_NOPTS_VALUE != lastDts && packet->dts < lastDts) {
+          outOfOrder++;
+        }
+        lastDts = packet->dts;
+        packets++;
+      }));
+    });
+    unpacker.setReorderDepth(2);
+    for (auto& segment : segments) {
+      unpacker.receive(std::move(segment));
+    }
+    unpacker.close();
+    ASSERT_EQ(0, unpacker.lateSegments());
+  }
+  for (auto& connection : connections) {
+    connection.disconnect();
+  }
+  ASSERT_GT(packets, 0);
+  ASSERT_EQ(0, outOfOrder);
+}
+
+// Segments that come out of receivedSegment in the contiguous layout
+// get republished through the stringstream process (like the router
+// demo does), and still have to decode for segments listeners
+
+TEST(Transport, contiguousSegments) {
+  auto sent = videoSegments();
+  ASSERT_GT(sent.size(), 1);
+  std::string addr("tcp://127.0.0.1:2715");
+  std::mutex lock;
+  std::vector<Segment::pointer> received;
+  ZmqSegmentSubscriber subscriber(addr);
+  subscriber.segments.connect([&](const Segment::pointer& segment, uuid_t, AVMediaType, int, int) {
+    std::lock_guard<std::mutex> guard(lock);
+    received.push_back(Segment::copy(segment));
+  });
+  subscriber.process();
+
+  ZmqSegmentPublisher publisher(addr);
+  // Give the connection a moment, or pub/sub drops what we send
+  std::this_thread::sleep_for(std::chrono::milliseconds(250));
+  for (const auto& segment : sent) {
+    std::stringstream buffer;
+    SegmentWire::write(*segment, buffer);
+    publisher.process(buffer, segment->jobId, AVMEDIA_TYPE_VIDEO,
+                      segment->parameters.width, segment->parameters.height);
+  }
+  for (int i = 0; i < 100; ++i) {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      if (received.size() >= sent.size()) {
+        break;
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  subscriber.close();
+  subscriber.join();
+
+  ASSERT_EQ(sent.size(), received.size());
+  for (size_t i = 0; i < sent.size(); ++i) {
+    ASSERT_EQ(sent[i]->dts, received[i]->dts);
+    ASSERT_EQ(sent[i]->packets.size(), received[i]->packets.size());
+    for (size_t j = 0; j < sent[i]->packets.size(); ++j) {
+      const AVPacket* a = sent[i]->packets[j].get();
+      const AVPacket* b = received[i]->packets[j].get();
+      ASSERT_EQ(a->dts, b->dts);
+      ASSERT_EQ(a->size, b->size);
+      ASSERT_EQ(0, memcmp(a->data, b->data, a->size));
+    }
+  }
+}
@@ -0,0 +1,100 @@
+/**
+ * Copyright (C) Bruce Ide
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <fr/media2/WorkQueue.h>
+#include <thread>
+#include <vector>
+
+using fr::media2::WorkQueue;
+
+TEST(WorkQueueTest, fifo) {
+  WorkQueue<int> queue;
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_TRUE(queue.push(i));
+  }
+  ASSERT_EQ(10, queue.size());
+  int item;
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_TRUE(queue.pop(item));
+    ASSERT_EQ(i, item);
+  }
+  ASSERT_TRUE(queue.empty());
+}
+
+// Closing the queue should let consumers drain it before pop
+// starts returning false
+
+TEST(WorkQueueTest, closeDrains) {
+  WorkQueue<int> queue;
+  queue.push(1);
+  queue.push(2);
+  queue.close();
+  ASSERT_FALSE(queue.push(3));
+  int item;
+  ASSERT_TRUE(queue.pop(item));
+  ASSERT_TRUE(queue.pop(item));
+  ASSERT_EQ(2, item);
+  ASSERT_FALSE(queue.pop(item));
+}
+
+// A full queue should block the producer until a consumer
+// makes room
+
+TEST(WorkQueueTest, backpressure) {
+  WorkQueue<int> queue(2);
+  queue.push(1);
+  queue.push(2);
+  int extra = 3;
+  ASSERT_FALSE(queue.tryPush(extra));
+  std::atomic<bool> pushed = false;
+  std::thread producer([&queue, &pushed]{
+    queue.push(3);
+    pushed = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  ASSERT_FALSE(pushed);
+  int item;
+  queue.pop(item);
+  producer.join();
+  ASSERT_TRUE(pushed);
+  ASSERT_EQ(2, queue.size());
+}
+
+TEST(WorkQueueTest, manyConsumers) {
+  WorkQueue<int> queue(16);
+  std::atomic<long> total = 0;
+  std::vector<std::thread> consumers;
+  for (int i = 0; i < 4; ++i) {
+    consumers.emplace_back([&queue, &total]{
+      int item;
+      while (queue.pop(item)) {
+        total += item;
+      }
+    });
+  }
+  for (int i = 1; i <= 1000; ++i) {
+    queue.push(i);
+  }
+  queue.close();
+  for (auto& consumer : consumers) {
+    consumer.join();
+  }
+  ASSERT_EQ(500500, total);
+}